@@ -31,6 +31,35 @@ module Dictionary =
         let mutable dictionaries: Dictionary<string, Dictionary<string, string list>> = new Dictionary<string, Dictionary<string, string list>>()
         // 当前词库名称
         let mutable currentDictName = "default"
+        // 用户新增词汇，叠加在当前词库之上，不修改词库本身
+        let userWords = new Dictionary<string, string list>()
+        
+        // 用户词库文件路径
+        let getUserDictPath (directoryPath: string) =
+            let config = configManager.GetDictionaryConfig()
+            if String.IsNullOrEmpty(config.UserDictionaryPath) then
+                Path.Combine(directoryPath, "user_dict.txt")
+            else
+                Path.Combine(directoryPath, config.UserDictionaryPath)
+        
+        // 从用户词库文件加载之前保存的用户词汇，保持文件中的顺序
+        let loadUserWords (userDictPath: string) =
+            userWords.Clear()
+            if File.Exists(userDictPath) then
+                try
+                    for line in File.ReadAllLines(userDictPath) do
+                        if not (String.IsNullOrWhiteSpace(line)) && not (line.StartsWith("//")) then
+                            let parts = line.Split(' ', 2, StringSplitOptions.RemoveEmptyEntries)
+                            if parts.Length >= 2 then
+                                let code = parts.[0].ToLower()
+                                let chars = parts.[1]
+                                if userWords.ContainsKey(code) then
+                                    if not (Seq.contains chars userWords.[code]) then
+                                        userWords.[code] <- userWords.[code] @ [chars]
+                                else
+                                    userWords.Add(code, [chars])
+                with
+                | ex -> printfn "加载用户词库 %s 时出错: %s" userDictPath ex.Message
         
         // 初始化词库 - 现在支持加载多个词库
         member this.Initialize(directoryPath: string) = 
@@ -70,10 +99,16 @@ module Dictionary =
             // 清空之前的词库数据
             dictionaries.Clear()
             
+            // 用户词库只加载到用户词汇中，不作为普通词库，否则第一次添加新词时会覆盖之前保存的用户词汇
+            let userDictPath = getUserDictPath directoryPath
+            let isUserDictFile (file: string) =
+                String.Equals(Path.GetFullPath(file), Path.GetFullPath(userDictPath), StringComparison.OrdinalIgnoreCase)
+            loadUserWords userDictPath
+            
             // 加载词库 - 读取目录中的所有txt和dic文件
             try
                 // 先加载所有.dic文件
-                let dicFiles = Directory.GetFiles(directoryPath, "*.dic", SearchOption.AllDirectories)
+                let dicFiles = Directory.GetFiles(directoryPath, "*.dic", SearchOption.AllDirectories) |> Array.filter (fun file -> not (isUserDictFile file))
                 for file in dicFiles do
                     try
                         let dictName = Path.GetFileNameWithoutExtension(file)
@@ -101,7 +136,7 @@ module Dictionary =
                     | ex -> printfn "加载.dic文件 %s 时出错: %s" file ex.Message
                 
                 // 再加载所有.txt文件作为一个名为"txt_dicts"的词库
-                let txtFiles = Directory.GetFiles(directoryPath, "*.txt", SearchOption.AllDirectories)
+                let txtFiles = Directory.GetFiles(directoryPath, "*.txt", SearchOption.AllDirectories) |> Array.filter (fun file -> not (isUserDictFile file))
                 if txtFiles.Length > 0 then
                     let txtDict = new Dictionary<string, string list>()
                     for file in txtFiles do
@@ -163,10 +198,11 @@ module Dictionary =
             match dictionary with
             | Some d ->
                 let lowerCode = code.ToLower()
-                if d.dict.ContainsKey(lowerCode) then
-                    d.dict.[lowerCode]
+                let dictResults = if d.dict.ContainsKey(lowerCode) then d.dict.[lowerCode] else []
+                if userWords.ContainsKey(lowerCode) then
+                    dictResults @ userWords.[lowerCode]
                 else
-                    []
+                    dictResults
             | None ->
                 // 如果词库未初始化，返回空列表
                 []
@@ -181,38 +217,28 @@ module Dictionary =
             
             // 使用历史记录对结果进行排序
             historyManager.GetWeightedCharacters(code, results)
+        
+        // 添加新词
+        member this.AddWord(code: string, chars: string) =
             match dictionary with
             | Some d ->
                 let lowerCode = code.ToLower()
-                if d.dict.ContainsKey(lowerCode) then
-                    if not (Seq.contains chars d.dict.[lowerCode]) then
-                        d.dict.[lowerCode] <- chars :: d.dict.[lowerCode]
+                // 词库只读且只存一份，新词只写入用户词汇
+                if userWords.ContainsKey(lowerCode) then
+                    if not (Seq.contains chars userWords.[lowerCode]) then
+                        userWords.[lowerCode] <- chars :: userWords.[lowerCode]
                 else
-                    d.dict.Add(lowerCode, [chars])
-                
-                // 同时更新当前词库在dictionaries中的副本
-                if dictionaries.ContainsKey(currentDictName) then
-                    let currentDict = dictionaries.[currentDictName]
-                    if currentDict.ContainsKey(lowerCode) then
-                        if not (Seq.contains chars currentDict.[lowerCode]) then
-                            currentDict.[lowerCode] <- chars :: currentDict.[lowerCode]
-                    else
-                        currentDict.Add(lowerCode, [chars])
+                    userWords.Add(lowerCode, [chars])
                 
                 // 记录用户输入到历史记录
                 historyManager.RecordInput(code, chars)
                 
                 // 保存词库到用户词库文件
                 try
-                    let config = configManager.GetDictionaryConfig()
-                    let userDictPath = 
-                        if String.IsNullOrEmpty(config.UserDictionaryPath) then
-                            Path.Combine(d.directoryPath, "user_dict.txt")
-                        else
-                            Path.Combine(d.directoryPath, config.UserDictionaryPath)
-                    // 只保存用户添加的词到用户词库文件
+                    let userDictPath = getUserDictPath d.directoryPath
+                    // 只保存用户添加的词到用户词库文件（包括启动时从该文件加载的词）
                     use writer = new StreamWriter(userDictPath, false)
-                    for kvp in d.dict do
+                    for kvp in userWords do
                         for value in kvp.Value do
                             writer.WriteLine("{0} {1}", kvp.Key, value)
                     writer.Close()
@@ -225,17 +251,17 @@ module Dictionary =
         // 获取所有编码
         member this.GetAllCodes() : string seq =
             match dictionary with
-            | Some d -> d.dict.Keys :> seq<_>
+            | Some d -> Seq.append d.dict.Keys userWords.Keys |> Seq.distinct
             | None -> Seq.empty
         
         // 清空词库
         member this.Clear() =
             match dictionary with
             | Some d -> 
-                d.dict.Clear()
+                userWords.Clear()
                 // 清空用户词库文件
                 try
-                    let userDictPath = Path.Combine(d.directoryPath, "user_dict.txt")
+                    let userDictPath = getUserDictPath d.directoryPath
                     if File.Exists(userDictPath) then
                         File.WriteAllText(userDictPath, "")
                         printfn "用户词库已清空"
@@ -285,11 +311,8 @@ module Dictionary =
         member this.SwitchDictionary(dictName: string) =
             if dictionaries.ContainsKey(dictName) then
                 try
-                    // 深拷贝当前词库到dictionary对象
-                    let currentDict = dictionaries.[dictName]
-                    let newDict = new Dictionary<string, string list>()
-                    for kvp in currentDict do
-                        newDict.Add(kvp.Key, List.ofSeq (kvp.Value))
+                    // 直接引用已加载的词库，不再深拷贝
+                    let newDict = dictionaries.[dictName]
                     
                     match dictionary with
                     | Some d ->
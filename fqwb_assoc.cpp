@@ -0,0 +1,429 @@
+// fqwb_assoc.cpp - 反切五笔输入法联想实现文件
+
+#include "fqwb_assoc.h"
+#include "fqwb_dict.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char ASSOCIATION_FILE_MAGIC[4] = { 'F', 'Q', 'W', 'A' };
+
+// 联想记录文件头，其后紧跟count个表项
+struct association_file_header {
+    char magic[4];     // 文件标识 "FQWA"
+    uint32_t version;  // 格式版本
+    uint64_t count;    // 表项数量
+};
+
+// 联想记录文件中的表项，字符按32位存放
+struct association_file_entry {
+    uint64_t key;
+    uint32_t count;
+    uint32_t length;
+    uint32_t text[LEARNED_ASSOCIATION_LENGTH];
+};
+
+// 构建索引时的一项：上文散列、排序依据和联想词；同一上文的联想词短的在前，长度相同时按词条在编码下的位置
+struct association_record {
+    uint64_t key;
+    uint32_t rank;         // 词条在其编码下的位置
+    uint32_t length;       // 联想词长度
+    uint32_t phrase_index;
+    uint32_t skip;         // 上文长度
+    uint32_t context_chars; // 上文字数
+};
+
+// 是否为UTF-16高代理项（wchar_t为16位的平台上，扩展区的字由两个wchar_t组成）
+bool is_high_surrogate(wchar_t c) {
+    return sizeof(wchar_t) == 2 && c >= 0xD800 && c <= 0xDBFF;
+}
+
+bool is_low_surrogate(wchar_t c) {
+    return sizeof(wchar_t) == 2 && c >= 0xDC00 && c <= 0xDFFF;
+}
+
+// 上文散列：FNV-1a，按字符值散列，与wchar_t宽度无关
+uint64_t make_context_key(std::wstring_view context) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (wchar_t c : context) {
+        hash ^= static_cast<uint32_t>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// 保留前max_context_chars字的上文、每个上文最多top_k个联想词时索引占用的内存
+size_t get_index_size(const std::vector<association_record>& groups, const std::vector<uint32_t>& group_sizes,
+                      size_t max_context_chars, size_t top_k) {
+    size_t total = sizeof(uint32_t);
+    for (size_t g = 0; g < groups.size(); g++) {
+        if (groups[g].context_chars <= max_context_chars) {
+            total += sizeof(uint64_t) + sizeof(uint32_t) + std::min<size_t>(group_sizes[g], top_k) * 2 * sizeof(uint32_t);
+        }
+    }
+    return total;
+}
+
+} // namespace
+
+std::wstring_view get_association_context(std::wstring_view text, size_t chars) {
+    size_t start = text.size();
+    for (size_t i = 0; i < chars; i++) {
+        if (start == 0) {
+            return std::wstring_view();
+        }
+        start--;
+        if (start > 0 && is_low_surrogate(text[start]) && is_high_surrogate(text[start - 1])) {
+            start--;
+        }
+    }
+    return text.substr(start);
+}
+
+// association_index 类实现
+bool association_index::build(const compiled_dictionary& dict, size_t memory_limit) {
+    try {
+        keys.clear();
+        offsets.clear();
+        items.clear();
+
+        // 各编码的词条在词条表中按编码顺序连续存放，顺序遍历即得到词条下标和词条在编码下的位置
+        std::vector<association_record> records;
+        size_t phrase_index = 0;
+        for (size_t c = 0; c < dict.get_code_count(); c++) {
+            size_t count = dict.get_phrase_count(c);
+            for (size_t n = 0; n < count; n++, phrase_index++) {
+                std::wstring_view phrase = dict.get_phrase(c, n);
+                size_t end = 0;
+                for (size_t chars = 1; chars <= ASSOCIATION_CONTEXT_CHARS; chars++) {
+                    end += end + 1 < phrase.size() && is_high_surrogate(phrase[end]) ? 2 : 1;
+                    if (end >= phrase.size()) {
+                        break;
+                    }
+                    records.push_back(association_record{ make_context_key(phrase.substr(0, end)), static_cast<uint32_t>(n),
+                                                          static_cast<uint32_t>(phrase.size() - end), static_cast<uint32_t>(phrase_index),
+                                                          static_cast<uint32_t>(end), static_cast<uint32_t>(chars) });
+                }
+            }
+        }
+        std::sort(records.begin(), records.end(), [](const association_record& a, const association_record& b) {
+            if (a.key != b.key) {
+                return a.key < b.key;
+            }
+            if (a.length != b.length) {
+                return a.length < b.length;
+            }
+            return a.rank != b.rank ? a.rank < b.rank : a.phrase_index < b.phrase_index;
+        });
+
+        // 每个上文去掉重复的联想词后保留前ASSOCIATION_TOP_K个，原地压缩；groups记录各上文的第一项
+        std::vector<association_record> groups;
+        std::vector<uint32_t> group_sizes;
+        size_t kept = 0;
+        for (size_t i = 0; i < records.size(); ) {
+            size_t group_start = kept;
+            size_t j = i;
+            for (; j < records.size() && records[j].key == records[i].key; j++) {
+                if (kept - group_start == ASSOCIATION_TOP_K) {
+                    continue;
+                }
+                std::wstring_view next = dict.get_phrase_at(records[j].phrase_index).substr(records[j].skip);
+                bool duplicate = false;
+                for (size_t k = group_start; k < kept && !duplicate; k++) {
+                    duplicate = dict.get_phrase_at(records[k].phrase_index).substr(records[k].skip) == next;
+                }
+                if (!duplicate) {
+                    records[kept++] = records[j];
+                }
+            }
+            groups.push_back(records[group_start]);
+            group_sizes.push_back(static_cast<uint32_t>(kept - group_start));
+            i = j;
+        }
+
+        // 超过内存上限时先去掉较长的上文，只剩一字上文时再减少每个上文的联想词数量
+        size_t max_context_chars = ASSOCIATION_CONTEXT_CHARS;
+        size_t top_k = ASSOCIATION_TOP_K;
+        while (top_k > 0 && get_index_size(groups, group_sizes, max_context_chars, top_k) > memory_limit) {
+            if (max_context_chars > 1) {
+                max_context_chars--;
+            } else {
+                top_k--;
+            }
+        }
+        if (top_k == 0) {
+            return true;
+        }
+
+        size_t group_count = 0;
+        size_t item_count = 0;
+        for (size_t g = 0; g < groups.size(); g++) {
+            if (groups[g].context_chars <= max_context_chars) {
+                group_count++;
+                item_count += std::min<size_t>(group_sizes[g], top_k);
+            }
+        }
+        keys.reserve(group_count);
+        offsets.reserve(group_count + 1);
+        items.reserve(item_count);
+
+        size_t start = 0;
+        for (size_t g = 0; g < groups.size(); g++) {
+            if (groups[g].context_chars <= max_context_chars) {
+                keys.push_back(groups[g].key);
+                offsets.push_back(static_cast<uint32_t>(items.size()));
+                size_t count = std::min<size_t>(group_sizes[g], top_k);
+                for (size_t i = start; i < start + count; i++) {
+                    items.push_back(association_item{ records[i].phrase_index, records[i].skip });
+                }
+            }
+            start += group_sizes[g];
+        }
+        offsets.push_back(static_cast<uint32_t>(items.size()));
+        return true;
+    }
+    catch (...) {
+        keys.clear();
+        offsets.clear();
+        items.clear();
+        return false;
+    }
+}
+
+void association_index::append(const compiled_dictionary& dict, std::wstring_view context, size_t max_results,
+                               std::vector<std::wstring_view>& result) const {
+    uint64_t key = make_context_key(context);
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it == keys.end() || *it != key) {
+        return;
+    }
+
+    size_t group = static_cast<size_t>(it - keys.begin());
+    for (size_t i = offsets[group]; i < offsets[group + 1] && result.size() < max_results; i++) {
+        // 核对上文，散列相同而上文不同的项跳过
+        std::wstring_view phrase = dict.get_phrase_at(items[i].phrase_index);
+        if (phrase.compare(0, items[i].skip, context) != 0) {
+            continue;
+        }
+        std::wstring_view next = phrase.substr(items[i].skip);
+        if (std::find(result.begin(), result.end(), next) == result.end()) {
+            result.push_back(next);
+        }
+    }
+}
+
+size_t association_index::size() const {
+    return keys.size();
+}
+
+size_t association_index::memory_usage() const {
+    return keys.capacity() * sizeof(uint64_t) + offsets.capacity() * sizeof(uint32_t) + items.capacity() * sizeof(association_item);
+}
+
+// association_memory 类实现
+association_memory::association_memory() : capacity(DEFAULT_LEARNED_ASSOCIATIONS), modified(false) {
+}
+
+void association_memory::decay() {
+    while (!entries.empty() && entries.size() >= capacity) {
+        // 次数减半不改变同一上文内的顺序
+        for (learned_entry& entry : entries) {
+            entry.count /= 2;
+        }
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](const learned_entry& entry) { return entry.count == 0; }), entries.end());
+    }
+}
+
+void association_memory::learn_one(uint64_t key, std::wstring_view next) {
+    auto less_key = [](const learned_entry& entry, uint64_t value) { return entry.key < value; };
+    auto first = std::lower_bound(entries.begin(), entries.end(), key, less_key);
+    auto last = first;
+    while (last != entries.end() && last->key == key) {
+        ++last;
+    }
+
+    auto it = std::find_if(first, last, [next](const learned_entry& entry) {
+        return std::wstring_view(entry.text, entry.length) == next;
+    });
+    if (it == last) {
+        if (static_cast<size_t>(last - first) >= LEARNED_ASSOCIATIONS_PER_CONTEXT) {
+            // 该上文已满时替换次数最少的一项
+            it = last - 1;
+        } else {
+            // 条数已达上限时先衰减，衰减后重新定位该上文；容量已预留，插入不会重新分配
+            if (entries.size() >= capacity) {
+                decay();
+                first = std::lower_bound(entries.begin(), entries.end(), key, less_key);
+                last = first;
+                while (last != entries.end() && last->key == key) {
+                    ++last;
+                }
+            }
+            it = entries.insert(last, learned_entry());
+        }
+        it->key = key;
+        it->count = 0;
+        it->length = static_cast<uint32_t>(next.size());
+        std::copy(next.begin(), next.end(), it->text);
+    }
+
+    // 次数不少于前一项时前移，同一上文的项保持按次数从高到低排列，次数相同时最近使用的在前
+    if (it->count < UINT32_MAX) {
+        it->count++;
+    }
+    while (it != first && (it - 1)->count <= it->count) {
+        std::iter_swap(it - 1, it);
+        --it;
+    }
+    modified = true;
+}
+
+void association_memory::learn(std::wstring_view previous, std::wstring_view next) {
+    if (next.empty() || next.size() > LEARNED_ASSOCIATION_LENGTH || capacity == 0) {
+        return;
+    }
+    if (entries.capacity() < capacity) {
+        entries.reserve(capacity);
+    }
+
+    // 以上文的最后一字、两字和三字分别记录，查询时较长的上文在前
+    for (size_t chars = 1; chars <= ASSOCIATION_CONTEXT_CHARS; chars++) {
+        std::wstring_view context = get_association_context(previous, chars);
+        if (context.empty()) {
+            break;
+        }
+        learn_one(make_context_key(context), next);
+    }
+}
+
+void association_memory::append(std::wstring_view context, size_t max_results, std::vector<std::wstring_view>& result) const {
+    uint64_t key = make_context_key(context);
+    auto it = std::lower_bound(entries.begin(), entries.end(), key, [](const learned_entry& entry, uint64_t value) {
+        return entry.key < value;
+    });
+    for (; it != entries.end() && it->key == key && result.size() < max_results; ++it) {
+        std::wstring_view next(it->text, it->length);
+        if (std::find(result.begin(), result.end(), next) == result.end()) {
+            result.push_back(next);
+        }
+    }
+}
+
+void association_memory::set_capacity(size_t count) {
+    capacity = count;
+    if (entries.size() >= capacity) {
+        size_t before = entries.size();
+        decay();
+        modified = modified || entries.size() != before;
+    }
+    entries.shrink_to_fit();
+}
+
+size_t association_memory::size() const {
+    return entries.size();
+}
+
+size_t association_memory::memory_usage() const {
+    return entries.capacity() * sizeof(learned_entry);
+}
+
+bool association_memory::is_modified() const {
+    return modified;
+}
+
+void association_memory::clear() {
+    modified = modified || !entries.empty();
+    entries.clear();
+}
+
+bool association_memory::load(const std::wstring& file_path) {
+    try {
+        std::ifstream file(native_path(file_path), std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        association_file_header header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            memcmp(header.magic, ASSOCIATION_FILE_MAGIC, sizeof(ASSOCIATION_FILE_MAGIC)) != 0 ||
+            header.version != ASSOCIATION_FILE_VERSION) {
+            return false;
+        }
+
+        std::vector<association_file_entry> records(static_cast<size_t>(header.count));
+        if (!records.empty() &&
+            !file.read(reinterpret_cast<char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(association_file_entry)))) {
+            return false;
+        }
+
+        entries.clear();
+        entries.reserve(std::max(capacity, records.size()));
+        for (const association_file_entry& record : records) {
+            if (record.count == 0 || record.length == 0 || record.length > LEARNED_ASSOCIATION_LENGTH) {
+                continue;
+            }
+            learned_entry entry = learned_entry();
+            entry.key = record.key;
+            entry.count = record.count;
+            entry.length = record.length;
+            for (uint32_t i = 0; i < record.length; i++) {
+                entry.text[i] = static_cast<wchar_t>(record.text[i]);
+            }
+            entries.push_back(entry);
+        }
+
+        // 文件按保存时的顺序排列，这里重新排序以防文件被修改过
+        std::stable_sort(entries.begin(), entries.end(), [](const learned_entry& a, const learned_entry& b) {
+            return a.key != b.key ? a.key < b.key : a.count > b.count;
+        });
+        decay();
+        modified = false;
+        return true;
+    }
+    catch (...) {
+        entries.clear();
+        modified = false;
+        return false;
+    }
+}
+
+void association_memory::serialize(std::vector<uint8_t>& data) const {
+    association_file_header header;
+    memcpy(header.magic, ASSOCIATION_FILE_MAGIC, sizeof(header.magic));
+    header.version = ASSOCIATION_FILE_VERSION;
+    header.count = entries.size();
+
+    data.resize(sizeof(header) + entries.size() * sizeof(association_file_entry));
+    memcpy(data.data(), &header, sizeof(header));
+    size_t offset = sizeof(header);
+    for (const learned_entry& entry : entries) {
+        association_file_entry record = association_file_entry();
+        record.key = entry.key;
+        record.count = entry.count;
+        record.length = entry.length;
+        for (uint32_t i = 0; i < entry.length; i++) {
+            record.text[i] = static_cast<uint32_t>(entry.text[i]);
+        }
+        memcpy(data.data() + offset, &record, sizeof(record));
+        offset += sizeof(record);
+    }
+}
+
+bool association_memory::save(const std::wstring& file_path) {
+    try {
+        // 写入临时文件后再替换，保存失败时原来的联想记录保持完整
+        std::vector<uint8_t> data;
+        serialize(data);
+        if (!write_file_replacing(data, file_path)) {
+            return false;
+        }
+
+        modified = false;
+        return true;
+    }
+    catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,127 @@
+// fqwb_assoc.h - 反切五笔输入法联想
+// 上屏后按上文（最后一到三个字）给出接下来可能输入的词：由词库中以上文开头的词条生成的联想索引，以及从连续上屏中学习到的联想
+
+#ifndef FQWB_ASSOC_H
+#define FQWB_ASSOC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class compiled_dictionary;
+
+// 联想记录文件名
+#define FQWB_ASSOCIATION_FILE_NAME L"association.bin"
+
+// 联想记录文件格式版本
+const uint32_t ASSOCIATION_FILE_VERSION = 1;
+
+// 上文最多取的字数
+const size_t ASSOCIATION_CONTEXT_CHARS = 3;
+
+// 每个上文预先排好的联想数量
+const size_t ASSOCIATION_TOP_K = 9;
+
+// 每个词库的联想索引默认内存上限（字节）
+const size_t DEFAULT_ASSOCIATION_MEMORY_LIMIT = 4 * 1024 * 1024;
+
+// 学习到的联想默认最多保留的条数，及每个上文最多保留的条数
+const size_t DEFAULT_LEARNED_ASSOCIATIONS = 16384;
+const size_t LEARNED_ASSOCIATIONS_PER_CONTEXT = 2 * ASSOCIATION_TOP_K;
+
+// 学习的联想词最长的字符数，更长的上屏字符串不学习
+const size_t LEARNED_ASSOCIATION_LENGTH = 8;
+
+// 获取text最后chars个字（代理对按一个字处理），不足chars个字时返回空
+std::wstring_view get_association_context(std::wstring_view text, size_t chars);
+
+// 词库联想索引：词库中的每个多字词条以其前一到三个字为上文，其余部分为联想词
+// 上文的64位散列按顺序存放，每个上文的联想词按长度（其次词条在编码下的位置）预先排好并去重，最多ASSOCIATION_TOP_K个
+// 每个联想词只占8字节（词条下标和上文长度），查询时二分查找上文散列，再从词库取出词条核对上文
+class association_index {
+private:
+    // 一个联想词：词条表下标和词条中上文所占的字符数
+    struct association_item {
+        uint32_t phrase_index;
+        uint32_t skip;
+    };
+
+    std::vector<uint64_t> keys;            // 按顺序排列的上文散列
+    std::vector<uint32_t> offsets;         // 各上文的联想词在items中的起点，末尾多一项
+    std::vector<association_item> items;   // 按上文分组、组内按优先顺序排列的联想词
+
+public:
+    // 为词库构建索引，memory_limit为索引占用内存的上限（字节）
+    // 超过上限时依次去掉三字、两字的上文，再减少每个上文的联想词数量
+    bool build(const compiled_dictionary& dict, size_t memory_limit);
+
+    // 按优先顺序追加上文恰为context的联想词（指向词库词条字符池的视图），已在result中的跳过，result最多追加到max_results个
+    void append(const compiled_dictionary& dict, std::wstring_view context, size_t max_results, std::vector<std::wstring_view>& result) const;
+
+    // 获取上文数量
+    size_t size() const;
+
+    // 获取索引占用的内存（字节）
+    size_t memory_usage() const;
+};
+
+// 学习到的联想：连续两次上屏时，以前一次的最后一到三个字为上文记录后一次上屏的字符串
+// 按上文散列排序存放在一个数组中，同一上文的项按次数从高到低排列（次数相同时最近使用的在前），查询时二分查找后直接取前几项
+// 条数达到上限时所有次数减半并去掉减为0的项
+class association_memory {
+private:
+    struct learned_entry {
+        uint64_t key;                               // 上文散列
+        uint32_t count;                             // 次数
+        uint32_t length;                            // 联想词长度
+        wchar_t text[LEARNED_ASSOCIATION_LENGTH];   // 联想词
+    };
+
+    std::vector<learned_entry> entries; // 按上文散列排序
+    size_t capacity;                    // 最多保留的条数
+    bool modified;                      // 自上次保存或加载后是否有变化
+
+    // 所有次数减半，去掉减为0的项，直到条数低于上限
+    void decay();
+
+    // 记录一次上文散列为key的联想
+    void learn_one(uint64_t key, std::wstring_view next);
+
+public:
+    association_memory();
+
+    // 记录一次连续上屏：previous为前一次上屏的字符串，next为这一次的
+    void learn(std::wstring_view previous, std::wstring_view next);
+
+    // 按次数从高到低追加上文恰为context的联想词（指向内部数组的视图，在下一次learn、clear或load之前有效）
+    // 已在result中的跳过，result最多追加到max_results个
+    void append(std::wstring_view context, size_t max_results, std::vector<std::wstring_view>& result) const;
+
+    // 设置最多保留的条数
+    void set_capacity(size_t count);
+
+    // 获取条数
+    size_t size() const;
+
+    // 获取占用的内存（字节）
+    size_t memory_usage() const;
+
+    // 是否有尚未保存的变化
+    bool is_modified() const;
+
+    // 清除所有记录
+    void clear();
+
+    // 从二进制文件加载，文件不存在或格式不符时返回false并保持为空
+    bool load(const std::wstring& file_path);
+
+    // 生成二进制文件的内容
+    void serialize(std::vector<uint8_t>& data) const;
+
+    // 保存到二进制文件
+    bool save(const std::wstring& file_path);
+};
+
+#endif // FQWB_ASSOC_H
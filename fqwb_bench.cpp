@@ -0,0 +1,957 @@
+// fqwb_bench.cpp - 反切五笔输入法性能基准测试
+// 生成指定规模的合成五笔词库，测量词库加载、查询和按键处理热路径的耗时、内存分配次数和峰值内存
+// 用法：fqwb_bench [--sizes 10000,100000,2000000] [--json 结果.json] [--min-time 毫秒] [--seed 种子] [--dir 工作目录] [--keep]
+
+#include "fqwb_tsf.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <codecvt>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <cwctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <locale>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// 全局内存分配计数，基准测试直接编译库的源文件，库内部的分配也经过这里
+static std::atomic<unsigned long long> g_alloc_count(0);
+static std::atomic<unsigned long long> g_alloc_bytes(0);
+
+void* operator new(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+// 每类查询预先生成的编码数量
+const size_t QUERY_COUNT = 4096;
+
+// 五笔编码字母a-y的相对权重（z为万能键，不出现在词库编码中），模拟各键位字根数量的差异
+const unsigned int LETTER_WEIGHTS[25] = {
+    3, 4, 3, 5, 4, 5, 5, 4, 5, 4, 4, 4, 3, 4, 3, 4, 4, 4, 4, 5, 3, 3, 5, 3, 4
+};
+
+// 常用汉字数量（GB2312一级和二级汉字）
+const size_t COMMON_CHAR_COUNT = 6763;
+
+// 可复现的伪随机数生成器（splitmix64），不同平台生成相同的词库
+class bench_random {
+private:
+    uint64_t state;
+
+public:
+    explicit bench_random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // [0, bound)内的均匀整数
+    size_t uniform(size_t bound) {
+        return static_cast<size_t>(next() % bound);
+    }
+
+    // [0, 1)内的均匀实数
+    double real() {
+        return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // 偏向较小下标的整数，模拟汉字和词组使用频率的长尾分布
+    size_t skewed(size_t bound) {
+        double u = real();
+        return static_cast<size_t>(static_cast<double>(bound) * u * u * u);
+    }
+
+    // 按键位权重抽取一个编码字母
+    wchar_t letter() {
+        static const unsigned int total = [] {
+            unsigned int sum = 0;
+            for (unsigned int weight : LETTER_WEIGHTS) {
+                sum += weight;
+            }
+            return sum;
+        }();
+
+        unsigned int pick = static_cast<unsigned int>(uniform(total));
+        for (int i = 0; i < 25; i++) {
+            if (pick < LETTER_WEIGHTS[i]) {
+                return static_cast<wchar_t>(L'a' + i);
+            }
+            pick -= LETTER_WEIGHTS[i];
+        }
+        return L'y';
+    }
+};
+
+// 合成词库的查询样本
+struct bench_dictionary {
+    size_t entry_count;                 // 词条数量
+    std::vector<std::wstring> hit_short; // 词库中存在的一、二码编码
+    std::vector<std::wstring> hit_long;  // 词库中存在的四码编码
+    std::vector<std::wstring> miss_short; // 不存在的二码编码
+    std::vector<std::wstring> miss_long;  // 前三码存在、第四码不存在的编码
+    std::vector<std::wstring> typing;     // 模拟输入的编码（按词条分布抽样）
+    std::vector<std::wstring> wildcard;   // 两个位置换成万能键的四码编码
+    std::vector<std::wstring> phrases;    // 反查的词条（按词条分布抽样）
+    std::vector<wchar_t> chars;           // 有全码的单字
+};
+
+// 将字符按UTF-8追加到输出缓冲区
+void append_utf8(std::string& out, wchar_t wc) {
+    uint32_t c = static_cast<uint32_t>(wc);
+    if (c < 0x80) {
+        out += static_cast<char>(c);
+    } else if (c < 0x800) {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+// 蓄水池抽样：第seen个样本以QUERY_COUNT/seen的概率替换已有样本
+void reservoir_add(std::vector<std::wstring>& samples, size_t& seen, const std::wstring& code, bench_random& random) {
+    seen++;
+    if (samples.size() < QUERY_COUNT) {
+        samples.push_back(code);
+    } else {
+        size_t slot = random.uniform(seen);
+        if (slot < QUERY_COUNT) {
+            samples[slot] = code;
+        }
+    }
+}
+
+// 生成合成五笔词库并写入文本词库文件
+// 词库组成与常见五笔词库相同：一级简码、二级简码、单字全码和三级简码，其余为按五笔取码规则由单字全码组成的词组编码
+bool generate_dictionary(size_t entry_count, uint64_t seed, const std::wstring& file_path, bench_dictionary& dict) {
+    try {
+        bench_random random(seed);
+
+        // 单字：按使用频率排列，每个字有2-4码的全码（大部分为四码）
+        size_t char_count = std::max<size_t>(25, std::min(COMMON_CHAR_COUNT, entry_count / 2));
+        std::vector<wchar_t> chars(char_count);
+        std::vector<std::wstring> char_codes(char_count);
+        for (size_t i = 0; i < char_count; i++) {
+            chars[i] = static_cast<wchar_t>(0x4E00 + (i * 3) % 0x51A6);
+            double u = random.real();
+            size_t length = u < 0.05 ? 2 : (u < 0.15 ? 3 : 4);
+            for (size_t k = 0; k < length; k++) {
+                char_codes[i] += random.letter();
+            }
+        }
+
+        std::ofstream output(native_path(file_path), std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            return false;
+        }
+
+        dict = bench_dictionary();
+        dict.entry_count = 0;
+        size_t short_seen = 0;
+        size_t long_seen = 0;
+        size_t typing_seen = 0;
+        size_t phrase_seen = 0;
+        std::string buffer;
+        std::wstring code;
+        std::wstring phrase;
+
+        auto emit = [&]() {
+            for (wchar_t c : code) {
+                buffer += static_cast<char>(c);
+            }
+            buffer += ' ';
+            for (wchar_t c : phrase) {
+                append_utf8(buffer, c);
+            }
+            buffer += '\n';
+            if (buffer.size() >= (1 << 20)) {
+                output.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+
+            if (code.size() <= 2) {
+                reservoir_add(dict.hit_short, short_seen, code, random);
+            } else if (code.size() == 4) {
+                reservoir_add(dict.hit_long, long_seen, code, random);
+            }
+            reservoir_add(dict.typing, typing_seen, code, random);
+            reservoir_add(dict.phrases, phrase_seen, phrase, random);
+            dict.entry_count++;
+        };
+
+        // 一级简码和二级简码：最常用的字
+        size_t next_char = 0;
+        for (int i = 0; i < 25 && dict.entry_count < entry_count; i++) {
+            code.assign(1, static_cast<wchar_t>(L'a' + i));
+            phrase.assign(1, chars[next_char++ % char_count]);
+            emit();
+        }
+        for (int i = 0; i < 25 * 25 && dict.entry_count < entry_count / 4; i++) {
+            code.assign(1, static_cast<wchar_t>(L'a' + i / 25));
+            code += static_cast<wchar_t>(L'a' + i % 25);
+            phrase.assign(1, chars[next_char++ % char_count]);
+            emit();
+        }
+
+        // 单字全码，前四分之一的字另有三级简码
+        for (size_t i = 0; i < char_count && dict.entry_count < entry_count; i++) {
+            code = char_codes[i];
+            phrase.assign(1, chars[i]);
+            emit();
+            dict.chars.push_back(chars[i]);
+            if (i < char_count / 4 && char_codes[i].size() == 4 && dict.entry_count < entry_count) {
+                code.resize(3);
+                emit();
+            }
+        }
+
+        // 词组：二字词为主，编码按五笔词组取码规则由各字全码组成
+        while (dict.entry_count < entry_count) {
+            double u = random.real();
+            size_t length = u < 0.65 ? 2 : (u < 0.80 ? 3 : (u < 0.95 ? 4 : 5 + random.uniform(3)));
+
+            phrase.clear();
+            size_t first = 0;
+            size_t last = 0;
+            for (size_t k = 0; k < length; k++) {
+                size_t index = random.skewed(char_count);
+                phrase += chars[index];
+                if (k == 0) {
+                    first = index;
+                }
+                last = index;
+            }
+
+            // 二字词取各字前两码；三字词取前两字首码和末字前两码；四字及以上取前三字和末字的首码
+            const std::wstring& c1 = char_codes[first];
+            const std::wstring& cn = char_codes[last];
+            code.clear();
+            if (length == 2) {
+                code.append(c1, 0, 2);
+                code.append(cn, 0, 2);
+            } else if (length == 3) {
+                code += c1[0];
+                code += char_codes[random.skewed(char_count)][0];
+                code.append(cn, 0, 2);
+            } else {
+                code += c1[0];
+                code += char_codes[random.skewed(char_count)][0];
+                code += char_codes[random.skewed(char_count)][0];
+                code += cn[0];
+            }
+            emit();
+        }
+
+        output.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        output.close();
+        if (output.fail()) {
+            return false;
+        }
+
+        // z不出现在词库编码中，以z结尾的编码一定不存在
+        for (const std::wstring& hit : dict.hit_short) {
+            dict.miss_short.push_back(hit.substr(0, 1) + L"z");
+        }
+        for (const std::wstring& hit : dict.hit_long) {
+            dict.miss_long.push_back(hit.substr(0, 3) + L"z");
+        }
+
+        // 通配查询依次把第1、3码，第2、4码或第3、4码换成万能键
+        const size_t WILDCARD_POSITIONS[3][2] = { { 0, 2 }, { 1, 3 }, { 2, 3 } };
+        for (size_t i = 0; i < dict.hit_long.size(); i++) {
+            std::wstring pattern = dict.hit_long[i];
+            pattern[WILDCARD_POSITIONS[i % 3][0]] = WILDCARD_KEY;
+            pattern[WILDCARD_POSITIONS[i % 3][1]] = WILDCARD_KEY;
+            dict.wildcard.push_back(pattern);
+        }
+        return true;
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+// 进程的峰值内存占用（字节）
+size_t get_peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// 单项基准测试结果
+struct bench_result {
+    std::string name;                     // 测试项名称
+    size_t entries;                       // 词库词条数量
+    unsigned long long iterations;        // 计时的迭代次数
+    unsigned long long ops;               // 计时的操作次数
+    double total_ns;                      // 总耗时（纳秒）
+    unsigned long long allocations;       // 计时期间的内存分配次数
+    unsigned long long allocated_bytes;   // 计时期间分配的字节数
+    size_t peak_rss;                      // 测试结束时的进程峰值内存（字节）
+};
+
+// 基准测试执行器
+class bench_runner {
+private:
+    double min_time_ms;               // 每项测试的最短计时时间
+    std::vector<bench_result> results; // 所有测试结果
+
+public:
+    explicit bench_runner(double min_time) : min_time_ms(min_time) {}
+
+    // 执行一项测试：先预热一次，再重复执行直到达到最短计时时间；body每次执行ops_per_iteration次操作
+    template <typename F>
+    void run(const std::string& name, size_t entries, size_t ops_per_iteration, F&& body) {
+        body();
+
+        unsigned long long alloc_start = g_alloc_count.load();
+        unsigned long long bytes_start = g_alloc_bytes.load();
+        auto start_time = std::chrono::steady_clock::now();
+        unsigned long long iterations = 0;
+        double elapsed_ns = 0.0;
+        do {
+            body();
+            iterations++;
+            elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+        } while (elapsed_ns < min_time_ms * 1e6);
+
+        bench_result result;
+        result.name = name;
+        result.entries = entries;
+        result.iterations = iterations;
+        result.ops = iterations * ops_per_iteration;
+        result.total_ns = elapsed_ns;
+        result.allocations = g_alloc_count.load() - alloc_start;
+        result.allocated_bytes = g_alloc_bytes.load() - bytes_start;
+        result.peak_rss = get_peak_rss();
+        results.push_back(result);
+
+        char line[256];
+        snprintf(line, sizeof(line), "%-30s %9zu %14.1f ns/op %14.0f op/s %10.2f alloc/op %10.1f MB\n",
+            name.c_str(), entries, result.total_ns / result.ops, result.ops * 1e9 / result.total_ns,
+            static_cast<double>(result.allocations) / result.ops, result.peak_rss / (1024.0 * 1024.0));
+        std::cout << line << std::flush;
+    }
+
+    // 最近一项测试的结果
+    const bench_result& get_last_result() const {
+        return results.back();
+    }
+
+    // 以JSON格式写出全部结果，便于比较不同版本的测试结果
+    bool write_json(const std::wstring& file_path, uint64_t seed) const {
+        std::ofstream output(native_path(file_path), std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            return false;
+        }
+
+        char line[512];
+        output << "{\n";
+        output << "  \"format_version\": 1,\n";
+        snprintf(line, sizeof(line), "  \"seed\": %llu,\n  \"min_time_ms\": %.0f,\n", static_cast<unsigned long long>(seed), min_time_ms);
+        output << line;
+#ifdef NDEBUG
+        output << "  \"build\": \"release\",\n";
+#else
+        output << "  \"build\": \"debug\",\n";
+#endif
+        output << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const bench_result& r = results[i];
+            snprintf(line, sizeof(line),
+                "    {\"name\": \"%s\", \"entries\": %zu, \"iterations\": %llu, \"ops\": %llu, \"total_ns\": %.0f, "
+                "\"ns_per_op\": %.3f, \"ops_per_sec\": %.1f, \"allocs_per_op\": %.4f, \"bytes_per_op\": %.1f, \"peak_rss_bytes\": %zu}%s\n",
+                r.name.c_str(), r.entries, r.iterations, r.ops, r.total_ns,
+                r.total_ns / r.ops, r.ops * 1e9 / r.total_ns,
+                static_cast<double>(r.allocations) / r.ops, static_cast<double>(r.allocated_bytes) / r.ops,
+                r.peak_rss, i + 1 < results.size() ? "," : "");
+            output << line;
+        }
+        output << "  ]\n}\n";
+        output.close();
+        return !output.fail();
+    }
+};
+
+// 防止编译器优化掉测试中未使用的结果
+volatile size_t g_sink = 0;
+
+// 由序号生成不重复的四码编码和二字词条，不分配内存
+void make_user_word(unsigned long long n, std::wstring& code, std::wstring& phrase) {
+    for (size_t i = 0; i < 4; i++) {
+        code[i] = static_cast<wchar_t>(L'a' + n % 25);
+        n /= 25;
+    }
+    phrase[0] = static_cast<wchar_t>(0x4E00 + n % 0x51A6);
+    phrase[1] = static_cast<wchar_t>(0x4E00 + (n / 0x51A6) % 0x51A6);
+}
+
+// 由序号生成不重复的二至四字词组，各字取自有全码的单字
+void make_import_phrase(unsigned long long n, const std::vector<wchar_t>& chars, std::wstring& phrase) {
+    phrase.assign(2 + n % 3, L' ');
+    n /= 3;
+    for (wchar_t& c : phrase) {
+        c = chars[n % chars.size()];
+        n /= chars.size();
+    }
+}
+
+// 一次读入解析之前的文本词库读取方式，作为解析速度的对照：按行读取UTF-8宽字符流，去掉空白后插入编码到词条的映射
+bool load_text_dictionary_wifstream(const std::wstring& file_path, std::map<std::wstring, std::vector<std::wstring>>& entries) {
+    try {
+        std::wifstream file(native_path(file_path));
+        if (!file.is_open()) {
+            return false;
+        }
+        file.imbue(std::locale(std::locale::classic(), new std::codecvt_utf8<wchar_t>));
+
+        std::wstring line;
+        while (std::getline(file, line)) {
+            if (line.empty()) {
+                continue;
+            }
+
+            size_t pos = line.find(L' ');
+            if (pos != std::wstring::npos && pos > 0 && pos < line.size() - 1) {
+                std::wstring code = line.substr(0, pos);
+                std::wstring characters = line.substr(pos + 1);
+                code.erase(std::remove_if(code.begin(), code.end(), ::iswspace), code.end());
+                characters.erase(std::remove_if(characters.begin(), characters.end(), ::iswspace), characters.end());
+                if (!code.empty() && !characters.empty()) {
+                    entries[code].push_back(characters);
+                }
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+// 测试一种规模的词库
+bool run_size(bench_runner& runner, size_t entry_count, uint64_t seed, const std::wstring& work_dir) {
+    std::wstring dir = work_dir + L"\\" + std::to_wstring(entry_count);
+    std::wstring manager_dir = dir + L"\\manager";
+    std::wstring text_path = dir + L"\\bench.dic";
+    std::wstring compiled_path = dir + L"\\bench" FQWB_COMPILED_DICT_EXT;
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(native_path(manager_dir)), error);
+    if (error) {
+        std::cerr << "创建工作目录失败\n";
+        return false;
+    }
+
+    // 生成文本词库，再编译出同名预编译词库（比文本词库新，输入法初始化时优先使用）
+    bench_dictionary dict;
+    if (!generate_dictionary(entry_count, seed, text_path, dict)) {
+        std::cerr << "生成词库失败\n";
+        return false;
+    }
+    {
+        text_dictionary text;
+        std::vector<uint8_t> data;
+        if (!load_text_dictionary(text_path, text) || text.entries.empty() || !build_compiled_dictionary(text, data) ||
+            !write_compiled_dictionary(data, compiled_path)) {
+            std::cerr << "编译词库失败\n";
+            return false;
+        }
+    }
+
+    // 文本词库解析测试：文件内容预先读入内存，只计解码、排序和去重的时间
+    {
+        std::ifstream input(native_path(text_path), std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        text_dictionary text;
+        runner.run("parse_text_dictionary", entry_count, 1, [&]() {
+            parse_text_dictionary(bytes.data(), bytes.size(), text);
+            g_sink = g_sink + text.entries.size();
+        });
+        const bench_result& result = runner.get_last_result();
+        char line[256];
+        snprintf(line, sizeof(line), "%-30s %9zu %14.1f MB/s\n", "parse_text_dictionary/speed", entry_count,
+            bytes.size() * 1e9 / (result.total_ns / result.ops) / (1024.0 * 1024.0));
+        std::cout << line << std::flush;
+
+        // 对照：之前的宽字符流读取方式，包含读文件的时间
+        std::map<std::wstring, std::vector<std::wstring>> entries;
+        runner.run("parse_wifstream", entry_count, 1, [&]() {
+            entries.clear();
+            load_text_dictionary_wifstream(text_path, entries);
+            g_sink = g_sink + entries.size();
+        });
+        const bench_result& baseline = runner.get_last_result();
+        snprintf(line, sizeof(line), "%-30s %9zu %14.1f MB/s\n", "parse_wifstream/speed", entry_count,
+            bytes.size() * 1e9 / (baseline.total_ns / baseline.ops) / (1024.0 * 1024.0));
+        std::cout << line << std::flush;
+    }
+
+    // 词库管理器测试：管理器目录中没有词库文件，测试的词库都显式加载
+    {
+        dictionary_manager manager;
+        manager.set_load_policy(dictionary_load_policy::load_on_demand);
+        // 加载测试每次都读取文件，不共用进程内已加载的词库
+        manager.set_dictionary_sharing(false);
+        if (!manager.initialize(manager_dir)) {
+            std::cerr << "初始化词库管理器失败\n";
+            return false;
+        }
+
+        const std::wstring text_name = L"text";
+        const std::wstring compiled_name = L"compiled";
+        if (!manager.load_dictionary(text_name, text_path) || !manager.load_compiled_dictionary(compiled_name, compiled_path)) {
+            std::cerr << "加载词库失败\n";
+            return false;
+        }
+
+        runner.run("load_dictionary", entry_count, 1, [&]() {
+            manager.load_dictionary(text_name, text_path);
+        });
+        runner.run("load_compiled_dictionary", entry_count, 1, [&]() {
+            manager.load_compiled_dictionary(compiled_name, compiled_path);
+        });
+
+        // 另一个会话已加载同一版本的文件时，新会话直接共用进程内的词库
+        {
+            dictionary_manager owner;
+            dictionary_manager session;
+            if (owner.load_dictionary(text_name, text_path)) {
+                runner.run("load_dictionary/shared", entry_count, 1, [&]() {
+                    session.load_dictionary(text_name, text_path);
+                });
+            }
+        }
+
+        const size_t SWITCH_OPS = 1024;
+        runner.run("switch_dictionary", entry_count, SWITCH_OPS, [&]() {
+            for (size_t i = 0; i < SWITCH_OPS; i++) {
+                manager.switch_dictionary((i & 1) ? compiled_name : text_name);
+            }
+        });
+        manager.switch_dictionary(compiled_name);
+
+        std::vector<candidate_view> result;
+        auto search = [&](const char* name, const std::vector<std::wstring>& codes) {
+            if (codes.empty()) {
+                return;
+            }
+            runner.run(name, entry_count, codes.size(), [&]() {
+                size_t total = 0;
+                for (const std::wstring& code : codes) {
+                    total += manager.search_code(code, result);
+                }
+                g_sink = total;
+            });
+        };
+        search("search_code/hit_short", dict.hit_short);
+        search("search_code/hit_long", dict.hit_long);
+        search("search_code/miss_short", dict.miss_short);
+        search("search_code/miss_long", dict.miss_long);
+
+        // 通配查询最多取90个候选词（与输入法的上限相同）
+        const size_t WILDCARD_RESULTS = 90;
+        if (!dict.wildcard.empty()) {
+            runner.run("search_wildcard", entry_count, dict.wildcard.size(), [&]() {
+                size_t total = 0;
+                for (const std::wstring& pattern : dict.wildcard) {
+                    total += manager.search_wildcard(pattern, WILDCARD_RESULTS, result);
+                }
+                g_sink = total;
+            });
+        }
+
+        // 反查：第一次反查时构建反查索引（在预热中完成）
+        std::vector<std::wstring> codes;
+        if (!dict.phrases.empty()) {
+            runner.run("find_codes", entry_count, dict.phrases.size(), [&]() {
+                size_t total = 0;
+                for (const std::wstring& characters : dict.phrases) {
+                    total += manager.find_codes(characters, codes);
+                }
+                g_sink = total;
+            });
+            char line[256];
+            snprintf(line, sizeof(line), "%-30s %9zu %14zu bytes\n", "reverse_index_memory", entry_count, manager.get_reverse_index_memory());
+            std::cout << line << std::flush;
+        }
+
+        // 联想：启用时构建当前词库的联想索引（单独计时），之后以抽样的词条为上文查询
+        if (!dict.phrases.empty()) {
+            auto build_start = std::chrono::steady_clock::now();
+            manager.set_association_enabled(true);
+            double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+
+            std::vector<candidate_view> associations;
+            runner.run("search_associations", entry_count, dict.phrases.size(), [&]() {
+                size_t total = 0;
+                for (const std::wstring& characters : dict.phrases) {
+                    total += manager.search_associations(characters, 2 * ASSOCIATION_TOP_K, associations);
+                }
+                g_sink = total;
+            });
+            char line[256];
+            snprintf(line, sizeof(line), "%-30s %9zu %14.1f ms\n", "association_index_build", entry_count, build_ms);
+            std::cout << line;
+            snprintf(line, sizeof(line), "%-30s %9zu %14zu bytes\n", "association_memory", entry_count, manager.get_association_memory());
+            std::cout << line << std::flush;
+            manager.set_association_enabled(false);
+        }
+
+        // 每次添加不同的新词，包括写入用户词库日志
+        const size_t ADD_OPS = 256;
+        unsigned long long word_number = 0;
+        std::wstring code(4, L'a');
+        std::wstring phrase(2, L' ');
+        runner.run("add_word", entry_count, ADD_OPS, [&]() {
+            for (size_t i = 0; i < ADD_OPS; i++) {
+                make_user_word(word_number++, code, phrase);
+                manager.add_word(code, phrase);
+            }
+        });
+
+        // 批量导入：每次导入不同的新词组，编码自动生成，包括写入用户词库日志
+        const size_t IMPORT_OPS = 100000;
+        if (!dict.chars.empty()) {
+            unsigned long long import_number = 0;
+            std::vector<std::wstring> phrases(IMPORT_OPS);
+            runner.run("import_phrases", entry_count, IMPORT_OPS, [&]() {
+                for (std::wstring& characters : phrases) {
+                    make_import_phrase(import_number++, dict.chars, characters);
+                }
+                size_t imported = 0;
+                manager.import_phrases(phrases, imported);
+                g_sink = imported;
+            });
+        }
+
+        // 并发查询：1、2、4……个线程同时查询命中编码，期间另一个线程不断添加新词；操作次数为全部查询线程的查询次数之和
+        // 分配次数包括写入线程的分配；查询线程不加锁，吞吐量应随核数增长
+        const size_t CONCURRENT_ROUNDS = 16;
+        if (!dict.hit_short.empty()) {
+            size_t max_readers = std::max<size_t>(4, std::thread::hardware_concurrency());
+            std::atomic<bool> writing(true);
+            std::atomic<unsigned long long> concurrent_words(0);
+            std::thread writer([&]() {
+                std::wstring writer_code(4, L'a');
+                std::wstring writer_phrase(2, L' ');
+                while (writing.load()) {
+                    make_user_word(word_number++, writer_code, writer_phrase);
+                    manager.add_word(writer_code, writer_phrase);
+                    concurrent_words++;
+                }
+            });
+
+            for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+                std::string name = "search_code/concurrent/" + std::to_string(readers);
+                runner.run(name, entry_count, readers * CONCURRENT_ROUNDS * dict.hit_short.size(), [&]() {
+                    std::atomic<size_t> total(0);
+                    std::vector<std::thread> threads;
+                    for (size_t t = 0; t < readers; t++) {
+                        threads.emplace_back([&]() {
+                            std::vector<candidate_view> local_result;
+                            size_t local_total = 0;
+                            for (size_t round = 0; round < CONCURRENT_ROUNDS; round++) {
+                                for (const std::wstring& code : dict.hit_short) {
+                                    local_total += manager.search_code(code, local_result);
+                                }
+                            }
+                            total += local_total;
+                        });
+                    }
+                    for (std::thread& thread : threads) {
+                        thread.join();
+                    }
+                    g_sink = total.load();
+                });
+            }
+
+            writing = false;
+            writer.join();
+            char line[256];
+            snprintf(line, sizeof(line), "%-30s %9zu %14llu words\n", "search_code/concurrent_writes", entry_count, concurrent_words.load());
+            std::cout << line << std::flush;
+        }
+    }
+
+    // 输入法测试：以生成的词库目录初始化，使用预编译词库
+    {
+        fqwb_input_method input_method;
+        if (!input_method.initialize(dir)) {
+            std::cerr << "初始化输入法失败\n";
+            return false;
+        }
+
+        // 每个编码依次按下各字母键，不足四码时按空格上屏
+        std::vector<UINT> keys;
+        for (const std::wstring& code : dict.typing) {
+            for (wchar_t c : code) {
+                keys.push_back(static_cast<UINT>(c - L'a' + 'A'));
+            }
+            if (code.size() < 4) {
+                keys.push_back(VK_SPACE);
+            }
+        }
+
+        if (!keys.empty()) {
+            runner.run("process_key_input", entry_count, keys.size(), [&]() {
+                bool handled = false;
+                for (UINT key : keys) {
+                    input_method.process_key_input(key, 0, true, &handled);
+                }
+                input_method.clear_input();
+            });
+
+            // 同样的按键启用联想：每次上屏都学习联想并查询联想词，下一个字母键结束联想
+            input_method.set_association_enabled(true);
+            runner.run("process_key_input/association", entry_count, keys.size(), [&]() {
+                bool handled = false;
+                for (UINT key : keys) {
+                    input_method.process_key_input(key, 0, true, &handled);
+                }
+                input_method.clear_input();
+            });
+            input_method.set_association_enabled(false);
+
+            // 同样的按键在后台查询补全：按键时只查询完全匹配的候选词，补全由查询线程完成后在下一次按键时合并
+            input_method.set_deferred_lookup(true);
+            runner.run("process_key_input/deferred", entry_count, keys.size(), [&]() {
+                bool handled = false;
+                for (UINT key : keys) {
+                    input_method.process_key_input(key, 0, true, &handled);
+                }
+                input_method.clear_input();
+            });
+
+            // 后台查询每次约需2毫秒时逐键计时一遍，记录最慢的一次按键：按键耗时不随后台查询的耗时增长
+            input_method.set_deferred_lookup_source([](const deferred_query& query, const lookup_cancel& cancel, std::vector<candidate_view>& result) {
+                for (int i = 0; i < 20 && !cancel.cancelled(); i++) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                result.assign(query.exact.begin(), query.exact.end());
+            });
+            double max_ns = 0.0;
+            bool handled = false;
+            for (UINT key : keys) {
+                auto key_start = std::chrono::steady_clock::now();
+                input_method.process_key_input(key, 0, true, &handled);
+                max_ns = std::max(max_ns, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - key_start).count());
+            }
+            input_method.clear_input();
+            input_method.set_deferred_lookup_source(deferred_lookup());
+            input_method.set_deferred_lookup(false);
+
+            char line[256];
+            snprintf(line, sizeof(line), "%-30s %9zu %14.1f ns max\n", "process_key_input/deferred_slow_max", entry_count, max_ns);
+            std::cout << line << std::flush;
+        }
+
+        // 连续输入：抽样的编码连成40键的编码串逐键输入，每键都重新生成整句候选词；输满后上屏最好的整句并清除剩余编码
+        const size_t CONTINUOUS_KEYS = 40;
+        std::vector<UINT> sentence_keys;
+        size_t sentence_length = 0;
+        for (const std::wstring& code : dict.typing) {
+            for (wchar_t c : code) {
+                sentence_keys.push_back(static_cast<UINT>(c - L'a' + 'A'));
+                if (++sentence_length == CONTINUOUS_KEYS) {
+                    sentence_keys.push_back(VK_SPACE);
+                    sentence_keys.push_back(VK_ESCAPE);
+                    sentence_length = 0;
+                }
+            }
+        }
+
+        if (!sentence_keys.empty()) {
+            input_method.clear_input();
+            input_method.set_continuous_input(true);
+            runner.run("process_key_input/continuous", entry_count, sentence_keys.size(), [&]() {
+                bool handled = false;
+                for (UINT key : sentence_keys) {
+                    input_method.process_key_input(key, 0, true, &handled);
+                }
+                input_method.clear_input();
+            });
+
+            // 逐键计时一遍，记录最慢的一次按键
+            double max_ns = 0.0;
+            bool handled = false;
+            for (UINT key : sentence_keys) {
+                auto key_start = std::chrono::steady_clock::now();
+                input_method.process_key_input(key, 0, true, &handled);
+                max_ns = std::max(max_ns, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - key_start).count());
+            }
+            input_method.clear_input();
+            input_method.set_continuous_input(false);
+
+            char line[256];
+            snprintf(line, sizeof(line), "%-30s %9zu %14.1f ns max\n", "process_key_input/continuous_max", entry_count, max_ns);
+            std::cout << line << std::flush;
+        }
+
+        // 一码前缀的候选词最多，翻页取候选词的开销最大
+        bool handled = false;
+        input_method.clear_input();
+        input_method.process_key_input('G', 0, true, &handled);
+        const size_t PAGE_OPS = 1024;
+        runner.run("get_current_page_candidates", entry_count, PAGE_OPS, [&]() {
+            size_t total = 0;
+            for (size_t i = 0; i < PAGE_OPS; i++) {
+                total += input_method.get_current_page_candidates().size();
+            }
+            g_sink = total;
+        });
+        input_method.clear_input();
+    }
+
+    return true;
+}
+
+// 解析逗号分隔的词库规模列表
+bool parse_sizes(const wchar_t* text, std::vector<size_t>& sizes) {
+    sizes.clear();
+    while (*text) {
+        wchar_t* end = nullptr;
+        unsigned long long value = std::wcstoull(text, &end, 10);
+        if (end == text || value == 0) {
+            return false;
+        }
+        sizes.push_back(static_cast<size_t>(value));
+        text = (*end == L',') ? end + 1 : end;
+        if (end == text && *text) {
+            return false;
+        }
+    }
+    return !sizes.empty();
+}
+
+int run_bench(const std::vector<std::wstring>& args) {
+    std::vector<size_t> sizes = { 10000, 100000, 2000000 };
+    std::wstring json_path;
+    std::wstring work_dir = (std::filesystem::temp_directory_path() / "fqwb_bench").wstring();
+    double min_time_ms = 500.0;
+    uint64_t seed = 20240601;
+    bool keep = false;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        bool has_value = i + 1 < args.size();
+        if (arg == L"--sizes" && has_value) {
+            if (!parse_sizes(args[++i].c_str(), sizes)) {
+                std::cerr << "无效的词库规模列表\n";
+                return 1;
+            }
+        } else if (arg == L"--json" && has_value) {
+            json_path = args[++i];
+        } else if (arg == L"--min-time" && has_value) {
+            min_time_ms = std::wcstod(args[++i].c_str(), nullptr);
+        } else if (arg == L"--seed" && has_value) {
+            seed = std::wcstoull(args[++i].c_str(), nullptr, 10);
+        } else if (arg == L"--dir" && has_value) {
+            work_dir = args[++i];
+        } else if (arg == L"--keep") {
+            keep = true;
+        } else {
+            std::cerr << "用法: fqwb_bench [--sizes 10000,100000,2000000] [--json 结果.json] [--min-time 毫秒] [--seed 种子] [--dir 工作目录] [--keep]\n";
+            return 1;
+        }
+    }
+
+    std::cout << "反切五笔输入法性能基准测试\n";
+    std::cout << "峰值内存为进程累计值，需要单独比较某一规模时请每次只测试一种规模\n\n";
+
+    bench_runner runner(min_time_ms);
+    bool succeeded = true;
+    for (size_t size : sizes) {
+        if (!run_size(runner, size, seed, work_dir)) {
+            succeeded = false;
+            break;
+        }
+    }
+
+    if (!keep) {
+        std::error_code error;
+        std::filesystem::remove_all(std::filesystem::path(native_path(work_dir)), error);
+    }
+
+    if (!json_path.empty() && !runner.write_json(json_path, seed)) {
+        std::cerr << "写入结果文件失败\n";
+        return 1;
+    }
+    return succeeded ? 0 : 1;
+}
+
+} // namespace
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+    return run_bench(std::vector<std::wstring>(argv, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+    // 其他平台的命令行参数为UTF-8
+    std::vector<std::wstring> args;
+    for (int i = 0; i < argc; i++) {
+        args.push_back(std::filesystem::path(argv[i]).wstring());
+    }
+    return run_bench(args);
+}
+#endif
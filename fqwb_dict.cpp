@@ -0,0 +1,1414 @@
+// fqwb_dict.cpp - 反切五笔输入法二进制词库格式实现文件
+
+#include "fqwb_dict.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <cwctype>
+#include <filesystem>
+#include <fstream>
+
+// 在SSE2可用时按16字节查找分隔符和解码ASCII
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FQWB_USE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char COMPILED_DICT_MAGIC[4] = { 'F', 'Q', 'W', 'B' };
+
+// 版本1的文件头不含前缀索引偏移
+const size_t COMPILED_DICT_V1_HEADER_SIZE = offsetof(compiled_dict_header, prefix_index_offset);
+
+// 版本2的文件头不含压缩编码表偏移
+const size_t COMPILED_DICT_V2_HEADER_SIZE = offsetof(compiled_dict_header, code_keys_offset);
+
+// 深度为d的前缀在前缀索引中覆盖的键数（27的3-d次方）
+const size_t PREFIX_INDEX_SCALE[PREFIX_INDEX_DEPTH + 1] = {
+    PREFIX_INDEX_RADIX * PREFIX_INDEX_RADIX * PREFIX_INDEX_RADIX, PREFIX_INDEX_RADIX * PREFIX_INDEX_RADIX, PREFIX_INDEX_RADIX, 1
+};
+
+// 按8字节对齐
+uint64_t align8(uint64_t value) {
+    return (value + 7) & ~static_cast<uint64_t>(7);
+}
+
+// 字符在前缀索引中的数字，不在a-z之间时返回0
+constexpr size_t get_prefix_digit(wchar_t c) {
+    return (c >= L'a' && c <= L'z') ? static_cast<size_t>(c - L'a') + 1 : 0;
+}
+
+// 前depth个字符相同的压缩编码个数（27的6-depth次方）
+constexpr packed_code get_packed_code_span(size_t depth) {
+    return depth >= PACKED_CODE_LENGTH ? 1 : static_cast<packed_code>(PREFIX_INDEX_RADIX) * get_packed_code_span(depth + 1);
+}
+
+const packed_code PACKED_CODE_SPAN[PACKED_CODE_LENGTH + 1] = {
+    get_packed_code_span(0), get_packed_code_span(1), get_packed_code_span(2), get_packed_code_span(3),
+    get_packed_code_span(4), get_packed_code_span(5), get_packed_code_span(6)
+};
+
+// 压缩编码除以该数即为前缀索引的键
+const packed_code PREFIX_KEY_SPAN = get_packed_code_span(PREFIX_INDEX_DEPTH);
+
+static_assert(PACKED_CODE_LENGTH <= 6, "27的7次方超出32位");
+
+// 压缩编码，编码长于六个字符或含a-z以外的字符时返回false
+bool pack_code(std::wstring_view code, packed_code& key) {
+    if (code.size() > PACKED_CODE_LENGTH) {
+        return false;
+    }
+
+    packed_code value = 0;
+    for (size_t i = 0; i < PACKED_CODE_LENGTH; i++) {
+        size_t digit = 0;
+        if (i < code.size()) {
+            digit = get_prefix_digit(code[i]);
+            if (digit == 0) {
+                return false;
+            }
+        }
+        value = value * PREFIX_INDEX_RADIX + static_cast<packed_code>(digit);
+    }
+    key = value;
+    return true;
+}
+
+// 编码在前缀索引中的键
+size_t get_prefix_key(std::wstring_view code) {
+    size_t key = 0;
+    for (size_t i = 0; i < PREFIX_INDEX_DEPTH; i++) {
+        key = key * PREFIX_INDEX_RADIX + (i < code.size() ? get_prefix_digit(code[i]) : 0);
+    }
+    return key;
+}
+
+// 逐项检查二进制词库的编码表、词条表、前缀索引和压缩编码表（各区段已确认不越界）
+// 查询时不再检查下标，损坏或被截断的文件必须在这里拒绝：
+// 编码和词条都在各自的字符池内，每个编码的词条都在词条表内，编码严格升序，前缀索引和压缩编码表与编码一致
+bool validate_tables(const compiled_dict_header& h, const uint8_t* data, const uint32_t* index, const packed_code* keys) {
+    const compiled_code_entry* codes = reinterpret_cast<const compiled_code_entry*>(data + h.codes_offset);
+    const compiled_phrase_entry* phrases = reinterpret_cast<const compiled_phrase_entry*>(data + h.phrases_offset);
+    const wchar_t* code_pool = reinterpret_cast<const wchar_t*>(data + h.code_pool_offset);
+
+    for (uint32_t i = 0; i < h.phrase_count; i++) {
+        if (static_cast<uint64_t>(phrases[i].offset) + phrases[i].length > h.phrase_pool_size) {
+            return false;
+        }
+    }
+
+    if (index) {
+        for (size_t k = 1; k < PREFIX_INDEX_SIZE; k++) {
+            if (index[k] < index[k - 1]) {
+                return false;
+            }
+        }
+    }
+
+    std::wstring_view previous;
+    for (uint32_t i = 0; i < h.code_count; i++) {
+        const compiled_code_entry& entry = codes[i];
+        if (entry.code_length == 0 || static_cast<uint64_t>(entry.code_offset) + entry.code_length > h.code_pool_size ||
+            (h.max_code_length != 0 && entry.code_length > h.max_code_length) ||
+            static_cast<uint64_t>(entry.first_phrase) + entry.phrase_count > h.phrase_count) {
+            return false;
+        }
+
+        std::wstring_view code(code_pool + entry.code_offset, entry.code_length);
+        if (i > 0 && !(previous < code)) {
+            return false;
+        }
+        previous = code;
+
+        if (index) {
+            for (size_t j = 0; j < code.size() && j < PREFIX_INDEX_DEPTH; j++) {
+                if (get_prefix_digit(code[j]) == 0) {
+                    return false;
+                }
+            }
+            size_t key = get_prefix_key(code);
+            if (i < index[key] || i >= index[key + 1]) {
+                return false;
+            }
+        }
+
+        packed_code key = 0;
+        if (keys && (!pack_code(code, key) || keys[i] != key)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// UTF-8文件开头可能带有的BOM
+const char UTF8_BOM[3] = { '\xEF', '\xBB', '\xBF' };
+
+// 估算词条数量时每行的平均字节数（编码、空格、二字词和换行）
+const size_t ESTIMATED_LINE_BYTES = 12;
+
+// 全角空格，与ASCII空白一样从编码和词条中去掉
+const uint32_t IDEOGRAPHIC_SPACE = 0x3000;
+
+// 无效的UTF-8字节解码为替换字符
+const wchar_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+bool is_ascii_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#ifdef FQWB_USE_SSE2
+// 最低的置位
+unsigned lowest_set_bit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+// 查找字节c，找不到时返回end
+const char* find_byte(const char* p, const char* end, char c) {
+#ifdef FQWB_USE_SSE2
+    const __m128i pattern = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), pattern)));
+        if (mask != 0) {
+            return p + lowest_set_bit(mask);
+        }
+        p += 16;
+    }
+#endif
+    const void* found = memchr(p, c, static_cast<size_t>(end - p));
+    return found ? static_cast<const char*>(found) : end;
+}
+
+// 将[p, end)中的UTF-8解码写入out，去掉空白，返回写入后的位置；写入的字符数不超过字节数
+wchar_t* decode_utf8_field(const unsigned char* p, const unsigned char* end, wchar_t* out) {
+    while (p < end) {
+        unsigned char c = *p;
+        if (c < 0x80) {
+#ifdef FQWB_USE_SSE2
+            // 连续16个字节都是可见ASCII字符时整块展开
+            const __m128i zero = _mm_setzero_si128();
+            while (end - p >= 16) {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                if (_mm_movemask_epi8(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x20))) != 0xFFFF) {
+                    break;
+                }
+                __m128i low = _mm_unpacklo_epi8(bytes, zero);
+                __m128i high = _mm_unpackhi_epi8(bytes, zero);
+                if (sizeof(wchar_t) == 2) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), low);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), high);
+                } else {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(low, zero));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(low, zero));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(high, zero));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(high, zero));
+                }
+                p += 16;
+                out += 16;
+            }
+            if (p == end) {
+                break;
+            }
+            c = *p;
+            if (c >= 0x80) {
+                continue;
+            }
+#endif
+            if (!is_ascii_space(c)) {
+                *out++ = static_cast<wchar_t>(c);
+            }
+            p++;
+            continue;
+        }
+
+        // 多字节序列：拒绝过长编码、代理区和超出范围的码位
+        size_t length = 0;
+        uint32_t code_point = 0;
+        if (c >= 0xC2 && c <= 0xDF) {
+            length = 2;
+            code_point = c & 0x1F;
+        } else if ((c & 0xF0) == 0xE0) {
+            length = 3;
+            code_point = c & 0x0F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            length = 4;
+            code_point = c & 0x07;
+        }
+        bool valid = length != 0 && static_cast<size_t>(end - p) >= length;
+        for (size_t i = 1; valid && i < length; i++) {
+            valid = (p[i] & 0xC0) == 0x80;
+            code_point = (code_point << 6) | (p[i] & 0x3F);
+        }
+        if (valid) {
+            valid = length == 2 || (length == 3 && code_point >= 0x800 && (code_point < 0xD800 || code_point > 0xDFFF)) ||
+                    (length == 4 && code_point >= 0x10000 && code_point <= 0x10FFFF);
+        }
+        if (!valid) {
+            *out++ = REPLACEMENT_CHARACTER;
+            p++;
+            continue;
+        }
+
+        p += length;
+        if (code_point == IDEOGRAPHIC_SPACE) {
+            continue;
+        }
+        if (sizeof(wchar_t) == 2 && code_point >= 0x10000) {
+            code_point -= 0x10000;
+            *out++ = static_cast<wchar_t>(0xD800 + (code_point >> 10));
+            *out++ = static_cast<wchar_t>(0xDC00 + (code_point & 0x3FF));
+        } else {
+            *out++ = static_cast<wchar_t>(code_point);
+        }
+    }
+    return out;
+}
+
+// 向文本词库追加一个(编码, 词条)，之后需调用normalize_text_dictionary；字符池超出格式限制时返回false
+bool append_text_entry(std::wstring_view code, std::wstring_view phrase, text_dictionary& dict) {
+    if (dict.chars.size() + code.size() + phrase.size() > UINT32_MAX) {
+        return false;
+    }
+    text_dictionary::entry item;
+    item.code_offset = static_cast<uint32_t>(dict.chars.size());
+    item.code_length = static_cast<uint32_t>(code.size());
+    dict.chars.insert(dict.chars.end(), code.begin(), code.end());
+    item.phrase_offset = static_cast<uint32_t>(dict.chars.size());
+    item.phrase_length = static_cast<uint32_t>(phrase.size());
+    dict.chars.insert(dict.chars.end(), phrase.begin(), phrase.end());
+    dict.entries.push_back(item);
+    return true;
+}
+
+// 排序键占用的编码字符数，每个字符16位
+const size_t SORT_KEY_CHARS = 4;
+
+// 词条的排序键：编码的前四个字符各占16位（字符加1，编码结束处为0），与按编码比较的顺序一致
+struct text_sort_key {
+    uint64_t key;   // 排序键
+    uint32_t index; // 词条在文件中的序号
+    bool exact;     // 排序键是否完整表示了编码（编码不长于四个字符且字符都在16位以内）
+};
+
+text_sort_key make_text_sort_key(std::wstring_view code, uint32_t index) {
+    text_sort_key result = { 0, index, code.size() <= SORT_KEY_CHARS };
+    for (size_t i = 0; i < SORT_KEY_CHARS; i++) {
+        uint64_t digit = 0;
+        if (i < code.size()) {
+            digit = static_cast<uint64_t>(code[i]) + 1;
+            if (digit >= 0xFFFF) {
+                digit = 0xFFFF;
+                result.exact = false;
+            }
+        }
+        result.key = (result.key << 16) | digit;
+    }
+    return result;
+}
+
+// 按排序键做低位优先的基数排序（稳定），每趟按一个字节分配；所有键在该字节上相同时跳过这一趟
+void radix_sort_keys(std::vector<text_sort_key>& keys) {
+    std::vector<text_sort_key> buffer(keys.size());
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = {};
+        for (const text_sort_key& item : keys) {
+            counts[(item.key >> shift) & 0xFF]++;
+        }
+        if (counts[(keys[0].key >> shift) & 0xFF] == keys.size()) {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            size_t next = offset + count;
+            count = offset;
+            offset = next;
+        }
+        for (const text_sort_key& item : keys) {
+            buffer[counts[(item.key >> shift) & 0xFF]++] = item;
+        }
+        keys.swap(buffer);
+    }
+}
+
+// 两个排序键对应的编码是否相同；排序键相同但不完整时比较完整编码
+bool same_text_code(const text_dictionary& dict, const text_sort_key& a, const text_sort_key& b) {
+    return a.key == b.key && ((a.exact && b.exact) || dict.get_code(dict.entries[a.index]) == dict.get_code(dict.entries[b.index]));
+}
+
+// 排序键是否已按编码有序（相同编码的词条保持原有顺序）
+bool is_text_keys_sorted(const text_dictionary& dict, const std::vector<text_sort_key>& keys) {
+    for (size_t i = 1; i < keys.size(); i++) {
+        const text_sort_key& prev = keys[i - 1];
+        const text_sort_key& next = keys[i];
+        if (prev.key > next.key) {
+            return false;
+        }
+        if (prev.key == next.key && !(prev.exact && next.exact) &&
+            dict.get_code(dict.entries[next.index]) < dict.get_code(dict.entries[prev.index])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 按编码排序排序键，同一编码的词条保持原有顺序
+void sort_text_keys(const text_dictionary& dict, std::vector<text_sort_key>& keys) {
+    radix_sort_keys(keys);
+
+    // 排序键相同、且其中有不完整的键时，再按完整编码稳定排序
+    auto code_less = [&dict](const text_sort_key& a, const text_sort_key& b) {
+        return dict.get_code(dict.entries[a.index]) < dict.get_code(dict.entries[b.index]);
+    };
+    for (size_t first = 0; first < keys.size();) {
+        size_t last = first + 1;
+        bool exact = keys[first].exact;
+        while (last < keys.size() && keys[last].key == keys[first].key) {
+            exact = exact && keys[last].exact;
+            last++;
+        }
+        if (!exact) {
+            std::stable_sort(keys.begin() + first, keys.begin() + last, code_less);
+        }
+        first = last;
+    }
+}
+
+// 同一编码下不超过此数量的词条逐个比较去重，更多时用哈希表
+const size_t LINEAR_DEDUP_LIMIT = 8;
+
+// 哈希表中的空位
+const uint32_t EMPTY_DEDUP_SLOT = UINT32_MAX;
+
+// 按编码排序（同一编码的词条保持原有顺序），去掉同一编码下重复的词条，统计编码数量
+// 排序检查、排序和分组只比较排序键，排序键不完整时才比较完整编码；去重的哈希表在各编码间复用，不按词条分配内存
+void normalize_text_dictionary(text_dictionary& dict) {
+    const std::vector<text_dictionary::entry>& entries = dict.entries;
+    dict.code_count = 0;
+    if (entries.empty()) {
+        return;
+    }
+
+    std::vector<text_sort_key> keys(entries.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = make_text_sort_key(dict.get_code(entries[i]), static_cast<uint32_t>(i));
+    }
+
+    // 词库文件通常已按编码排序，这时不需要再排序
+    if (!is_text_keys_sorted(dict, keys)) {
+        sort_text_keys(dict, keys);
+    }
+
+    std::vector<text_dictionary::entry> result;
+    result.reserve(keys.size());
+    std::vector<uint32_t> slots; // 开放定址哈希表，存放result中的下标
+    std::hash<std::wstring_view> hasher;
+    for (size_t first = 0; first < keys.size();) {
+        size_t last = first + 1;
+        while (last < keys.size() && same_text_code(dict, keys[first], keys[last])) {
+            last++;
+        }
+
+        size_t group_start = result.size();
+        size_t mask = 0;
+        bool use_hash = last - first > LINEAR_DEDUP_LIMIT;
+        if (use_hash) {
+            size_t capacity = 16;
+            while (capacity < (last - first) * 2) {
+                capacity *= 2;
+            }
+            slots.assign(capacity, EMPTY_DEDUP_SLOT);
+            mask = capacity - 1;
+        }
+        for (size_t i = first; i < last; i++) {
+            const text_dictionary::entry& item = entries[keys[i].index];
+            std::wstring_view phrase = dict.get_phrase(item);
+            bool duplicate = false;
+            if (use_hash) {
+                size_t slot = hasher(phrase) & mask;
+                while (slots[slot] != EMPTY_DEDUP_SLOT) {
+                    if (dict.get_phrase(result[slots[slot]]) == phrase) {
+                        duplicate = true;
+                        break;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+                if (!duplicate) {
+                    slots[slot] = static_cast<uint32_t>(result.size());
+                }
+            } else {
+                for (size_t j = group_start; j < result.size() && !duplicate; j++) {
+                    duplicate = dict.get_phrase(result[j]) == phrase;
+                }
+            }
+            if (!duplicate) {
+                result.push_back(item);
+            }
+        }
+
+        dict.code_count++;
+        first = last;
+    }
+    dict.entries.swap(result);
+}
+
+} // namespace
+
+#ifdef _WIN32
+// Windows下文件接口直接接受宽字符路径
+const std::wstring& native_path(const std::wstring& path) {
+    return path;
+}
+#else
+// 其他平台将宽字符路径转换为UTF-8，Windows路径分隔符转换为/
+std::string native_path(const std::wstring& path) {
+    std::string result;
+    for (wchar_t wc : path) {
+        uint32_t c = static_cast<uint32_t>(wc == L'\\' ? L'/' : wc);
+        if (c < 0x80) {
+            result += static_cast<char>(c);
+        } else if (c < 0x800) {
+            result += static_cast<char>(0xC0 | (c >> 6));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            result += static_cast<char>(0xE0 | (c >> 12));
+            result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        } else {
+            result += static_cast<char>(0xF0 | (c >> 18));
+            result += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+    return result;
+}
+#endif
+
+bool replace_file(const std::wstring& temp_path, const std::wstring& file_path) {
+    // 改名之前临时文件的内容必须已在磁盘上，否则断电后可能留下改了名的空文件
+    bool synced = false;
+#ifdef _WIN32
+    HANDLE hFile = CreateFileW(temp_path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        synced = FlushFileBuffers(hFile) != 0;
+        CloseHandle(hFile);
+    }
+#else
+    int fd = ::open(native_path(temp_path).c_str(), O_WRONLY);
+    if (fd >= 0) {
+        synced = fsync(fd) == 0;
+        ::close(fd);
+    }
+#endif
+
+    std::error_code error;
+    if (synced) {
+        std::filesystem::rename(std::filesystem::path(native_path(temp_path)), std::filesystem::path(native_path(file_path)), error);
+    }
+    if (!synced || error) {
+        std::filesystem::remove(std::filesystem::path(native_path(temp_path)), error);
+        return false;
+    }
+    return true;
+}
+
+// mapped_file 类实现
+#ifdef _WIN32
+mapped_file::mapped_file() : view(nullptr), view_size(0), file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr) {
+}
+#else
+mapped_file::mapped_file() : view(nullptr), view_size(0) {
+}
+#endif
+
+mapped_file::~mapped_file() {
+    close();
+}
+
+bool mapped_file::open(const std::wstring& file_path) {
+    close();
+
+#ifdef _WIN32
+    // 允许删除共享，词库编译工具和热更新可以在映射期间以改名方式替换文件
+    HANDLE hFile = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(hFile, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    HANDLE hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (hMapping == nullptr) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    void* address = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (address == nullptr) {
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return false;
+    }
+
+    file_handle = hFile;
+    mapping_handle = hMapping;
+    view = static_cast<const uint8_t*>(address);
+    view_size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(native_path(file_path).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* address = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+
+    view = static_cast<const uint8_t*>(address);
+    view_size = static_cast<size_t>(st.st_size);
+#endif
+
+    return true;
+}
+
+void mapped_file::close() {
+#ifdef _WIN32
+    if (view) {
+        UnmapViewOfFile(view);
+    }
+    if (mapping_handle) {
+        CloseHandle(mapping_handle);
+        mapping_handle = nullptr;
+    }
+    if (file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_handle);
+        file_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (view) {
+        munmap(const_cast<uint8_t*>(view), view_size);
+    }
+#endif
+    view = nullptr;
+    view_size = 0;
+}
+
+const uint8_t* mapped_file::data() const {
+    return view;
+}
+
+size_t mapped_file::size() const {
+    return view_size;
+}
+
+// compiled_dictionary 类实现
+compiled_dictionary::compiled_dictionary()
+    : header(nullptr), codes(nullptr), phrases(nullptr), code_pool(nullptr), phrase_pool(nullptr), prefix_index(nullptr), code_keys(nullptr),
+      max_code_length(0) {
+}
+
+bool compiled_dictionary::attach(const uint8_t* data, size_t size) {
+    if (data == nullptr || size < COMPILED_DICT_V1_HEADER_SIZE) {
+        return false;
+    }
+
+    const compiled_dict_header* h = reinterpret_cast<const compiled_dict_header*>(data);
+    if (memcmp(h->magic, COMPILED_DICT_MAGIC, sizeof(COMPILED_DICT_MAGIC)) != 0 ||
+        h->version < COMPILED_DICT_MIN_VERSION || h->version > COMPILED_DICT_VERSION ||
+        h->char_size != sizeof(wchar_t) ||
+        h->file_size != size) {
+        return false;
+    }
+
+    // 版本1的文件头较短，没有前缀索引；版本2没有压缩编码表
+    uint64_t prefix_index_offset = 0;
+    uint64_t code_keys_offset = 0;
+    if (h->version >= 2) {
+        if (size < (h->version >= 3 ? sizeof(compiled_dict_header) : COMPILED_DICT_V2_HEADER_SIZE)) {
+            return false;
+        }
+        prefix_index_offset = h->prefix_index_offset;
+    }
+    if (h->version >= 3) {
+        code_keys_offset = h->code_keys_offset;
+    }
+
+    // 检查各区段是否越界，各表按其表项对齐
+    if (h->codes_offset > size || h->phrases_offset > size || h->code_pool_offset > size || h->phrase_pool_offset > size ||
+        prefix_index_offset > size || code_keys_offset > size) {
+        return false;
+    }
+    if (h->codes_offset % alignof(compiled_code_entry) != 0 || h->phrases_offset % alignof(compiled_phrase_entry) != 0 ||
+        h->code_pool_offset % alignof(wchar_t) != 0 || h->phrase_pool_offset % alignof(wchar_t) != 0 ||
+        prefix_index_offset % alignof(uint32_t) != 0 || code_keys_offset % alignof(packed_code) != 0) {
+        return false;
+    }
+    uint64_t codes_end = h->codes_offset + static_cast<uint64_t>(h->code_count) * sizeof(compiled_code_entry);
+    uint64_t phrases_end = h->phrases_offset + static_cast<uint64_t>(h->phrase_count) * sizeof(compiled_phrase_entry);
+    uint64_t code_pool_end = h->code_pool_offset + static_cast<uint64_t>(h->code_pool_size) * sizeof(wchar_t);
+    uint64_t phrase_pool_end = h->phrase_pool_offset + static_cast<uint64_t>(h->phrase_pool_size) * sizeof(wchar_t);
+    if (codes_end > size || phrases_end > size || code_pool_end > size || phrase_pool_end > size) {
+        return false;
+    }
+    if (prefix_index_offset != 0 && prefix_index_offset + PREFIX_INDEX_SIZE * sizeof(uint32_t) > size) {
+        return false;
+    }
+    const uint32_t* index = prefix_index_offset != 0 ? reinterpret_cast<const uint32_t*>(data + prefix_index_offset) : nullptr;
+    if (index && index[PREFIX_INDEX_SIZE - 1] != h->code_count) {
+        return false;
+    }
+
+    // 能压缩的编码前三个字符都在a-z之间，有压缩编码表时一定有前缀索引
+    if (code_keys_offset != 0 && (!index || code_keys_offset + static_cast<uint64_t>(h->code_count) * sizeof(packed_code) > size)) {
+        return false;
+    }
+    const packed_code* keys = code_keys_offset != 0 ? reinterpret_cast<const packed_code*>(data + code_keys_offset) : nullptr;
+
+    // 逐项检查表项，只在加载时检查一次
+    if (!validate_tables(*h, data, index, keys)) {
+        return false;
+    }
+
+    header = h;
+    codes = reinterpret_cast<const compiled_code_entry*>(data + h->codes_offset);
+    phrases = reinterpret_cast<const compiled_phrase_entry*>(data + h->phrases_offset);
+    code_pool = reinterpret_cast<const wchar_t*>(data + h->code_pool_offset);
+    phrase_pool = reinterpret_cast<const wchar_t*>(data + h->phrase_pool_offset);
+    prefix_index = index;
+    code_keys = keys;
+    max_code_length = h->max_code_length;
+    return true;
+}
+
+bool compiled_dictionary::open(const std::wstring& file_path) {
+    if (!file.open(file_path)) {
+        return false;
+    }
+
+    if (!attach(file.data(), file.size())) {
+        file.close();
+        return false;
+    }
+
+    return true;
+}
+
+bool compiled_dictionary::load_image(std::vector<uint8_t>&& data) {
+    image = std::move(data);
+    if (!attach(image.data(), image.size())) {
+        image.clear();
+        return false;
+    }
+    return true;
+}
+
+size_t compiled_dictionary::get_code_count() const {
+    return header ? header->code_count : 0;
+}
+
+size_t compiled_dictionary::get_phrase_count() const {
+    return header ? header->phrase_count : 0;
+}
+
+size_t compiled_dictionary::get_max_code_length() const {
+    return max_code_length;
+}
+
+std::wstring_view compiled_dictionary::get_code(size_t index) const {
+    const compiled_code_entry& entry = codes[index];
+    return std::wstring_view(code_pool + entry.code_offset, entry.code_length);
+}
+
+size_t compiled_dictionary::find_code(std::wstring_view code) const {
+    size_t lo = 0;
+    size_t hi = get_code_count();
+
+    // 能压缩的编码先由前缀索引得到前三个字符相同的编码范围
+    packed_code key = 0;
+    if (prefix_index && pack_code(code, key)) {
+        size_t prefix_key = key / PREFIX_KEY_SPAN;
+        lo = prefix_index[prefix_key];
+        hi = prefix_index[prefix_key + 1];
+
+        // 不超过三个字符的编码在范围内只可能排在最前，其余都是更长的编码
+        if (code.size() <= PREFIX_INDEX_DEPTH) {
+            return lo < hi && codes[lo].code_length == code.size() ? lo : npos;
+        }
+        if (code_keys) {
+            const packed_code* it = std::lower_bound(code_keys + lo, code_keys + hi, key);
+            return it != code_keys + hi && *it == key ? static_cast<size_t>(it - code_keys) : npos;
+        }
+    } else if (code_keys) {
+        // 词库中的编码都能压缩
+        return npos;
+    }
+
+    // 在编码表上二分查找
+    size_t end = hi;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (get_code(mid) < code) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < end && get_code(lo) == code) {
+        return lo;
+    }
+    return npos;
+}
+
+void compiled_dictionary::get_prefix_range(std::wstring_view prefix, size_t& first, size_t& last) const {
+    size_t lo = 0;
+    size_t hi = get_code_count();
+
+    // 不超过三个字符的前缀直接查前缀索引，更长的前缀在前三个字符相同的范围内查找
+    packed_code key = 0;
+    if (prefix_index && pack_code(prefix, key)) {
+        size_t prefix_key = key / PREFIX_KEY_SPAN;
+        if (prefix.size() <= PREFIX_INDEX_DEPTH) {
+            first = prefix_index[prefix_key];
+            last = prefix_index[prefix_key + PREFIX_INDEX_SCALE[prefix.size()]];
+            return;
+        }
+        lo = prefix_index[prefix_key];
+        hi = prefix_index[prefix_key + 1];
+        if (code_keys) {
+            first = static_cast<size_t>(std::lower_bound(code_keys + lo, code_keys + hi, key) - code_keys);
+            last = static_cast<size_t>(std::lower_bound(code_keys + first, code_keys + hi, key + PACKED_CODE_SPAN[prefix.size()]) - code_keys);
+            return;
+        }
+    } else if (code_keys) {
+        first = 0;
+        last = 0;
+        return;
+    }
+
+    // 第一个不小于prefix的编码
+    size_t end = hi;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (get_code(mid) < prefix) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    first = lo;
+
+    // 第一个不以prefix开头的编码
+    hi = end;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (get_code(mid).substr(0, prefix.size()) == prefix) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    last = lo;
+}
+
+bool compiled_dictionary::narrow_range(size_t first, size_t last, size_t depth, wchar_t c, size_t& sub_first, size_t& sub_last) const {
+    // 有压缩编码表时，第depth个字符为c的编码的压缩编码是一段连续的整数
+    if (code_keys && first < last && depth < PACKED_CODE_LENGTH) {
+        size_t digit = get_prefix_digit(c);
+        if (digit == 0) {
+            sub_first = last;
+            sub_last = last;
+            return false;
+        }
+        packed_code low = code_keys[first] - code_keys[first] % PACKED_CODE_SPAN[depth] + static_cast<packed_code>(digit) * PACKED_CODE_SPAN[depth + 1];
+        sub_first = static_cast<size_t>(std::lower_bound(code_keys + first, code_keys + last, low) - code_keys);
+        sub_last = static_cast<size_t>(std::lower_bound(code_keys + sub_first, code_keys + last, low + PACKED_CODE_SPAN[depth + 1]) - code_keys);
+        return sub_first < sub_last;
+    }
+
+    // 范围内长度恰为depth的编码只可能有一个，且排在最前
+    if (first < last && get_code(first).size() == depth) {
+        first++;
+    }
+
+    // 其余编码的第depth个字符单调不减，二分查找字符c所在区间
+    size_t lo = first;
+    size_t hi = last;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (get_code(mid)[depth] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    sub_first = lo;
+
+    hi = last;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (get_code(mid)[depth] <= c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    sub_last = lo;
+
+    return sub_first < sub_last;
+}
+
+void compiled_dictionary::append_completions(size_t first, size_t last, size_t depth, size_t max_phrases, completion_buffer& buffer, std::vector<std::wstring_view>& result) const {
+    size_t limit = result.size() + max_phrases;
+    std::vector<code_range>& level = buffer.level;
+    std::vector<code_range>& next_level = buffer.next_level;
+    level.clear();
+    level.push_back(code_range{ first, last });
+
+    // 按编码长度逐层展开，保证较短的补全编码排在前面；收集够max_phrases个词条即停止
+    while (!level.empty() && result.size() < limit) {
+        next_level.clear();
+
+        for (const code_range& node : level) {
+            size_t pos = node.first;
+            if (pos < node.last && get_code(pos).size() == depth) {
+                pos++;
+            }
+
+            // 依次枚举下一个字符不同的子范围
+            while (pos < node.last) {
+                size_t child_first = 0;
+                size_t child_last = 0;
+                narrow_range(pos, node.last, depth, get_code(pos)[depth], child_first, child_last);
+
+                if (get_code(child_first).size() == depth + 1) {
+                    size_t count = get_phrase_count(child_first);
+                    for (size_t n = 0; n < count && result.size() < limit; n++) {
+                        result.push_back(get_phrase(child_first, n));
+                    }
+                    if (result.size() >= limit) {
+                        return;
+                    }
+                }
+
+                // 只有一个恰为depth + 1个字符的编码时没有更长的编码，下一层不再展开
+                if (child_last - child_first > 1 || get_code(child_first).size() > depth + 1) {
+                    next_level.push_back(code_range{ child_first, child_last });
+                }
+                pos = child_last;
+            }
+        }
+
+        level.swap(next_level);
+        depth++;
+    }
+}
+
+bool compiled_dictionary::match_wildcard(size_t first, size_t last, size_t depth, size_t key, std::wstring_view pattern, size_t length, size_t limit,
+                                         std::vector<std::wstring_view>& result, bool& has_longer) const {
+    // 已匹配到目标长度：长度恰为length的编码只可能排在最前，其余编码都更长
+    if (depth == length) {
+        bool exact = get_code(first).size() == length;
+        if (last - first > (exact ? 1u : 0u)) {
+            has_longer = true;
+        }
+        if (exact) {
+            size_t count = get_phrase_count(first);
+            for (size_t n = 0; n < count && result.size() < limit; n++) {
+                result.push_back(get_phrase(first, n));
+            }
+        }
+        return result.size() >= limit;
+    }
+
+    bool literal = depth < pattern.size() && pattern[depth] != WILDCARD_ANY_CHAR;
+
+    // 前三个字符直接查前缀索引，不在编码表上二分查找
+    if (prefix_index && depth < PREFIX_INDEX_DEPTH) {
+        size_t digit_first = 1;
+        size_t digit_last = PREFIX_INDEX_RADIX;
+        if (literal) {
+            digit_first = get_prefix_digit(pattern[depth]);
+            if (digit_first == 0) {
+                return false;
+            }
+            digit_last = digit_first + 1;
+        }
+
+        size_t scale = PREFIX_INDEX_SCALE[depth + 1];
+        for (size_t digit = digit_first; digit < digit_last; digit++) {
+            size_t child_key = key * PREFIX_INDEX_RADIX + digit;
+            size_t child_first = prefix_index[child_key * scale];
+            size_t child_last = prefix_index[(child_key + 1) * scale];
+            if (child_first < child_last && match_wildcard(child_first, child_last, depth + 1, child_key, pattern, length, limit, result, has_longer)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 确定的字符只需收窄一次
+    size_t child_first = 0;
+    size_t child_last = 0;
+    if (literal) {
+        return narrow_range(first, last, depth, pattern[depth], child_first, child_last) &&
+               match_wildcard(child_first, child_last, depth + 1, key, pattern, length, limit, result, has_longer);
+    }
+
+    // 通配的位置依次枚举下一个字符不同的子范围，范围内不存在的字符不会被展开
+    size_t pos = first;
+    if (pos < last && get_code(pos).size() == depth) {
+        pos++;
+    }
+    while (pos < last) {
+        narrow_range(pos, last, depth, get_code(pos)[depth], child_first, child_last);
+        if (match_wildcard(child_first, child_last, depth + 1, key, pattern, length, limit, result, has_longer)) {
+            return true;
+        }
+        pos = child_last;
+    }
+    return false;
+}
+
+bool compiled_dictionary::append_wildcard_matches(std::wstring_view pattern, size_t length, size_t max_phrases, std::vector<std::wstring_view>& result) const {
+    // 比最长编码还长的模式不必展开
+    if (length < pattern.size() || length == 0 || (max_code_length != 0 && length > max_code_length)) {
+        return false;
+    }
+    if (max_phrases == 0) {
+        return true;
+    }
+
+    size_t count = get_code_count();
+    if (count == 0) {
+        return false;
+    }
+
+    bool has_longer = false;
+    if (match_wildcard(0, count, 0, 0, pattern, length, result.size() + max_phrases, result, has_longer)) {
+        return true;
+    }
+    return has_longer;
+}
+
+size_t compiled_dictionary::get_phrase_count(size_t code_index) const {
+    return codes[code_index].phrase_count;
+}
+
+std::wstring_view compiled_dictionary::get_phrase(size_t code_index, size_t n) const {
+    const compiled_phrase_entry& entry = phrases[codes[code_index].first_phrase + n];
+    return std::wstring_view(phrase_pool + entry.offset, entry.length);
+}
+
+std::wstring_view compiled_dictionary::get_phrase_at(size_t phrase_index) const {
+    const compiled_phrase_entry& entry = phrases[phrase_index];
+    return std::wstring_view(phrase_pool + entry.offset, entry.length);
+}
+
+size_t compiled_dictionary::get_phrase_code(size_t phrase_index) const {
+    // 最后一个第一个词条不在phrase_index之后的编码
+    const compiled_code_entry* begin = codes;
+    const compiled_code_entry* end = codes + get_code_count();
+    const compiled_code_entry* it = std::upper_bound(begin, end, phrase_index, [](size_t index, const compiled_code_entry& entry) {
+        return index < entry.first_phrase;
+    });
+    return it == begin ? npos : static_cast<size_t>(it - begin - 1);
+}
+
+void compiled_dictionary::append_phrases(size_t code_index, std::vector<std::wstring_view>& result) const {
+    size_t count = get_phrase_count(code_index);
+    for (size_t n = 0; n < count; n++) {
+        result.push_back(get_phrase(code_index, n));
+    }
+}
+
+// completion_stream 类实现
+completion_stream::completion_stream() : dict(nullptr), node(0), pos(0), depth(0), code_index(compiled_dictionary::npos), phrase(0) {
+}
+
+void completion_stream::reset(const compiled_dictionary* source, size_t first, size_t last, size_t prefix_length) {
+    dict = source;
+    level.clear();
+    next_level.clear();
+    depth = prefix_length;
+    code_index = compiled_dictionary::npos;
+    if (!dict || first >= last) {
+        return;
+    }
+
+    level.push_back(code_range{ first, last });
+    node = 0;
+    enter_node();
+    next_code();
+}
+
+void completion_stream::enter_node() {
+    pos = level[node].first;
+    if (pos < level[node].last && dict->get_code(pos).size() == depth) {
+        pos++;
+    }
+}
+
+void completion_stream::next_code() {
+    code_index = compiled_dictionary::npos;
+
+    for (;;) {
+        // 当前层展开完毕，进入下一层
+        if (node >= level.size()) {
+            if (next_level.empty()) {
+                return;
+            }
+            level.swap(next_level);
+            next_level.clear();
+            depth++;
+            node = 0;
+            enter_node();
+            continue;
+        }
+
+        if (pos >= level[node].last) {
+            node++;
+            if (node < level.size()) {
+                enter_node();
+            }
+            continue;
+        }
+
+        // 取下一个字符不同的子范围，长度恰为depth+1的编码排在子范围最前
+        size_t child_first = 0;
+        size_t child_last = 0;
+        dict->narrow_range(pos, level[node].last, depth, dict->get_code(pos)[depth], child_first, child_last);
+        next_level.push_back(code_range{ child_first, child_last });
+        pos = child_last;
+
+        if (dict->get_code(child_first).size() == depth + 1 && dict->get_phrase_count(child_first) > 0) {
+            code_index = child_first;
+            phrase = 0;
+            return;
+        }
+    }
+}
+
+bool completion_stream::done() const {
+    return code_index == compiled_dictionary::npos;
+}
+
+std::wstring_view completion_stream::get_code() const {
+    return dict->get_code(code_index);
+}
+
+std::wstring_view completion_stream::get_phrase() const {
+    return dict->get_phrase(code_index, phrase);
+}
+
+void completion_stream::next() {
+    if (++phrase >= dict->get_phrase_count(code_index)) {
+        next_code();
+    }
+}
+
+// text_dictionary 实现
+text_dictionary::text_dictionary() : code_count(0) {
+}
+
+void text_dictionary::clear() {
+    chars.clear();
+    entries.clear();
+    code_count = 0;
+}
+
+std::wstring_view text_dictionary::get_code(const entry& item) const {
+    return std::wstring_view(chars.data() + item.code_offset, item.code_length);
+}
+
+std::wstring_view text_dictionary::get_phrase(const entry& item) const {
+    return std::wstring_view(chars.data() + item.phrase_offset, item.phrase_length);
+}
+
+// 将文本词库构建为二进制词库镜像
+bool build_compiled_dictionary(const text_dictionary& dict, std::vector<uint8_t>& data) {
+    const std::vector<text_dictionary::entry>& entries = dict.entries;
+    uint64_t code_count = 0;
+    uint64_t phrase_count = entries.size();
+    uint64_t code_pool_size = 0;
+    uint64_t phrase_pool_size = 0;
+    uint64_t max_code_length = 0;
+    bool indexable = true;
+    bool packable = true;
+
+    // 词条已按编码排序，编码变化处开始一个新编码
+    for (size_t i = 0; i < entries.size(); i++) {
+        phrase_pool_size += entries[i].phrase_length;
+        std::wstring_view code = dict.get_code(entries[i]);
+        if (i > 0 && code == dict.get_code(entries[i - 1])) {
+            continue;
+        }
+        code_count++;
+        code_pool_size += code.size();
+        max_code_length = std::max<uint64_t>(max_code_length, code.size());
+        for (size_t j = 0; j < code.size() && j < PREFIX_INDEX_DEPTH; j++) {
+            if (get_prefix_digit(code[j]) == 0) {
+                indexable = false;
+            }
+        }
+        packed_code key = 0;
+        if (!pack_code(code, key)) {
+            packable = false;
+        }
+    }
+
+    if (code_count > UINT32_MAX || phrase_count > UINT32_MAX ||
+        code_pool_size > UINT32_MAX || phrase_pool_size > UINT32_MAX) {
+        return false;
+    }
+
+    // 计算各区段布局
+    compiled_dict_header h = {};
+    memcpy(h.magic, COMPILED_DICT_MAGIC, sizeof(COMPILED_DICT_MAGIC));
+    h.version = COMPILED_DICT_VERSION;
+    h.char_size = sizeof(wchar_t);
+    h.code_count = static_cast<uint32_t>(code_count);
+    h.phrase_count = static_cast<uint32_t>(phrase_count);
+    h.code_pool_size = static_cast<uint32_t>(code_pool_size);
+    h.phrase_pool_size = static_cast<uint32_t>(phrase_pool_size);
+    h.max_code_length = static_cast<uint32_t>(max_code_length);
+    h.codes_offset = align8(sizeof(compiled_dict_header));
+    h.phrases_offset = align8(h.codes_offset + code_count * sizeof(compiled_code_entry));
+    h.code_pool_offset = align8(h.phrases_offset + phrase_count * sizeof(compiled_phrase_entry));
+    h.phrase_pool_offset = align8(h.code_pool_offset + code_pool_size * sizeof(wchar_t));
+    h.file_size = align8(h.phrase_pool_offset + phrase_pool_size * sizeof(wchar_t));
+
+    // 编码的前三个字符都在a-z之间时附加前缀索引
+    if (indexable) {
+        h.prefix_index_offset = h.file_size;
+        h.file_size = align8(h.prefix_index_offset + PREFIX_INDEX_SIZE * sizeof(uint32_t));
+    }
+
+    // 所有编码都能压缩时附加压缩编码表（这时前三个字符一定都在a-z之间）
+    if (packable) {
+        h.code_keys_offset = h.file_size;
+        h.file_size = align8(h.code_keys_offset + code_count * sizeof(packed_code));
+    }
+
+    data.assign(static_cast<size_t>(h.file_size), 0);
+    memcpy(data.data(), &h, sizeof(h));
+
+    compiled_code_entry* code_table = reinterpret_cast<compiled_code_entry*>(data.data() + h.codes_offset);
+    compiled_phrase_entry* phrase_table = reinterpret_cast<compiled_phrase_entry*>(data.data() + h.phrases_offset);
+    wchar_t* code_chars = reinterpret_cast<wchar_t*>(data.data() + h.code_pool_offset);
+    wchar_t* phrase_chars = reinterpret_cast<wchar_t*>(data.data() + h.phrase_pool_offset);
+
+    // 顺序写入编码表和词条表
+    uint32_t code_index = 0;
+    uint32_t code_offset = 0;
+    uint32_t phrase_offset = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::wstring_view code = dict.get_code(entries[i]);
+        if (i == 0 || code != dict.get_code(entries[i - 1])) {
+            compiled_code_entry& entry = code_table[code_index++];
+            entry.code_offset = code_offset;
+            entry.code_length = static_cast<uint32_t>(code.size());
+            entry.first_phrase = static_cast<uint32_t>(i);
+            entry.phrase_count = 0;
+
+            std::copy(code.begin(), code.end(), code_chars + code_offset);
+            code_offset += entry.code_length;
+        }
+        code_table[code_index - 1].phrase_count++;
+
+        std::wstring_view phrase = dict.get_phrase(entries[i]);
+        compiled_phrase_entry& phrase_entry = phrase_table[i];
+        phrase_entry.offset = phrase_offset;
+        phrase_entry.length = static_cast<uint32_t>(phrase.size());
+
+        std::copy(phrase.begin(), phrase.end(), phrase_chars + phrase_offset);
+        phrase_offset += phrase_entry.length;
+    }
+
+    // 前缀索引的第k项为第一个键不小于k的编码下标
+    if (h.prefix_index_offset != 0) {
+        uint32_t* index = reinterpret_cast<uint32_t*>(data.data() + h.prefix_index_offset);
+        size_t next_key = 0;
+        for (code_index = 0; code_index < code_count; code_index++) {
+            const compiled_code_entry& entry = code_table[code_index];
+            size_t key = get_prefix_key(std::wstring_view(code_chars + entry.code_offset, entry.code_length));
+            while (next_key <= key) {
+                index[next_key++] = code_index;
+            }
+        }
+        while (next_key < PREFIX_INDEX_SIZE) {
+            index[next_key++] = code_index;
+        }
+    }
+
+    // 压缩编码表与编码表一一对应，同样按升序排列
+    if (h.code_keys_offset != 0) {
+        packed_code* keys = reinterpret_cast<packed_code*>(data.data() + h.code_keys_offset);
+        for (code_index = 0; code_index < code_count; code_index++) {
+            const compiled_code_entry& entry = code_table[code_index];
+            pack_code(std::wstring_view(code_chars + entry.code_offset, entry.code_length), keys[code_index]);
+        }
+    }
+
+    return true;
+}
+
+// 将编码到词条的映射构建为二进制词库镜像
+bool build_compiled_dictionary(const std::map<std::wstring, std::vector<std::wstring>>& entries, std::vector<uint8_t>& data) {
+    // 映射已按编码排序，转换为文本词库的形式后共用同一构建过程
+    text_dictionary dict;
+    for (const auto& pair : entries) {
+        for (const auto& phrase : pair.second) {
+            if (!append_text_entry(pair.first, phrase, dict)) {
+                return false;
+            }
+        }
+    }
+    normalize_text_dictionary(dict);
+    return build_compiled_dictionary(dict, data);
+}
+
+// 将二进制词库镜像写入文件
+bool write_compiled_dictionary(const std::vector<uint8_t>& data, const std::wstring& file_path) {
+    // 目标文件可能正被其他会话内存映射，不能原地截断改写：先写临时文件，再改名替换
+    return write_file_replacing(data, file_path);
+}
+
+bool write_file_replacing(const std::vector<uint8_t>& data, const std::wstring& file_path) {
+    try {
+        std::wstring temp_path = file_path + L".tmp";
+        std::ofstream file(native_path(temp_path), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        file.close();
+        if (file.fail()) {
+            std::error_code error;
+            std::filesystem::remove(std::filesystem::path(native_path(temp_path)), error);
+            return false;
+        }
+        return replace_file(temp_path, file_path);
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+// 解析UTF-8文本词库
+bool parse_text_dictionary(const char* text, size_t size, text_dictionary& dict) {
+    dict.clear();
+    if (size > UINT32_MAX) {
+        return false;
+    }
+
+    const char* p = text;
+    const char* end = text + size;
+    if (size >= sizeof(UTF8_BOM) && memcmp(p, UTF8_BOM, sizeof(UTF8_BOM)) == 0) {
+        p += sizeof(UTF8_BOM);
+    }
+
+    // 解码后的字符数不超过字节数，字符池一次分配，解码时直接写入
+    dict.chars.resize(size);
+    wchar_t* pool = dict.chars.data();
+    wchar_t* out = pool;
+    dict.entries.reserve(size / ESTIMATED_LINE_BYTES);
+
+    while (p < end) {
+        const char* line = p;
+        const char* line_end = find_byte(p, end, '\n');
+        p = line_end == end ? end : line_end + 1;
+
+        if (line_end - line >= 2 && line[0] == '/' && line[1] == '/') {
+            continue;
+        }
+
+        // 编码与词条以第一个空格分隔；行首是空格或空格之后没有内容的行跳过
+        const char* separator = find_byte(line, line_end, ' ');
+        if (separator == line || separator + 1 >= line_end) {
+            continue;
+        }
+
+        wchar_t* code = out;
+        wchar_t* phrase = decode_utf8_field(reinterpret_cast<const unsigned char*>(line), reinterpret_cast<const unsigned char*>(separator), code);
+        out = decode_utf8_field(reinterpret_cast<const unsigned char*>(separator + 1), reinterpret_cast<const unsigned char*>(line_end), phrase);
+        if (phrase == code || out == phrase) {
+            out = code;
+            continue;
+        }
+
+        text_dictionary::entry item;
+        item.code_offset = static_cast<uint32_t>(code - pool);
+        item.code_length = static_cast<uint32_t>(phrase - code);
+        item.phrase_offset = static_cast<uint32_t>(phrase - pool);
+        item.phrase_length = static_cast<uint32_t>(out - phrase);
+        dict.entries.push_back(item);
+    }
+
+    dict.chars.resize(static_cast<size_t>(out - pool));
+    normalize_text_dictionary(dict);
+    return true;
+}
+
+// 一次读入整个文本词库文件并解析
+bool load_text_dictionary(const std::wstring& file_path, text_dictionary& dict) {
+    try {
+        // 文本词库可能被编辑器原地改写，读入内存后再解析，不使用内存映射
+        std::ifstream file(native_path(file_path), std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        file.seekg(0, std::ios::end);
+        std::streamoff size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        if (size < 0) {
+            return false;
+        }
+
+        std::vector<char> text(static_cast<size_t>(size));
+        if (size > 0 && !file.read(text.data(), size)) {
+            return false;
+        }
+        file.close();
+
+        return parse_text_dictionary(text.data(), text.size(), dict);
+    }
+    catch (...) {
+        return false;
+    }
+}
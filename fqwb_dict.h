@@ -0,0 +1,290 @@
+// fqwb_dict.h - 反切五笔输入法二进制词库格式
+// 提供预编译词库的构建、内存映射加载和只读查询
+
+#ifndef FQWB_DICT_H
+#define FQWB_DICT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 二进制词库文件扩展名
+#define FQWB_COMPILED_DICT_EXT L".bdic"
+
+// 二进制词库格式版本；版本1没有前缀索引，版本2没有压缩编码表，仍可读取
+const uint32_t COMPILED_DICT_VERSION = 3;
+const uint32_t COMPILED_DICT_MIN_VERSION = 1;
+
+// 前缀索引：编码的前三个字符（a-z记为1-26，编码不足三个字符时记为0）组成27进制的键，
+// 索引的第k项为第一个键不小于k的编码下标，前三个字符相同的编码范围可直接查表得到
+const size_t PREFIX_INDEX_DEPTH = 3;
+const size_t PREFIX_INDEX_RADIX = 27;
+const size_t PREFIX_INDEX_SIZE = PREFIX_INDEX_RADIX * PREFIX_INDEX_RADIX * PREFIX_INDEX_RADIX + 1;
+
+// 压缩编码：编码的各字符按前缀索引的方式记为1-26，不足六个字符时补0，组成27进制的32位整数
+// 整数的大小顺序与编码顺序相同，前三位就是前缀索引的键；所有编码都能压缩时，词库附带与编码表对应的压缩编码表
+typedef uint32_t packed_code;
+const size_t PACKED_CODE_LENGTH = 6;
+
+// 二进制词库文件头
+// 文件布局：文件头 | 编码表 | 词条表 | 编码字符池 | 词条字符池 | 前缀索引（可选） | 压缩编码表（可选）
+struct compiled_dict_header {
+    char magic[4];               // 文件标识 "FQWB"
+    uint32_t version;            // 格式版本
+    uint32_t char_size;          // 字符宽度（sizeof(wchar_t)），不同宽度的平台之间词库不通用
+    uint32_t code_count;         // 编码数量
+    uint32_t phrase_count;       // 词条数量
+    uint32_t code_pool_size;     // 编码字符池长度（字符数）
+    uint32_t phrase_pool_size;   // 词条字符池长度（字符数）
+    uint32_t max_code_length;    // 最长编码长度，0表示未记录（早期生成的文件）
+    uint64_t codes_offset;       // 编码表偏移
+    uint64_t phrases_offset;     // 词条表偏移
+    uint64_t code_pool_offset;   // 编码字符池偏移
+    uint64_t phrase_pool_offset; // 词条字符池偏移
+    uint64_t file_size;          // 文件总长度
+    uint64_t prefix_index_offset; // 前缀索引偏移，0表示没有前缀索引（有编码的前三个字符不在a-z之间）；版本2起
+    uint64_t code_keys_offset;    // 压缩编码表偏移，0表示没有压缩编码表（有编码不在a-z之间或长于六个字符）；版本3起
+};
+
+// 编码表项，编码表按编码升序排列
+struct compiled_code_entry {
+    uint32_t code_offset;  // 编码在编码字符池中的偏移
+    uint32_t code_length;  // 编码长度
+    uint32_t first_phrase; // 第一个词条在词条表中的下标
+    uint32_t phrase_count; // 词条数量
+};
+
+// 词条表项
+struct compiled_phrase_entry {
+    uint32_t offset; // 词条在词条字符池中的偏移
+    uint32_t length; // 词条长度
+};
+
+// 将宽字符路径转换为本平台文件接口接受的路径
+#ifdef _WIN32
+const std::wstring& native_path(const std::wstring& path);
+#else
+std::string native_path(const std::wstring& path);
+#endif
+
+// 用已写好并关闭的临时文件temp_path原子替换file_path：先把临时文件写入磁盘，再改名覆盖原文件
+// 替换前后file_path都是完整的文件，正在读取或内存映射原文件的会话继续使用旧内容；失败时删除临时文件、保留原文件
+bool replace_file(const std::wstring& temp_path, const std::wstring& file_path);
+
+// 将data写入临时文件，再用replace_file替换file_path
+bool write_file_replacing(const std::vector<uint8_t>& data, const std::wstring& file_path);
+
+// 通配查询中匹配任意一个字符的通配符
+const wchar_t WILDCARD_ANY_CHAR = L'?';
+
+// 编码范围[first, last)
+struct code_range {
+    size_t first;
+    size_t last;
+};
+
+// 补全查询的工作缓冲区，由调用方持有并在多次查询之间复用，预热后查询不再分配内存
+struct completion_buffer {
+    std::vector<code_range> level;      // 当前层的编码范围
+    std::vector<code_range> next_level; // 下一层的编码范围
+};
+
+// 只读内存映射文件
+class mapped_file {
+private:
+    const uint8_t* view;  // 映射视图
+    size_t view_size;     // 映射长度
+#ifdef _WIN32
+    void* file_handle;    // 文件句柄
+    void* mapping_handle; // 映射句柄
+#endif
+
+public:
+    mapped_file();
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // 以只读方式映射文件
+    bool open(const std::wstring& file_path);
+
+    // 取消映射并关闭文件
+    void close();
+
+    // 获取映射数据
+    const uint8_t* data() const;
+
+    // 获取映射长度
+    size_t size() const;
+};
+
+// 预编译词库，所有查询直接在映射页面（或内存镜像）上进行
+class compiled_dictionary {
+private:
+    mapped_file file;                     // 映射文件（从.bdic文件加载时使用）
+    std::vector<uint8_t> image;           // 内存镜像（由文本词库在内存中构建时使用）
+    const compiled_dict_header* header;   // 文件头
+    const compiled_code_entry* codes;     // 编码表
+    const compiled_phrase_entry* phrases; // 词条表
+    const wchar_t* code_pool;             // 编码字符池
+    const wchar_t* phrase_pool;           // 词条字符池
+    const uint32_t* prefix_index;         // 前缀索引，没有时为空
+    const packed_code* code_keys;         // 压缩编码表，没有时为空
+    size_t max_code_length;               // 最长编码长度，0表示未知
+
+    // 校验并绑定词库数据：检查文件头、各区段边界和每个表项，任何一项不符时拒绝整个文件
+    bool attach(const uint8_t* data, size_t size);
+
+    // 通配查询的递归部分：在前depth个字符与pattern匹配的编码范围[first, last)内继续匹配，已追加到limit个词条时返回true
+    // key为已匹配前缀在前缀索引中的键（只用到前PREFIX_INDEX_DEPTH个字符）
+    bool match_wildcard(size_t first, size_t last, size_t depth, size_t key, std::wstring_view pattern, size_t length, size_t limit,
+                        std::vector<std::wstring_view>& result, bool& has_longer) const;
+
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    compiled_dictionary();
+
+    compiled_dictionary(const compiled_dictionary&) = delete;
+    compiled_dictionary& operator=(const compiled_dictionary&) = delete;
+
+    // 以内存映射方式打开二进制词库文件
+    bool open(const std::wstring& file_path);
+
+    // 使用内存中的词库镜像
+    bool load_image(std::vector<uint8_t>&& data);
+
+    // 获取编码数量
+    size_t get_code_count() const;
+
+    // 获取词条总数
+    size_t get_phrase_count() const;
+
+    // 获取最长编码长度，文件中未记录时返回0
+    size_t get_max_code_length() const;
+
+    // 获取指定下标的编码
+    std::wstring_view get_code(size_t index) const;
+
+    // 查找编码，返回编码下标，未找到时返回npos
+    // 不超过三个字符的编码直接查前缀索引，更长的编码在前三个字符相同的范围内比较压缩编码；编码含a-z以外的字符时比较字符串
+    size_t find_code(std::wstring_view code) const;
+
+    // 获取以prefix开头的编码下标范围[first, last)
+    void get_prefix_range(std::wstring_view prefix, size_t& first, size_t& last) const;
+
+    // 在前depth个字符相同的编码范围[first, last)内，按第depth个字符收窄范围
+    // 返回收窄后的范围是否非空
+    bool narrow_range(size_t first, size_t last, size_t depth, wchar_t c, size_t& sub_first, size_t& sub_last) const;
+
+    // 按编码由短到长的顺序，追加范围[first, last)内长于depth的编码的词条，最多追加max_phrases个
+    // 顺序只按编码：长度相同时按编码顺序，同一编码下按词条在词库中的顺序，不按使用频率或其他权重排序
+    // 按编码长度逐层展开，收集够max_phrases个词条即停止：耗时与展开到的各层中不同前缀的数量成正比（每个前缀一次二分查找），
+    // 而不是O(前缀长度 + max_phrases)；没有更长编码的前缀不再展开。短码稀少、长码很多的范围仍可能展开整层
+    // 追加的是指向词条字符池的视图，在词库对象销毁前有效；buffer为逐层展开使用的工作缓冲区
+    void append_completions(size_t first, size_t last, size_t depth, size_t max_phrases, completion_buffer& buffer, std::vector<std::wstring_view>& result) const;
+
+    // 通配查询：按编码顺序追加长度恰为length、且与pattern匹配的编码的词条，最多追加max_phrases个
+    // pattern中的WILDCARD_ANY_CHAR以及pattern之后直到length的位置匹配任意字符；逐字符收窄范围，只展开仍有编码的分支
+    // 返回是否可能还有与pattern匹配且长于length的编码（提前停止时总是返回true）
+    bool append_wildcard_matches(std::wstring_view pattern, size_t length, size_t max_phrases, std::vector<std::wstring_view>& result) const;
+
+    // 获取指定编码下的词条数量
+    size_t get_phrase_count(size_t code_index) const;
+
+    // 获取指定编码下的第n个词条
+    std::wstring_view get_phrase(size_t code_index, size_t n) const;
+
+    // 获取词条表中的第phrase_index个词条
+    std::wstring_view get_phrase_at(size_t phrase_index) const;
+
+    // 获取词条表中第phrase_index个词条所属的编码下标（各编码的词条在词条表中按编码顺序连续存放，二分查找）
+    size_t get_phrase_code(size_t phrase_index) const;
+
+    // 将指定编码下的所有词条（指向词条字符池的视图）追加到结果列表
+    void append_phrases(size_t code_index, std::vector<std::wstring_view>& result) const;
+};
+
+// 补全流：按与append_completions相同的顺序（编码由短到长，长度相同时按编码顺序）逐个产生范围内更长编码的词条
+// 多个词库的补全候选词按编码归并时，每个词库只展开实际取到的部分；预热后不再分配内存
+class completion_stream {
+private:
+    const compiled_dictionary* dict;    // 词库
+    std::vector<code_range> level;      // 当前层待展开的范围
+    std::vector<code_range> next_level; // 下一层的范围
+    size_t node;                        // 正在展开的范围在level中的下标
+    size_t pos;                         // 该范围内下一个子范围的起点
+    size_t depth;                       // 当前层范围内相同的前缀长度
+    size_t code_index;                  // 当前编码下标，npos表示已结束
+    size_t phrase;                      // 当前编码中的词条序号
+
+    // 开始展开level中的第node个范围，跳过长度恰为depth的编码
+    void enter_node();
+
+    // 前进到下一个有词条的更长编码
+    void next_code();
+
+public:
+    completion_stream();
+
+    // 从前depth个字符相同的编码范围[first, last)开始
+    void reset(const compiled_dictionary* source, size_t first, size_t last, size_t depth);
+
+    // 是否已没有更多词条
+    bool done() const;
+
+    // 获取当前词条的编码
+    std::wstring_view get_code() const;
+
+    // 获取当前词条
+    std::wstring_view get_phrase() const;
+
+    // 前进到下一个词条
+    void next();
+};
+
+// 文本词库的解析结果：编码和词条解码后连续存放在一个字符池中，不为每个编码和词条单独分配内存
+struct text_dictionary {
+    // 一个(编码, 词条)
+    struct entry {
+        uint32_t code_offset;   // 编码在字符池中的偏移
+        uint32_t code_length;   // 编码长度
+        uint32_t phrase_offset; // 词条在字符池中的偏移
+        uint32_t phrase_length; // 词条长度
+    };
+
+    std::vector<wchar_t> chars;  // 字符池
+    std::vector<entry> entries;  // 按编码排序；同一编码的词条保持出现的顺序，重复的词条只保留第一个
+    size_t code_count;           // 不同编码的数量
+
+    text_dictionary();
+
+    // 清空
+    void clear();
+
+    // 获取词条的编码和内容
+    std::wstring_view get_code(const entry& item) const;
+    std::wstring_view get_phrase(const entry& item) const;
+};
+
+// 将文本词库构建为二进制词库镜像
+bool build_compiled_dictionary(const text_dictionary& dict, std::vector<uint8_t>& data);
+
+// 将编码到词条的映射构建为二进制词库镜像
+bool build_compiled_dictionary(const std::map<std::wstring, std::vector<std::wstring>>& entries, std::vector<uint8_t>& data);
+
+// 将二进制词库镜像写入文件：先写临时文件再改名替换，正在映射原文件的会话不受影响
+bool write_compiled_dictionary(const std::vector<uint8_t>& data, const std::wstring& file_path);
+
+// 解析UTF-8文本词库（每行：编码+空格+词条），结果替换dict的内容
+// 以//开头的行为注释；编码和词条中的空白（ASCII空白和全角空格）被去掉；文件开头的BOM跳过，无效的UTF-8字节解码为U+FFFD
+bool parse_text_dictionary(const char* text, size_t size, text_dictionary& dict);
+
+// 一次读入整个文本词库文件并解析
+bool load_text_dictionary(const std::wstring& file_path, text_dictionary& dict);
+
+#endif // FQWB_DICT_H
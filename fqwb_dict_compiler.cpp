@@ -0,0 +1,64 @@
+// fqwb_dict_compiler.cpp - 反切五笔输入法词库编译工具
+// 将文本词库(.dic)编译为可内存映射的二进制词库(.bdic)
+// 用法：fqwb_dict_compiler <输入词库.dic> [输出词库.bdic]
+
+#include "fqwb_dict.h"
+#include <windows.h>
+#include <iostream>
+#include <string>
+
+// 辅助函数：将宽字符串转换为UTF-8字符串
+std::string wstring_to_string(const std::wstring& wstr) {
+    int size_needed = WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), NULL, 0, NULL, NULL);
+    std::string str(size_needed, 0);
+    WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), &str[0], size_needed, NULL, NULL);
+    return str;
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+    if (argc < 2) {
+        std::cerr << "用法: fqwb_dict_compiler <输入词库.dic> [输出词库.bdic]\n";
+        return 1;
+    }
+
+    std::wstring input_path = argv[1];
+    std::wstring output_path;
+    if (argc >= 3) {
+        output_path = argv[2];
+    } else {
+        // 默认输出到同目录下的同名.bdic文件
+        output_path = input_path.substr(0, input_path.find_last_of(L'.')) + FQWB_COMPILED_DICT_EXT;
+    }
+
+    // 解析文本词库
+    text_dictionary text;
+    if (!load_text_dictionary(input_path, text) || text.entries.empty()) {
+        std::cerr << "读取词库失败: " << wstring_to_string(input_path) << "\n";
+        return 1;
+    }
+
+    // 构建二进制镜像
+    std::vector<uint8_t> data;
+    if (!build_compiled_dictionary(text, data)) {
+        std::cerr << "构建二进制词库失败，词库规模超出格式限制\n";
+        return 1;
+    }
+
+    if (!write_compiled_dictionary(data, output_path)) {
+        std::cerr << "写入文件失败: " << wstring_to_string(output_path) << "\n";
+        return 1;
+    }
+
+    // 重新映射输出文件，确认可以正常加载
+    compiled_dictionary compiled;
+    if (!compiled.open(output_path)) {
+        std::cerr << "校验输出文件失败: " << wstring_to_string(output_path) << "\n";
+        return 1;
+    }
+
+    std::cout << "编译完成: " << wstring_to_string(output_path) << "\n";
+    std::cout << "编码数量: " << compiled.get_code_count() << "\n";
+    std::cout << "词条数量: " << compiled.get_phrase_count() << "\n";
+    std::cout << "文件大小: " << data.size() << " 字节\n";
+    return 0;
+}
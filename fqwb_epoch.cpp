@@ -0,0 +1,87 @@
+// fqwb_epoch.cpp - 反切五笔输入法基于纪元的内存回收实现文件
+
+#include "fqwb_epoch.h"
+#include <limits>
+#include <mutex>
+#include <vector>
+
+std::atomic<uint64_t> global_epoch(1);
+
+namespace {
+
+// 所有线程的读取状态
+struct epoch_registry {
+    std::mutex mutex;
+    std::vector<epoch_reader*> readers;
+};
+
+// 不析构，静态对象析构之后才退出的线程仍可安全注销
+epoch_registry& get_registry() {
+    static epoch_registry* registry = new epoch_registry();
+    return *registry;
+}
+
+// 当前线程的读取状态是否已注销
+thread_local bool epoch_reader_exited = false;
+
+// 线程读取状态的登记和注销
+struct epoch_reader_holder {
+    epoch_reader reader;
+
+    epoch_reader_holder() {
+        reader.active.store(0, std::memory_order_relaxed);
+        reader.depth = 0;
+        epoch_registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.readers.push_back(&reader);
+    }
+
+    ~epoch_reader_holder() {
+        current_epoch_reader = nullptr;
+        epoch_reader_exited = true;
+        epoch_registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (auto it = registry.readers.begin(); it != registry.readers.end(); ++it) {
+            if (*it == &reader) {
+                registry.readers.erase(it);
+                break;
+            }
+        }
+    }
+};
+
+} // namespace
+
+epoch_reader& register_epoch_reader() {
+    if (epoch_reader_exited) {
+        // 线程退出过程中其他线程局部对象的析构仍可能进入读取区，为其登记一个不再注销的读取状态
+        epoch_reader* reader = new epoch_reader();
+        reader->active.store(0, std::memory_order_relaxed);
+        reader->depth = 0;
+        epoch_registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.readers.push_back(reader);
+        current_epoch_reader = reader;
+        return *reader;
+    }
+    thread_local epoch_reader_holder holder;
+    current_epoch_reader = &holder.reader;
+    return holder.reader;
+}
+
+uint64_t retire_epoch() {
+    return global_epoch.fetch_add(1, std::memory_order_seq_cst);
+}
+
+uint64_t get_oldest_active_epoch() {
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    epoch_registry& registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const epoch_reader* reader : registry.readers) {
+        uint64_t active = reader->active.load(std::memory_order_seq_cst);
+        if (active != 0 && active < oldest) {
+            oldest = active;
+        }
+    }
+    return oldest;
+}
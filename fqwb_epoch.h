@@ -0,0 +1,171 @@
+// fqwb_epoch.h - 反切五笔输入法基于纪元的内存回收
+// 共享数据以只读快照发布：查询线程进入读取区时登记当前纪元，不加锁也不修改引用计数；
+// 写入线程替换快照后把旧快照放入回收列表，等所有可能仍在读取它的线程离开读取区后再释放
+
+#ifndef FQWB_EPOCH_H
+#define FQWB_EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// 一个线程的读取状态，只由所属线程写入
+struct epoch_reader {
+    std::atomic<uint64_t> active; // 进入读取区时的纪元，0表示不在读取区
+    size_t depth;                 // 读取区嵌套层数
+};
+
+// 登记当前线程的读取状态，线程退出时注销
+epoch_reader& register_epoch_reader();
+
+// 当前线程的读取状态，登记前为空
+inline thread_local epoch_reader* current_epoch_reader = nullptr;
+
+// 全局纪元，从1开始，每次回收旧快照时递增
+extern std::atomic<uint64_t> global_epoch;
+
+// 读取区：在作用域内读取的快照不会被释放；可以嵌套，外层进入时登记一次
+// 进入和离开只读写本线程的状态，等待无关（首次使用时登记线程需要加锁一次）
+class epoch_guard {
+private:
+    epoch_reader* reader;
+
+public:
+    epoch_guard() {
+        reader = current_epoch_reader ? current_epoch_reader : &register_epoch_reader();
+        if (reader->depth++ == 0) {
+            reader->active.store(global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+    }
+
+    ~epoch_guard() {
+        if (--reader->depth == 0) {
+            reader->active.store(0, std::memory_order_release);
+        }
+    }
+
+    epoch_guard(const epoch_guard&) = delete;
+    epoch_guard& operator=(const epoch_guard&) = delete;
+};
+
+// 结束一个纪元，返回结束的纪元；在替换快照之后调用，之前进入读取区的线程登记的纪元都不大于返回值
+uint64_t retire_epoch();
+
+// 获取仍在读取区中的线程登记的最小纪元，没有线程在读取区时返回UINT64_MAX
+uint64_t get_oldest_active_epoch();
+
+// 快照回收列表，由写入线程持有（调用方负责写入线程之间的互斥）
+template <typename T>
+class retire_list {
+private:
+    std::deque<std::pair<uint64_t, std::shared_ptr<const T>>> items; // (结束的纪元, 旧快照)，纪元递增
+
+public:
+    // 放入已被替换的旧快照，并释放已没有线程读取的旧快照
+    void retire(std::shared_ptr<const T> old) {
+        items.emplace_back(retire_epoch(), std::move(old));
+        reclaim();
+    }
+
+    // 释放已没有线程读取的旧快照：读取区中最小的纪元大于旧快照结束的纪元时，不会再有线程读取它
+    void reclaim() {
+        if (items.empty()) {
+            return;
+        }
+        uint64_t oldest = get_oldest_active_epoch();
+        while (!items.empty() && items.front().first < oldest) {
+            items.pop_front();
+        }
+    }
+
+    // 待释放的旧快照数量
+    size_t size() const {
+        return items.size();
+    }
+
+    // 直接释放全部旧快照，调用时必须已没有线程在读取
+    void clear() {
+        items.clear();
+    }
+};
+
+// 两份轮换发布的快照，用于每次修改都很小、但整体复制代价较大的数据（使用频率、学习的联想）
+// 读取线程在读取区内无锁读取当前一份；写入线程修改另一份后发布，换下的一份等没有线程读取后补上同样的修改，下次写入时使用
+// 两份各自保留容量，稳定后写入不分配内存；Op为一次修改，op.apply(T&)把修改应用到一份上
+// 写入线程之间由调用方互斥，写入不能在读取区内进行（否则可能等待自己）
+template <typename T, typename Op>
+class double_buffered {
+private:
+    T copies[2];
+    std::atomic<const T*> current; // 当前发布的一份
+    size_t published;              // 当前发布的一份的下标
+    uint64_t released_epoch;       // 另一份被换下时结束的纪元
+    std::vector<Op> pending;       // 已应用到当前一份、尚未应用到另一份的修改
+    bool spare_outdated;           // 另一份需要整体复制当前一份（重置之后）
+
+    // 等待可能仍在读取另一份的线程离开读取区，补上它缺少的修改后返回
+    T& acquire_spare() {
+        while (get_oldest_active_epoch() <= released_epoch) {
+            std::this_thread::yield();
+        }
+        T& spare = copies[1 - published];
+        if (spare_outdated) {
+            spare = copies[published];
+            spare_outdated = false;
+        } else {
+            for (const Op& op : pending) {
+                op.apply(spare);
+            }
+        }
+        pending.clear();
+        return spare;
+    }
+
+    // 发布另一份，换下的一份从下一个纪元起不再有新的读取
+    void publish(T& spare) {
+        current.store(&spare, std::memory_order_seq_cst);
+        published = 1 - published;
+        released_epoch = retire_epoch();
+    }
+
+public:
+    double_buffered() : current(&copies[0]), published(0), released_epoch(0), spare_outdated(false) {
+    }
+
+    double_buffered(const double_buffered&) = delete;
+    double_buffered& operator=(const double_buffered&) = delete;
+
+    // 获取当前发布的一份，只能在读取区内调用，离开读取区后不再使用
+    const T& get() const {
+        return *current.load(std::memory_order_seq_cst);
+    }
+
+    // 获取最新的一份，只能在写入线程中（持有写入锁时）调用
+    const T& get_latest() const {
+        return copies[published];
+    }
+
+    // 应用一次修改并发布
+    void modify(const Op& op) {
+        T& spare = acquire_spare();
+        op.apply(spare);
+        publish(spare);
+        pending.push_back(op);
+    }
+
+    // 以任意方式修改（加载、清除等不便重放的修改）并发布，另一份下次写入时整体复制
+    template <typename F>
+    void reset(F&& update) {
+        T& spare = acquire_spare();
+        update(spare);
+        publish(spare);
+        spare_outdated = true;
+    }
+};
+
+#endif // FQWB_EPOCH_H
@@ -0,0 +1,205 @@
+// fqwb_fuzzy.cpp - 反切五笔输入法模糊音索引实现文件
+
+#include "fqwb_fuzzy.h"
+#include "fqwb_dict.h"
+#include <algorithm>
+
+// fuzzy_rules 类实现
+fuzzy_rules::fuzzy_rules() : max_length(0) {
+}
+
+fuzzy_rules fuzzy_rules::default_rules() {
+    fuzzy_rules rules;
+
+    // 平翘舌音模糊
+    rules.add_rule(L"z", L"zh");
+    rules.add_rule(L"c", L"ch");
+    rules.add_rule(L"s", L"sh");
+
+    // 前后鼻音模糊
+    rules.add_rule(L"an", L"ang");
+    rules.add_rule(L"en", L"eng");
+    rules.add_rule(L"in", L"ing");
+
+    // 其他常见模糊音
+    rules.add_rule(L"l", L"n");
+    rules.add_rule(L"f", L"h");
+
+    // 尖团音模糊
+    rules.add_rule(L"j", L"z");
+    rules.add_rule(L"q", L"c");
+    rules.add_rule(L"x", L"s");
+
+    return rules;
+}
+
+void fuzzy_rules::add_rule(const std::wstring& a, const std::wstring& b) {
+    if (a.empty() || b.empty() || a == b) {
+        return;
+    }
+    pairs.emplace_back(a, b);
+    rebuild();
+}
+
+void fuzzy_rules::clear() {
+    pairs.clear();
+    canonical.clear();
+    max_length = 0;
+}
+
+bool fuzzy_rules::empty() const {
+    return canonical.empty();
+}
+
+void fuzzy_rules::rebuild() {
+    // 并查集合并等价片段
+    std::map<std::wstring, std::wstring> parent;
+    auto find_root = [&parent](std::wstring node) {
+        while (parent[node] != node) {
+            node = parent[node];
+        }
+        return node;
+    };
+
+    for (const auto& pair : pairs) {
+        parent.emplace(pair.first, pair.first);
+        parent.emplace(pair.second, pair.second);
+    }
+
+    for (const auto& pair : pairs) {
+        std::wstring a = find_root(pair.first);
+        std::wstring b = find_root(pair.second);
+        if (a == b) {
+            continue;
+        }
+
+        // 以较短（其次字典序较小）的片段为根，根即为组代表
+        if (b.size() < a.size() || (b.size() == a.size() && b < a)) {
+            std::swap(a, b);
+        }
+        parent[b] = a;
+    }
+
+    canonical.clear();
+    max_length = 0;
+    for (const auto& node : parent) {
+        canonical[node.first] = find_root(node.first);
+        max_length = std::max(max_length, node.first.size());
+    }
+}
+
+void fuzzy_rules::canonicalize(std::wstring_view code, std::wstring& key) const {
+    key.clear();
+
+    size_t pos = 0;
+    while (pos < code.size()) {
+        // 优先匹配最长的片段，如ang优先于an
+        size_t length = std::min(max_length, code.size() - pos);
+        for (; length > 0; length--) {
+            auto it = canonical.find(code.substr(pos, length));
+            if (it != canonical.end()) {
+                key += it->second;
+                break;
+            }
+        }
+
+        if (length == 0) {
+            key += code[pos];
+            length = 1;
+        }
+        pos += length;
+    }
+}
+
+// fuzzy_index 类实现
+std::wstring_view fuzzy_index::get_key(const entry& item) const {
+    return std::wstring_view(key_pool.data() + item.key_offset, item.key_length);
+}
+
+bool fuzzy_index::build(const compiled_dictionary& dict, const fuzzy_rules& rules) {
+    try {
+        size_t count = dict.get_code_count();
+        key_pool.clear();
+        entries.clear();
+        entries.reserve(count);
+
+        std::wstring key;
+        for (size_t i = 0; i < count; i++) {
+            rules.canonicalize(dict.get_code(i), key);
+            entries.push_back(entry{ static_cast<uint32_t>(key_pool.size()), static_cast<uint32_t>(key.size()), static_cast<uint32_t>(i) });
+            key_pool.insert(key_pool.end(), key.begin(), key.end());
+        }
+
+        std::sort(entries.begin(), entries.end(), [this](const entry& a, const entry& b) {
+            int result = get_key(a).compare(get_key(b));
+            return result != 0 ? result < 0 : a.code_index < b.code_index;
+        });
+        return true;
+    }
+    catch (...) {
+        key_pool.clear();
+        entries.clear();
+        return false;
+    }
+}
+
+void fuzzy_index::find(std::wstring_view key, size_t& first, size_t& last) const {
+    auto lower = std::lower_bound(entries.begin(), entries.end(), key, [this](const entry& a, std::wstring_view b) {
+        return get_key(a) < b;
+    });
+    auto upper = std::upper_bound(lower, entries.end(), key, [this](std::wstring_view a, const entry& b) {
+        return a < get_key(b);
+    });
+    first = static_cast<size_t>(lower - entries.begin());
+    last = static_cast<size_t>(upper - entries.begin());
+}
+
+bool fuzzy_index::has_prefix(std::wstring_view key_prefix) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), key_prefix, [this](const entry& a, std::wstring_view b) {
+        return get_key(a) < b;
+    });
+    return it != entries.end() && get_key(*it).substr(0, key_prefix.size()) == key_prefix;
+}
+
+size_t fuzzy_index::get_code_index(size_t index) const {
+    return entries[index].code_index;
+}
+
+size_t fuzzy_index::size() const {
+    return entries.size();
+}
+
+void remove_duplicate_candidates(std::vector<std::wstring_view>& candidates, size_t first, dedup_buffer& buffer) {
+    if (candidates.size() <= first || candidates.size() < 2) {
+        return;
+    }
+
+    // 按内容排序，内容相同时原始位置小的在前
+    buffer.sorted.clear();
+    for (size_t i = 0; i < candidates.size(); i++) {
+        buffer.sorted.emplace_back(candidates[i], static_cast<uint32_t>(i));
+    }
+    std::sort(buffer.sorted.begin(), buffer.sorted.end());
+
+    // 每组相同内容只保留首次出现的位置，first之前的位置总是保留
+    buffer.keep.assign(candidates.size(), 1);
+    bool has_duplicate = false;
+    for (size_t i = 1; i < buffer.sorted.size(); i++) {
+        if (buffer.sorted[i].first == buffer.sorted[i - 1].first && buffer.sorted[i].second >= first) {
+            buffer.keep[buffer.sorted[i].second] = 0;
+            has_duplicate = true;
+        }
+    }
+
+    if (!has_duplicate) {
+        return;
+    }
+
+    size_t out = first;
+    for (size_t i = first; i < candidates.size(); i++) {
+        if (buffer.keep[i]) {
+            candidates[out++] = candidates[i];
+        }
+    }
+    candidates.resize(out);
+}
@@ -0,0 +1,90 @@
+// fqwb_fuzzy.h - 反切五笔输入法模糊音索引
+// 加载词库时将每个编码映射为规范模糊键，模糊查询只需在索引中查找一次
+
+#ifndef FQWB_FUZZY_H
+#define FQWB_FUZZY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class compiled_dictionary;
+
+// 模糊音规则
+// 规则是成组的等价片段（如z与zh、an与ang），等价关系可传递，每组以最短（其次字典序最小）的片段为代表
+class fuzzy_rules {
+private:
+    std::vector<std::pair<std::wstring, std::wstring>> pairs;       // 用户设置的等价片段对
+    std::map<std::wstring, std::wstring, std::less<>> canonical;    // 片段到其所在组代表的映射
+    size_t max_length;                                              // 最长片段长度
+
+    // 由等价片段对重新计算各组代表
+    void rebuild();
+
+public:
+    fuzzy_rules();
+
+    // 默认规则：与fuzzy_sound.fs中的默认模糊音表相同（平翘舌、前后鼻音、l/n、f/h、尖团音）
+    static fuzzy_rules default_rules();
+
+    // 添加一对等价片段
+    void add_rule(const std::wstring& a, const std::wstring& b);
+
+    // 清除所有规则
+    void clear();
+
+    // 是否没有任何规则
+    bool empty() const;
+
+    // 计算编码的规范模糊键：从左到右按最长匹配把片段替换为所在组的代表，结果写入key（复用其容量）
+    void canonicalize(std::wstring_view code, std::wstring& key) const;
+};
+
+// 模糊音索引：按规范模糊键排序的(模糊键, 编码下标)表，为一个词库和一组规则构建
+class fuzzy_index {
+private:
+    // 索引项
+    struct entry {
+        uint32_t key_offset; // 模糊键在字符池中的偏移
+        uint32_t key_length; // 模糊键长度
+        uint32_t code_index; // 编码在词库编码表中的下标
+    };
+
+    std::vector<wchar_t> key_pool; // 模糊键字符池
+    std::vector<entry> entries;    // 按模糊键排序的索引项，模糊键相同时按编码下标排序
+
+    // 获取索引项的模糊键
+    std::wstring_view get_key(const entry& item) const;
+
+public:
+    // 为词库中的所有编码构建索引
+    bool build(const compiled_dictionary& dict, const fuzzy_rules& rules);
+
+    // 查找模糊键等于key的索引项范围[first, last)
+    void find(std::wstring_view key, size_t& first, size_t& last) const;
+
+    // 是否存在以key_prefix开头的模糊键
+    bool has_prefix(std::wstring_view key_prefix) const;
+
+    // 获取索引项对应的编码下标
+    size_t get_code_index(size_t index) const;
+
+    // 获取索引项数量
+    size_t size() const;
+};
+
+// 候选词去重的工作缓冲区，由调用方持有并在多次去重之间复用
+struct dedup_buffer {
+    std::vector<std::pair<std::wstring_view, uint32_t>> sorted; // 按内容排序的(候选词, 原始位置)
+    std::vector<char> keep;                                      // 各位置是否保留
+};
+
+// 去除候选词列表中[first, end)范围内与之前内容相同的候选词，保留首次出现的位置和原有顺序，O(k log k)
+void remove_duplicate_candidates(std::vector<std::wstring_view>& candidates, size_t first, dedup_buffer& buffer);
+
+#endif // FQWB_FUZZY_H
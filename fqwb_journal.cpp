@@ -0,0 +1,368 @@
+// fqwb_journal.cpp - 反切五笔输入法用户词库日志实现文件
+
+#include "fqwb_journal.h"
+#include "fqwb_dict.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace {
+
+const char USER_JOURNAL_MAGIC[4] = { 'F', 'Q', 'W', 'J' };
+
+// 日志文件头
+struct journal_header {
+    char magic[4];      // 文件标识 "FQWJ"
+    uint32_t version;   // 格式版本
+    uint32_t char_size; // 字符宽度（sizeof(wchar_t)）
+    uint32_t reserved;  // 保留字段
+};
+
+// 记录头，其后紧跟payload_size字节的载荷
+struct journal_record_header {
+    uint32_t payload_size; // 载荷长度
+    uint32_t crc;          // 载荷CRC32
+};
+
+// 载荷头，其后紧跟编码和词条字符
+struct journal_payload_header {
+    uint16_t op;          // 操作
+    uint16_t code_length; // 编码长度（字符数）
+    uint32_t text_length; // 词条长度（字符数）
+};
+
+// CRC32查找表
+struct crc32_table {
+    uint32_t values[256];
+
+    crc32_table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            values[i] = c;
+        }
+    }
+};
+
+uint32_t crc32(const char* data, size_t size) {
+    static const crc32_table table;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table.values[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+} // namespace
+
+// user_journal 类实现
+user_journal::user_journal() : file_size(0), record_count(0), compact_records(DEFAULT_JOURNAL_COMPACT_RECORDS), compacting(false) {
+}
+
+user_journal::~user_journal() {
+    close();
+}
+
+void user_journal::encode_record(journal_op op, std::wstring_view code, std::wstring_view characters, std::vector<char>& buffer) const {
+    size_t payload_size = sizeof(journal_payload_header) + (code.size() + characters.size()) * sizeof(wchar_t);
+    buffer.resize(sizeof(journal_record_header) + payload_size);
+
+    char* payload = buffer.data() + sizeof(journal_record_header);
+    journal_payload_header payload_header = { static_cast<uint16_t>(op), static_cast<uint16_t>(code.size()), static_cast<uint32_t>(characters.size()) };
+    memcpy(payload, &payload_header, sizeof(payload_header));
+    std::copy(code.begin(), code.end(), reinterpret_cast<wchar_t*>(payload + sizeof(payload_header)));
+    std::copy(characters.begin(), characters.end(), reinterpret_cast<wchar_t*>(payload + sizeof(payload_header)) + code.size());
+
+    journal_record_header record_header = { static_cast<uint32_t>(payload_size), crc32(payload, payload_size) };
+    memcpy(buffer.data(), &record_header, sizeof(record_header));
+}
+
+bool user_journal::write_header(std::ofstream& stream) {
+    journal_header header;
+    memcpy(header.magic, USER_JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = USER_JOURNAL_VERSION;
+    header.char_size = sizeof(wchar_t);
+    header.reserved = 0;
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return !stream.fail();
+}
+
+bool user_journal::open(const std::wstring& path, const replay_callback& replay) {
+    close();
+
+    try {
+        file_path = path;
+        file_size = 0;
+        record_count = 0;
+
+        // 一次读入整个日志再回放
+        std::vector<char> data;
+        {
+            std::ifstream input(native_path(path), std::ios::binary | std::ios::ate);
+            if (input.is_open()) {
+                std::streamoff size = input.tellg();
+                if (size > 0) {
+                    data.resize(static_cast<size_t>(size));
+                    input.seekg(0);
+                    if (!input.read(data.data(), size)) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        if (data.empty()) {
+            // 新建空日志
+            std::ofstream output(native_path(path), std::ios::binary | std::ios::trunc);
+            if (!output.is_open() || !write_header(output)) {
+                return false;
+            }
+            file_size = sizeof(journal_header);
+        } else {
+            // 文件头不符时不改动文件，避免覆盖用户数据
+            journal_header header;
+            if (data.size() < sizeof(header)) {
+                return false;
+            }
+            memcpy(&header, data.data(), sizeof(header));
+            if (memcmp(header.magic, USER_JOURNAL_MAGIC, sizeof(USER_JOURNAL_MAGIC)) != 0 ||
+                header.version != USER_JOURNAL_VERSION || header.char_size != sizeof(wchar_t)) {
+                return false;
+            }
+
+            size_t offset = sizeof(header);
+            while (offset + sizeof(journal_record_header) <= data.size()) {
+                journal_record_header record_header;
+                memcpy(&record_header, data.data() + offset, sizeof(record_header));
+
+                // 长度越界或校验不符：崩溃时未写完的记录，丢弃其后的全部内容
+                const char* payload = data.data() + offset + sizeof(record_header);
+                if (record_header.payload_size < sizeof(journal_payload_header) ||
+                    record_header.payload_size > data.size() - offset - sizeof(record_header) ||
+                    crc32(payload, record_header.payload_size) != record_header.crc) {
+                    break;
+                }
+
+                journal_payload_header payload_header;
+                memcpy(&payload_header, payload, sizeof(payload_header));
+                if (sizeof(payload_header) + (static_cast<size_t>(payload_header.code_length) + payload_header.text_length) * sizeof(wchar_t) != record_header.payload_size) {
+                    break;
+                }
+
+                // 记录长度都是字符宽度的整数倍，载荷中的字符保持对齐
+                const wchar_t* chars = reinterpret_cast<const wchar_t*>(payload + sizeof(payload_header));
+                replay(static_cast<journal_op>(payload_header.op),
+                    std::wstring_view(chars, payload_header.code_length),
+                    std::wstring_view(chars + payload_header.code_length, payload_header.text_length));
+
+                offset += sizeof(record_header) + record_header.payload_size;
+                record_count++;
+            }
+
+            // 截掉不完整的末尾记录，之后追加的记录才能被正确回放
+            if (offset < data.size()) {
+                std::error_code error;
+                std::filesystem::resize_file(std::filesystem::path(native_path(path)), offset, error);
+                if (error) {
+                    return false;
+                }
+            }
+            file_size = offset;
+        }
+
+        file.open(native_path(path), std::ios::binary | std::ios::app);
+        return file.is_open();
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+bool user_journal::append(journal_op op, std::wstring_view code, std::wstring_view characters) {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    try {
+        // 整条记录一次顺序写入
+        encode_record(op, code, characters, record_buffer);
+        file.write(record_buffer.data(), static_cast<std::streamsize>(record_buffer.size()));
+        file.flush();
+        if (file.fail()) {
+            return false;
+        }
+
+        file_size += record_buffer.size();
+        record_count++;
+        return true;
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+bool user_journal::append_batch(journal_op op, const snapshot& entries) {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    try {
+        // 记录依次写入文件缓冲区，最后刷新一次；中途崩溃时回放到最后一条完整的记录为止
+        for (const auto& entry : entries) {
+            encode_record(op, entry.first, entry.second, record_buffer);
+            file.write(record_buffer.data(), static_cast<std::streamsize>(record_buffer.size()));
+            if (file.fail()) {
+                return false;
+            }
+            file_size += record_buffer.size();
+            record_count++;
+        }
+        file.flush();
+        return !file.fail();
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+bool user_journal::flush() {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.flush();
+    return !file.fail();
+}
+
+bool user_journal::should_compact(size_t live_records) {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    return !compacting && record_count > compact_records && record_count > live_records * 2;
+}
+
+bool user_journal::compact(snapshot&& entries) {
+    if (compacting) {
+        return false;
+    }
+
+    // 回收上一次已结束的压缩线程
+    if (compact_thread.joinable()) {
+        compact_thread.join();
+    }
+
+    uint64_t snapshot_size = 0;
+    size_t snapshot_records = 0;
+    {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        if (!file.is_open()) {
+            return false;
+        }
+        snapshot_size = file_size;
+        snapshot_records = record_count;
+    }
+
+    compacting = true;
+    compact_thread = std::thread(&user_journal::compact_worker, this, std::move(entries), snapshot_size, snapshot_records);
+    return true;
+}
+
+// 后台压缩线程
+void user_journal::compact_worker(snapshot entries, uint64_t snapshot_size, size_t snapshot_records) {
+#ifdef _WIN32
+    // 压缩不与输入线程争抢CPU
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#endif
+
+    std::wstring temp_path = file_path + L".tmp";
+
+    try {
+        // 先在临时文件中写出快照，这一步不影响继续追加
+        std::ofstream output(native_path(temp_path), std::ios::binary | std::ios::trunc);
+        if (!output.is_open() || !write_header(output)) {
+            compacting = false;
+            return;
+        }
+
+        std::vector<char> buffer;
+        uint64_t output_size = sizeof(journal_header);
+        for (const auto& entry : entries) {
+            encode_record(journal_op::add_word, entry.first, entry.second, buffer);
+            output.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            output_size += buffer.size();
+        }
+
+        std::lock_guard<std::mutex> lock(file_mutex);
+
+        // 接上快照之后追加的记录
+        uint64_t tail_size = file_size - snapshot_size;
+        if (tail_size > 0) {
+            file.flush();
+            std::ifstream input(native_path(file_path), std::ios::binary);
+            input.seekg(static_cast<std::streamoff>(snapshot_size));
+            buffer.resize(static_cast<size_t>(tail_size));
+            if (!input.read(buffer.data(), static_cast<std::streamsize>(tail_size))) {
+                output.close();
+                std::filesystem::remove(std::filesystem::path(native_path(temp_path)));
+                compacting = false;
+                return;
+            }
+            output.write(buffer.data(), static_cast<std::streamsize>(tail_size));
+            output_size += tail_size;
+        }
+
+        output.close();
+        if (output.fail()) {
+            std::filesystem::remove(std::filesystem::path(native_path(temp_path)));
+            compacting = false;
+            return;
+        }
+
+        // 原子替换日志文件，替换失败时继续使用原日志
+        file.close();
+        std::error_code error;
+        std::filesystem::rename(std::filesystem::path(native_path(temp_path)), std::filesystem::path(native_path(file_path)), error);
+        if (!error) {
+            record_count = entries.size() + (record_count - snapshot_records);
+            file_size = output_size;
+        } else {
+            std::filesystem::remove(std::filesystem::path(native_path(temp_path)), error);
+        }
+        file.open(native_path(file_path), std::ios::binary | std::ios::app);
+    }
+    catch (...) {
+    }
+
+    compacting = false;
+}
+
+void user_journal::close() {
+    if (compact_thread.joinable()) {
+        compact_thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+void user_journal::set_compact_threshold(size_t records) {
+    compact_records = records;
+}
+
+size_t user_journal::get_record_count() {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    return record_count;
+}
+
+uint64_t user_journal::get_file_size() {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    return file_size;
+}
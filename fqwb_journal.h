@@ -0,0 +1,104 @@
+// fqwb_journal.h - 反切五笔输入法用户词库日志
+// 用户词库以只追加日志保存：每次加词只顺序写入一条记录，日志过长时在后台压缩
+
+#ifndef FQWB_JOURNAL_H
+#define FQWB_JOURNAL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// 用户词库日志文件名
+#define FQWB_USER_JOURNAL_FILE_NAME L"user_dict.journal"
+
+// 用户词库日志格式版本
+const uint32_t USER_JOURNAL_VERSION = 1;
+
+// 默认压缩阈值：日志记录数超过该值且超过有效词条数的两倍时压缩
+const size_t DEFAULT_JOURNAL_COMPACT_RECORDS = 4096;
+
+// 日志操作
+enum class journal_op : uint16_t {
+    add_word = 1, // 添加词条
+    clear = 2     // 清除全部词条
+};
+
+// 用户词库日志
+// 文件布局：文件头 | 记录 | 记录 | ...
+// 每条记录为：载荷长度 | 载荷CRC32 | 操作 | 编码长度 | 词条长度 | 编码 | 词条
+// 回放时遇到长度或校验不符的记录（崩溃时写了一半的末尾记录）即停止，并截掉该记录
+class user_journal {
+public:
+    // 回放回调：依次收到每条有效记录
+    typedef std::function<void(journal_op op, std::wstring_view code, std::wstring_view characters)> replay_callback;
+
+    // 压缩快照：当前全部有效的(编码, 词条)
+    typedef std::vector<std::pair<std::wstring, std::wstring>> snapshot;
+
+private:
+    std::wstring file_path;          // 日志文件路径
+    std::ofstream file;              // 以追加方式打开的日志文件
+    std::vector<char> record_buffer; // 组装单条记录的缓冲区，保证每条记录一次写入
+    uint64_t file_size;              // 日志文件长度
+    size_t record_count;             // 日志中的记录数
+    size_t compact_records;          // 压缩阈值（记录数）
+    std::mutex file_mutex;           // 保护日志文件，压缩线程替换文件时与追加互斥
+    std::thread compact_thread;      // 后台压缩线程
+    std::atomic<bool> compacting;    // 是否正在压缩
+
+    // 组装一条记录到缓冲区
+    void encode_record(journal_op op, std::wstring_view code, std::wstring_view characters, std::vector<char>& buffer) const;
+
+    // 写入文件头
+    static bool write_header(std::ofstream& stream);
+
+    // 后台压缩：写出快照，再接上快照之后追加的记录，最后原子替换日志文件
+    void compact_worker(snapshot entries, uint64_t snapshot_size, size_t snapshot_records);
+
+public:
+    user_journal();
+    ~user_journal();
+
+    user_journal(const user_journal&) = delete;
+    user_journal& operator=(const user_journal&) = delete;
+
+    // 打开日志并回放其中的记录，文件不存在时创建空日志
+    bool open(const std::wstring& path, const replay_callback& replay);
+
+    // 追加一条记录
+    bool append(journal_op op, std::wstring_view code, std::wstring_view characters);
+
+    // 追加多条同一操作的记录，全部写入后只刷新一次（用于批量导入）
+    bool append_batch(journal_op op, const snapshot& entries);
+
+    // 将已追加的记录写入磁盘
+    bool flush();
+
+    // 日志记录数是否已超过压缩阈值（live_records为当前有效词条数）
+    bool should_compact(size_t live_records);
+
+    // 在后台线程中以快照重写日志，上一次压缩尚未结束时返回false
+    bool compact(snapshot&& entries);
+
+    // 等待后台压缩结束并关闭日志
+    void close();
+
+    // 设置压缩阈值（记录数）
+    void set_compact_threshold(size_t records);
+
+    // 获取日志记录数
+    size_t get_record_count();
+
+    // 获取日志文件长度
+    uint64_t get_file_size();
+};
+
+#endif // FQWB_JOURNAL_H
@@ -0,0 +1,144 @@
+// fqwb_lattice.cpp - 反切五笔输入法连续输入分段实现文件
+
+#include "fqwb_lattice.h"
+#include <algorithm>
+
+namespace {
+
+// 一段编码的默认最大长度（五笔编码最长四码）
+const size_t DEFAULT_SEGMENT_LENGTH = 4;
+
+// 预留的编码串长度，常规输入在预热后不再分配内存
+const size_t RESERVED_CODE_LENGTH = 64;
+
+} // namespace
+
+// sentence_lattice 类实现
+sentence_lattice::sentence_lattice() : max_sentences(DEFAULT_SENTENCE_COUNT), max_segment_length(DEFAULT_SEGMENT_LENGTH) {
+    code.reserve(RESERVED_CODE_LENGTH);
+    pending.reserve(RESERVED_CODE_LENGTH);
+    segment_code.reserve(DEFAULT_SEGMENT_LENGTH);
+    clear();
+}
+
+void sentence_lattice::set_limits(size_t sentences, size_t segment_length) {
+    max_sentences = std::max<size_t>(sentences, 1);
+    max_segment_length = std::max<size_t>(segment_length, 1);
+}
+
+void sentence_lattice::clear() {
+    code.clear();
+
+    // 第0列为空路径
+    if (columns.empty()) {
+        columns.resize(1);
+    }
+    columns[0].assign(1, path{ 0, 0, 0, std::wstring_view() });
+}
+
+void sentence_lattice::insert_path(std::vector<path>& column, const path& item) const {
+    if (column.size() >= max_sentences && item.score <= column.back().score) {
+        return;
+    }
+
+    size_t pos = column.size();
+    while (pos > 0 && column[pos - 1].score < item.score) {
+        pos--;
+    }
+    if (column.size() >= max_sentences) {
+        column.pop_back();
+    }
+    column.insert(column.begin() + pos, item);
+}
+
+void sentence_lattice::push(wchar_t c, const segment_lookup& lookup) {
+    code += c;
+    size_t end = code.size();
+    if (columns.size() <= end) {
+        columns.resize(end + 1);
+    }
+    std::vector<path>& column = columns[end];
+    column.clear();
+
+    // 以新字符结尾的每一段接在其起点一列的各条路径之后；短的最后一段先加入，得分相同时排在前面
+    for (size_t length = 1; length <= max_segment_length && length <= end; length++) {
+        size_t start = end - length;
+        const std::vector<path>& previous = columns[start];
+        if (previous.empty()) {
+            continue;
+        }
+
+        segment_code.assign(code, start, length);
+        phrases.clear();
+        lookup(segment_code, phrases);
+        size_t phrase_count = std::min(phrases.size(), SEGMENT_CANDIDATES);
+        for (size_t rank = 0; rank < phrase_count; rank++) {
+            int32_t segment_score = -SEGMENT_COST - RANK_COST * static_cast<int32_t>(rank);
+
+            // 前一列按得分排列，某条路径接上后已进不了本列时，其后的路径也不能
+            for (size_t p = 0; p < previous.size(); p++) {
+                path item = { previous[p].score + segment_score, static_cast<uint32_t>(start), static_cast<uint32_t>(p), phrases[rank] };
+                if (column.size() >= max_sentences && item.score <= column.back().score) {
+                    break;
+                }
+                insert_path(column, item);
+            }
+        }
+    }
+}
+
+bool sentence_lattice::pop() {
+    if (code.empty()) {
+        return false;
+    }
+    code.pop_back();
+    return true;
+}
+
+void sentence_lattice::assign(std::wstring_view text, const segment_lookup& lookup) {
+    // text可能指向当前编码串，先复制
+    pending.assign(text);
+    clear();
+    for (wchar_t c : pending) {
+        push(c, lookup);
+    }
+}
+
+const std::wstring& sentence_lattice::get_code() const {
+    return code;
+}
+
+size_t sentence_lattice::get_segmented_length() const {
+    for (size_t length = code.size(); length > 0; length--) {
+        if (!columns[length].empty()) {
+            return length;
+        }
+    }
+    return 0;
+}
+
+size_t sentence_lattice::get_sentence_count(size_t length) const {
+    return length > 0 && length <= code.size() ? columns[length].size() : 0;
+}
+
+void sentence_lattice::get_sentence(size_t length, size_t rank, std::wstring& text, std::vector<sentence_segment>& segments) const {
+    text.clear();
+    segments.clear();
+    if (rank >= get_sentence_count(length)) {
+        return;
+    }
+
+    // 从最后一段沿前一段回溯到第0列
+    size_t end = length;
+    size_t index = rank;
+    while (end > 0) {
+        const path& item = columns[end][index];
+        segments.push_back(sentence_segment{ item.start, end, item.phrase });
+        end = item.start;
+        index = item.prev;
+    }
+    std::reverse(segments.begin(), segments.end());
+    for (const sentence_segment& segment : segments) {
+        text.append(segment.phrase.data(), segment.phrase.size());
+    }
+}
@@ -0,0 +1,90 @@
+// fqwb_lattice.h - 反切五笔输入法连续输入分段
+// 把任意长度的编码串切分为词库中的编码，在分段网格上动态规划求出得分最高的N个整句
+
+#ifndef FQWB_LATTICE_H
+#define FQWB_LATTICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 分段查询：把编码完全匹配的词条按优先顺序写入result（复用其容量）
+typedef std::function<void(const std::wstring& code, std::vector<std::wstring_view>& result)> segment_lookup;
+
+// 默认保留的整句数量
+const size_t DEFAULT_SENTENCE_COUNT = 5;
+
+// 每段最多取用的候选词数量
+const size_t SEGMENT_CANDIDATES = 3;
+
+// 分段得分：每多一段扣SEGMENT_COST，所选候选词每靠后一位扣RANK_COST
+// RANK_COST * SEGMENT_CANDIDATES小于SEGMENT_COST，段数少的整句总是排在前面，段数相同时所选候选词越靠前越好
+const int32_t SEGMENT_COST = 10;
+const int32_t RANK_COST = 1;
+
+// 整句中的一段：编码串中[start, end)对应的词条
+struct sentence_segment {
+    size_t start;
+    size_t end;
+    std::wstring_view phrase;
+};
+
+// 编码串的分段网格
+// 第j列保存覆盖编码串前j个字符、得分最高的N条路径，每条路径只记录最后一段和前一段所在的路径
+// 追加一个字符只计算新的一列（以该字符结尾的各长度的分段各查询一次），退格只丢弃最后一列
+class sentence_lattice {
+private:
+    // 一条路径的最后一段
+    struct path {
+        int32_t score;            // 整条路径的得分
+        uint32_t start;           // 最后一段的起点，即前一段所在的列
+        uint32_t prev;            // 前一段所在的路径在该列中的下标
+        std::wstring_view phrase; // 最后一段的词条
+    };
+
+    std::wstring code;                      // 编码串
+    std::vector<std::vector<path>> columns; // columns[j]为覆盖前j个字符的路径（按得分从高到低），只有前code.size() + 1列有效，其余保留容量
+    size_t max_sentences;                   // 每列保留的路径数量
+    size_t max_segment_length;              // 一段编码的最大长度
+    std::wstring segment_code;              // 查询中的分段编码
+    std::wstring pending;                   // 重建网格时的编码串
+    std::vector<std::wstring_view> phrases; // 分段查询结果
+
+    // 把路径按得分插入列中，得分相同时先加入的在前，超出保留数量的丢弃
+    void insert_path(std::vector<path>& column, const path& item) const;
+
+public:
+    sentence_lattice();
+
+    // 设置每列保留的路径数量和一段编码的最大长度（下次重建网格时生效）
+    void set_limits(size_t sentences, size_t segment_length);
+
+    // 清空编码串（保留已分配的缓存）
+    void clear();
+
+    // 追加一个字符，计算新的一列
+    void push(wchar_t c, const segment_lookup& lookup);
+
+    // 删除最后一个字符，编码串已为空时返回false
+    bool pop();
+
+    // 按新的编码串重建网格（词库变化或上屏一部分之后）
+    void assign(std::wstring_view text, const segment_lookup& lookup);
+
+    // 获取编码串
+    const std::wstring& get_code() const;
+
+    // 能够完整切分的最长前缀的长度，没有时返回0
+    size_t get_segmented_length() const;
+
+    // 覆盖前length个字符的整句数量
+    size_t get_sentence_count(size_t length) const;
+
+    // 获取覆盖前length个字符的第rank个整句：text为整句（复用其容量），segments为按顺序排列的各段
+    void get_sentence(size_t length, size_t rank, std::wstring& text, std::vector<sentence_segment>& segments) const;
+};
+
+#endif // FQWB_LATTICE_H
@@ -0,0 +1,325 @@
+// fqwb_replay.cpp - 反切五笔输入法按键轨迹回放工具
+// 在不含TSF的输入法核心上回放按键轨迹，按按键类别统计处理延迟的分位数，并核对上屏结果是否与记录一致
+// 用法：fqwb_replay <轨迹文件.fqwt> [--data 词库目录] [--speed full|original] [--json 结果.json]
+
+#include "fqwb_tsf.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// 按键类别
+enum key_class {
+    key_letter,    // 字母键（输入编码）
+    key_select,    // 数字键或界面选择候选词
+    key_backspace, // 退格键
+    key_page,      // 翻页键
+    key_commit,    // 空格键和回车键
+    key_other,     // 其他按键
+    key_class_count
+};
+
+const char* const KEY_CLASS_NAMES[key_class_count] = {
+    "letter", "select", "backspace", "page", "commit", "other"
+};
+
+// 按虚拟键码划分按键类别
+key_class classify_key(UINT key_code) {
+    if (key_code >= 'A' && key_code <= 'Z') {
+        return key_letter;
+    }
+    if (key_code >= '1' && key_code <= '9') {
+        return key_select;
+    }
+    if (key_code == VK_BACK) {
+        return key_backspace;
+    }
+    if (key_code == VK_PRIOR || key_code == VK_NEXT) {
+        return key_page;
+    }
+    if (key_code == VK_SPACE || key_code == VK_RETURN) {
+        return key_commit;
+    }
+    return key_other;
+}
+
+// 一类按键的延迟统计（纳秒）
+struct latency_summary {
+    size_t count;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+// 按最近秩法计算分位数，samples需已排序
+double percentile(const std::vector<double>& samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(p / 100.0 * samples.size() + 0.999999);
+    return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+latency_summary summarize(std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    latency_summary summary;
+    summary.count = samples.size();
+    summary.p50 = percentile(samples, 50);
+    summary.p90 = percentile(samples, 90);
+    summary.p99 = percentile(samples, 99);
+    summary.max = samples.empty() ? 0.0 : samples.back();
+    return summary;
+}
+
+// 将宽字符串转换为UTF-8字符串
+std::string to_utf8(const std::wstring& text) {
+    std::string result;
+    for (wchar_t wc : text) {
+        uint32_t c = static_cast<uint32_t>(wc);
+        if (c < 0x80) {
+            result += static_cast<char>(c);
+        } else if (c < 0x800) {
+            result += static_cast<char>(0xC0 | (c >> 6));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            result += static_cast<char>(0xE0 | (c >> 12));
+            result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        } else {
+            result += static_cast<char>(0xF0 | (c >> 18));
+            result += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+    return result;
+}
+
+// 取出轨迹中的全部上屏字符串
+void collect_commits(const std::vector<key_trace_record>& records, std::vector<std::wstring>& commits) {
+    commits.clear();
+    for (const key_trace_record& record : records) {
+        if (record.type == key_trace_type::commit) {
+            commits.push_back(record.text);
+        }
+    }
+}
+
+// 以JSON格式写出回放结果
+bool write_json(const std::wstring& file_path, const std::wstring& trace_path, bool original_speed, size_t event_count,
+                const latency_summary* summaries, size_t expected_commits, size_t replayed_commits, bool output_matches,
+                const engine_stats_snapshot& stats) {
+    std::ofstream output(native_path(file_path), std::ios::binary | std::ios::trunc);
+    if (!output.is_open()) {
+        return false;
+    }
+
+    std::string trace_name = to_utf8(std::filesystem::path(native_path(trace_path)).filename().wstring());
+    std::string escaped;
+    for (char c : trace_name) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+
+    char line[512];
+    output << "{\n";
+    output << "  \"format_version\": 1,\n";
+    output << "  \"trace\": \"" << escaped << "\",\n";
+    output << "  \"speed\": \"" << (original_speed ? "original" : "full") << "\",\n";
+    snprintf(line, sizeof(line), "  \"events\": %zu,\n  \"commits_expected\": %zu,\n  \"commits_replayed\": %zu,\n  \"output_matches\": %s,\n",
+        event_count, expected_commits, replayed_commits, output_matches ? "true" : "false");
+    output << line;
+    output << "  \"latency_us\": {\n";
+    for (int i = 0; i < key_class_count; i++) {
+        const latency_summary& s = summaries[i];
+        snprintf(line, sizeof(line), "    \"%s\": {\"count\": %zu, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+            KEY_CLASS_NAMES[i], s.count, s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0, s.max / 1000.0, i + 1 < key_class_count ? "," : "");
+        output << line;
+    }
+    output << "  },\n";
+
+    // 回放期间输入法核心的运行统计
+    std::string stats_json = stats.to_json();
+    while (!stats_json.empty() && stats_json.back() == '\n') {
+        stats_json.pop_back();
+    }
+    output << "  \"engine_stats\": " << stats_json << "\n}\n";
+    output.close();
+    return !output.fail();
+}
+
+int run_replay(const std::vector<std::wstring>& args) {
+    std::wstring trace_path;
+    std::wstring data_dir = L"Data";
+    std::wstring json_path;
+    bool original_speed = false;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        bool has_value = i + 1 < args.size();
+        if (args[i] == L"--data" && has_value) {
+            data_dir = args[++i];
+        } else if (args[i] == L"--speed" && has_value && (args[i + 1] == L"full" || args[i + 1] == L"original")) {
+            original_speed = args[++i] == L"original";
+        } else if (args[i] == L"--json" && has_value) {
+            json_path = args[++i];
+        } else if (trace_path.empty() && args[i].compare(0, 2, L"--") != 0) {
+            trace_path = args[i];
+        } else {
+            trace_path.clear();
+            break;
+        }
+    }
+
+    if (trace_path.empty()) {
+        std::cerr << "用法: fqwb_replay <轨迹文件.fqwt> [--data 词库目录] [--speed full|original] [--json 结果.json]\n";
+        return 1;
+    }
+
+    std::vector<key_trace_record> records;
+    if (!read_key_trace(trace_path, records)) {
+        std::cerr << "读取轨迹文件失败: " << to_utf8(trace_path) << "\n";
+        return 1;
+    }
+
+    // 在词库目录的副本上回放，回放产生的用户词汇和使用频率不写回原目录
+    std::wstring work_dir = (std::filesystem::temp_directory_path() / "fqwb_replay").wstring();
+    std::error_code error;
+    std::filesystem::path work_path(native_path(work_dir));
+    std::filesystem::remove_all(work_path, error);
+    std::filesystem::create_directories(work_path, error);
+    std::filesystem::copy(std::filesystem::path(native_path(data_dir)), work_path,
+        std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing, error);
+    if (error) {
+        std::cerr << "复制词库目录失败: " << to_utf8(data_dir) << "\n";
+        return 1;
+    }
+
+    std::vector<std::wstring> expected_commits;
+    std::vector<std::wstring> replayed_commits;
+    engine_stats_snapshot stats;
+    std::vector<double> samples[key_class_count];
+    size_t event_count = 0;
+
+    {
+        fqwb_input_method input_method;
+        if (!input_method.initialize(work_dir)) {
+            std::cerr << "初始化输入法失败\n";
+            return 1;
+        }
+
+        // 回放时同样记录轨迹，上屏结果与原轨迹逐条比较
+        std::wstring replay_trace_path = work_dir + L"\\replay" FQWB_TRACE_FILE_EXT;
+        if (!input_method.start_trace(replay_trace_path)) {
+            std::cerr << "创建回放轨迹失败\n";
+            return 1;
+        }
+
+        // 运行统计只包含回放期间的数据
+        reset_engine_stats();
+
+        auto start_time = std::chrono::steady_clock::now();
+        for (const key_trace_record& record : records) {
+            if (record.type == key_trace_type::commit) {
+                continue;
+            }
+            event_count++;
+
+            // 按原速度回放时等到记录的时间再处理
+            if (original_speed) {
+                std::this_thread::sleep_until(start_time + std::chrono::microseconds(record.time_us));
+            }
+
+            if (record.type == key_trace_type::key) {
+                bool handled = false;
+                auto key_start = std::chrono::steady_clock::now();
+                input_method.process_key(record.value, record.is_down, record.shift, &handled);
+                double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - key_start).count();
+
+                // 只统计按下的按键，抬起的按键不做处理
+                if (record.is_down) {
+                    samples[classify_key(record.value)].push_back(elapsed_ns);
+                }
+            } else if (record.type == key_trace_type::select) {
+                auto select_start = std::chrono::steady_clock::now();
+                input_method.select_candidate(static_cast<int>(record.value));
+                samples[key_select].push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - select_start).count());
+            } else if (record.type == key_trace_type::clear) {
+                input_method.clear_input();
+            }
+        }
+
+        input_method.stop_trace();
+        stats = get_engine_stats();
+
+        std::vector<key_trace_record> replayed;
+        if (!read_key_trace(replay_trace_path, replayed)) {
+            std::cerr << "读取回放轨迹失败\n";
+            return 1;
+        }
+        collect_commits(records, expected_commits);
+        collect_commits(replayed, replayed_commits);
+    }
+
+    std::filesystem::remove_all(work_path, error);
+
+    // 输出各类按键的延迟分位数（微秒）
+    latency_summary summaries[key_class_count];
+    char line[256];
+    std::cout << "回放事件: " << event_count << (original_speed ? "（原速度）" : "（全速）") << "\n\n";
+    snprintf(line, sizeof(line), "%-10s %8s %10s %10s %10s %10s\n", "class", "count", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    std::cout << line;
+    for (int i = 0; i < key_class_count; i++) {
+        summaries[i] = summarize(samples[i]);
+        snprintf(line, sizeof(line), "%-10s %8zu %10.2f %10.2f %10.2f %10.2f\n", KEY_CLASS_NAMES[i], summaries[i].count,
+            summaries[i].p50 / 1000.0, summaries[i].p90 / 1000.0, summaries[i].p99 / 1000.0, summaries[i].max / 1000.0);
+        std::cout << line;
+    }
+
+    // 逐条核对上屏结果
+    bool output_matches = expected_commits == replayed_commits;
+    if (output_matches) {
+        std::cout << "\n上屏结果一致（" << expected_commits.size() << "条）\n";
+    } else {
+        size_t index = 0;
+        while (index < expected_commits.size() && index < replayed_commits.size() && expected_commits[index] == replayed_commits[index]) {
+            index++;
+        }
+        std::cout << "\n上屏结果不一致：记录" << expected_commits.size() << "条，回放" << replayed_commits.size() << "条，第" << (index + 1) << "条起不同\n";
+        std::cout << "  记录: " << (index < expected_commits.size() ? to_utf8(expected_commits[index]) : "（无）") << "\n";
+        std::cout << "  回放: " << (index < replayed_commits.size() ? to_utf8(replayed_commits[index]) : "（无）") << "\n";
+    }
+
+    if (!json_path.empty() && !write_json(json_path, trace_path, original_speed, event_count, summaries,
+                                          expected_commits.size(), replayed_commits.size(), output_matches, stats)) {
+        std::cerr << "写入结果文件失败\n";
+        return 1;
+    }
+    return output_matches ? 0 : 2;
+}
+
+} // namespace
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+    return run_replay(std::vector<std::wstring>(argv, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+    // 其他平台的命令行参数为UTF-8
+    std::vector<std::wstring> args;
+    for (int i = 0; i < argc; i++) {
+        args.push_back(std::filesystem::path(argv[i]).wstring());
+    }
+    return run_replay(args);
+}
+#endif
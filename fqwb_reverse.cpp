@@ -0,0 +1,136 @@
+// fqwb_reverse.cpp - 反切五笔输入法反查索引实现文件
+
+#include "fqwb_reverse.h"
+#include "fqwb_dict.h"
+#include <algorithm>
+
+namespace {
+
+// 取码字：在词组的前三个字和最后一个字中的位置，及所取的码数
+struct code_part {
+    size_t character;
+    size_t length;
+};
+
+const code_part TWO_CHAR_PARTS[] = { { 0, 2 }, { 1, 2 } };
+const code_part THREE_CHAR_PARTS[] = { { 0, 1 }, { 1, 1 }, { 2, 2 } };
+const code_part MULTI_CHAR_PARTS[] = { { 0, 1 }, { 1, 1 }, { 2, 1 }, { 3, 1 } };
+
+// 排序键：词条前三个字符（各加1，不足三个字符时记为0）组成的整数，与按字符串比较的顺序一致
+const size_t SORT_KEY_CHARS = 3;
+const unsigned SORT_KEY_BITS = 21;
+
+uint64_t get_sort_key(std::wstring_view phrase) {
+    uint64_t key = 0;
+    for (size_t i = 0; i < SORT_KEY_CHARS; i++) {
+        uint64_t digit = i < phrase.size() ? (static_cast<uint64_t>(phrase[i]) & 0x1FFFFF) + 1 : 0;
+        key = (key << SORT_KEY_BITS) | digit;
+    }
+    return key;
+}
+
+// 是否为UTF-16高代理项（wchar_t为16位的平台上，扩展区的字由两个wchar_t组成）
+bool is_high_surrogate(wchar_t c) {
+    return sizeof(wchar_t) == 2 && c >= 0xD800 && c <= 0xDBFF;
+}
+
+} // namespace
+
+// reverse_index 类实现
+bool reverse_index::build(const compiled_dictionary& dict) {
+    try {
+        size_t count = dict.get_phrase_count();
+        entries.clear();
+
+        // 先按前三个字符的整数键排序，只有键相同时才回到词条字符池比较，减少排序时的随机访问
+        std::vector<std::pair<uint64_t, uint32_t>> keyed;
+        keyed.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            keyed.emplace_back(get_sort_key(dict.get_phrase_at(i)), static_cast<uint32_t>(i));
+        }
+        std::sort(keyed.begin(), keyed.end(), [&dict](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+            if (a.first != b.first) {
+                return a.first < b.first;
+            }
+            int result = dict.get_phrase_at(a.second).compare(dict.get_phrase_at(b.second));
+            return result != 0 ? result < 0 : a.second < b.second;
+        });
+
+        entries.reserve(count);
+        block_keys.clear();
+        block_keys.reserve((count + REVERSE_INDEX_BLOCK - 1) / REVERSE_INDEX_BLOCK);
+        for (size_t i = 0; i < count; i++) {
+            entries.push_back(keyed[i].second);
+            if (i % REVERSE_INDEX_BLOCK == 0) {
+                block_keys.push_back(keyed[i].first);
+            }
+        }
+        return true;
+    }
+    catch (...) {
+        entries.clear();
+        block_keys.clear();
+        return false;
+    }
+}
+
+void reverse_index::find(const compiled_dictionary& dict, std::wstring_view phrase, size_t& first, size_t& last) const {
+    // 排序键与phrase相同的项只可能在第一个键不小于它的块的前一块，到第一个键大于它的块之间
+    uint64_t key = get_sort_key(phrase);
+    size_t first_block = static_cast<size_t>(std::lower_bound(block_keys.begin(), block_keys.end(), key) - block_keys.begin());
+    size_t last_block = static_cast<size_t>(std::upper_bound(block_keys.begin() + first_block, block_keys.end(), key) - block_keys.begin());
+    auto begin = entries.begin() + (first_block > 0 ? first_block - 1 : 0) * REVERSE_INDEX_BLOCK;
+    auto end = entries.begin() + std::min(last_block * REVERSE_INDEX_BLOCK, entries.size());
+
+    auto lower = std::lower_bound(begin, end, phrase, [&dict](uint32_t a, std::wstring_view b) {
+        return dict.get_phrase_at(a) < b;
+    });
+    // 一个词条通常只有一两个编码，顺序向后找到范围末尾
+    auto upper = lower;
+    while (upper != end && dict.get_phrase_at(*upper) == phrase) {
+        ++upper;
+    }
+    first = static_cast<size_t>(lower - entries.begin());
+    last = static_cast<size_t>(upper - entries.begin());
+}
+
+size_t reverse_index::get_code_index(const compiled_dictionary& dict, size_t index) const {
+    return dict.get_phrase_code(entries[index]);
+}
+
+size_t reverse_index::size() const {
+    return entries.size();
+}
+
+size_t reverse_index::memory_usage() const {
+    return entries.capacity() * sizeof(uint32_t) + block_keys.capacity() * sizeof(uint64_t);
+}
+
+bool make_wubi_phrase_code(std::wstring_view phrase, const char_code_lookup& get_char_code, std::wstring& code) {
+    code.clear();
+
+    // 取码只用到前三个字和最后一个字
+    std::wstring_view characters[4];
+    size_t count = 0;
+    for (size_t i = 0; i < phrase.size(); ) {
+        size_t length = i + 1 < phrase.size() && is_high_surrogate(phrase[i]) ? 2 : 1;
+        characters[count < 3 ? count : 3] = phrase.substr(i, length);
+        count++;
+        i += length;
+    }
+    if (count < 2) {
+        return false;
+    }
+
+    const code_part* parts = count == 2 ? TWO_CHAR_PARTS : (count == 3 ? THREE_CHAR_PARTS : MULTI_CHAR_PARTS);
+    size_t part_count = count < 4 ? count : 4;
+    for (size_t i = 0; i < part_count; i++) {
+        std::wstring_view char_code = get_char_code(characters[parts[i].character]);
+        if (char_code.size() < parts[i].length) {
+            code.clear();
+            return false;
+        }
+        code.append(char_code.substr(0, parts[i].length));
+    }
+    return true;
+}
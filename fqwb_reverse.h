@@ -0,0 +1,51 @@
+// fqwb_reverse.h - 反切五笔输入法反查索引
+// 由词条反查编码，并按五笔词组取码规则由各字的编码生成新词的编码
+
+#ifndef FQWB_REVERSE_H
+#define FQWB_REVERSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class compiled_dictionary;
+
+// 反查索引每块的索引项数
+const size_t REVERSE_INDEX_BLOCK = 64;
+
+// 反查索引：按词条排序的词条表下标，为一个词库构建，查询时从词库取出词条比较
+// 每个词条只占4字节，不复制词条字符串；另为每REVERSE_INDEX_BLOCK项记录一个排序键，查找时先在其中定位，
+// 只有最后几步二分查找需要访问词条字符池
+class reverse_index {
+private:
+    std::vector<uint32_t> entries;    // 按词条排序的词条表下标，词条相同时按下标（即编码顺序）排列
+    std::vector<uint64_t> block_keys; // 每块第一项的排序键（词条前三个字符）
+
+public:
+    // 为词库中的所有词条构建索引
+    bool build(const compiled_dictionary& dict);
+
+    // 查找词条等于phrase的索引项范围[first, last)，O(log n)
+    void find(const compiled_dictionary& dict, std::wstring_view phrase, size_t& first, size_t& last) const;
+
+    // 获取索引项对应的编码下标
+    size_t get_code_index(const compiled_dictionary& dict, size_t index) const;
+
+    // 获取索引项数量
+    size_t size() const;
+
+    // 获取索引占用的内存（字节）
+    size_t memory_usage() const;
+};
+
+// 获取单字的五笔全码，查不到时返回空
+typedef std::function<std::wstring_view(std::wstring_view character)> char_code_lookup;
+
+// 按五笔词组取码规则生成编码，结果写入code：二字词取各字前两码；三字词取前两字首码和末字前两码；四字及以上取前三字和末字的首码
+// 代理对按一个字处理；不足两个字、有字查不到编码或编码不够长时返回false
+bool make_wubi_phrase_code(std::wstring_view phrase, const char_code_lookup& get_char_code, std::wstring& code);
+
+#endif // FQWB_REVERSE_H
@@ -0,0 +1,297 @@
+// fqwb_stats.cpp - 反切五笔输入法运行统计实现文件
+
+#include "fqwb_stats.h"
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const char* const STAT_COUNTER_NAMES[STAT_COUNTER_COUNT] = {
+    "lookup_hits",
+    "lookup_misses",
+    "candidates_returned",
+    "dictionary_loads",
+    "dictionary_load_failures",
+    "dictionary_shares",
+    "dictionary_switches",
+    "add_word_calls",
+    "pages_flipped",
+    "auto_commits",
+    "keys_processed",
+    "deferred_lookups",
+    "deferred_cancels"
+};
+
+const char* const STAT_HISTOGRAM_NAMES[STAT_HISTOGRAM_COUNT] = {
+    "dictionary_load",
+    "dictionary_switch",
+    "key_processing"
+};
+
+#ifdef FQWB_ENABLE_STATS
+
+// 全局统计：各线程的统计数据、已退出线程的累计值和重置时的基准值
+struct stats_registry {
+    std::mutex mutex;
+    std::vector<stats_block*> blocks; // 正在运行的线程
+    stats_block retired;              // 已退出线程的累计值，持有mutex时写入
+    engine_stats_snapshot baseline;   // 上次重置时的累计值
+};
+
+// 全局统计不析构，静态对象析构之后才退出的线程仍可安全登记和退出
+stats_registry& get_registry() {
+    static stats_registry* registry = new stats_registry();
+    return *registry;
+}
+
+// 当前线程的统计数据是否已并入全局统计
+thread_local bool thread_stats_exited = false;
+
+// 线程退出后的更新写入这里，不计入统计
+stats_block discarded_stats;
+
+// 线程统计数据的登记和退出处理
+struct thread_stats_holder {
+    stats_block block;
+
+    thread_stats_holder() : block() {
+        stats_registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.blocks.push_back(&block);
+    }
+
+    ~thread_stats_holder() {
+        // 线程退出过程中其他线程局部对象的析构仍可能更新统计，之后的更新不再计入
+        current_thread_stats = nullptr;
+        thread_stats_exited = true;
+
+        stats_registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (size_t i = 0; i < STAT_COUNTER_COUNT; i++) {
+            stat_store_add(registry.retired.counters[i], block.counters[i].load(std::memory_order_relaxed));
+        }
+        for (size_t h = 0; h < STAT_HISTOGRAM_COUNT; h++) {
+            for (size_t b = 0; b < LATENCY_BUCKET_COUNT; b++) {
+                stat_store_add(registry.retired.buckets[h][b], block.buckets[h][b].load(std::memory_order_relaxed));
+            }
+            stat_store_add(registry.retired.total_ns[h], block.total_ns[h].load(std::memory_order_relaxed));
+        }
+        for (auto it = registry.blocks.begin(); it != registry.blocks.end(); ++it) {
+            if (*it == &block) {
+                registry.blocks.erase(it);
+                break;
+            }
+        }
+    }
+};
+
+// 把一个线程的统计数据累加到快照
+void accumulate(const stats_block& block, engine_stats_snapshot& snapshot) {
+    for (size_t i = 0; i < STAT_COUNTER_COUNT; i++) {
+        snapshot.counters[i] += block.counters[i].load(std::memory_order_relaxed);
+    }
+    for (size_t h = 0; h < STAT_HISTOGRAM_COUNT; h++) {
+        latency_histogram_snapshot& histogram = snapshot.histograms[h];
+        for (size_t b = 0; b < LATENCY_BUCKET_COUNT; b++) {
+            uint64_t count = block.buckets[h][b].load(std::memory_order_relaxed);
+            histogram.buckets[b] += count;
+            histogram.count += count;
+        }
+        histogram.total_ns += block.total_ns[h].load(std::memory_order_relaxed);
+    }
+}
+
+// 汇总全部线程的累计值，调用时需持有registry.mutex
+engine_stats_snapshot collect_totals(const stats_registry& registry) {
+    engine_stats_snapshot totals = engine_stats_snapshot();
+    totals.enabled = true;
+    accumulate(registry.retired, totals);
+    for (const stats_block* block : registry.blocks) {
+        accumulate(*block, totals);
+    }
+    return totals;
+}
+
+#endif // FQWB_ENABLE_STATS
+
+} // namespace
+
+size_t get_latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return static_cast<size_t>(ns);
+    }
+
+    // 最高位决定2的幂区间，其后两位决定区间内的桶
+    size_t msb = 0;
+    while ((ns >> (msb + 1)) != 0) {
+        msb++;
+    }
+    size_t bucket = (msb - 1) * LATENCY_SUB_BUCKETS + static_cast<size_t>((ns >> (msb - 2)) & (LATENCY_SUB_BUCKETS - 1));
+    return bucket < LATENCY_BUCKET_COUNT ? bucket : LATENCY_BUCKET_COUNT - 1;
+}
+
+uint64_t get_latency_bucket_limit(size_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+    size_t msb = bucket / LATENCY_SUB_BUCKETS + 1;
+    uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return (LATENCY_SUB_BUCKETS + sub + 1) << (msb - 2);
+}
+
+// latency_histogram_snapshot 实现
+double latency_histogram_snapshot::mean_ns() const {
+    return count > 0 ? static_cast<double>(total_ns) / count : 0.0;
+}
+
+uint64_t latency_histogram_snapshot::percentile_ns(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    // 最近秩：第ceil(p * count)次测量所在的桶
+    uint64_t rank = static_cast<uint64_t>(p * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t b = 0; b < LATENCY_BUCKET_COUNT; b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return get_latency_bucket_limit(b);
+        }
+    }
+    return max_ns();
+}
+
+uint64_t latency_histogram_snapshot::max_ns() const {
+    for (size_t b = LATENCY_BUCKET_COUNT; b > 0; b--) {
+        if (buckets[b - 1] != 0) {
+            return get_latency_bucket_limit(b - 1);
+        }
+    }
+    return 0;
+}
+
+// engine_stats_snapshot 实现
+uint64_t engine_stats_snapshot::get(stat_counter counter) const {
+    return counters[static_cast<size_t>(counter)];
+}
+
+const latency_histogram_snapshot& engine_stats_snapshot::get(stat_histogram histogram) const {
+    return histograms[static_cast<size_t>(histogram)];
+}
+
+uint64_t engine_stats_snapshot::lookups() const {
+    return get(stat_counter::lookup_hits) + get(stat_counter::lookup_misses);
+}
+
+std::string engine_stats_snapshot::to_json() const {
+    std::string json;
+    char line[256];
+
+    json += "{\n";
+    json += enabled ? "  \"enabled\": true,\n" : "  \"enabled\": false,\n";
+    snprintf(line, sizeof(line), "  \"counters\": {\n    \"lookups\": %llu", static_cast<unsigned long long>(lookups()));
+    json += line;
+    for (size_t i = 0; i < STAT_COUNTER_COUNT; i++) {
+        snprintf(line, sizeof(line), ",\n    \"%s\": %llu", STAT_COUNTER_NAMES[i], static_cast<unsigned long long>(counters[i]));
+        json += line;
+    }
+    json += "\n  },\n  \"histograms\": {\n";
+
+    for (size_t h = 0; h < STAT_HISTOGRAM_COUNT; h++) {
+        const latency_histogram_snapshot& histogram = histograms[h];
+        snprintf(line, sizeof(line),
+            "    \"%s\": {\"count\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"buckets\": [",
+            STAT_HISTOGRAM_NAMES[h], static_cast<unsigned long long>(histogram.count), histogram.mean_ns(),
+            static_cast<unsigned long long>(histogram.percentile_ns(0.50)), static_cast<unsigned long long>(histogram.percentile_ns(0.90)),
+            static_cast<unsigned long long>(histogram.percentile_ns(0.99)), static_cast<unsigned long long>(histogram.max_ns()));
+        json += line;
+
+        // 只输出非空的桶，le_ns为桶的上界
+        bool first = true;
+        for (size_t b = 0; b < LATENCY_BUCKET_COUNT; b++) {
+            if (histogram.buckets[b] == 0) {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%s{\"le_ns\": %llu, \"count\": %llu}", first ? "" : ", ",
+                static_cast<unsigned long long>(get_latency_bucket_limit(b)), static_cast<unsigned long long>(histogram.buckets[b]));
+            json += line;
+            first = false;
+        }
+        json += h + 1 < STAT_HISTOGRAM_COUNT ? "]},\n" : "]}\n";
+    }
+    json += "  }\n}\n";
+    return json;
+}
+
+const char* get_stat_counter_name(stat_counter counter) {
+    size_t index = static_cast<size_t>(counter);
+    return index < STAT_COUNTER_COUNT ? STAT_COUNTER_NAMES[index] : "";
+}
+
+const char* get_stat_histogram_name(stat_histogram histogram) {
+    size_t index = static_cast<size_t>(histogram);
+    return index < STAT_HISTOGRAM_COUNT ? STAT_HISTOGRAM_NAMES[index] : "";
+}
+
+#ifdef FQWB_ENABLE_STATS
+
+stats_block& register_thread_stats() {
+    if (thread_stats_exited) {
+        return discarded_stats;
+    }
+    thread_local thread_stats_holder holder;
+    current_thread_stats = &holder.block;
+    return holder.block;
+}
+
+void stat_record(stat_histogram histogram, uint64_t ns) {
+    stats_block& block = get_thread_stats();
+    size_t index = static_cast<size_t>(histogram);
+    stat_store_add(block.buckets[index][get_latency_bucket(ns)], 1);
+    stat_store_add(block.total_ns[index], ns);
+}
+
+engine_stats_snapshot get_engine_stats() {
+    stats_registry& registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    engine_stats_snapshot snapshot = collect_totals(registry);
+
+    // 减去重置时的累计值；计数只增不减，相减不会为负
+    for (size_t i = 0; i < STAT_COUNTER_COUNT; i++) {
+        snapshot.counters[i] -= registry.baseline.counters[i];
+    }
+    for (size_t h = 0; h < STAT_HISTOGRAM_COUNT; h++) {
+        latency_histogram_snapshot& histogram = snapshot.histograms[h];
+        const latency_histogram_snapshot& baseline = registry.baseline.histograms[h];
+        for (size_t b = 0; b < LATENCY_BUCKET_COUNT; b++) {
+            histogram.buckets[b] -= baseline.buckets[b];
+        }
+        histogram.count -= baseline.count;
+        histogram.total_ns -= baseline.total_ns;
+    }
+    return snapshot;
+}
+
+void reset_engine_stats() {
+    // 各线程的数据只由所属线程写入，重置时记录基准值而不清零
+    stats_registry& registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.baseline = collect_totals(registry);
+}
+
+#else
+
+engine_stats_snapshot get_engine_stats() {
+    engine_stats_snapshot snapshot = engine_stats_snapshot();
+    snapshot.enabled = false;
+    return snapshot;
+}
+
+void reset_engine_stats() {
+}
+
+#endif // FQWB_ENABLE_STATS
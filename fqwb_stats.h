@@ -0,0 +1,195 @@
+// fqwb_stats.h - 反切五笔输入法运行统计
+// 统计查询、候选词、词库加载和切换、按键处理等的次数和耗时，定义FQWB_ENABLE_STATS时编译进输入法核心
+
+#ifndef FQWB_STATS_H
+#define FQWB_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 计数器
+enum class stat_counter : size_t {
+    lookup_hits,              // 有候选词的查询
+    lookup_misses,            // 没有候选词的查询（包括被提前拒绝的按键）
+    candidates_returned,      // 查询返回的候选词总数
+    dictionary_loads,         // 加载成功的词库
+    dictionary_load_failures, // 加载失败的词库
+    dictionary_shares,        // 共用进程内其他会话已加载的词库（不计入加载）
+    dictionary_switches,      // 切换词库
+    add_word_calls,           // 调用add_word
+    pages_flipped,            // 翻页
+    auto_commits,             // 达到最大编码长度自动上屏
+    keys_processed,           // 处理的按键
+    deferred_lookups,         // 完成并交给输入线程的后台查询
+    deferred_cancels,         // 因编码变化而取消或丢弃的后台查询
+    count
+};
+
+// 延迟直方图
+enum class stat_histogram : size_t {
+    dictionary_load,   // 词库加载耗时
+    dictionary_switch, // 词库切换耗时（包括等待加载）
+    key_processing,    // 按键处理耗时（抽样）
+    count
+};
+
+const size_t STAT_COUNTER_COUNT = static_cast<size_t>(stat_counter::count);
+const size_t STAT_HISTOGRAM_COUNT = static_cast<size_t>(stat_histogram::count);
+
+// 直方图分桶：每个2的幂区间再等分为4个桶（相对误差不超过25%），最大约1100秒
+const size_t LATENCY_SUB_BUCKETS = 4;
+const size_t LATENCY_BUCKET_COUNT = 160;
+
+// 按键处理耗时每隔多少个按键测量一次；逐键读取两次时钟会使按键处理变慢约一成
+const uint64_t KEY_TIMING_SAMPLE_INTERVAL = 32;
+
+// 获取耗时所在的桶
+size_t get_latency_bucket(uint64_t ns);
+
+// 获取桶的上界（纳秒，不含）
+uint64_t get_latency_bucket_limit(size_t bucket);
+
+// 延迟直方图快照
+struct latency_histogram_snapshot {
+    uint64_t count;                        // 测量次数
+    uint64_t total_ns;                     // 总耗时（纳秒）
+    uint64_t buckets[LATENCY_BUCKET_COUNT]; // 各桶的次数
+
+    // 平均耗时（纳秒）
+    double mean_ns() const;
+
+    // 估算分位数（p为0到1），返回所在桶的上界（纳秒）
+    uint64_t percentile_ns(double p) const;
+
+    // 最大耗时所在桶的上界（纳秒）
+    uint64_t max_ns() const;
+};
+
+// 运行统计快照
+struct engine_stats_snapshot {
+    bool enabled;                                                 // 编译时是否启用了统计
+    uint64_t counters[STAT_COUNTER_COUNT];                        // 计数器
+    latency_histogram_snapshot histograms[STAT_HISTOGRAM_COUNT];  // 延迟直方图
+
+    // 获取计数器的值
+    uint64_t get(stat_counter counter) const;
+
+    // 获取直方图
+    const latency_histogram_snapshot& get(stat_histogram histogram) const;
+
+    // 查询总次数（有候选词和没有候选词的查询之和）
+    uint64_t lookups() const;
+
+    // 以JSON格式输出
+    std::string to_json() const;
+};
+
+// 获取计数器名称
+const char* get_stat_counter_name(stat_counter counter);
+
+// 获取直方图名称
+const char* get_stat_histogram_name(stat_histogram histogram);
+
+// 获取自启动（或上次重置）以来的统计快照；编译时未启用统计时全部为0
+engine_stats_snapshot get_engine_stats();
+
+// 重置统计，之后的快照只包含重置后的数据
+void reset_engine_stats();
+
+#ifdef FQWB_ENABLE_STATS
+
+// 一个线程的统计数据，只由所属线程写入
+// 写入时用relaxed的读取和存储代替原子加法，不锁总线；其他线程读取快照时也不会读到撕裂的值
+struct stats_block {
+    std::atomic<uint64_t> counters[STAT_COUNTER_COUNT];
+    std::atomic<uint64_t> buckets[STAT_HISTOGRAM_COUNT][LATENCY_BUCKET_COUNT];
+    std::atomic<uint64_t> total_ns[STAT_HISTOGRAM_COUNT];
+};
+
+// 登记当前线程的统计数据，线程退出时并入全局统计
+stats_block& register_thread_stats();
+
+// 当前线程的统计数据，登记前为空；常量初始化，访问时不需要线程局部变量的初始化检查
+inline thread_local stats_block* current_thread_stats = nullptr;
+
+// 获取当前线程的统计数据
+inline stats_block& get_thread_stats() {
+    stats_block* block = current_thread_stats;
+    return block ? *block : register_thread_stats();
+}
+
+// 单写者累加
+inline void stat_store_add(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// 累加计数器
+inline void stat_add(stat_counter counter, uint64_t n) {
+    stat_store_add(get_thread_stats().counters[static_cast<size_t>(counter)], n);
+}
+
+// 记录一次耗时
+void stat_record(stat_histogram histogram, uint64_t ns);
+
+// 作用域计时器：析构时把耗时记入直方图
+class stat_timer {
+private:
+    stat_histogram histogram;
+    bool active;
+    std::chrono::steady_clock::time_point start_time;
+
+public:
+    explicit stat_timer(stat_histogram histogram, bool active = true) : histogram(histogram), active(active) {
+        if (active) {
+            start_time = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~stat_timer() {
+        if (active) {
+            stat_record(histogram, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count()));
+        }
+    }
+
+    stat_timer(const stat_timer&) = delete;
+    stat_timer& operator=(const stat_timer&) = delete;
+};
+
+// 记录一次查询及其返回的候选词数量
+inline void stat_lookup(size_t candidate_count) {
+    stats_block& block = get_thread_stats();
+    stat_store_add(block.counters[static_cast<size_t>(candidate_count > 0 ? stat_counter::lookup_hits : stat_counter::lookup_misses)], 1);
+    stat_store_add(block.counters[static_cast<size_t>(stat_counter::candidates_returned)], candidate_count);
+}
+
+// 累加计数器，返回累加前当前线程的值
+inline uint64_t stat_next(stat_counter counter) {
+    std::atomic<uint64_t>& value = get_thread_stats().counters[static_cast<size_t>(counter)];
+    uint64_t previous = value.load(std::memory_order_relaxed);
+    value.store(previous + 1, std::memory_order_relaxed);
+    return previous;
+}
+
+#define FQWB_STAT_ADD(counter, n) stat_add(stat_counter::counter, (n))
+#define FQWB_STAT_LOOKUP(candidate_count) stat_lookup(candidate_count)
+#define FQWB_STAT_RECORD(histogram, ns) stat_record(stat_histogram::histogram, (ns))
+#define FQWB_STAT_TIMER(histogram) stat_timer stat_scope_timer(stat_histogram::histogram)
+// 计数并每隔KEY_TIMING_SAMPLE_INTERVAL次测量一次耗时
+#define FQWB_STAT_SAMPLED_TIMER(counter, histogram) \
+    stat_timer stat_scope_timer(stat_histogram::histogram, stat_next(stat_counter::counter) % KEY_TIMING_SAMPLE_INTERVAL == 0)
+
+#else
+
+// 未启用统计时不生成任何代码，参数也不求值
+#define FQWB_STAT_ADD(counter, n) ((void)0)
+#define FQWB_STAT_LOOKUP(candidate_count) ((void)0)
+#define FQWB_STAT_RECORD(histogram, ns) ((void)0)
+#define FQWB_STAT_TIMER(histogram) ((void)0)
+#define FQWB_STAT_SAMPLED_TIMER(counter, histogram) ((void)0)
+
+#endif // FQWB_ENABLE_STATS
+
+#endif // FQWB_STATS_H
@@ -0,0 +1,147 @@
+// fqwb_store.cpp - 反切五笔输入法进程内共享词库实现文件
+
+#include "fqwb_store.h"
+#include "fqwb_dict.h"
+#include <filesystem>
+#include <tuple>
+
+bool dictionary_file_key::operator<(const dictionary_file_key& other) const {
+    return std::tie(file_path, compiled, file_size, write_time) < std::tie(other.file_path, other.compiled, other.file_size, other.write_time);
+}
+
+bool get_dictionary_file_key(const std::wstring& file_path, bool compiled, dictionary_file_key& key) {
+    std::error_code error;
+    std::filesystem::path path(native_path(file_path));
+    unsigned long long file_size = std::filesystem::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    auto write_time = std::filesystem::last_write_time(path, error);
+    if (error) {
+        return false;
+    }
+
+    key.file_path = file_path;
+    key.compiled = compiled;
+    key.file_size = file_size;
+    key.write_time = static_cast<unsigned long long>(write_time.time_since_epoch().count());
+    return true;
+}
+
+// dictionary_store 类实现
+dictionary_store::dictionary_store() {
+}
+
+void dictionary_store::remove_released() {
+    for (auto it = entries.begin(); it != entries.end(); ) {
+        if (!it->second.loading && it->second.data.expired()) {
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::shared_ptr<const compiled_dictionary> dictionary_store::acquire(const dictionary_file_key& key, const loader& load, bool& shared) {
+    shared = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            auto it = entries.find(key);
+            if (it == entries.end()) {
+                // 顺便清理已释放的词库项（包括热更新后不再使用的旧版本）
+                remove_released();
+                entries[key].loading = true;
+                break;
+            }
+            if (!it->second.loading) {
+                std::shared_ptr<const compiled_dictionary> data = it->second.data.lock();
+                if (data) {
+                    shared = true;
+                    return data;
+                }
+                it->second.loading = true;
+                break;
+            }
+            load_cv.wait(lock);
+        }
+    }
+
+    // 在调用线程中加载，其他请求同一版本的线程等待；加载失败时移除该项，等待的线程各自重试
+    std::shared_ptr<const compiled_dictionary> data;
+    try {
+        data = load();
+    }
+    catch (...) {
+        data.reset();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (data) {
+        it->second.data = data;
+        it->second.loading = false;
+    } else {
+        entries.erase(it);
+    }
+    load_cv.notify_all();
+    return data;
+}
+
+size_t dictionary_store::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    remove_released();
+    return entries.size();
+}
+
+dictionary_store& dictionary_store::instance() {
+    // 不析构：静态对象析构之后仍可能有会话释放词库
+    static dictionary_store* store = new dictionary_store();
+    return *store;
+}
+
+// user_data 类实现
+user_data::user_data() : words(nullptr), words_owner(std::make_shared<user_word_snapshot>()), version(0), loaded(false),
+    usage_changes(0), usage_saved_changes(0), association_changes(0), association_saved_changes(0) {
+    words.store(words_owner.get(), std::memory_order_seq_cst);
+}
+
+user_data::~user_data() {
+    // 最后一个会话已释放，不再有线程读取旧快照
+    retired_words.clear();
+}
+
+// user_data_store 类实现
+user_data_store::user_data_store() {
+}
+
+std::shared_ptr<user_data> user_data_store::acquire(const std::wstring& data_dir) {
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::weakly_canonical(std::filesystem::path(native_path(data_dir)), error);
+    std::wstring key = error ? data_dir : path.wstring();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<user_data> data = entries[key].lock();
+    if (data) {
+        return data;
+    }
+
+    // 顺便清理已被所有会话释放的目录
+    for (auto it = entries.begin(); it != entries.end(); ) {
+        if (it->second.expired()) {
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    data = std::make_shared<user_data>();
+    entries[key] = data;
+    return data;
+}
+
+user_data_store& user_data_store::instance() {
+    // 不析构：静态对象析构之后仍可能有会话释放用户数据
+    static user_data_store* store = new user_data_store();
+    return *store;
+}
@@ -0,0 +1,155 @@
+// fqwb_store.h - 反切五笔输入法进程内共享词库和用户数据
+// 同一进程中的所有输入法会话（每个文本服务实例各有一个）共用只读词库数据，同一文件的同一版本只加载一次；
+// 使用同一Data目录的会话共用一份用户数据，同一目录下的日志、使用频率和联想文件只有一个写入者
+
+#ifndef FQWB_STORE_H
+#define FQWB_STORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include "fqwb_assoc.h"
+#include "fqwb_epoch.h"
+#include "fqwb_journal.h"
+#include "fqwb_usage.h"
+#include "fqwb_userdict.h"
+
+class compiled_dictionary;
+
+// 词库文件版本：路径、格式、大小和最后修改时间都相同时视为同一份词库
+struct dictionary_file_key {
+    std::wstring file_path;        // 词库文件路径
+    bool compiled;                 // 是否为预编译词库
+    unsigned long long file_size;  // 文件大小
+    unsigned long long write_time; // 最后修改时间
+
+    bool operator<(const dictionary_file_key& other) const;
+};
+
+// 读取词库文件的当前版本，文件不存在时返回false
+bool get_dictionary_file_key(const std::wstring& file_path, bool compiled, dictionary_file_key& key);
+
+// 进程内共享词库表：以文件版本为键保存已加载词库的弱引用，不延长词库的生命期
+// 各会话持有词库的shared_ptr，最后一个会话释放时词库随之释放；线程安全
+class dictionary_store {
+public:
+    // 加载词库，失败时返回空
+    typedef std::function<std::shared_ptr<const compiled_dictionary>()> loader;
+
+private:
+    // 共享词库项
+    struct entry {
+        std::weak_ptr<const compiled_dictionary> data; // 已加载的词库
+        bool loading;                                  // 是否有线程正在加载
+    };
+
+    std::mutex mutex;                                // 保护entries
+    std::condition_variable load_cv;                 // 词库加载完成通知
+    std::map<dictionary_file_key, entry> entries;    // 各文件版本的词库
+
+    // 移除已被所有会话释放的词库项，调用时需持有mutex
+    void remove_released();
+
+public:
+    dictionary_store();
+
+    dictionary_store(const dictionary_store&) = delete;
+    dictionary_store& operator=(const dictionary_store&) = delete;
+
+    // 获取该文件版本的词库：仍有会话持有时直接共用；其他线程正在加载时等待其完成；否则在调用线程中调用load加载
+    // shared返回是否共用了已加载的词库
+    std::shared_ptr<const compiled_dictionary> acquire(const dictionary_file_key& key, const loader& load, bool& shared);
+
+    // 获取仍被会话持有的词库数量
+    size_t size();
+
+    // 进程内唯一的共享词库表
+    static dictionary_store& instance();
+};
+
+// 一次使用记录，按散列键记录，重放时不需要保留编码和词条
+struct usage_record_op {
+    uint64_t key;  // (编码, 词条)的散列键
+    uint32_t time; // 使用时间
+
+    void apply(usage_tracker& usage) const {
+        usage.record_key(key, time);
+    }
+};
+
+// 一次学习的联想：前一次上屏的最后几个字（学习只用到最后ASSOCIATION_CONTEXT_CHARS个字）和这一次上屏的字符串
+struct association_learn_op {
+    wchar_t previous[ASSOCIATION_CONTEXT_CHARS * 2]; // 代理对占两个wchar_t
+    size_t previous_length;
+    wchar_t next[LEARNED_ASSOCIATION_LENGTH];
+    size_t next_length;
+
+    void apply(association_memory& memory) const {
+        memory.learn(std::wstring_view(previous, previous_length), std::wstring_view(next, next_length));
+    }
+};
+
+// 一个Data目录的用户数据：用户词汇快照、用户词条池、用户词库日志、使用频率和联想记录
+// 由使用该目录的所有会话共用，最后一个会话释放时随之释放；文件由第一个会话读入（loaded），之后各会话只修改内存中的同一份
+struct user_data {
+    std::atomic<const user_word_snapshot*> words;           // 用户新增词汇的当前快照，在读取区内无锁读取
+    std::shared_ptr<const user_word_snapshot> words_owner;  // 持有当前快照，写入时整体替换
+    retire_list<user_word_snapshot> retired_words;          // 已被替换、等待没有线程读取后释放的快照
+    std::atomic<unsigned long long> version;                // 用户词汇版本，每发布一次快照递增
+
+    std::mutex write_mutex;                                 // 写入用户词汇的线程之间互斥，保护以下用户词条池、反查表、日志和loaded
+    std::deque<std::wstring> phrase_pool;                   // 用户词条字符串池，元素地址在追加时保持不变
+    std::unordered_set<std::wstring_view> phrase_index;     // 用户词条池索引，相同词条只存一份
+    std::unordered_multimap<std::wstring_view, std::wstring> phrase_codes; // 用户词条到编码的反查表
+    user_journal journal;                                   // 用户词库日志
+    bool loaded;                                            // 是否已读入日志、使用频率和联想文件
+
+    // 各会话的输入线程排序候选词和查询联想时在读取区内无锁读取当前一份，记录、清除和加载时需持有usage_mutex
+    std::mutex usage_mutex;
+    double_buffered<usage_tracker, usage_record_op> usage;  // 候选词使用频率，与词库无关
+    double_buffered<association_memory, association_learn_op> learned_associations; // 从连续上屏中学习到的联想
+    unsigned long long usage_changes;                       // 使用频率的修改次数
+    unsigned long long usage_saved_changes;                 // 已保存到文件的修改次数
+    unsigned long long association_changes;                 // 学习的联想的修改次数
+    unsigned long long association_saved_changes;           // 已保存到文件的修改次数
+
+    // 保存使用频率和联想文件的会话之间互斥：文件内容在usage_mutex内生成，写入文件和刷新到磁盘时只持有save_mutex
+    std::mutex save_mutex;
+
+    user_data();
+    ~user_data();
+
+    user_data(const user_data&) = delete;
+    user_data& operator=(const user_data&) = delete;
+};
+
+// 进程内共享用户数据表：以Data目录为键保存用户数据的弱引用，不延长其生命期；线程安全
+class user_data_store {
+private:
+    std::mutex mutex;                                       // 保护entries
+    std::map<std::wstring, std::weak_ptr<user_data>> entries; // 各Data目录的用户数据
+
+public:
+    user_data_store();
+
+    user_data_store(const user_data_store&) = delete;
+    user_data_store& operator=(const user_data_store&) = delete;
+
+    // 获取该目录的用户数据：仍有会话持有时直接共用，否则新建一份（loaded为false，由调用者读入文件）
+    // 同一目录的不同写法（相对路径、多余的分隔符）视为同一目录
+    std::shared_ptr<user_data> acquire(const std::wstring& data_dir);
+
+    // 进程内唯一的共享用户数据表
+    static user_data_store& instance();
+};
+
+#endif // FQWB_STORE_H
@@ -0,0 +1,543 @@
+// fqwb_test.cpp - 反切五笔输入法自动测试
+// 在临时目录中生成小词库，检查输入法核心的行为约束，通过时返回0，失败时输出原因并返回1
+// 用法：fqwb_test <测试名> [--dir 工作目录]
+//   alloc   稳定状态下按键处理不分配内存
+//   stress  输入线程反复切换词库和词库层叠时，其他线程同时造词、反查和添加新词
+//   deferred 后台查询每次需要2毫秒时，按键不等待查询，查询完成后通知输入线程合并结果
+//   scaling 一个线程不断添加新词和记录使用频率时，1、2、N个输入会话同时按键，按键吞吐量随线程数增长
+
+#include "fqwb_tsf.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 内存分配计数：只统计打开计数的线程中的分配，后台线程的分配不计入
+static thread_local bool g_count_allocs = false;
+static thread_local unsigned long long g_alloc_count = 0;
+
+void* operator new(size_t size) {
+    if (g_count_allocs) {
+        g_alloc_count++;
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+// 将字符按UTF-8追加到输出缓冲区
+void append_utf8(std::string& out, wchar_t wc) {
+    uint32_t c = static_cast<uint32_t>(wc);
+    if (c < 0x80) {
+        out += static_cast<char>(c);
+    } else if (c < 0x800) {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+// 在工作目录中生成测试词库：全部一、二码编码各一个字，每个二码编码下另有若干三、四码编码
+bool write_test_dictionary(const std::wstring& dir) {
+    std::error_code error;
+    std::filesystem::remove_all(std::filesystem::path(native_path(dir)), error);
+    std::filesystem::create_directories(std::filesystem::path(native_path(dir)), error);
+    if (error) {
+        return false;
+    }
+
+    std::string buffer;
+    wchar_t next_char = 0x4E00;
+    auto emit = [&](const std::string& code, size_t length) {
+        buffer += code;
+        buffer += ' ';
+        for (size_t i = 0; i < length; i++) {
+            append_utf8(buffer, next_char++);
+        }
+        buffer += '\n';
+    };
+
+    for (char first = 'a'; first <= 'y'; first++) {
+        emit(std::string(1, first), 1);
+        for (char second = 'a'; second <= 'y'; second++) {
+            std::string code = { first, second };
+            emit(code, 1);
+            for (int i = 0; i < 4; i++) {
+                emit(code + static_cast<char>('a' + (first + second + i) % 25), 1);
+                emit(code + static_cast<char>('a' + (first * 3 + i) % 25) + static_cast<char>('a' + (second + i * 7) % 25), 2);
+            }
+        }
+    }
+
+    std::ofstream output(native_path(dir + L"\\test.dic"), std::ios::binary | std::ios::trunc);
+    output.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    return static_cast<bool>(output);
+}
+
+// 稳定状态下按键不分配内存：同一组按键预热几轮后，再重复输入时任何一次按键都不应分配内存
+bool test_alloc(const std::wstring& dir) {
+    fqwb_input_method input_method;
+    input_method.set_completion_limit(9);
+    if (!input_method.initialize(dir)) {
+        std::cerr << "初始化输入法失败\n";
+        return false;
+    }
+
+    // 覆盖输入编码、退格、翻页、数字键选择和空格上屏
+    const UINT keys[] = {
+        'A', 'B', VK_BACK, 'B', 'C', VK_NEXT, VK_PRIOR, '1',
+        'D', 'E', 'F', VK_BACK, 'F', '2',
+        'G', 'H', 'I', VK_SPACE,
+        'K', 'L', 'M', 'N',
+        'A', 'B', 'D', VK_BACK, VK_BACK, VK_BACK,
+        'Y', VK_NEXT, VK_NEXT, VK_ESCAPE
+    };
+    const size_t key_count = sizeof(keys) / sizeof(keys[0]);
+
+    bool handled = false;
+    for (int round = 0; round < 3; round++) {
+        for (UINT key : keys) {
+            input_method.process_key_input(key, 0, true, &handled);
+            input_method.get_current_page_candidates();
+        }
+    }
+
+    const int ROUNDS = 100;
+    bool passed = true;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < key_count; i++) {
+            g_alloc_count = 0;
+            g_count_allocs = true;
+            input_method.process_key_input(keys[i], 0, true, &handled);
+            input_method.get_current_page_candidates();
+            g_count_allocs = false;
+
+            if (g_alloc_count != 0) {
+                std::cerr << "第" << round + 1 << "轮第" << i + 1 << "个按键（0x" << std::hex << keys[i] << std::dec
+                          << "）分配了" << g_alloc_count << "次内存\n";
+                passed = false;
+            }
+        }
+        if (!passed) {
+            break;
+        }
+    }
+
+    if (passed) {
+        std::cout << "alloc: " << ROUNDS * key_count << "次按键没有分配内存\n";
+    }
+    return passed;
+}
+
+// 输入线程切换词库时其他线程写入：造词和反查只能使用切换前或切换后的词库，不能读到切换了一半的状态
+bool test_stress(const std::wstring& dir) {
+    // 第二个词库与测试词库内容相同，无论切换到哪一个，造词和反查的结果都不变
+    std::error_code error;
+    std::filesystem::copy_file(std::filesystem::path(native_path(dir + L"\\test.dic")), std::filesystem::path(native_path(dir + L"\\other.dic")), error);
+    if (error) {
+        std::cerr << "复制测试词库失败\n";
+        return false;
+    }
+
+    dictionary_manager manager;
+    if (!manager.initialize(dir)) {
+        std::cerr << "初始化词库管理器失败\n";
+        return false;
+    }
+
+    // 二码编码下各有一个字，其全码就是这两码；两个这样的字组成的二字词编码为两个字的编码相连
+    std::vector<std::wstring> chars;
+    std::vector<std::wstring> char_codes;
+    std::vector<candidate_view> result;
+    for (wchar_t first = L'a'; first <= L'y'; first++) {
+        for (wchar_t second = L'a'; second <= L'y'; second++) {
+            std::wstring code = { first, second };
+            if (manager.search_code(code, result) > 0) {
+                chars.emplace_back(result[0]);
+                char_codes.push_back(code);
+            }
+        }
+    }
+    if (chars.size() < 2) {
+        std::cerr << "测试词库中没有二码单字\n";
+        return false;
+    }
+
+    const int WRITER_COUNT = 3;
+    const size_t PHRASES_PER_WRITER = 200;
+    std::atomic<int> running(WRITER_COUNT);
+    std::atomic<size_t> failures(0);
+    std::vector<std::vector<std::pair<std::wstring, std::wstring>>> added(WRITER_COUNT);
+
+    auto writer = [&](int id) {
+        std::wstring code;
+        std::vector<std::wstring> codes;
+        for (size_t i = 0; i < PHRASES_PER_WRITER; i++) {
+            size_t a = (id * PHRASES_PER_WRITER + i) % chars.size();
+            size_t b = (id * 7 + i * 13 + 1) % chars.size();
+            std::wstring phrase = chars[a] + chars[b];
+            std::wstring expected = char_codes[a] + char_codes[b];
+
+            if (!manager.make_phrase_code(phrase, code) || code != expected) {
+                failures++;
+            }
+            manager.find_codes(chars[a], codes);
+            if (std::find(codes.begin(), codes.end(), char_codes[a]) == codes.end()) {
+                failures++;
+            }
+
+            // 交替使用逐个添加和批量导入
+            if (i % 2 == 0) {
+                if (!manager.add_phrase(phrase)) {
+                    failures++;
+                }
+            } else {
+                size_t imported = 0;
+                if (!manager.import_phrases({ phrase }, imported)) {
+                    failures++;
+                }
+            }
+            added[id].emplace_back(expected, phrase);
+        }
+        running--;
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < WRITER_COUNT; i++) {
+        threads.emplace_back(writer, i);
+    }
+
+    size_t switches = 0;
+    while (running > 0) {
+        manager.switch_dictionary(L"other");
+        manager.set_dictionary_stack({ L"test", L"other" });
+        manager.set_dictionary_stack({ L"other", L"test" });
+        manager.switch_dictionary(L"test");
+        manager.poll_pending_switch();
+        switches++;
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // 所有线程添加的词都能查到
+    for (const auto& words : added) {
+        for (const auto& word : words) {
+            manager.search_code(word.first, result);
+            if (std::find(result.begin(), result.end(), candidate_view(word.second)) == result.end()) {
+                failures++;
+            }
+        }
+    }
+
+    if (failures > 0) {
+        std::cerr << "stress: " << failures << "次造词、反查或添加新词的结果不正确\n";
+        return false;
+    }
+    std::cout << "stress: " << WRITER_COUNT << "个写入线程，输入线程切换词库" << switches << "轮\n";
+    return true;
+}
+
+// 一个线程不断添加新词和记录使用频率时，1、2、N个输入会话（共用同一Data目录）同时按键，测量每秒处理的按键数
+// 输入会话查询时不加锁，吞吐量应随线程数增长；可用的核数少于4个时只报告，不检查增长
+bool test_scaling(const std::wstring& dir) {
+    dictionary_manager writer_manager;
+    if (!writer_manager.initialize(dir)) {
+        std::cerr << "初始化词库管理器失败\n";
+        return false;
+    }
+
+    // 输入编码、退格和翻页，不上屏：只测量查询，上屏记录的使用频率由写入线程产生
+    const UINT keys[] = {
+        'A', 'B', 'C', VK_BACK, VK_BACK, 'D', VK_NEXT, VK_PRIOR, VK_ESCAPE,
+        'K', 'L', 'M', VK_BACK, 'N', VK_ESCAPE,
+        'G', 'H', VK_NEXT, VK_ESCAPE,
+        'Y', 'X', 'W', VK_BACK, VK_BACK, VK_BACK
+    };
+    const auto DURATION = std::chrono::milliseconds(500);
+
+    std::atomic<bool> writing(true);
+    std::atomic<unsigned long long> written(0);
+    std::thread writer([&]() {
+        std::wstring code(4, L'a');
+        std::wstring phrase(2, L' ');
+        for (unsigned long long n = 0; writing.load(); n++) {
+            unsigned long long value = n;
+            for (size_t i = 0; i < code.size(); i++) {
+                code[code.size() - 1 - i] = static_cast<wchar_t>(L'a' + value % 25);
+                value /= 25;
+            }
+            phrase[0] = static_cast<wchar_t>(0x5000 + n % 0x4000);
+            phrase[1] = static_cast<wchar_t>(0x9000 + n / 0x4000 % 0x800);
+            writer_manager.add_word(code, phrase);
+            writer_manager.record_usage(code, phrase);
+            written++;
+        }
+    });
+
+    // 每个会话预先初始化并预热，计时期间只处理按键
+    auto measure = [&](size_t readers) -> double {
+        std::vector<std::unique_ptr<fqwb_input_method>> sessions;
+        for (size_t i = 0; i < readers; i++) {
+            sessions.emplace_back(new fqwb_input_method());
+            if (!sessions.back()->initialize(dir)) {
+                return 0.0;
+            }
+        }
+
+        std::atomic<bool> started(false);
+        std::atomic<bool> stopping(false);
+        std::atomic<unsigned long long> total(0);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < readers; i++) {
+            threads.emplace_back([&, i]() {
+                fqwb_input_method& input_method = *sessions[i];
+                bool handled = false;
+                for (UINT key : keys) {
+                    input_method.process_key_input(key, 0, true, &handled);
+                }
+                while (!started.load()) {
+                    std::this_thread::yield();
+                }
+                unsigned long long count = 0;
+                while (!stopping.load()) {
+                    for (UINT key : keys) {
+                        input_method.process_key_input(key, 0, true, &handled);
+                    }
+                    count += sizeof(keys) / sizeof(keys[0]);
+                }
+                total += count;
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        started = true;
+        std::this_thread::sleep_for(DURATION);
+        stopping = true;
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return total.load() / seconds;
+    };
+
+    unsigned int cores = std::thread::hardware_concurrency();
+    size_t max_readers = std::max<size_t>(4, std::min<size_t>(cores, 8));
+    std::vector<size_t> reader_counts = { 1, 2, max_readers };
+    std::vector<double> rates;
+    for (size_t readers : reader_counts) {
+        rates.push_back(measure(readers));
+    }
+    writing = false;
+    writer.join();
+
+    std::cout << "scaling: " << cores << "核，写入线程添加" << written.load() << "个新词";
+    for (size_t i = 0; i < reader_counts.size(); i++) {
+        std::cout << "，" << reader_counts[i] << "个会话" << static_cast<unsigned long long>(rates[i]) << "键/秒";
+    }
+    std::cout << "\n";
+
+    for (double rate : rates) {
+        if (rate <= 0.0) {
+            std::cerr << "初始化输入法失败或没有处理按键\n";
+            return false;
+        }
+    }
+
+    // 写入线程也占用一个核：2个会话至少达到1个会话的1.4倍，N个会话不少于2个会话
+    if (cores >= 4) {
+        if (rates[1] < rates[0] * 1.4 || rates[2] < rates[1]) {
+            std::cerr << "按键吞吐量没有随线程数增长\n";
+            return false;
+        }
+    } else {
+        std::cout << "scaling: 可用的核数少于4个，不检查吞吐量的增长\n";
+    }
+    return true;
+}
+
+// 后台查询很慢时按键不等待查询：查询每次约需2毫秒，每个按键仍在1毫秒内返回；查询完成后通知输入线程合并结果
+bool test_deferred(const std::wstring& dir) {
+    fqwb_input_method input_method;
+    if (!input_method.initialize(dir)) {
+        std::cerr << "初始化输入法失败\n";
+        return false;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int notify_count = 0;
+    input_method.set_deferred_notify([&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        notify_count++;
+        cv.notify_one();
+    });
+    input_method.set_deferred_lookup_source([](const deferred_query& query, const lookup_cancel& cancel, std::vector<candidate_view>& result) {
+        for (int i = 0; i < 20 && !cancel.cancelled(); i++) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        result.assign(query.exact.begin(), query.exact.end());
+    });
+    if (!input_method.set_deferred_lookup(true)) {
+        std::cerr << "启动后台查询失败\n";
+        return false;
+    }
+
+    const UINT keys[] = {
+        'A', 'B', 'C', VK_BACK, 'C', VK_ESCAPE,
+        'D', 'E', VK_BACK, VK_BACK, 'F', 'G', VK_ESCAPE,
+        'K', 'L', 'M', VK_SPACE,
+        'Y', 'X', VK_BACK, VK_ESCAPE
+    };
+    const size_t key_count = sizeof(keys) / sizeof(keys[0]);
+    const double LIMIT_NS = 1e6;
+
+    // 每个按键取几轮中最快的一次，排除调度造成的偶然延迟；按键若等待查询，每一轮都会超过2毫秒
+    const int ROUNDS = 5;
+    std::vector<double> fastest(key_count, 1e18);
+    bool handled = false;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < key_count; i++) {
+            auto start = std::chrono::steady_clock::now();
+            input_method.process_key_input(keys[i], 0, true, &handled);
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            fastest[i] = std::min(fastest[i], ns);
+        }
+        input_method.clear_input();
+    }
+
+    bool passed = true;
+    double max_ns = 0.0;
+    for (size_t i = 0; i < key_count; i++) {
+        max_ns = std::max(max_ns, fastest[i]);
+        if (fastest[i] > LIMIT_NS) {
+            std::cerr << "第" << i + 1 << "个按键（0x" << std::hex << keys[i] << std::dec << "）耗时" << fastest[i] / 1e6 << "毫秒\n";
+            passed = false;
+        }
+    }
+
+    // 停止输入后查询完成，通知到达时合并结果
+    input_method.process_key_input('A', 0, true, &handled);
+    input_method.process_key_input('B', 0, true, &handled);
+    bool merged = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!merged && std::chrono::steady_clock::now() < deadline) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            int seen = notify_count;
+            cv.wait_for(lock, std::chrono::milliseconds(100), [&]() { return notify_count != seen; });
+        }
+        merged = input_method.poll_deferred_candidates();
+    }
+    if (!merged) {
+        std::cerr << "后台查询完成后没有合并结果\n";
+        passed = false;
+    }
+    // 停止查询线程后不会再有通知
+    input_method.set_deferred_lookup(false);
+
+    if (passed) {
+        std::cout << "deferred: 最慢的按键" << max_ns / 1e3 << "微秒，收到" << notify_count << "次查询完成通知\n";
+    }
+    return passed;
+}
+
+int run_test(const std::vector<std::wstring>& args) {
+    std::wstring work_dir = (std::filesystem::temp_directory_path() / "fqwb_test").wstring();
+    std::wstring name;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        if (arg == L"--dir" && i + 1 < args.size()) {
+            work_dir = args[++i];
+        } else if (name.empty() && arg.compare(0, 2, L"--") != 0) {
+            name = arg;
+        } else {
+            name.clear();
+            break;
+        }
+    }
+
+    bool (*test)(const std::wstring&) = nullptr;
+    if (name == L"alloc") {
+        test = test_alloc;
+    } else if (name == L"stress") {
+        test = test_stress;
+    } else if (name == L"deferred") {
+        test = test_deferred;
+    } else if (name == L"scaling") {
+        test = test_scaling;
+    }
+    if (!test) {
+        std::cerr << "用法: fqwb_test alloc|stress|deferred|scaling [--dir 工作目录]\n";
+        return 1;
+    }
+
+    // 每个测试使用单独的子目录，可以并行运行
+    std::wstring dir = work_dir + L"\\" + name;
+    if (!write_test_dictionary(dir)) {
+        std::cerr << "生成测试词库失败\n";
+        return 1;
+    }
+
+    bool passed = test(dir);
+
+    std::error_code error;
+    std::filesystem::remove_all(std::filesystem::path(native_path(dir)), error);
+    return passed ? 0 : 1;
+}
+
+} // namespace
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+    return run_test(std::vector<std::wstring>(argv, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+    // 其他平台的命令行参数为UTF-8
+    std::vector<std::wstring> args;
+    for (int i = 0; i < argc; i++) {
+        args.push_back(std::filesystem::path(argv[i]).wstring());
+    }
+    return run_test(args);
+}
+#endif
@@ -0,0 +1,298 @@
+// fqwb_trace.cpp - 反切五笔输入法按键轨迹实现文件
+
+#include "fqwb_trace.h"
+#include "fqwb_dict.h"
+#include <cstring>
+
+namespace {
+
+const char KEY_TRACE_MAGIC[4] = { 'F', 'Q', 'W', 'T' };
+
+// 轨迹文件头
+struct key_trace_header {
+    char magic[4];     // 文件标识 "FQWT"
+    uint32_t version;  // 格式版本
+    uint32_t reserved; // 保留字段
+};
+
+// 记录头字节：低4位为记录类型，其余为标志
+const uint8_t TRACE_TYPE_MASK = 0x0F;
+const uint8_t TRACE_FLAG_DOWN = 0x10;
+const uint8_t TRACE_FLAG_SHIFT = 0x20;
+
+// 读取变长整数，数据不完整时返回false
+bool read_varint(const std::vector<char>& data, size_t& offset, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (offset >= data.size()) {
+            return false;
+        }
+        uint8_t byte = static_cast<uint8_t>(data[offset++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+// key_trace_writer 类实现
+key_trace_writer::key_trace_writer() : last_time_us(0), stopping(false) {
+}
+
+key_trace_writer::~key_trace_writer() {
+    close();
+}
+
+bool key_trace_writer::open(const std::wstring& file_path) {
+    close();
+
+    try {
+        file.open(native_path(file_path), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        key_trace_header header;
+        memcpy(header.magic, KEY_TRACE_MAGIC, sizeof(header.magic));
+        header.version = KEY_TRACE_VERSION;
+        header.reserved = 0;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (file.fail()) {
+            file.close();
+            return false;
+        }
+
+        // 两个缓冲区都预留两倍阈值，交换后和单条记录都不会使缓冲区重新分配
+        buffer.clear();
+        buffer.reserve(FLUSH_THRESHOLD * 2);
+        pending.clear();
+        pending.reserve(FLUSH_THRESHOLD * 2);
+        start_time = std::chrono::steady_clock::now();
+        last_time_us = 0;
+        stopping = false;
+        writer = std::thread(&key_trace_writer::write_loop, this);
+        return true;
+    }
+    catch (...) {
+        if (file.is_open()) {
+            file.close();
+        }
+        return false;
+    }
+}
+
+bool key_trace_writer::flush() {
+    if (!file.is_open()) {
+        return false;
+    }
+
+    // pending为空时写入线程不访问文件，持有锁期间可以在当前线程写入
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    writer_cv.wait(lock, [this]() { return pending.empty(); });
+    if (!buffer.empty()) {
+        file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+    file.flush();
+    return !file.fail();
+}
+
+void key_trace_writer::close() {
+    stop_writer();
+    if (file.is_open()) {
+        flush();
+        file.close();
+    }
+}
+
+void key_trace_writer::stop_writer() {
+    if (!writer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        stopping = true;
+    }
+    writer_cv.notify_all();
+    writer.join();
+}
+
+void key_trace_writer::write_loop() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    for (;;) {
+        writer_cv.wait(lock, [this]() { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            return;
+        }
+
+        // 写文件时不持有锁，记录线程可以继续追加
+        lock.unlock();
+        file.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+        lock.lock();
+        pending.clear();
+        writer_cv.notify_all();
+    }
+}
+
+bool key_trace_writer::is_open() const {
+    return file.is_open();
+}
+
+void key_trace_writer::append_varint(uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+void key_trace_writer::append_header(key_trace_type type, bool is_down, bool shift) {
+    uint8_t head = static_cast<uint8_t>(type);
+    if (is_down) {
+        head |= TRACE_FLAG_DOWN;
+    }
+    if (shift) {
+        head |= TRACE_FLAG_SHIFT;
+    }
+    buffer.push_back(static_cast<char>(head));
+
+    // 上屏与引起上屏的按键同时发生，不记录时间
+    if (type != key_trace_type::commit) {
+        uint64_t now_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count());
+        append_varint(now_us - last_time_us);
+        last_time_us = now_us;
+    }
+}
+
+void key_trace_writer::flush_if_full() {
+    if (buffer.size() < FLUSH_THRESHOLD) {
+        return;
+    }
+
+    // 不等待写入线程：拿不到锁或上一块还没写完时，下一条记录再尝试
+    std::unique_lock<std::mutex> lock(writer_mutex, std::try_to_lock);
+    if (lock.owns_lock() && pending.empty()) {
+        buffer.swap(pending);
+        writer_cv.notify_one();
+    }
+}
+
+void key_trace_writer::append_key(uint32_t key_code, bool is_down, bool shift) {
+    if (!file.is_open()) {
+        return;
+    }
+    append_header(key_trace_type::key, is_down, shift);
+    append_varint(key_code);
+    flush_if_full();
+}
+
+void key_trace_writer::append_select(uint32_t index) {
+    if (!file.is_open()) {
+        return;
+    }
+    append_header(key_trace_type::select, false, false);
+    append_varint(index);
+    flush_if_full();
+}
+
+void key_trace_writer::append_clear() {
+    if (!file.is_open()) {
+        return;
+    }
+    append_header(key_trace_type::clear, false, false);
+    flush_if_full();
+}
+
+void key_trace_writer::append_commit(std::wstring_view text) {
+    if (!file.is_open()) {
+        return;
+    }
+    append_header(key_trace_type::commit, false, false);
+    append_varint(text.size());
+    for (wchar_t c : text) {
+        append_varint(static_cast<uint32_t>(c));
+    }
+    flush_if_full();
+}
+
+bool read_key_trace(const std::wstring& file_path, std::vector<key_trace_record>& records) {
+    records.clear();
+
+    try {
+        std::ifstream input(native_path(file_path), std::ios::binary | std::ios::ate);
+        if (!input.is_open()) {
+            return false;
+        }
+
+        std::streamoff size = input.tellg();
+        if (size < static_cast<std::streamoff>(sizeof(key_trace_header))) {
+            return false;
+        }
+        std::vector<char> data(static_cast<size_t>(size));
+        input.seekg(0);
+        if (!input.read(data.data(), size)) {
+            return false;
+        }
+
+        key_trace_header header;
+        memcpy(&header, data.data(), sizeof(header));
+        if (memcmp(header.magic, KEY_TRACE_MAGIC, sizeof(KEY_TRACE_MAGIC)) != 0 || header.version != KEY_TRACE_VERSION) {
+            return false;
+        }
+
+        size_t offset = sizeof(header);
+        uint64_t time_us = 0;
+        while (offset < data.size()) {
+            uint8_t head = static_cast<uint8_t>(data[offset++]);
+            key_trace_record record;
+            record.type = static_cast<key_trace_type>(head & TRACE_TYPE_MASK);
+            record.value = 0;
+            record.is_down = (head & TRACE_FLAG_DOWN) != 0;
+            record.shift = (head & TRACE_FLAG_SHIFT) != 0;
+
+            uint64_t value = 0;
+            if (record.type != key_trace_type::commit) {
+                if (!read_varint(data, offset, value)) {
+                    break;
+                }
+                time_us += value;
+            }
+            record.time_us = time_us;
+
+            bool complete = true;
+            switch (record.type) {
+            case key_trace_type::key:
+            case key_trace_type::select:
+                complete = read_varint(data, offset, value);
+                record.value = static_cast<uint32_t>(value);
+                break;
+            case key_trace_type::clear:
+                break;
+            case key_trace_type::commit:
+                complete = read_varint(data, offset, value);
+                for (uint64_t i = 0; complete && i < value; i++) {
+                    uint64_t c = 0;
+                    complete = read_varint(data, offset, c);
+                    record.text += static_cast<wchar_t>(c);
+                }
+                break;
+            default:
+                // 未知的记录类型无法确定长度，其后的内容不再读取
+                complete = false;
+                break;
+            }
+
+            if (!complete) {
+                break;
+            }
+            records.push_back(std::move(record));
+        }
+        return true;
+    }
+    catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,111 @@
+// fqwb_trace.h - 反切五笔输入法按键轨迹
+// 记录输入法收到的按键、Shift状态、时间和上屏结果，用于无界面回放、延迟统计和结果核对
+
+#ifndef FQWB_TRACE_H
+#define FQWB_TRACE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// 按键轨迹文件扩展名
+#define FQWB_TRACE_FILE_EXT L".fqwt"
+
+// 按键轨迹格式版本
+const uint32_t KEY_TRACE_VERSION = 1;
+
+// 轨迹记录类型
+enum class key_trace_type : uint8_t {
+    key = 1,    // 按键（虚拟键码、按下或抬起、Shift状态）
+    select = 2, // 由界面直接选择候选词（候选词序号）
+    clear = 3,  // 由界面清除当前输入
+    commit = 4  // 上屏（上屏的字符串），紧跟在引起上屏的按键或选择之后
+};
+
+// 一条轨迹记录
+struct key_trace_record {
+    key_trace_type type; // 记录类型
+    uint32_t value;      // 按键的虚拟键码或选择的候选词序号
+    bool is_down;        // 是否为按下
+    bool shift;          // Shift键是否按下
+    uint64_t time_us;    // 距开始记录的时间（微秒）
+    std::wstring text;   // 上屏的字符串（仅上屏记录）
+};
+
+// 按键轨迹写入器
+// 文件布局：文件头 | 记录...；每条记录以一个字节的类型和标志开头，时间增量、键码和字符都以变长整数存储
+// 记录先写入预留容量的缓冲区，缓冲区写满时与备用缓冲区交换，由写入线程写入文件；记录过程中不分配内存，也不等待文件写入
+// 记录、flush和close只能在同一个线程中调用
+class key_trace_writer {
+private:
+    std::ofstream file;                               // 轨迹文件，写入线程只在pending不为空时访问
+    std::vector<char> buffer;                         // 正在追加记录的缓冲区
+    std::vector<char> pending;                        // 交给写入线程的缓冲区，写入完成后清空
+    std::chrono::steady_clock::time_point start_time; // 开始记录的时间
+    uint64_t last_time_us;                            // 上一条带时间的记录的时间（微秒）
+    std::thread writer;                               // 写入线程
+    std::mutex writer_mutex;                          // 保护pending和stopping
+    std::condition_variable writer_cv;                // 有缓冲区待写入、写入完成或需要停止
+    bool stopping;                                    // 写入线程写完剩余缓冲区后退出
+
+    // 缓冲区写入文件的阈值
+    static const size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    // 追加变长整数（每字节7位，最高位表示后面还有字节）
+    void append_varint(uint64_t value);
+
+    // 追加记录头：类型和标志字节以及距上一条记录的时间增量
+    void append_header(key_trace_type type, bool is_down, bool shift);
+
+    // 缓冲区超过阈值时交给写入线程；写入线程仍在写上一块时继续追加到当前缓冲区
+    void flush_if_full();
+
+    // 写入线程主循环
+    void write_loop();
+
+    // 停止写入线程，等待其写完已交给它的缓冲区
+    void stop_writer();
+
+public:
+    key_trace_writer();
+    ~key_trace_writer();
+
+    key_trace_writer(const key_trace_writer&) = delete;
+    key_trace_writer& operator=(const key_trace_writer&) = delete;
+
+    // 创建轨迹文件并开始记录
+    bool open(const std::wstring& file_path);
+
+    // 等待写入线程写完后，将当前缓冲区写入文件
+    bool flush();
+
+    // 写出剩余记录并关闭文件
+    void close();
+
+    // 是否正在记录
+    bool is_open() const;
+
+    // 记录一次按键
+    void append_key(uint32_t key_code, bool is_down, bool shift);
+
+    // 记录一次由界面直接选择候选词
+    void append_select(uint32_t index);
+
+    // 记录一次由界面清除输入
+    void append_clear();
+
+    // 记录一次上屏
+    void append_commit(std::wstring_view text);
+};
+
+// 读取按键轨迹文件；文件末尾不完整的记录（记录过程中崩溃）被忽略
+bool read_key_trace(const std::wstring& file_path, std::vector<key_trace_record>& records);
+
+#endif // FQWB_TRACE_H
@@ -3,8 +3,14 @@
 #include "fqwb_tsf.h"
 #include <fstream>
 #include <algorithm>
+#include <cwctype>
+#include <filesystem>
 #include <sstream>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
+#ifdef _WIN32
 // 定义输入法GUID
 const GUID g_guidProfile = {
     0x12345678, 0x1234, 0x1234, {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0}
@@ -13,53 +19,486 @@ const GUID g_guidProfile = {
 const GUID g_guidInputMethod = {
     0x87654321, 0x4321, 0x4321, {0x0f, 0xed, 0xcb, 0xa9, 0x87, 0x65, 0x43, 0x21}
 };
+#endif
+
+namespace {
+
+// Data目录中的文件信息
+struct data_file_info {
+    std::wstring file_name;        // 文件名（不含目录）
+    unsigned long long file_size;  // 文件大小
+    unsigned long long write_time; // 最后修改时间
+};
+
+// 列出目录中指定扩展名的文件
+void find_data_files(const std::wstring& dir_path, const std::wstring& extension, std::vector<data_file_info>& files) {
+    files.clear();
+    
+#ifdef _WIN32
+    WIN32_FIND_DATAW findFileData;
+    HANDLE hFind = FindFirstFileW((dir_path + L"\\*" + extension).c_str(), &findFileData);
+    
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                files.push_back(data_file_info{ findFileData.cFileName,
+                    (static_cast<unsigned long long>(findFileData.nFileSizeHigh) << 32) | findFileData.nFileSizeLow,
+                    (static_cast<unsigned long long>(findFileData.ftLastWriteTime.dwHighDateTime) << 32) | findFileData.ftLastWriteTime.dwLowDateTime });
+            }
+        } while (FindNextFileW(hFind, &findFileData) != 0);
+        
+        FindClose(hFind);
+    }
+#else
+    std::error_code error;
+    std::filesystem::directory_iterator it(std::filesystem::path(native_path(dir_path)), error);
+    for (; !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+        std::error_code entry_error;
+        if (!it->is_regular_file(entry_error)) {
+            continue;
+        }
+        
+        std::wstring file_name = it->path().filename().wstring();
+        if (file_name.size() <= extension.size() || file_name.compare(file_name.size() - extension.size(), extension.size(), extension) != 0) {
+            continue;
+        }
+        
+        unsigned long long file_size = it->file_size(entry_error);
+        unsigned long long write_time = static_cast<unsigned long long>(it->last_write_time(entry_error).time_since_epoch().count());
+        if (!entry_error) {
+            files.push_back(data_file_info{ file_name, file_size, write_time });
+        }
+    }
+#endif
+}
+
+// 不区分大小写比较文件名
+bool same_file_name(const std::wstring& a, const std::wstring& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](wchar_t x, wchar_t y) {
+        return std::towlower(x) == std::towlower(y);
+    });
+}
+
+// 读取词库文件并构建只读词库，失败时返回空
+std::shared_ptr<compiled_dictionary> read_dictionary_data(const std::wstring& file_path, bool compiled) {
+    try {
+        std::shared_ptr<compiled_dictionary> result = std::make_shared<compiled_dictionary>();
+        
+        if (compiled) {
+            // 预编译词库以内存映射方式打开
+            if (!result->open(file_path) || result->get_code_count() == 0) {
+                return nullptr;
+            }
+            return result;
+        }
+        
+        text_dictionary text;
+        if (!load_text_dictionary(file_path, text) || text.entries.empty()) {
+            return nullptr;
+        }
+        
+        // 文本词库构建为只读内存镜像，之后与预编译词库共用同一套查询路径
+        std::vector<uint8_t> data;
+        if (!build_compiled_dictionary(text, data) || !result->load_image(std::move(data))) {
+            return nullptr;
+        }
+        return result;
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+// 去除result中[first, end)与前first个候选词内容相同的候选词，用于较低优先级的词库层叠加在已有候选词之后
+void remove_shadowed_candidates(std::vector<candidate_view>& result, size_t first) {
+    if (first == 0) {
+        return;
+    }
+    
+    auto shadowed_end = result.begin() + first;
+    auto out = shadowed_end;
+    for (auto it = shadowed_end; it != result.end(); ++it) {
+        if (std::find(result.begin(), shadowed_end, *it) == shadowed_end) {
+            *out++ = *it;
+        }
+    }
+    result.erase(out, result.end());
+}
+
+} // namespace
+
+// lookup_cursor 类实现
+lookup_cursor::lookup_cursor() : levels(1), max_completions(0), version(static_cast<unsigned long long>(-1)) {
+    levels.reserve(RESERVED_DEPTH + 1);
+    levels[0].layer_ranges.reserve(RESERVED_LAYERS);
+    buffer.layer_ranges.reserve(RESERVED_LAYERS);
+    code.reserve(RESERVED_DEPTH);
+}
+
+void lookup_cursor::clear() {
+    code.clear();
+}
+
+bool lookup_cursor::pop() {
+    if (code.empty()) {
+        return false;
+    }
+    code.pop_back();
+    return true;
+}
+
+void lookup_cursor::set_completion_limit(size_t limit) {
+    if (max_completions != limit) {
+        max_completions = limit;
+        version = static_cast<unsigned long long>(-1);
+    }
+}
+
+const std::wstring& lookup_cursor::get_code() const {
+    return code;
+}
+
+candidate_span lookup_cursor::get_candidates() const {
+    const std::vector<candidate_view>& candidates = levels[code.size()].candidates;
+    return candidate_span(candidates.data(), candidates.size());
+}
+
+size_t lookup_cursor::get_exact_count() const {
+    return levels[code.size()].exact_count;
+}
+
+unsigned long long lookup_cursor::get_version() const {
+    return version;
+}
+
+// deferred_lookup_worker 类实现
+deferred_lookup_worker::deferred_lookup_worker() : has_pending(false), stopping(false), latest(0), ready_generation(0), has_ready(false) {
+}
+
+deferred_lookup_worker::~deferred_lookup_worker() {
+    stop();
+}
+
+bool deferred_lookup_worker::start(const deferred_lookup& lookup_fn, const std::function<void()>& on_ready) {
+    stop();
+    if (!lookup_fn) {
+        return false;
+    }
+    
+    lookup = lookup_fn;
+    notify = on_ready;
+    stopping = false;
+    try {
+        thread = std::thread(&deferred_lookup_worker::run, this);
+    }
+    catch (...) {
+        return false;
+    }
+    return true;
+}
+
+void deferred_lookup_worker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    
+    // 查询线程已退出，不需要加锁
+    has_pending = false;
+    pending.source = lookup_source();
+    has_ready = false;
+    ready.clear();
+    ready_source = lookup_source();
+}
+
+bool deferred_lookup_worker::is_running() const {
+    return thread.joinable();
+}
+
+void deferred_lookup_worker::cancel(unsigned long long generation) {
+    latest.store(generation, std::memory_order_release);
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    if (has_pending && pending.generation != generation) {
+        has_pending = false;
+        FQWB_STAT_ADD(deferred_cancels, 1);
+    }
+    if (has_ready && ready_generation != generation) {
+        has_ready = false;
+        FQWB_STAT_ADD(deferred_cancels, 1);
+    }
+}
+
+void deferred_lookup_worker::submit(deferred_query& query) {
+    latest.store(query.generation, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (has_pending) {
+            FQWB_STAT_ADD(deferred_cancels, 1);
+        }
+        std::swap(pending, query);
+        has_pending = true;
+        if (has_ready && ready_generation != pending.generation) {
+            has_ready = false;
+        }
+    }
+    cv.notify_one();
+    
+    // 换回的请求只保留缓冲区，不再持有旧的词库数据
+    query.source = lookup_source();
+}
+
+bool deferred_lookup_worker::take(unsigned long long generation, std::vector<candidate_view>& result, lookup_source& source) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!has_ready || ready_generation != generation) {
+        return false;
+    }
+    result.swap(ready);
+    std::swap(source, ready_source);
+    has_ready = false;
+    return true;
+}
+
+void deferred_lookup_worker::run() {
+#ifdef _WIN32
+    // 后台查询不与输入线程争抢CPU
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#endif
+    
+    deferred_query working;
+    std::vector<candidate_view> result;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cv.wait(lock, [this] { return stopping || has_pending; });
+        if (stopping) {
+            break;
+        }
+        std::swap(working, pending);
+        has_pending = false;
+        lock.unlock();
+        
+        // 查询期间不持有锁，输入线程随时可以提交新请求或取消
+        lookup_cancel cancel = { &latest, working.generation };
+        bool succeeded = false;
+        if (!cancel.cancelled()) {
+            try {
+                lookup(working, cancel, result);
+                succeeded = true;
+            }
+            catch (...) {
+                result.clear();
+            }
+        }
+        
+        lock.lock();
+        bool published = false;
+        if (succeeded && !cancel.cancelled()) {
+            ready.swap(result);
+            std::swap(ready_source, working.source);
+            ready_generation = working.generation;
+            has_ready = true;
+            published = true;
+            FQWB_STAT_ADD(deferred_lookups, 1);
+        } else {
+            FQWB_STAT_ADD(deferred_cancels, 1);
+        }
+        lock.unlock();
+        
+        // 在锁外释放旧的词库数据并通知
+        working.source = lookup_source();
+        if (published && notify) {
+            notify();
+        }
+        lock.lock();
+    }
+}
 
 // dictionary_manager 类实现
-dictionary_manager::dictionary_manager() : initialized(false), current_dict_name(L"default") {
+dictionary_manager::dictionary_manager() : user(std::make_shared<user_data>()), initialized(false), current_dict_name(L"default"), version(0), max_load_threads(0), share_dictionaries(true),
+    load_policy(dictionary_load_policy::load_in_background), switch_policy(dictionary_switch_policy::wait_for_load),
+    fuzzy_enabled(false), fuzzy_rule_set(std::make_shared<fuzzy_rules>(fuzzy_rules::default_rules())), fuzzy_version(0),
+    association_enabled(false), association_memory_limit(DEFAULT_ASSOCIATION_MEMORY_LIMIT), loader_running(false), stop_loading(false), pending_ready(false), reload_ready(false) {
 }
 
 dictionary_manager::~dictionary_manager() {
+    // 先停止目录监视，之后不再有重新加载
+    watcher.stop();
+    
+    // 通知后台加载线程在当前文件加载完成后退出
+    stop_loading = true;
+    if (loader_thread.joinable()) {
+        loader_thread.join();
+    }
+    
+    // 保存尚未写入文件的使用频率和联想；与其他会话共用时保存的是合并后的同一份记录，之后释放的会话只写入新的变化
+    if (initialized) {
+        bool usage_modified = false;
+        bool associations_modified = false;
+        {
+            std::lock_guard<std::mutex> lock(user->usage_mutex);
+            usage_modified = user->usage_changes != user->usage_saved_changes;
+            associations_modified = user->association_changes != user->association_saved_changes;
+        }
+        if (usage_modified) {
+            save_usage();
+        }
+        if (associations_modified) {
+            save_associations();
+        }
+    }
 }
 
 bool dictionary_manager::initialize(const std::wstring& dir_path) {
     data_dir = dir_path;
     initialized = true;
     
+    // 与使用同一目录的会话共用用户数据，只有第一个会话读入文件
+    user = user_data_store::instance().acquire(data_dir);
+    version++;
+    
+    {
+        std::lock_guard<std::mutex> lock(user->write_mutex);
+        if (!user->loaded) {
+            user->loaded = true;
+            
+            // 加载使用频率，文件不存在时从空记录开始
+            {
+                std::lock_guard<std::mutex> usage_lock(user->usage_mutex);
+                user->usage.reset([this](usage_tracker& usage) {
+                    usage.load(data_dir + L"\\" FQWB_USAGE_FILE_NAME);
+                });
+                user->learned_associations.reset([this](association_memory& memory) {
+                    memory.load(data_dir + L"\\" FQWB_ASSOCIATION_FILE_NAME);
+                });
+            }
+            
+            // 回放用户词库日志：清除记录之前的新词直接丢弃，回放完成后一次建立并发布用户词汇快照
+            std::vector<std::pair<std::wstring, candidate_view>> replayed;
+            user->journal.open(data_dir + L"\\" FQWB_USER_JOURNAL_FILE_NAME, [this, &replayed](journal_op op, std::wstring_view code, std::wstring_view characters) {
+                if (op == journal_op::add_word) {
+                    replayed.emplace_back(std::wstring(code), intern_user_phrase(characters));
+                } else if (op == journal_op::clear) {
+                    replayed.clear();
+                }
+            });
+            
+            std::vector<std::pair<std::wstring_view, std::wstring_view>> words;
+            words.reserve(replayed.size());
+            for (const auto& entry : replayed) {
+                words.emplace_back(entry.first, entry.second);
+            }
+            size_t added_count = 0;
+            insert_user_words(words, false, added_count);
+            compact_user_journal();
+        }
+    }
+    
     try {
-        // 首先尝试从Data目录加载所有.dic文件作为词库
-        WIN32_FIND_DATAW findFileData;
-        HANDLE hFind = FindFirstFileW((data_dir + L"\\*.dic").c_str(), &findFileData);
-        
-        if (hFind != INVALID_HANDLE_VALUE) {
-            do {
-                if (!(findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-                    std::wstring file_name = findFileData.cFileName;
-                    std::wstring dict_name = file_name.substr(0, file_name.find_last_of(L'.'));
-                    std::wstring file_path = data_dir + L"\\" + file_name;
-                    
-                    if (load_dictionary(dict_name, file_path)) {
-                        if (dictionaries.size() == 1) {
-                            // 如果是第一个加载的词库，自动切换到它
-                            switch_dictionary(dict_name);
-                        }
-                    }
+        std::unique_lock<std::mutex> lock(load_mutex);
+        
+        std::vector<data_file_info> compiled_files;
+        std::vector<data_file_info> text_files;
+        find_data_files(data_dir, FQWB_COMPILED_DICT_EXT, compiled_files);
+        find_data_files(data_dir, L".dic", text_files);
+        
+        // 首先登记Data目录中的预编译词库(.bdic)，加载时以内存映射方式打开
+        for (const data_file_info& file : compiled_files) {
+            std::wstring dict_name = file.file_name.substr(0, file.file_name.find_last_of(L'.'));
+            
+            // 同名文本词库比预编译词库更新时，说明预编译词库已过期，改为加载文本词库
+            auto text_it = std::find_if(text_files.begin(), text_files.end(), [&dict_name](const data_file_info& text_file) {
+                return same_file_name(text_file.file_name, dict_name + L".dic");
+            });
+            if (text_it != text_files.end() && text_it->write_time > file.write_time) {
+                continue;
+            }
+            
+            register_dictionary(dict_name, data_dir + L"\\" + file.file_name, true, file.file_size, file.write_time);
+            
+            // 预编译词库损坏、格式过旧或字符宽度不符时，仍可退回解析同名文本词库
+            if (text_it != text_files.end()) {
+                dictionaries[dict_name].fallback_path = data_dir + L"\\" + text_it->file_name;
+            }
+        }
+        
+        // 然后登记所有.dic文件，已有预编译版本的词库不再重复解析
+        for (const data_file_info& file : text_files) {
+            std::wstring dict_name = file.file_name.substr(0, file.file_name.find_last_of(L'.'));
+            if (dictionaries.find(dict_name) == dictionaries.end()) {
+                register_dictionary(dict_name, data_dir + L"\\" + file.file_name, false, file.file_size, file.write_time);
+            }
+        }
+        
+        std::vector<std::wstring> names = registration_order;
+        lock.unlock();
+        
+        if (load_policy == dictionary_load_policy::load_all) {
+            // 在有上限的线程池中并行解析全部词库，每个线程依次领取下一个文件
+            std::atomic<size_t> next_task(0);
+            auto worker = [&]() {
+                for (size_t i = next_task++; i < names.size(); i = next_task++) {
+                    load_slot(names[i]);
                 }
-            } while (FindNextFileW(hFind, &findFileData) != 0);
+            };
+            
+            size_t thread_count = max_load_threads ? max_load_threads : std::max(1u, std::thread::hardware_concurrency());
+            thread_count = std::min(thread_count, names.size());
             
-            FindClose(hFind);
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < thread_count; i++) {
+                threads.emplace_back(worker);
+            }
+            worker();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+        
+        // 按登记顺序切换到第一个加载成功的词库；按需加载时只解析到这一个词库为止
+        for (const std::wstring& name : names) {
+            if (load_slot(name)) {
+                switch_dictionary(name);
+                break;
+            }
+        }
+        
+        // 当前词库就绪后，其余词库交给低优先级后台线程加载
+        if (load_policy == dictionary_load_policy::load_in_background) {
+            lock.lock();
+            for (const std::wstring& name : names) {
+                if (dictionaries[name].state == dictionary_slot::registered) {
+                    queue_background_load(name, false);
+                }
+            }
+            lock.unlock();
         }
         
         // 如果没有加载到任何词库，创建一个默认词库
-        if (dictionaries.empty()) {
+        if (!dict) {
             // 示例词库内容
-            add_word(L"abc", L"测试");
-            add_word(L"def", L"输入法");
-            add_word(L"ghi", L"Windows");
-            add_word(L"jkl", L"TSF");
-            add_word(L"mno", L"风琴五笔");
+            std::map<std::wstring, std::vector<std::wstring>> entries;
+            entries[L"abc"].push_back(L"测试");
+            entries[L"def"].push_back(L"输入法");
+            entries[L"ghi"].push_back(L"Windows");
+            entries[L"jkl"].push_back(L"TSF");
+            entries[L"mno"].push_back(L"风琴五笔");
             
             // 保存到默认词库
-            dictionaries[current_dict_name] = dict;
+            std::vector<uint8_t> data;
+            std::shared_ptr<compiled_dictionary> compiled = std::make_shared<compiled_dictionary>();
+            if (build_compiled_dictionary(entries, data) && compiled->load_image(std::move(data))) {
+                lock.lock();
+                register_dictionary(current_dict_name, std::wstring(), false, 0, 0);
+                dictionary_slot& slot = dictionaries[current_dict_name];
+                slot.state = dictionary_slot::loaded;
+                slot.data = compiled;
+                lock.unlock();
+                switch_dictionary(current_dict_name);
+            }
         }
         
         return true;
@@ -69,163 +508,1773 @@ bool dictionary_manager::initialize(const std::wstring& dir_path) {
     }
 }
 
-std::vector<std::wstring> dictionary_manager::search_code(const std::wstring& code) {
-    std::vector<std::wstring> result;
+size_t dictionary_manager::search_code(const std::wstring& code, std::vector<candidate_view>& result) const {
+    result.clear();
     
     if (!initialized) {
-        return result;
+        return 0;
     }
     
-    auto it = dict.find(code);
-    if (it != dict.end()) {
-        result = it->second;
+    // 在读取区内使用的用户词汇快照不会被释放
+    epoch_guard guard;
+    
+    // 直接在词库的只读数据（或映射页面）上查找
+    if (dict) {
+        size_t index = dict->find_code(code);
+        if (index != compiled_dictionary::npos) {
+            dict->append_phrases(index, result);
+        }
     }
     
-    return result;
-}
-
-bool dictionary_manager::add_word(const std::wstring& code, const std::wstring& characters) {
-    if (!initialized) {
-        return false;
+    // 依次叠加附加词库层，已出现在优先级更高的词库中的词条不再重复
+    if (extra_layers) {
+        for (const dictionary_layer& layer : *extra_layers) {
+            size_t index = layer.data->find_code(code);
+            if (index != compiled_dictionary::npos) {
+                size_t layer_first = result.size();
+                layer.data->append_phrases(index, result);
+                remove_shadowed_candidates(result, layer_first);
+            }
+        }
+    }
+    
+    // 叠加用户新增词汇
+    const user_word_snapshot& words = get_user_words();
+    auto it = words.find(code);
+    if (it != words.end()) {
+        size_t user_first = result.size();
+        result.insert(result.end(), it->second.begin(), it->second.end());
+        remove_shadowed_candidates(result, user_first);
     }
     
-    dict[code].push_back(characters);
+    FQWB_STAT_LOOKUP(result.size());
+    return result.size();
+}
+
+size_t dictionary_manager::search_prefix(const std::wstring& prefix, size_t max_completions, std::vector<candidate_view>& result) const {
+    result.clear();
+    size_t count = 0;
     
-    // 同时更新当前词库在dictionaries中的副本
-    if (!current_dict_name.empty()) {
-        dictionaries[current_dict_name][code].push_back(characters);
+    if (initialized && !prefix.empty()) {
+        epoch_guard guard;
+        
+        // 在有序编码表上确定前缀范围
+        size_t first = 0;
+        size_t last = 0;
+        if (dict) {
+            dict->get_prefix_range(prefix, first, last);
+        }
+        lookup_buffer buffer;
+        if (extra_layers) {
+            for (const dictionary_layer& layer : *extra_layers) {
+                code_range range = { 0, 0 };
+                layer.data->get_prefix_range(prefix, range.first, range.last);
+                buffer.layer_ranges.push_back(range);
+            }
+        }
+        count = collect_candidates(prefix, first, last, buffer.layer_ranges.data(), max_completions, buffer, result);
     }
     
-    return true;
+    return count;
 }
 
-bool dictionary_manager::save_user_dictionary() {
-    if (!initialized) {
-        return false;
+size_t dictionary_manager::search_exact(const std::wstring& code, lookup_buffer& buffer, std::vector<candidate_view>& result) const {
+    result.clear();
+    
+    if (!initialized || code.empty()) {
+        return 0;
     }
+    epoch_guard guard;
     
-    try {
-        // 实际应用中应该保存到文件
-        // 这里我们简化处理，直接返回true
-        return true;
+    // 与前缀查询相同地收集候选词，不展开补全，只保留完全匹配的部分
+    size_t first = 0;
+    size_t last = 0;
+    if (dict) {
+        dict->get_prefix_range(code, first, last);
     }
-    catch (...) {
-        return false;
+    buffer.layer_ranges.clear();
+    if (extra_layers) {
+        for (const dictionary_layer& layer : *extra_layers) {
+            code_range range = { 0, 0 };
+            layer.data->get_prefix_range(code, range.first, range.last);
+            buffer.layer_ranges.push_back(range);
+        }
     }
+    size_t exact_count = collect_candidates(code, first, last, buffer.layer_ranges.data(), 0, buffer, result);
+    result.resize(exact_count);
+    return exact_count;
 }
 
-bool dictionary_manager::clear_user_dictionary() {
-    if (!initialized) {
-        return false;
+lookup_source dictionary_manager::get_lookup_source() const {
+    return lookup_source{ dict, extra_layers, fuzzy };
+}
+
+size_t dictionary_manager::search_completions(const lookup_source& source, const std::wstring& prefix, size_t max_completions, lookup_buffer& buffer,
+                                              std::vector<candidate_view>& result, const lookup_cancel& cancel) const {
+    if (prefix.empty() || max_completions == 0 || cancel.cancelled()) {
+        return result.size();
     }
+    epoch_guard guard;
     
-    try {
-        // 实际应用中应该清除用户词库文件中的内容
-        // 这里我们简化处理，直接返回true
-        return true;
+    // 与collect_candidates的补全部分相同，前缀范围在source的各词库中重新查找
+    size_t exact_count = result.size();
+    size_t limit = exact_count + max_completions;
+    size_t first = 0;
+    size_t last = 0;
+    if (source.dict) {
+        source.dict->get_prefix_range(prefix, first, last);
     }
-    catch (...) {
-        return false;
+    if (source.layers) {
+        buffer.layer_ranges.clear();
+        for (const dictionary_layer& layer : *source.layers) {
+            code_range range = { 0, 0 };
+            layer.data->get_prefix_range(prefix, range.first, range.last);
+            buffer.layer_ranges.push_back(range);
+        }
+        merge_layer_completions(source.dict.get(), *source.layers, prefix, first, last, buffer.layer_ranges.data(), limit, buffer, result);
+    } else if (source.dict && first < last) {
+        source.dict->append_completions(first, last, prefix.size(), max_completions, buffer.completions, result);
+    }
+    
+    if (cancel.cancelled()) {
+        return result.size();
     }
+    if (result.size() < limit) {
+        append_user_completions(prefix, limit - result.size(), result);
+    }
+    
+    // 模糊音、各词库层与完全匹配、补全之间可能有相同的词条，保留先出现的
+    if (source.fuzzy || source.layers) {
+        remove_duplicate_candidates(result, exact_count, buffer.dedup);
+    }
+    return result.size();
 }
 
-std::vector<std::wstring> dictionary_manager::get_all_codes() {
-    std::vector<std::wstring> result;
-    
+size_t dictionary_manager::search_wildcard(const std::wstring& pattern, size_t max_results, std::vector<candidate_view>& result) const {
     if (!initialized) {
-        return result;
+        result.clear();
+        return 0;
     }
+    return search_wildcard(get_lookup_source(), pattern, max_results, result, lookup_cancel{ nullptr, 0 });
+}
+
+size_t dictionary_manager::search_wildcard(const lookup_source& source, const std::wstring& pattern, size_t max_results, std::vector<candidate_view>& result,
+                                           const lookup_cancel& cancel) const {
+    result.clear();
     
-    for (const auto& pair : dict) {
-        result.push_back(pair.first);
+    if (max_results == 0) {
+        return 0;
     }
+    epoch_guard guard;
     
-    return result;
-}
-
-// 加载指定词库文件
-bool dictionary_manager::load_dictionary(const std::wstring& dict_name, const std::wstring& file_path) {
-    try {
-        std::wifstream file(file_path);
-        if (!file.is_open()) {
-            return false;
-        }
-        
-        std::map<std::wstring, std::vector<std::wstring>> new_dict;
-        std::wstring line;
+    // 万能键统一换成通配符；*只能出现在末尾
+    bool any_suffix = !pattern.empty() && pattern.back() == WILDCARD_ANY_SUFFIX;
+    std::wstring key = pattern.substr(0, pattern.size() - (any_suffix ? 1 : 0));
+    if (key.find(WILDCARD_ANY_SUFFIX) != std::wstring::npos || (key.empty() && !any_suffix)) {
+        return 0;
+    }
+    std::replace(key.begin(), key.end(), WILDCARD_KEY, WILDCARD_ANY_CHAR);
+    
+    // 按编码长度逐级查询，每级在各词库中只展开与模式匹配的分支，收集够max_results个即停止
+    dedup_buffer dedup;
+    for (size_t length = std::max<size_t>(key.size(), 1); result.size() < max_results && !cancel.cancelled(); length++) {
+        size_t level_first = result.size();
+        size_t level_limit = max_results;
+        bool has_longer = false;
         
-        while (std::getline(file, line)) {
-            if (line.empty()) {
-                continue;
+        for (;;) {
+            result.resize(level_first);
+            has_longer = false;
+            if (source.dict) {
+                has_longer |= source.dict->append_wildcard_matches(key, length, level_limit - result.size(), result);
             }
-            
-            // 查找空格分隔符
-            size_t pos = line.find(L' ');
-            if (pos != std::wstring::npos && pos > 0 && pos < line.size() - 1) {
-                std::wstring code = line.substr(0, pos);
-                std::wstring characters = line.substr(pos + 1);
-                
-                // 移除可能的空白字符
-                code.erase(std::remove_if(code.begin(), code.end(), ::iswspace), code.end());
-                characters.erase(std::remove_if(characters.begin(), characters.end(), ::iswspace), characters.end());
-                
-                if (!code.empty() && !characters.empty()) {
-                    new_dict[code].push_back(characters);
+            if (source.layers) {
+                for (const dictionary_layer& layer : *source.layers) {
+                    if (result.size() < level_limit) {
+                        has_longer |= layer.data->append_wildcard_matches(key, length, level_limit - result.size(), result);
+                    }
                 }
             }
+            if (result.size() < level_limit) {
+                has_longer |= append_user_wildcard_matches(key, length, level_limit, result);
+            } else {
+                has_longer = true;
+            }
+            
+            // 不同编码和不同词库中可能有相同的词条，保留先出现的；去重后不足时加倍本级的数量重新查询
+            size_t count = result.size();
+            remove_duplicate_candidates(result, level_first, dedup);
+            if (result.size() >= max_results || result.size() == count || count < level_limit) {
+                break;
+            }
+            level_limit += level_limit - level_first;
         }
         
-        file.close();
-        
-        if (!new_dict.empty()) {
-            dictionaries[dict_name] = new_dict;
-            return true;
+        if (result.size() > max_results) {
+            result.resize(max_results);
+        }
+        if (!any_suffix || !has_longer) {
+            break;
+        }
+    }
+    
+    FQWB_STAT_LOOKUP(result.size());
+    return result.size();
+}
+
+bool dictionary_manager::append_user_wildcard_matches(const std::wstring& pattern, size_t length, size_t limit, std::vector<candidate_view>& result) const {
+    // 用户词汇按编码排序，只遍历以第一个通配符之前的前缀开头的编码
+    std::wstring_view prefix(pattern.data(), std::min(pattern.find(WILDCARD_ANY_CHAR), pattern.size()));
+    bool has_longer = false;
+    const user_word_snapshot& words = get_user_words();
+    for (auto it = words.lower_bound(prefix); it != words.end(); ++it) {
+        const std::wstring& code = it->first;
+        if (code.compare(0, prefix.size(), prefix) != 0) {
+            break;
+        }
+        if (code.size() < length) {
+            continue;
         }
         
-        return false;
+        bool matched = true;
+        for (size_t i = prefix.size(); i < pattern.size() && matched; i++) {
+            matched = pattern[i] == WILDCARD_ANY_CHAR || pattern[i] == code[i];
+        }
+        if (!matched) {
+            continue;
+        }
+        if (code.size() > length) {
+            has_longer = true;
+            continue;
+        }
+        for (const candidate_view& phrase : it->second) {
+            if (result.size() >= limit) {
+                return true;
+            }
+            result.push_back(phrase);
+        }
     }
-    catch (...) {
-        return false;
+    return has_longer;
+}
+
+size_t dictionary_manager::collect_candidates(const std::wstring& prefix, size_t first, size_t last, const code_range* layer_ranges, size_t max_completions,
+                                              lookup_buffer& buffer, std::vector<candidate_view>& result) const {
+    result.clear();
+    
+    // 完全匹配：范围内长度等于前缀长度的编码只可能排在最前
+    if (dict && first < last && dict->get_code(first).size() == prefix.size()) {
+        dict->append_phrases(first, result);
+    }
+    
+    if (extra_layers) {
+        append_layer_phrases(prefix, layer_ranges, result);
+    }
+    
+    const user_word_snapshot& words = get_user_words();
+    auto it = words.find(prefix);
+    if (it != words.end()) {
+        size_t user_first = result.size();
+        result.insert(result.end(), it->second.begin(), it->second.end());
+        remove_shadowed_candidates(result, user_first);
+    }
+    
+    // 完全匹配的候选词按使用频率排序，补全候选词保持编码由短到长的顺序
+    // 使用频率与其他会话共用，在读取区内无锁读取当前一份，其他会话记录或保存时不需要等待
+    size_t exact_count = result.size();
+    user->usage.get().rank(prefix, result.data(), exact_count, buffer.ranking);
+    
+    // 模糊音候选词排在完全匹配之后、补全之前
+    if (fuzzy) {
+        append_fuzzy_matches(prefix, buffer, result);
+    }
+    
+    if (max_completions == 0) {
+        if (fuzzy) {
+            remove_duplicate_candidates(result, exact_count, buffer.dedup);
+        }
+        FQWB_STAT_LOOKUP(result.size());
+        return exact_count;
+    }
+    
+    size_t limit = result.size() + max_completions;
+    
+    // 在前缀范围内逐层展开；有附加词库层时按编码归并各层的补全
+    if (extra_layers) {
+        merge_layer_completions(dict.get(), *extra_layers, prefix, first, last, layer_ranges, limit, buffer, result);
+    } else if (dict && first < last) {
+        dict->append_completions(first, last, prefix.size(), max_completions, buffer.completions, result);
+    }
+    
+    // 用户新增词汇
+    if (result.size() < limit) {
+        append_user_completions(prefix, limit - result.size(), result);
+    }
+    
+    // 模糊音、各词库层与完全匹配、补全之间可能有相同的词条，保留先出现的
+    if (fuzzy || extra_layers) {
+        remove_duplicate_candidates(result, exact_count, buffer.dedup);
+    }
+    
+    FQWB_STAT_LOOKUP(result.size());
+    return exact_count;
+}
+
+void dictionary_manager::append_layer_phrases(const std::wstring& prefix, const code_range* layer_ranges, std::vector<candidate_view>& result) const {
+    for (size_t i = 0; i < extra_layers->size(); i++) {
+        const compiled_dictionary& data = *(*extra_layers)[i].data;
+        const code_range& range = layer_ranges[i];
+        if (range.first < range.last && data.get_code(range.first).size() == prefix.size()) {
+            size_t layer_first = result.size();
+            data.append_phrases(range.first, result);
+            remove_shadowed_candidates(result, layer_first);
+        }
+    }
+}
+
+void dictionary_manager::merge_layer_completions(const compiled_dictionary* base, const dictionary_layer_list& layers, const std::wstring& prefix, size_t first, size_t last,
+                                                 const code_range* layer_ranges, size_t limit, lookup_buffer& buffer, std::vector<candidate_view>& result) const {
+    // 每层一个补全流，各层只展开实际取到的编码，不合并词库
+    size_t stream_count = layers.size() + 1;
+    std::vector<completion_stream>& streams = buffer.streams;
+    if (streams.size() < stream_count) {
+        streams.resize(stream_count);
+    }
+    streams[0].reset(base, first, last, prefix.size());
+    for (size_t i = 1; i < stream_count; i++) {
+        streams[i].reset(layers[i - 1].data.get(), layer_ranges[i - 1].first, layer_ranges[i - 1].last, prefix.size());
+    }
+    
+    size_t completion_first = result.size();
+    for (;;) {
+        while (result.size() < limit) {
+            // 取编码最短、其次编码最小的流；编码相同时取优先级高的层，其词条全部取完后才轮到下一层
+            completion_stream* best = nullptr;
+            for (size_t i = 0; i < stream_count; i++) {
+                completion_stream& stream = streams[i];
+                if (stream.done()) {
+                    continue;
+                }
+                if (!best) {
+                    best = &stream;
+                    continue;
+                }
+                std::wstring_view code = stream.get_code();
+                std::wstring_view best_code = best->get_code();
+                if (code.size() < best_code.size() || (code.size() == best_code.size() && code < best_code)) {
+                    best = &stream;
+                }
+            }
+            if (!best) {
+                break;
+            }
+            result.push_back(best->get_phrase());
+            best->next();
+        }
+        
+        // 去掉与之前候选词相同的词条，被去掉的位置继续从各层补足
+        size_t count = result.size();
+        remove_duplicate_candidates(result, completion_first, buffer.dedup);
+        if (result.size() == count) {
+            break;
+        }
+    }
+}
+
+void dictionary_manager::append_fuzzy_matches(const std::wstring& prefix, lookup_buffer& buffer, std::vector<candidate_view>& result) const {
+    // 在模糊音索引中查找一次，不展开编码变体
+    fuzzy_rule_set->canonicalize(prefix, buffer.fuzzy_key);
+    
+    size_t first = 0;
+    size_t last = 0;
+    fuzzy->find(buffer.fuzzy_key, first, last);
+    for (size_t i = first; i < last; i++) {
+        size_t code_index = fuzzy->get_code_index(i);
+        if (dict->get_code(code_index) != prefix) {
+            dict->append_phrases(code_index, result);
+        }
+    }
+}
+
+void dictionary_manager::begin_lookup(lookup_cursor& cursor, size_t max_completions) const {
+    epoch_guard guard;
+    if (cursor.levels.empty()) {
+        cursor.levels.resize(1);
+    }
+    
+    lookup_cursor::level& root = cursor.levels[0];
+    root.first = 0;
+    root.last = dict ? dict->get_code_count() : 0;
+    root.layer_ranges.clear();
+    if (extra_layers) {
+        for (const dictionary_layer& layer : *extra_layers) {
+            root.layer_ranges.push_back(code_range{ 0, layer.data->get_code_count() });
+        }
+    }
+    root.user_match = !get_user_words().empty();
+    root.candidates.clear();
+    root.exact_count = 0;
+    
+    cursor.code.clear();
+    cursor.max_completions = max_completions;
+    cursor.version = get_content_version();
+    
+    // 候选词视图指向词库字符池，游标持有词库直到下次重建
+    cursor.source = dict;
+    cursor.source_layers = extra_layers;
+}
+
+bool dictionary_manager::advance_lookup(lookup_cursor& cursor, wchar_t c) const {
+    epoch_guard guard;
+    refresh_lookup(cursor);
+    
+    size_t depth = cursor.code.size();
+    const lookup_cursor::level& parent = cursor.levels[depth];
+    
+    // 在上一级范围内按新字符收窄
+    size_t first = parent.last;
+    size_t last = parent.last;
+    if (dict && parent.first < parent.last) {
+        dict->narrow_range(parent.first, parent.last, depth, c, first, last);
+    }
+    
+    // 各附加词库层同样在上一级范围内收窄
+    std::vector<code_range>& layer_ranges = cursor.buffer.layer_ranges;
+    layer_ranges.clear();
+    bool layer_match = false;
+    for (size_t i = 0; i < parent.layer_ranges.size(); i++) {
+        const code_range& range = parent.layer_ranges[i];
+        code_range child_range = { range.last, range.last };
+        if (range.first < range.last) {
+            layer_match |= (*extra_layers)[i].data->narrow_range(range.first, range.last, depth, c, child_range.first, child_range.last);
+        }
+        layer_ranges.push_back(child_range);
+    }
+    
+    // 用户词汇：只需确认存在以新前缀开头的编码
+    cursor.code.push_back(c);
+    bool user_match = false;
+    if (parent.user_match) {
+        const user_word_snapshot& words = get_user_words();
+        auto it = words.lower_bound(cursor.code);
+        user_match = it != words.end() && it->first.compare(0, cursor.code.size(), cursor.code) == 0;
+    }
+    
+    // 启用模糊音时，只要有模糊键以新前缀的模糊键开头就接受该按键
+    bool fuzzy_match = false;
+    if (first == last && !layer_match && !user_match && fuzzy) {
+        fuzzy_rule_set->canonicalize(cursor.code, cursor.buffer.fuzzy_key);
+        fuzzy_match = fuzzy->has_prefix(cursor.buffer.fuzzy_key);
+    }
+    
+    // 没有任何编码以新前缀开头，提前拒绝该按键
+    if (first == last && !layer_match && !user_match && !fuzzy_match) {
+        cursor.code.pop_back();
+        FQWB_STAT_LOOKUP(0);
+        return false;
+    }
+    
+    if (cursor.levels.size() <= depth + 1) {
+        cursor.levels.resize(depth + 2);
+        cursor.levels[depth + 1].candidates.reserve(lookup_cursor::RESERVED_EXACT + cursor.max_completions);
+        cursor.levels[depth + 1].layer_ranges.reserve(lookup_cursor::RESERVED_LAYERS);
+    }
+    
+    lookup_cursor::level& child = cursor.levels[depth + 1];
+    child.first = first;
+    child.last = last;
+    child.layer_ranges.assign(layer_ranges.begin(), layer_ranges.end());
+    child.user_match = user_match;
+    child.exact_count = collect_candidates(cursor.code, first, last, child.layer_ranges.data(), cursor.max_completions, cursor.buffer, child.candidates);
+    return true;
+}
+
+void dictionary_manager::refresh_lookup(lookup_cursor& cursor) const {
+    if (cursor.version == get_content_version()) {
+        return;
+    }
+    
+    // 词库已变化，按原前缀重新逐级建立游标；前缀不再有效时停在最长的有效前缀处
+    epoch_guard guard;
+    std::wstring code = cursor.code;
+    begin_lookup(cursor, cursor.max_completions);
+    for (wchar_t c : code) {
+        if (!advance_lookup(cursor, c)) {
+            break;
+        }
+    }
+}
+
+void dictionary_manager::append_user_completions(const std::wstring& prefix, size_t max_phrases, std::vector<candidate_view>& result) const {
+    size_t limit = result.size() + max_phrases;
+    const user_word_snapshot& words = get_user_words();
+    auto range_first = words.upper_bound(prefix);
+    
+    // 用户词汇通常很少，按编码长度逐遍扫描前缀范围即可保证由短到长的顺序，且不需要额外缓冲区
+    size_t length = prefix.size() + 1;
+    bool has_longer = true;
+    while (has_longer && result.size() < limit) {
+        has_longer = false;
+        
+        for (auto it = range_first; it != words.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            if (it->first.size() > length) {
+                has_longer = true;
+            } else if (it->first.size() == length) {
+                for (candidate_view characters : it->second) {
+                    if (result.size() >= limit) {
+                        return;
+                    }
+                    result.push_back(characters);
+                }
+            }
+        }
+        
+        length++;
+    }
+}
+
+bool dictionary_manager::add_word(const std::wstring& code, const std::wstring& characters) {
+    FQWB_STAT_ADD(add_word_calls, 1);
+    
+    if (!initialized) {
+        return false;
+    }
+    
+    // 词库只读，新词只写入一次用户词汇；已有的词条不再重复记录
+    std::lock_guard<std::mutex> lock(user->write_mutex);
+    size_t added_count = 0;
+    return write_user_words({ { code, characters } }, added_count);
+}
+
+const user_word_snapshot& dictionary_manager::get_user_words() const {
+    // 与读取区登记的纪元一同按顺序一致读取，写入线程释放旧快照前一定能看到本线程的登记
+    return *user->words.load(std::memory_order_seq_cst);
+}
+
+unsigned long long dictionary_manager::get_content_version() const {
+    // 两个版本都只增不减，和相同说明两者都没有变化
+    return version + user->version;
+}
+
+bool dictionary_manager::insert_user_words(const std::vector<std::pair<std::wstring_view, std::wstring_view>>& words, bool write_journal, size_t& added_count) {
+    // 快照中的词条指向用户词条池，池中的字符串在词库管理器销毁前一直有效
+    std::vector<std::pair<std::wstring_view, std::wstring_view>> interned;
+    interned.reserve(words.size());
+    for (const auto& word : words) {
+        interned.emplace_back(word.first, intern_user_phrase(word.second));
+    }
+    
+    std::vector<size_t> inserted;
+    std::shared_ptr<const user_word_snapshot> snapshot = user->words_owner->insert(interned, inserted);
+    added_count = 0;
+    if (inserted.empty()) {
+        return true;
+    }
+    
+    // 先写日志再发布快照：写入失败时新词不会出现在查询结果中，重启后也不会丢失已经显示过的词
+    // 一个新词只追加一条记录，一批新词依次写入后只刷新一次
+    if (write_journal) {
+        user_journal::snapshot added;
+        added.reserve(inserted.size());
+        for (size_t index : inserted) {
+            added.emplace_back(std::wstring(interned[index].first), std::wstring(interned[index].second));
+        }
+        bool written = added.size() == 1 ? user->journal.append(journal_op::add_word, added[0].first, added[0].second) : user->journal.append_batch(journal_op::add_word, added);
+        if (!written) {
+            return false;
+        }
+    }
+    
+    for (size_t index : inserted) {
+        user->phrase_codes.emplace(interned[index].second, std::wstring(interned[index].first));
+    }
+    publish_user_words(std::move(snapshot));
+    added_count = inserted.size();
+    return true;
+}
+
+void dictionary_manager::publish_user_words(std::shared_ptr<const user_word_snapshot> snapshot) {
+    // 先换上新快照再递增版本：看到新版本的游标重建时一定读到新快照
+    user->words.store(snapshot.get(), std::memory_order_seq_cst);
+    std::shared_ptr<const user_word_snapshot> old = std::move(user->words_owner);
+    user->words_owner = std::move(snapshot);
+    user->version++;
+    
+    // 旧快照可能仍有查询线程在读取，等其离开读取区后才释放
+    user->retired_words.retire(std::move(old));
+}
+
+bool dictionary_manager::write_user_words(const std::vector<std::pair<std::wstring_view, std::wstring_view>>& words, size_t& added_count) {
+    if (!insert_user_words(words, true, added_count)) {
+        return false;
+    }
+    if (added_count > 0) {
+        compact_user_journal();
+    }
+    
+    return true;
+}
+
+bool dictionary_manager::add_phrase(const std::wstring& characters) {
+    if (!initialized) {
+        return false;
+    }
+    
+    phrase_source source = get_phrase_source();
+    std::lock_guard<std::mutex> lock(user->write_mutex);
+    std::wstring code;
+    if (!make_wubi_phrase_code(characters, [this, &source](std::wstring_view character) { return find_char_code(source, character); }, code)) {
+        return false;
+    }
+    
+    // 词库中已有的词条不再加入用户词汇
+    if (is_phrase_in_layers(source, code, characters)) {
+        return true;
+    }
+    size_t added_count = 0;
+    return write_user_words({ { code, characters } }, added_count);
+}
+
+bool dictionary_manager::import_phrases(const std::vector<std::wstring>& phrases, size_t& imported) {
+    imported = 0;
+    if (!initialized) {
+        return false;
+    }
+    phrase_source source = get_phrase_source();
+    std::lock_guard<std::mutex> lock(user->write_mutex);
+    
+    // 同一个字的全码只反查一次
+    std::unordered_map<std::wstring_view, std::wstring_view> char_codes;
+    char_code_lookup get_char_code = [this, &source, &char_codes](std::wstring_view character) {
+        auto it = char_codes.find(character);
+        if (it == char_codes.end()) {
+            it = char_codes.emplace(character, find_char_code(source, character)).first;
+        }
+        return it->second;
+    };
+    
+    std::deque<std::wstring> codes;
+    std::vector<std::pair<std::wstring_view, std::wstring_view>> words;
+    std::wstring code;
+    for (const std::wstring& characters : phrases) {
+        if (make_wubi_phrase_code(characters, get_char_code, code) && !is_phrase_in_layers(source, code, characters)) {
+            codes.push_back(code);
+            words.emplace_back(codes.back(), characters);
+        }
+    }
+    
+    // 所有新词合并为一个新快照发布，依次写入日志后只刷新一次
+    return write_user_words(words, imported);
+}
+
+void dictionary_manager::compact_user_journal() {
+    if (!user->journal.should_compact(user->words_owner->get_word_count())) {
+        return;
+    }
+    
+    // 在写入线程中复制一份当前用户词汇，由后台线程写出
+    user_journal::snapshot entries;
+    entries.reserve(user->words_owner->get_word_count());
+    for (const auto& pair : *user->words_owner) {
+        for (candidate_view characters : pair.second) {
+            entries.emplace_back(pair.first, std::wstring(characters));
+        }
+    }
+    user->journal.compact(std::move(entries));
+}
+
+candidate_view dictionary_manager::intern_user_phrase(std::wstring_view characters) {
+    auto it = user->phrase_index.find(characters);
+    if (it != user->phrase_index.end()) {
+        return *it;
+    }
+    
+    // 池中的字符串不再修改或移除，视图在共用该用户数据的最后一个会话销毁前一直有效
+    user->phrase_pool.emplace_back(characters);
+    candidate_view view = user->phrase_pool.back();
+    user->phrase_index.insert(view);
+    return view;
+}
+
+bool dictionary_manager::save_user_dictionary() {
+    if (!initialized) {
+        return false;
+    }
+    
+    // 新词在添加时已追加到日志，这里只需确保写入磁盘
+    return user->journal.flush();
+}
+
+bool dictionary_manager::clear_user_dictionary() {
+    if (!initialized) {
+        return false;
+    }
+    
+    // 先追加一条清除记录再发布空快照：写入失败时用户词汇保持不变，与重启后回放日志的结果一致
+    // 之前的记录在下次压缩时丢弃
+    std::lock_guard<std::mutex> lock(user->write_mutex);
+    if (!user->journal.append(journal_op::clear, std::wstring_view(), std::wstring_view())) {
+        return false;
+    }
+    
+    // 词条池保留，游标中可能仍有指向其中的候选词视图
+    publish_user_words(std::make_shared<user_word_snapshot>());
+    user->phrase_codes.clear();
+    compact_user_journal();
+    
+    return true;
+}
+
+void dictionary_manager::record_usage(const std::wstring& code, std::wstring_view characters) {
+    if (initialized) {
+        usage_record_op op = { usage_tracker::make_key(code, characters), usage_tracker::now() };
+        std::lock_guard<std::mutex> lock(user->usage_mutex);
+        user->usage.modify(op);
+        user->usage_changes++;
+    }
+}
+
+bool dictionary_manager::save_usage() {
+    if (!initialized) {
+        return false;
+    }
+    
+    // 文件内容在usage_mutex内生成，写入文件和刷新到磁盘时不持有usage_mutex，其他会话记录使用频率不需要等待保存完成
+    // 同一目录的会话由save_mutex依次保存，不会同时写同一个临时文件，后生成的内容也不会被先生成的覆盖
+    std::lock_guard<std::mutex> save_lock(user->save_mutex);
+    std::vector<uint8_t> data;
+    unsigned long long changes = 0;
+    {
+        std::lock_guard<std::mutex> lock(user->usage_mutex);
+        user->usage.get_latest().serialize(data);
+        changes = user->usage_changes;
+    }
+    if (!write_file_replacing(data, data_dir + L"\\" FQWB_USAGE_FILE_NAME)) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(user->usage_mutex);
+    user->usage_saved_changes = changes;
+    return true;
+}
+
+void dictionary_manager::clear_usage() {
+    std::lock_guard<std::mutex> lock(user->usage_mutex);
+    user->usage.reset([](usage_tracker& usage) {
+        usage.clear();
+    });
+    user->usage_changes++;
+}
+
+void dictionary_manager::learn_association(std::wstring_view previous, std::wstring_view next) {
+    if (!initialized || next.empty() || next.size() > LEARNED_ASSOCIATION_LENGTH) {
+        return;
+    }
+    
+    // 学习只用到上文的最后几个字，取能取到的最长上文（不足ASSOCIATION_CONTEXT_CHARS个字时取全部）
+    std::wstring_view context;
+    for (size_t chars = ASSOCIATION_CONTEXT_CHARS; chars > 0 && context.empty(); chars--) {
+        context = get_association_context(previous, chars);
+    }
+    if (context.empty()) {
+        return;
+    }
+    
+    association_learn_op op;
+    op.previous_length = context.size();
+    std::copy(context.begin(), context.end(), op.previous);
+    op.next_length = next.size();
+    std::copy(next.begin(), next.end(), op.next);
+    
+    std::lock_guard<std::mutex> lock(user->usage_mutex);
+    user->learned_associations.modify(op);
+    user->association_changes++;
+}
+
+bool dictionary_manager::save_associations() {
+    if (!initialized) {
+        return false;
+    }
+    
+    // 与save_usage相同：锁内生成文件内容，锁外写入
+    std::lock_guard<std::mutex> save_lock(user->save_mutex);
+    std::vector<uint8_t> data;
+    unsigned long long changes = 0;
+    {
+        std::lock_guard<std::mutex> lock(user->usage_mutex);
+        user->learned_associations.get_latest().serialize(data);
+        changes = user->association_changes;
+    }
+    if (!write_file_replacing(data, data_dir + L"\\" FQWB_ASSOCIATION_FILE_NAME)) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(user->usage_mutex);
+    user->association_saved_changes = changes;
+    return true;
+}
+
+void dictionary_manager::clear_associations() {
+    std::lock_guard<std::mutex> lock(user->usage_mutex);
+    user->learned_associations.reset([](association_memory& memory) {
+        memory.clear();
+    });
+    user->association_changes++;
+}
+
+std::vector<std::wstring> dictionary_manager::get_all_codes() {
+    std::vector<std::wstring> result;
+    
+    if (!initialized) {
+        return result;
+    }
+    epoch_guard guard;
+    const user_word_snapshot& words = get_user_words();
+    
+    if (dict) {
+        size_t count = dict->get_code_count();
+        result.reserve(count + words.size());
+        for (size_t i = 0; i < count; i++) {
+            std::wstring_view code = dict->get_code(i);
+            result.emplace_back(code.data(), code.size());
+        }
+    }
+    
+    // 附加词库层中只在该层出现的编码
+    if (extra_layers) {
+        for (size_t layer = 0; layer < extra_layers->size(); layer++) {
+            const compiled_dictionary& data = *(*extra_layers)[layer].data;
+            for (size_t i = 0; i < data.get_code_count(); i++) {
+                std::wstring_view code = data.get_code(i);
+                if (!is_code_in_layers(code, layer)) {
+                    result.emplace_back(code.data(), code.size());
+                }
+            }
+        }
+    }
+    
+    for (const auto& pair : words) {
+        if (!is_code_in_layers(pair.first, extra_layers ? extra_layers->size() : 0)) {
+            result.push_back(pair.first);
+        }
+    }
+    
+    return result;
+}
+
+bool dictionary_manager::is_code_in_layers(std::wstring_view code, size_t layer_count) const {
+    if (dict && dict->find_code(code) != compiled_dictionary::npos) {
+        return true;
+    }
+    for (size_t i = 0; i < layer_count; i++) {
+        if ((*extra_layers)[i].data->find_code(code) != compiled_dictionary::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 当前词库或附加词库层中编码下是否已有该词条
+bool dictionary_manager::is_phrase_in_layers(const phrase_source& source, std::wstring_view code, std::wstring_view characters) const {
+    auto contains = [code, characters](const compiled_dictionary& data) {
+        size_t code_index = data.find_code(code);
+        if (code_index == compiled_dictionary::npos) {
+            return false;
+        }
+        size_t count = data.get_phrase_count(code_index);
+        for (size_t n = 0; n < count; n++) {
+            if (data.get_phrase(code_index, n) == characters) {
+                return true;
+            }
+        }
+        return false;
+    };
+    
+    if (source.dict && contains(*source.dict)) {
+        return true;
+    }
+    if (source.layers) {
+        for (const dictionary_layer& layer : *source.layers) {
+            if (contains(*layer.data)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// 读取词库文件并构建只读词库
+std::shared_ptr<const compiled_dictionary> dictionary_manager::read_dictionary_file(const std::wstring& file_path, bool compiled) const {
+    // 所有词库加载（初始化、切换、后台加载和热更新）都经过这里
+    auto load = [&file_path, compiled]() -> std::shared_ptr<const compiled_dictionary> {
+        FQWB_STAT_TIMER(dictionary_load);
+        std::shared_ptr<const compiled_dictionary> result = read_dictionary_data(file_path, compiled);
+        if (result) {
+            FQWB_STAT_ADD(dictionary_loads, 1);
+        } else {
+            FQWB_STAT_ADD(dictionary_load_failures, 1);
+        }
+        return result;
+    };
+    
+    // 同一版本的文件在进程内只加载一次，各会话共用；文件变化后版本不同，热更新时读取新内容
+    dictionary_file_key key;
+    if (!share_dictionaries || !get_dictionary_file_key(file_path, compiled, key)) {
+        return load();
+    }
+    bool shared = false;
+    std::shared_ptr<const compiled_dictionary> result = dictionary_store::instance().acquire(key, load, shared);
+    if (shared) {
+        FQWB_STAT_ADD(dictionary_shares, 1);
+    }
+    return result;
+}
+
+// 注册词库文件（不加载）
+void dictionary_manager::register_dictionary(const std::wstring& dict_name, const std::wstring& file_path, bool compiled,
+                                             unsigned long long file_size, unsigned long long write_time) {
+    if (dictionaries.find(dict_name) == dictionaries.end()) {
+        registration_order.push_back(dict_name);
+    }
+    
+    dictionary_slot& slot = dictionaries[dict_name];
+    slot.file_path = file_path;
+    slot.compiled = compiled;
+    slot.fallback_path.clear();
+    slot.file_size = file_size;
+    slot.write_time = write_time;
+    slot.state = dictionary_slot::registered;
+    slot.load_ms = 0.0;
+    slot.data.reset();
+    slot.fuzzy.reset();
+    slot.fuzzy_version = 0;
+    slot.reverse.reset();
+    slot.association.reset();
+}
+
+// 在调用线程中加载已注册的词库
+std::shared_ptr<const compiled_dictionary> dictionary_manager::load_slot(const std::wstring& dict_name) {
+    std::unique_lock<std::mutex> lock(load_mutex);
+    
+    auto it = dictionaries.find(dict_name);
+    if (it == dictionaries.end()) {
+        return nullptr;
+    }
+    
+    // std::map的节点地址在插入其他元素时保持不变
+    dictionary_slot& slot = it->second;
+    load_cv.wait(lock, [&slot]() { return slot.state != dictionary_slot::loading; });
+    
+    if (slot.state != dictionary_slot::registered) {
+        return slot.data;
+    }
+    
+    slot.state = dictionary_slot::loading;
+    std::wstring file_path = slot.file_path;
+    bool compiled = slot.compiled;
+    std::wstring fallback_path = compiled ? slot.fallback_path : std::wstring();
+    std::shared_ptr<const fuzzy_rules> rules = fuzzy_enabled ? fuzzy_rule_set : nullptr;
+    unsigned long long rules_version = fuzzy_version;
+    lock.unlock();
+    
+    auto start_time = std::chrono::steady_clock::now();
+    std::shared_ptr<const compiled_dictionary> data = read_dictionary_file(file_path, compiled);
+    
+    // 预编译词库无法读取时改为解析同名文本词库，之后该词库按文本词库对待
+    bool used_fallback = false;
+    if (!data && !fallback_path.empty()) {
+        data = read_dictionary_file(fallback_path, false);
+        used_fallback = data != nullptr;
+    }
+    
+    // 启用模糊音时在加载词库的同时构建模糊音索引
+    std::shared_ptr<fuzzy_index> fuzzy_data;
+    if (data && rules) {
+        fuzzy_data = std::make_shared<fuzzy_index>();
+        if (!fuzzy_data->build(*data, *rules)) {
+            fuzzy_data.reset();
+        }
+    }
+    double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    
+    lock.lock();
+    if (used_fallback) {
+        slot.file_path = fallback_path;
+        slot.compiled = false;
+        slot.fallback_path.clear();
+    }
+    slot.data = data;
+    slot.fuzzy = fuzzy_data;
+    slot.fuzzy_version = rules_version;
+    slot.reverse.reset();
+    slot.association.reset();
+    slot.state = data ? dictionary_slot::loaded : dictionary_slot::failed;
+    slot.load_ms = load_ms;
+    if (pending_dict_name == dict_name) {
+        pending_ready = true;
+    }
+    load_cv.notify_all();
+    
+    return data;
+}
+
+// 将词库放入后台加载队列
+void dictionary_manager::queue_background_load(const std::wstring& dict_name, bool urgent) {
+    if (urgent) {
+        load_queue.push_front(dict_name);
+    } else {
+        load_queue.push_back(dict_name);
+    }
+    
+    if (!loader_running) {
+        // 上一个后台线程已经退出队列循环，回收后重新启动
+        if (loader_thread.joinable()) {
+            loader_thread.join();
+        }
+        loader_running = true;
+        loader_thread = std::thread(&dictionary_manager::background_load_loop, this);
+    }
+}
+
+// 后台加载线程主循环
+void dictionary_manager::background_load_loop() {
+#ifdef _WIN32
+    // 后台加载不与输入线程争抢CPU
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#endif
+    
+    for (;;) {
+        std::wstring dict_name;
+        {
+            std::lock_guard<std::mutex> lock(load_mutex);
+            if (stop_loading || load_queue.empty()) {
+                loader_running = false;
+                return;
+            }
+            dict_name = load_queue.front();
+            load_queue.pop_front();
+        }
+        
+        load_slot(dict_name);
+    }
+}
+
+// 加载指定词库文件
+bool dictionary_manager::load_dictionary(const std::wstring& dict_name, const std::wstring& file_path) {
+    std::shared_ptr<const compiled_dictionary> loaded = read_dictionary_file(file_path, false);
+    if (!loaded) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    register_dictionary(dict_name, file_path, false, 0, 0);
+    dictionaries[dict_name].state = dictionary_slot::loaded;
+    dictionaries[dict_name].data = loaded;
+    return true;
+}
+
+// 以内存映射方式加载预编译词库文件
+bool dictionary_manager::load_compiled_dictionary(const std::wstring& dict_name, const std::wstring& file_path) {
+    std::shared_ptr<const compiled_dictionary> loaded = read_dictionary_file(file_path, true);
+    if (!loaded) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    register_dictionary(dict_name, file_path, true, 0, 0);
+    dictionaries[dict_name].state = dictionary_slot::loaded;
+    dictionaries[dict_name].data = loaded;
+    return true;
+}
+
+// 切换到指定词库
+bool dictionary_manager::switch_dictionary(const std::wstring& dict_name) {
+    if (!initialized) {
+        return false;
+    }
+    
+    // 耗时包括在当前线程加载或等待其他线程加载词库
+    FQWB_STAT_TIMER(dictionary_switch);
+    
+    std::shared_ptr<const compiled_dictionary> data;
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        
+        auto it = dictionaries.find(dict_name);
+        if (it == dictionaries.end() || it->second.state == dictionary_slot::failed) {
+            return false;
+        }
+        
+        data = it->second.data;
+        if (!data && switch_policy == dictionary_switch_policy::keep_current) {
+            // 保持当前词库，加载完成后由poll_pending_switch切换
+            pending_dict_name = dict_name;
+            pending_ready = false;
+            if (it->second.state == dictionary_slot::registered) {
+                queue_background_load(dict_name, true);
+            }
+            FQWB_STAT_ADD(dictionary_switches, 1);
+            return true;
+        }
+    }
+    
+    // 尚未加载时在当前线程加载；其他线程正在加载时等待其完成
+    if (!data) {
+        data = load_slot(dict_name);
+        if (!data) {
+            return false;
+        }
+    }
+    
+    // 只切换共享引用；在load_mutex内修改，其他线程的反查和造词取得一致的快照
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        pending_dict_name.clear();
+        pending_ready = false;
+        current_dict_name = dict_name;
+        dict = data;
+    }
+    fuzzy = fuzzy_enabled ? get_fuzzy_index(dict_name, data) : nullptr;
+    if (association_enabled) {
+        get_association_index(dict_name, data);
+    }
+    version++;
+    FQWB_STAT_ADD(dictionary_switches, 1);
+    return true;
+}
+
+// 应用已加载完成的延迟切换
+bool dictionary_manager::poll_pending_switch() {
+    bool changed = false;
+    
+    // 先应用已加载完成的延迟切换，切换时一并换上已重新加载的附加词库层
+    if (pending_ready) {
+        std::shared_ptr<const compiled_dictionary> data;
+        std::shared_ptr<const dictionary_layer_list> layers;
+        std::wstring dict_name;
+        {
+            std::lock_guard<std::mutex> lock(load_mutex);
+            pending_ready = false;
+            dict_name.swap(pending_dict_name);
+            
+            auto it = dictionaries.find(dict_name);
+            if (it != dictionaries.end()) {
+                data = it->second.data;
+            }
+            layers = reload_extra_layers();
+        }
+        
+        if (data) {
+            {
+                std::lock_guard<std::mutex> lock(load_mutex);
+                current_dict_name = dict_name;
+                dict = data;
+                if (layers) {
+                    extra_layers = layers;
+                }
+            }
+            fuzzy = fuzzy_enabled ? get_fuzzy_index(dict_name, data) : nullptr;
+            changed = true;
+        }
+    }
+    
+    // 当前词库或附加词库层在后台重新加载完成：只替换共享引用，正在使用旧词库的游标仍持有旧数据
+    // 在切换之后处理：有延迟切换等待应用时也照常替换，重新加载的结果不会丢失
+    if (reload_ready.exchange(false)) {
+        std::shared_ptr<const compiled_dictionary> data;
+        std::shared_ptr<const dictionary_layer_list> layers;
+        {
+            std::lock_guard<std::mutex> lock(load_mutex);
+            auto it = dictionaries.find(current_dict_name);
+            if (it != dictionaries.end()) {
+                data = it->second.data;
+            }
+            layers = reload_extra_layers();
+        }
+        
+        if (data && data != dict) {
+            {
+                std::lock_guard<std::mutex> lock(load_mutex);
+                dict = data;
+            }
+            fuzzy = fuzzy_enabled ? get_fuzzy_index(current_dict_name, data) : nullptr;
+            changed = true;
+        }
+        if (layers) {
+            std::lock_guard<std::mutex> lock(load_mutex);
+            extra_layers = layers;
+            changed = true;
+        }
+    }
+    
+    if (changed) {
+        version++;
+    }
+    return changed;
+}
+
+// 设置词库层叠
+bool dictionary_manager::set_dictionary_stack(const std::vector<std::wstring>& dict_names) {
+    if (!initialized || dict_names.empty()) {
+        return false;
+    }
+    
+    // 先加载全部附加词库层，任一词库不可用时保持原有层叠；重复的词库只保留优先级最高的一层
+    std::shared_ptr<dictionary_layer_list> layers = std::make_shared<dictionary_layer_list>();
+    for (size_t i = 1; i < dict_names.size(); i++) {
+        const std::wstring& name = dict_names[i];
+        if (name == dict_names[0] || std::any_of(layers->begin(), layers->end(), [&name](const dictionary_layer& layer) { return layer.name == name; })) {
+            continue;
+        }
+        
+        std::shared_ptr<const compiled_dictionary> data = load_slot(name);
+        if (!data) {
+            return false;
+        }
+        layers->push_back(dictionary_layer{ name, data });
+    }
+    
+    // 当前词库已加载，切换不会延迟
+    if (!load_slot(dict_names[0]) || !switch_dictionary(dict_names[0])) {
+        return false;
+    }
+    
+    // 只替换共享引用，正在使用原有层叠的游标仍持有原有数据
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        extra_layers = layers->empty() ? nullptr : layers;
+    }
+    if (association_enabled) {
+        prepare_associations();
+    }
+    version++;
+    return true;
+}
+
+// 获取词库层叠
+std::vector<std::wstring> dictionary_manager::get_dictionary_stack() const {
+    std::vector<std::wstring> result;
+    result.push_back(current_dict_name);
+    if (extra_layers) {
+        for (const dictionary_layer& layer : *extra_layers) {
+            result.push_back(layer.name);
+        }
+    }
+    return result;
+}
+
+// 按当前层叠重新获取附加词库层的数据
+std::shared_ptr<const dictionary_layer_list> dictionary_manager::reload_extra_layers() const {
+    if (!extra_layers) {
+        return nullptr;
+    }
+    
+    std::shared_ptr<dictionary_layer_list> layers;
+    for (size_t i = 0; i < extra_layers->size(); i++) {
+        const dictionary_layer& layer = (*extra_layers)[i];
+        auto it = dictionaries.find(layer.name);
+        if (it == dictionaries.end() || !it->second.data || it->second.data == layer.data) {
+            continue;
+        }
+        
+        // 有词库层变化时才复制层列表
+        if (!layers) {
+            layers = std::make_shared<dictionary_layer_list>(*extra_layers);
+        }
+        (*layers)[i].data = it->second.data;
+    }
+    return layers;
+}
+
+// 开始监视Data目录
+bool dictionary_manager::start_watching(watch_backend backend, unsigned int interval_ms) {
+    if (!initialized) {
+        return false;
+    }
+    
+    return watcher.start(data_dir, { FQWB_COMPILED_DICT_EXT, L".dic" },
+        [this](const std::wstring& file_name) { reload_dictionary_file(file_name); },
+        backend, interval_ms);
+}
+
+// 停止监视Data目录
+void dictionary_manager::stop_watching() {
+    watcher.stop();
+}
+
+// 重新加载变化的词库文件（在监视线程中调用）
+void dictionary_manager::reload_dictionary_file(const std::wstring& file_name) {
+    size_t dot = file_name.find_last_of(L'.');
+    if (dot == std::wstring::npos || dot == 0) {
+        return;
+    }
+    
+    std::wstring dict_name = file_name.substr(0, dot);
+    std::wstring extension = file_name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::towlower);
+    bool compiled = extension == FQWB_COMPILED_DICT_EXT;
+    std::wstring file_path = data_dir + L"\\" + file_name;
+    
+    std::shared_ptr<const fuzzy_rules> rules;
+    unsigned long long rules_version = 0;
+    {
+        std::unique_lock<std::mutex> lock(load_mutex);
+        
+        // 新增的词库只登记，首次使用时加载
+        auto it = dictionaries.find(dict_name);
+        if (it == dictionaries.end()) {
+            register_dictionary(dict_name, file_path, compiled, 0, 0);
+            return;
+        }
+        
+        // 同名的.dic和.bdic以最近变化的文件为准
+        dictionary_slot& slot = it->second;
+        load_cv.wait(lock, [&slot]() { return slot.state != dictionary_slot::loading; });
+        if (compiled && !slot.compiled) {
+            // 改用新的预编译词库时保留原来的文本词库作为退路
+            slot.fallback_path = slot.file_path;
+        }
+        slot.file_path = file_path;
+        slot.compiled = compiled;
+        
+        // 尚未加载或加载失败的词库只需更新文件，下次使用时读取新内容
+        if (slot.state != dictionary_slot::loaded) {
+            slot.state = dictionary_slot::registered;
+            return;
+        }
+        
+        rules = fuzzy_enabled ? fuzzy_rule_set : nullptr;
+        rules_version = fuzzy_version;
+    }
+    
+    // 在监视线程中读取并构建新词库，输入线程继续使用旧词库
+    auto start_time = std::chrono::steady_clock::now();
+    std::shared_ptr<const compiled_dictionary> data = read_dictionary_file(file_path, compiled);
+    if (!data) {
+        // 文件不完整或格式错误时保留旧词库
+        return;
+    }
+    
+    std::shared_ptr<fuzzy_index> fuzzy_data;
+    if (rules) {
+        fuzzy_data = std::make_shared<fuzzy_index>();
+        if (!fuzzy_data->build(*data, *rules)) {
+            fuzzy_data.reset();
+        }
+    }
+    double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    auto it = dictionaries.find(dict_name);
+    if (it == dictionaries.end() || it->second.file_path != file_path) {
+        return;
+    }
+    
+    dictionary_slot& slot = it->second;
+    slot.data = data;
+    slot.fuzzy = fuzzy_data;
+    slot.fuzzy_version = rules_version;
+    slot.reverse.reset();
+    slot.association.reset();
+    slot.state = dictionary_slot::loaded;
+    slot.load_ms = load_ms;
+    reload_ready = true;
+}
+
+// 获取词库在当前规则下的模糊音索引
+std::shared_ptr<const fuzzy_index> dictionary_manager::get_fuzzy_index(const std::wstring& dict_name, const std::shared_ptr<const compiled_dictionary>& data) {
+    std::shared_ptr<const fuzzy_rules> rules;
+    unsigned long long rules_version = 0;
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        auto it = dictionaries.find(dict_name);
+        if (it != dictionaries.end() && it->second.data == data && it->second.fuzzy && it->second.fuzzy_version == fuzzy_version) {
+            return it->second.fuzzy;
+        }
+        rules = fuzzy_rule_set;
+        rules_version = fuzzy_version;
+    }
+    
+    // 规则变化后或词库加载时未启用模糊音，在调用线程中构建
+    std::shared_ptr<fuzzy_index> result = std::make_shared<fuzzy_index>();
+    if (!data || !result->build(*data, *rules)) {
+        return nullptr;
+    }
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    auto it = dictionaries.find(dict_name);
+    if (it != dictionaries.end() && it->second.data == data) {
+        it->second.fuzzy = result;
+        it->second.fuzzy_version = rules_version;
+    }
+    return result;
+}
+
+// 获取词库的反查索引
+std::shared_ptr<const reverse_index> dictionary_manager::get_reverse_index(const std::wstring& dict_name, const std::shared_ptr<const compiled_dictionary>& data) {
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        auto it = dictionaries.find(dict_name);
+        if (it != dictionaries.end() && it->second.data == data && it->second.reverse) {
+            return it->second.reverse;
+        }
+    }
+    
+    // 第一次反查时在调用线程中构建，之后随词库数据一起保留，词库重新加载时丢弃
+    std::shared_ptr<reverse_index> result = std::make_shared<reverse_index>();
+    if (!data || !result->build(*data)) {
+        return nullptr;
+    }
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    auto it = dictionaries.find(dict_name);
+    if (it != dictionaries.end() && it->second.data == data) {
+        it->second.reverse = result;
+    }
+    return result;
+}
+
+// 获取词库的联想索引
+std::shared_ptr<const association_index> dictionary_manager::get_association_index(const std::wstring& dict_name, const std::shared_ptr<const compiled_dictionary>& data) {
+    size_t memory_limit = 0;
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        auto it = dictionaries.find(dict_name);
+        if (it != dictionaries.end() && it->second.data == data && it->second.association) {
+            return it->second.association;
+        }
+        memory_limit = association_memory_limit;
+    }
+    
+    // 在调用线程中构建，之后随词库数据一起保留，词库重新加载或内存上限变化时丢弃
+    std::shared_ptr<association_index> result = std::make_shared<association_index>();
+    if (!data || !result->build(*data, memory_limit)) {
+        return nullptr;
+    }
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    auto it = dictionaries.find(dict_name);
+    if (it != dictionaries.end() && it->second.data == data && association_memory_limit == memory_limit) {
+        it->second.association = result;
+    }
+    return result;
+}
+
+// 为当前词库和附加词库层构建联想索引
+void dictionary_manager::prepare_associations() {
+    if (dict) {
+        get_association_index(current_dict_name, dict);
+    }
+    if (extra_layers) {
+        for (const dictionary_layer& layer : *extra_layers) {
+            get_association_index(layer.name, layer.data);
+        }
+    }
+}
+
+// 查询联想词
+size_t dictionary_manager::search_associations(std::wstring_view context, size_t max_results, std::vector<candidate_view>& result) {
+    result.clear();
+    if (!initialized) {
+        return 0;
+    }
+    
+    // 学习到的联想与其他会话共用，在读取区内无锁读取当前一份；离开读取区后这一份可能被写入，取出的联想词在读取区内复制到本会话的缓冲区
+    if (learned_text.size() < max_results * LEARNED_ASSOCIATION_LENGTH) {
+        learned_text.resize(max_results * LEARNED_ASSOCIATION_LENGTH);
+    }
+    size_t learned_count = 0;
+    
+    // 较长的上文更能确定接下来的词，先查；同一上文中学习到的联想在前
+    std::shared_ptr<const association_index> index = dict ? get_association_index(current_dict_name, dict) : nullptr;
+    for (size_t chars = ASSOCIATION_CONTEXT_CHARS; chars > 0 && result.size() < max_results; chars--) {
+        std::wstring_view suffix = get_association_context(context, chars);
+        if (suffix.empty()) {
+            continue;
+        }
+        {
+            epoch_guard guard;
+            size_t learned_first = result.size();
+            user->learned_associations.get().append(suffix, max_results, result);
+            for (size_t i = learned_first; i < result.size(); i++) {
+                wchar_t* text = learned_text.data() + learned_count++ * LEARNED_ASSOCIATION_LENGTH;
+                std::copy(result[i].begin(), result[i].end(), text);
+                result[i] = candidate_view(text, result[i].size());
+            }
+        }
+        if (index) {
+            index->append(*dict, suffix, max_results, result);
+        }
+        if (extra_layers) {
+            for (const dictionary_layer& layer : *extra_layers) {
+                std::shared_ptr<const association_index> layer_index = get_association_index(layer.name, layer.data);
+                if (layer_index) {
+                    layer_index->append(*layer.data, suffix, max_results, result);
+                }
+            }
+        }
+    }
+    return result.size();
+}
+
+// 取得反查和造词使用的词库快照
+dictionary_manager::phrase_source dictionary_manager::get_phrase_source() const {
+    std::lock_guard<std::mutex> lock(load_mutex);
+    return phrase_source{ current_dict_name, dict, extra_layers };
+}
+
+// 依次反查当前词库、附加词库层和用户词汇中词条的编码
+void dictionary_manager::visit_phrase_codes(const phrase_source& source, std::wstring_view phrase, const std::function<void(std::wstring_view code)>& visit) {
+    auto visit_dictionary = [this, phrase, &visit](const std::wstring& dict_name, const std::shared_ptr<const compiled_dictionary>& data) {
+        std::shared_ptr<const reverse_index> index = get_reverse_index(dict_name, data);
+        if (!index) {
+            return;
+        }
+        size_t first = 0;
+        size_t last = 0;
+        index->find(*data, phrase, first, last);
+        for (size_t i = first; i < last; i++) {
+            size_t code_index = index->get_code_index(*data, i);
+            if (code_index != compiled_dictionary::npos) {
+                visit(data->get_code(code_index));
+            }
+        }
+    };
+    
+    if (source.dict) {
+        visit_dictionary(source.dict_name, source.dict);
+    }
+    if (source.layers) {
+        for (const dictionary_layer& layer : *source.layers) {
+            visit_dictionary(layer.name, layer.data);
+        }
+    }
+    
+    auto range = user->phrase_codes.equal_range(phrase);
+    for (auto it = range.first; it != range.second; ++it) {
+        visit(it->second);
+    }
+}
+
+// 获取单字的全码
+std::wstring_view dictionary_manager::find_char_code(const phrase_source& source, std::wstring_view character) {
+    // 简码是全码的前缀，取最长的编码
+    std::wstring_view result;
+    visit_phrase_codes(source, character, [&result](std::wstring_view code) {
+        if (code.size() > result.size()) {
+            result = code;
+        }
+    });
+    return result;
+}
+
+// 反查词条的编码
+size_t dictionary_manager::find_codes(std::wstring_view phrase, std::vector<std::wstring>& codes) {
+    codes.clear();
+    if (!initialized) {
+        return 0;
+    }
+    
+    // 用户词条反查表只在写入线程之间共享
+    phrase_source source = get_phrase_source();
+    std::lock_guard<std::mutex> lock(user->write_mutex);
+    visit_phrase_codes(source, phrase, [&codes](std::wstring_view code) {
+        codes.emplace_back(code);
+    });
+    std::sort(codes.begin(), codes.end(), [](const std::wstring& a, const std::wstring& b) {
+        return a.size() != b.size() ? a.size() < b.size() : a < b;
+    });
+    codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+    return codes.size();
+}
+
+// 按五笔词组取码规则生成词组编码
+bool dictionary_manager::make_phrase_code(std::wstring_view phrase, std::wstring& code) {
+    if (!initialized) {
+        code.clear();
+        return false;
+    }
+    phrase_source source = get_phrase_source();
+    std::lock_guard<std::mutex> lock(user->write_mutex);
+    return make_wubi_phrase_code(phrase, [this, &source](std::wstring_view character) {
+        return find_char_code(source, character);
+    }, code);
+}
+
+// 获取已构建的反查索引占用的内存
+size_t dictionary_manager::get_reverse_index_memory() const {
+    size_t total = 0;
+    std::lock_guard<std::mutex> lock(load_mutex);
+    for (const auto& pair : dictionaries) {
+        if (pair.second.reverse) {
+            total += pair.second.reverse->memory_usage();
+        }
+    }
+    return total;
+}
+
+// 获取联想占用的内存
+size_t dictionary_manager::get_association_memory() const {
+    size_t total = 0;
+    {
+        // 学习的联想有轮换使用的两份
+        epoch_guard guard;
+        total = user->learned_associations.get().memory_usage() * 2;
+    }
+    std::lock_guard<std::mutex> lock(load_mutex);
+    for (const auto& pair : dictionaries) {
+        if (pair.second.association) {
+            total += pair.second.association->memory_usage();
+        }
+    }
+    return total;
+}
+
+// 设置联想索引内存上限
+void dictionary_manager::set_association_memory_limit(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        association_memory_limit = bytes;
+        for (auto& pair : dictionaries) {
+            pair.second.association.reset();
+        }
+    }
+    if (association_enabled) {
+        prepare_associations();
+    }
+}
+
+// 获取所有已注册的词库名称：后台加载失败的词库仍在列表中，不会在加载完成后从列表中消失
+std::vector<std::wstring> dictionary_manager::get_available_dictionaries() const {
+    std::vector<std::wstring> result;
+    
+    if (!initialized) {
+        return result;
+    }
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    for (const auto& pair : dictionaries) {
+        result.push_back(pair.first);
+    }
+    
+    return result;
+}
+
+// 获取词库的加载状态
+bool dictionary_manager::get_dictionary_state(const std::wstring& dict_name, dictionary_slot::load_state& state) const {
+    std::lock_guard<std::mutex> lock(load_mutex);
+    auto it = dictionaries.find(dict_name);
+    if (it == dictionaries.end()) {
+        return false;
+    }
+    
+    state = it->second.state;
+    return true;
+}
+
+// 获取当前词库名称
+std::wstring dictionary_manager::get_current_dictionary() const {
+    return current_dict_name;
+}
+
+// 设置并行加载词库的线程数上限
+void dictionary_manager::set_max_load_threads(size_t count) {
+    max_load_threads = count;
+}
+
+// 获取已加载的各词库文件的加载耗时
+std::vector<dictionary_load_timing> dictionary_manager::get_load_timings() const {
+    std::vector<dictionary_load_timing> result;
+    
+    std::lock_guard<std::mutex> lock(load_mutex);
+    for (const std::wstring& name : registration_order) {
+        const dictionary_slot& slot = dictionaries.at(name);
+        if (slot.state == dictionary_slot::loaded || slot.state == dictionary_slot::failed) {
+            result.push_back(dictionary_load_timing{ name, slot.file_path, slot.compiled, slot.state == dictionary_slot::loaded, slot.load_ms });
+        }
     }
+    
+    return result;
 }
 
-// 切换到指定词库
-bool dictionary_manager::switch_dictionary(const std::wstring& dict_name) {
-    if (!initialized || dictionaries.find(dict_name) == dictionaries.end()) {
-        return false;
+// 设置词库加载方式
+void dictionary_manager::set_load_policy(dictionary_load_policy policy) {
+    load_policy = policy;
+}
+
+// 设置是否与进程内其他会话共用词库数据
+void dictionary_manager::set_dictionary_sharing(bool enable) {
+    share_dictionaries = enable;
+}
+
+// 设置切换到未加载完成的词库时的处理方式
+void dictionary_manager::set_switch_policy(dictionary_switch_policy policy) {
+    switch_policy = policy;
+}
+
+// 启用或禁用模糊音
+void dictionary_manager::set_fuzzy_enabled(bool enable) {
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        fuzzy_enabled = enable;
     }
-    
-    current_dict_name = dict_name;
-    dict = dictionaries[dict_name];
-    return true;
+    fuzzy = enable && dict ? get_fuzzy_index(current_dict_name, dict) : nullptr;
+    version++;
 }
 
-// 获取所有可用词库名称
-std::vector<std::wstring> dictionary_manager::get_available_dictionaries() const {
-    std::vector<std::wstring> result;
-    
-    if (!initialized) {
-        return result;
+// 获取模糊音功能状态
+bool dictionary_manager::get_fuzzy_enabled() const {
+    return fuzzy_enabled;
+}
+
+// 设置模糊音规则
+void dictionary_manager::set_fuzzy_rules(const fuzzy_rules& rules) {
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        fuzzy_rule_set = std::make_shared<fuzzy_rules>(rules);
+        fuzzy_version++;
     }
-    
-    for (const auto& pair : dictionaries) {
-        result.push_back(pair.first);
+    fuzzy = fuzzy_enabled && dict ? get_fuzzy_index(current_dict_name, dict) : nullptr;
+    version++;
+}
+
+// 启用或禁用联想
+void dictionary_manager::set_association_enabled(bool enable) {
+    association_enabled = enable;
+    if (enable) {
+        prepare_associations();
     }
-    
-    return result;
 }
 
-// 获取当前词库名称
-std::wstring dictionary_manager::get_current_dictionary() const {
-    return current_dict_name;
+// 获取联想功能状态
+bool dictionary_manager::get_association_enabled() const {
+    return association_enabled;
 }
 
 // fqwb_input_method 类实现
-fqwb_input_method::fqwb_input_method() : dict_manager(nullptr), initialized(false), auto_commit(true), shift_select(true), current_page(0), page_size(9) {
+fqwb_input_method::fqwb_input_method()
+    : dict_manager(nullptr), lookup_generation(0), initialized(false), auto_commit(true), shift_select(true), wildcard_enabled(true), continuous_input(false),
+      deferred_lookup_enabled(false), current_page(0), page_size(9), completion_limit(9), sentence_count(static_cast<int>(DEFAULT_SENTENCE_COUNT)) {
     dict_manager = new dictionary_manager();
+    
+    // 预留编码和上屏缓冲区，按键处理过程中不再分配内存
+    current_code.reserve(MAX_CODE_LENGTH);
+    committed_text.reserve(COMMIT_BUFFER_SIZE);
+    wildcard_candidates.reserve(MAX_WILDCARD_CANDIDATES);
+    association_candidates.reserve(MAX_ASSOCIATION_CANDIDATES);
+    previous_commit.reserve(COMMIT_BUFFER_SIZE);
+    deferred_request.code.reserve(MAX_CODE_LENGTH + 1);
+    deferred_request.exact.reserve(MAX_WILDCARD_CANDIDATES);
+    
+    // 连续输入的每一段取编码完全匹配的候选词（按使用频率排序）
+    lattice.set_limits(DEFAULT_SENTENCE_COUNT, MAX_CODE_LENGTH);
+    segment_source = [this](const std::wstring& code, std::vector<std::wstring_view>& result) {
+        dict_manager->search_exact(code, segment_buffer, result);
+    };
 }
 
 fqwb_input_method::~fqwb_input_method() {
+    // 后台查询使用词库管理器，先等待查询线程退出
+    lookup_worker.stop();
     if (dict_manager) {
         delete dict_manager;
         dict_manager = nullptr;
@@ -235,6 +2284,7 @@ fqwb_input_method::~fqwb_input_method() {
 bool fqwb_input_method::initialize(const std::wstring& data_dir) {
     if (dict_manager) {
         initialized = dict_manager->initialize(data_dir);
+        dict_manager->begin_lookup(cursor, deferred_lookup_enabled ? 0 : completion_limit);
     }
     return initialized;
 }
@@ -259,11 +2309,172 @@ bool fqwb_input_method::get_shift_select() const {
     return shift_select;
 }
 
+// 设置是否启用万能键
+void fqwb_input_method::set_wildcard_enabled(bool enable) {
+    wildcard_enabled = enable;
+    if (!enable && is_wildcard_input()) {
+        reset_input();
+    }
+}
+
+// 获取万能键功能状态
+bool fqwb_input_method::get_wildcard_enabled() const {
+    return wildcard_enabled;
+}
+
+// 设置连续输入功能，切换时清除当前输入
+void fqwb_input_method::set_continuous_input(bool enable) {
+    if (continuous_input != enable) {
+        reset_input();
+        continuous_input = enable;
+        current_code.reserve(enable ? MAX_CONTINUOUS_LENGTH : MAX_CODE_LENGTH);
+    }
+}
+
+// 获取连续输入功能状态
+bool fqwb_input_method::get_continuous_input() const {
+    return continuous_input;
+}
+
+// 设置连续输入的整句候选词数量
+void fqwb_input_method::set_sentence_count(int count) {
+    if (count > 0) {
+        sentence_count = count;
+        lattice.set_limits(static_cast<size_t>(count), MAX_CODE_LENGTH);
+        refresh_candidates();
+    }
+}
+
+// 获取连续输入的整句候选词数量
+int fqwb_input_method::get_sentence_count() const {
+    return sentence_count;
+}
+
+// 设置联想功能
+void fqwb_input_method::set_association_enabled(bool enable) {
+    if (dict_manager) {
+        dict_manager->set_association_enabled(enable);
+    }
+    if (!enable) {
+        end_associations();
+    }
+}
+
+// 获取联想功能状态
+bool fqwb_input_method::get_association_enabled() const {
+    return dict_manager && dict_manager->get_association_enabled();
+}
+
+// 设置是否在后台线程中计算耗时的候选词
+bool fqwb_input_method::set_deferred_lookup(bool enable) {
+    if (enable == deferred_lookup_enabled) {
+        return true;
+    }
+    if (enable) {
+        if (!start_deferred_worker()) {
+            return false;
+        }
+    } else {
+        lookup_worker.stop();
+        deferred_candidates.clear();
+        deferred_data = lookup_source();
+    }
+    deferred_lookup_enabled = enable;
+    
+    // 补全由后台线程查询时游标只缓存完全匹配（和模糊音）的候选词
+    cursor.set_completion_limit(enable ? 0 : completion_limit);
+    refresh_candidates();
+    return true;
+}
+
+// 获取后台查询功能状态
+bool fqwb_input_method::get_deferred_lookup() const {
+    return deferred_lookup_enabled;
+}
+
+// 设置后台查询完成时的通知
+void fqwb_input_method::set_deferred_notify(const std::function<void()>& notify) {
+    deferred_notify = notify;
+    if (deferred_lookup_enabled) {
+        start_deferred_worker();
+        refresh_candidates();
+    }
+}
+
+// 替换后台查询方式
+void fqwb_input_method::set_deferred_lookup_source(const deferred_lookup& source) {
+    deferred_source = source;
+    if (deferred_lookup_enabled) {
+        start_deferred_worker();
+        refresh_candidates();
+    }
+}
+
+// 合并已完成的后台查询结果
+bool fqwb_input_method::poll_deferred_candidates() {
+    if (!deferred_lookup_enabled || !lookup_worker.take(lookup_generation, deferred_candidates, deferred_data)) {
+        return false;
+    }
+    
+    // 输入线程已有的候选词仍排在最前且顺序不变，保持当前页
+    current_candidates = candidate_span(deferred_candidates.data(), deferred_candidates.size());
+    return true;
+}
+
+bool fqwb_input_method::start_deferred_worker() {
+    deferred_lookup lookup = deferred_source;
+    if (!lookup) {
+        // 默认在发出查询时的词库数据上通配查询或追加补全
+        lookup = [this](const deferred_query& query, const lookup_cancel& cancel, std::vector<candidate_view>& result) {
+            if (query.wildcard) {
+                dict_manager->search_wildcard(query.source, query.code, query.limit, result, cancel);
+            } else {
+                result.assign(query.exact.begin(), query.exact.end());
+                dict_manager->search_completions(query.source, query.code, query.limit, deferred_buffer, result, cancel);
+            }
+        };
+    }
+    return lookup_worker.start(lookup, deferred_notify);
+}
+
+void fqwb_input_method::request_deferred_candidates() {
+    // 之前发出的查询和已合并的结果都已过期（调用前当前候选词已不再指向deferred_candidates）
+    lookup_generation++;
+    deferred_candidates.clear();
+    if (!deferred_lookup_enabled) {
+        return;
+    }
+    if (current_code.empty() || continuous_input) {
+        lookup_worker.cancel(lookup_generation);
+        return;
+    }
+    
+    deferred_request.generation = lookup_generation;
+    deferred_request.wildcard = is_wildcard_input();
+    if (deferred_request.wildcard) {
+        deferred_request.code.assign(wildcard_pattern);
+        deferred_request.limit = MAX_WILDCARD_CANDIDATES;
+        deferred_request.exact.clear();
+    } else {
+        if (completion_limit <= 0) {
+            lookup_worker.cancel(lookup_generation);
+            return;
+        }
+        candidate_span exact = cursor.get_candidates();
+        deferred_request.code.assign(current_code);
+        deferred_request.limit = static_cast<size_t>(completion_limit);
+        deferred_request.exact.assign(exact.begin(), exact.end());
+    }
+    deferred_request.source = dict_manager->get_lookup_source();
+    lookup_worker.submit(deferred_request);
+}
+
 // 翻到下一页
 void fqwb_input_method::next_page() {
     int total_pages = get_total_pages();
     if (current_page < total_pages - 1) {
         current_page++;
+        FQWB_STAT_ADD(pages_flipped, 1);
     }
 }
 
@@ -271,6 +2482,7 @@ void fqwb_input_method::next_page() {
 void fqwb_input_method::prev_page() {
     if (current_page > 0) {
         current_page--;
+        FQWB_STAT_ADD(pages_flipped, 1);
     }
 }
 
@@ -301,46 +2513,316 @@ int fqwb_input_method::get_page_size() const {
 }
 
 // 获取当前页的候选词
-std::vector<std::wstring> fqwb_input_method::get_current_page_candidates() const {
-    std::vector<std::wstring> result;
-    
+candidate_span fqwb_input_method::get_current_page_candidates() const {
     if (current_candidates.empty() || page_size <= 0) {
-        return result;
+        return candidate_span();
+    }
+    
+    // 直接返回候选词列表中的一段，不复制候选词
+    return current_candidates.subspan(static_cast<size_t>(current_page) * page_size, page_size);
+}
+
+// 设置补全候选词的数量上限
+void fqwb_input_method::set_completion_limit(int limit) {
+    if (limit >= 0) {
+        completion_limit = limit;
+        cursor.set_completion_limit(deferred_lookup_enabled ? 0 : limit);
+        refresh_candidates();
+    }
+}
+
+// 获取补全候选词的数量上限
+int fqwb_input_method::get_completion_limit() const {
+    return completion_limit;
+}
+
+// 设置是否启用模糊音
+void fqwb_input_method::set_fuzzy_enabled(bool enable) {
+    if (dict_manager) {
+        dict_manager->set_fuzzy_enabled(enable);
+        refresh_candidates();
+    }
+}
+
+// 获取模糊音功能状态
+bool fqwb_input_method::get_fuzzy_enabled() const {
+    return dict_manager && dict_manager->get_fuzzy_enabled();
+}
+
+// 设置模糊音规则
+void fqwb_input_method::set_fuzzy_rules(const fuzzy_rules& rules) {
+    if (dict_manager) {
+        dict_manager->set_fuzzy_rules(rules);
+        refresh_candidates();
+    }
+}
+
+// 启用或禁用词库热更新
+bool fqwb_input_method::set_hot_reload(bool enable) {
+    if (!dict_manager) {
+        return false;
+    }
+    
+    if (!enable) {
+        dict_manager->stop_watching();
+        return true;
+    }
+    return dict_manager->start_watching();
+}
+
+// 设置词库层叠
+bool fqwb_input_method::set_dictionary_stack(const std::vector<std::wstring>& dict_names) {
+    if (!dict_manager || !dict_manager->set_dictionary_stack(dict_names)) {
+        return false;
+    }
+    refresh_candidates();
+    return true;
+}
+
+// 开始记录按键轨迹
+bool fqwb_input_method::start_trace(const std::wstring& file_path) {
+    return trace.open(file_path);
+}
+
+// 停止记录按键轨迹
+void fqwb_input_method::stop_trace() {
+    trace.close();
+}
+
+// 词库或查询设置变化后按当前编码重新获取候选词
+void fqwb_input_method::refresh_candidates() {
+    if (dict_manager && is_association_input()) {
+        // 联想词可能指向旧词库的词条，按新词库重新查询
+        dict_manager->search_associations(previous_commit, MAX_ASSOCIATION_CANDIDATES, association_candidates);
+        current_candidates = candidate_span(association_candidates.data(), association_candidates.size());
+        current_page = 0;
+        return;
+    }
+    if (dict_manager && !current_code.empty()) {
+        if (continuous_input) {
+            // 整句候选词指向旧词库的词条，按新词库重建网格
+            lattice.assign(current_code, segment_source);
+            update_sentences();
+            return;
+        }
+        bool wildcard = is_wildcard_input();
+        dict_manager->refresh_lookup(cursor);
+        if (wildcard) {
+            // 含万能键的编码按完整编码重新查询，旧的候选词视图可能已失效
+            search_wildcard_code(current_code);
+        } else {
+            current_code = cursor.get_code();
+            current_candidates = cursor.get_candidates();
+            request_deferred_candidates();
+        }
+        current_page = 0;
+    }
+}
+
+bool fqwb_input_method::is_wildcard_input() const {
+    return !continuous_input && current_code.size() > cursor.get_code().size();
+}
+
+bool fqwb_input_method::search_wildcard_code(const std::wstring& code) {
+    // 启用补全时同时列出更长的编码
+    wildcard_pattern.assign(code);
+    if (completion_limit > 0) {
+        wildcard_pattern += WILDCARD_ANY_SUFFIX;
+    }
+    if (deferred_lookup_enabled) {
+        // 通配查询交给后台线程，结果返回前没有候选词
+        wildcard_candidates.clear();
+        current_candidates = candidate_span();
+        request_deferred_candidates();
+        return true;
+    }
+    dict_manager->search_wildcard(wildcard_pattern, MAX_WILDCARD_CANDIDATES, wildcard_candidates);
+    current_candidates = candidate_span(wildcard_candidates.data(), wildcard_candidates.size());
+    return !wildcard_candidates.empty();
+}
+
+void fqwb_input_method::update_sentences() {
+    // 候选词为能完整切分的最长前缀的前几个整句；不同切分可能得到相同的整句，只保留得分高的
+    current_code = lattice.get_code();
+    size_t length = lattice.get_segmented_length();
+    size_t count = lattice.get_sentence_count(length);
+    if (sentence_texts.size() < count) {
+        sentence_texts.resize(count);
+    }
+    sentence_candidates.clear();
+    sentence_ranks.clear();
+    for (size_t rank = 0; rank < count; rank++) {
+        std::wstring& text = sentence_texts[sentence_candidates.size()];
+        lattice.get_sentence(length, rank, text, sentence_segments);
+        if (std::find(sentence_candidates.begin(), sentence_candidates.end(), candidate_view(text)) == sentence_candidates.end()) {
+            sentence_candidates.push_back(text);
+            sentence_ranks.push_back(rank);
+        }
+    }
+    current_candidates = candidate_span(sentence_candidates.data(), sentence_candidates.size());
+    current_page = 0;
+}
+
+bool fqwb_input_method::commit_sentence(int index) {
+    if (index < 0 || static_cast<size_t>(index) >= sentence_candidates.size()) {
+        return false;
+    }
+    
+    // 各段按自己的编码记录使用频率
+    size_t length = lattice.get_segmented_length();
+    lattice.get_sentence(length, sentence_ranks[index], committed_text, sentence_segments);
+    const std::wstring& code = lattice.get_code();
+    for (const sentence_segment& segment : sentence_segments) {
+        segment_code.assign(code, segment.start, segment.end - segment.start);
+        dict_manager->record_usage(segment_code, segment.phrase);
     }
+    trace.append_commit(committed_text);
     
-    int start_index = current_page * page_size;
-    int end_index = std::min(start_index + page_size, static_cast<int>(current_candidates.size()));
+    // 未能切分的剩余编码重建网格后继续输入
+    lattice.assign(std::wstring_view(code).substr(length), segment_source);
+    if (lattice.get_code().empty()) {
+        reset_input();
+    } else {
+        update_sentences();
+    }
+    show_associations();
+    return true;
+}
+
+bool fqwb_input_method::is_association_input() const {
+    return current_code.empty() && !current_candidates.empty();
+}
+
+void fqwb_input_method::show_associations() {
+    if (!dict_manager->get_association_enabled()) {
+        return;
+    }
     
-    for (int i = start_index; i < end_index; i++) {
-        result.push_back(current_candidates[i]);
+    // 连续两次上屏之间没有其他按键时学习联想
+    if (!previous_commit.empty()) {
+        dict_manager->learn_association(previous_commit, committed_text);
     }
+    previous_commit.assign(committed_text);
     
-    return result;
+    if (current_code.empty()) {
+        dict_manager->search_associations(committed_text, MAX_ASSOCIATION_CANDIDATES, association_candidates);
+        current_candidates = candidate_span(association_candidates.data(), association_candidates.size());
+        current_page = 0;
+    }
+}
+
+void fqwb_input_method::end_associations() {
+    previous_commit.clear();
+    if (is_association_input()) {
+        reset_input();
+    }
 }
 
 bool fqwb_input_method::process_key_input(UINT key_code, LPARAM lParam, bool is_down, bool* handled) {
+    // 获取Shift键状态
+#ifdef _WIN32
+    bool shift_pressed = (GetKeyState(VK_SHIFT) & 0x8000) != 0;
+#else
+    bool shift_pressed = false;
+#endif
+    
+    return process_key(key_code, is_down, shift_pressed, handled);
+}
+
+bool fqwb_input_method::process_key(UINT key_code, bool is_down, bool shift_pressed, bool* handled) {
     if (!initialized || !handled) {
-        *handled = false;
+        if (handled) {
+            *handled = false;
+        }
         return false;
     }
     
     *handled = true;
     
-    // 获取Shift键状态
-    bool shift_pressed = (GetKeyState(VK_SHIFT) & 0x8000) != 0;
+    // 统计按键数量，抽样测量处理耗时
+    FQWB_STAT_SAMPLED_TIMER(keys_processed, key_processing);
+    
+    // 记录按键轨迹（写入预留的缓冲区）
+    trace.append_key(key_code, is_down, shift_pressed);
+    
+    // 应用后台加载完成后的延迟词库切换或词库热更新，按新词库重新获取当前候选词
+    if (dict_manager->poll_pending_switch()) {
+        refresh_candidates();
+    }
+    
+    // 合并已完成的后台查询结果
+    poll_deferred_candidates();
     
     // 处理按键输入
     if (is_down) {
         // 字母键（A-Z）
         if (key_code >= 'A' && key_code <= 'Z') {
-            current_code += static_cast<wchar_t>(key_code);
-            current_candidates = dict_manager->search_code(current_code);
+            // 虚拟键码为大写字母，词库编码为小写
+            wchar_t c = static_cast<wchar_t>(key_code - 'A' + 'a');
+            
+            // 显示联想词时开始新的输入，这次输入上屏后仍与上一次上屏一起学习
+            if (is_association_input()) {
+                reset_input();
+            }
+            
+            // 连续输入：只计算分段网格新的一列，不限四码，不自动上屏
+            if (continuous_input) {
+                if (current_code.size() < MAX_CONTINUOUS_LENGTH) {
+                    lattice.push(c, segment_source);
+                    update_sentences();
+                }
+                return true;
+            }
+            
+            // 编码中已有万能键时按完整编码通配查询，没有候选词时拒绝该按键；不自动上屏
+            if (is_wildcard_input()) {
+                current_code += c;
+                if (!search_wildcard_code(current_code)) {
+                    current_code.pop_back();
+                    search_wildcard_code(current_code);
+                    return true;
+                }
+                current_page = 0;
+                return true;
+            }
+            
+            // 游标在上一级前缀的范围内收窄一次；没有编码以新前缀开头时直接拒绝该按键
+            unsigned long long cursor_version = cursor.get_version();
+            bool accepted = dict_manager->advance_lookup(cursor, c);
+            
+            // 游标可能已按新词库重建，候选词视图需要重新获取
+            current_code = cursor.get_code();
+            current_candidates = cursor.get_candidates();
+            if (!accepted) {
+                // 没有编码以新前缀开头时，万能键开始通配查询
+                if (wildcard_enabled && c == WILDCARD_KEY) {
+                    current_code += c;
+                    if (search_wildcard_code(current_code)) {
+                        current_page = 0;
+                    } else {
+                        current_code.pop_back();
+                        current_candidates = cursor.get_candidates();
+                    }
+                } else if (cursor.get_version() != cursor_version) {
+                    // 游标已重建，之前的后台查询结果随之失效
+                    request_deferred_candidates();
+                } else if (!deferred_candidates.empty()) {
+                    // 编码未变，仍显示已合并的后台查询结果
+                    current_candidates = candidate_span(deferred_candidates.data(), deferred_candidates.size());
+                }
+                return true;
+            }
+            current_page = 0;
             
-            // 实现四码上屏功能
-            if (auto_commit && current_code.length() == MAX_CODE_LENGTH && !current_candidates.empty()) {
-                select_candidate(0);
+            // 实现四码上屏功能（仅在编码完全匹配时上屏，不上屏补全候选词）
+            if (auto_commit && current_code.length() == MAX_CODE_LENGTH && cursor.get_exact_count() > 0) {
+                FQWB_STAT_ADD(auto_commits, 1);
+                commit_candidate(0);
+                return true;
             }
             
+            // 补全候选词在后台查询，完成后再合并
+            request_deferred_candidates();
             return true;
         }
         // 数字键（1-9）- 用于选择候选词
@@ -355,25 +2837,52 @@ bool fqwb_input_method::process_key_input(UINT key_code, LPARAM lParam, bool is_
             }
             
             if (index < current_candidates.size()) {
-                select_candidate(index);
+                commit_candidate(index);
             }
             return true;
         }
         // 退格键
         else if (key_code == VK_BACK) {
+            // 显示联想词时结束联想，退格键交给应用程序
+            if (is_association_input()) {
+                end_associations();
+                *handled = false;
+                return true;
+            }
             if (!current_code.empty()) {
-                current_code.pop_back();
-                if (!current_code.empty()) {
-                    current_candidates = dict_manager->search_code(current_code);
+                if (continuous_input) {
+                    // 丢弃分段网格的最后一列，无需重新查询
+                    lattice.pop();
+                    update_sentences();
+                    return true;
+                }
+                if (is_wildcard_input()) {
+                    // 删除万能键或其后的字符，删到万能键之前时回到游标缓存的结果
+                    current_code.pop_back();
+                    if (is_wildcard_input()) {
+                        search_wildcard_code(current_code);
+                        current_page = 0;
+                        return true;
+                    }
                 } else {
-                    current_candidates.clear();
+                    // 回到上一级缓存的游标位置，无需重新查询
+                    cursor.pop();
                 }
+                dict_manager->refresh_lookup(cursor);
+                current_code = cursor.get_code();
+                current_candidates = cursor.get_candidates();
+                current_page = 0;
+                request_deferred_candidates();
             }
             return true;
         }
         // ESC键 - 清除输入
         else if (key_code == VK_ESCAPE) {
-            clear_input();
+            if (is_association_input()) {
+                end_associations();
+                return true;
+            }
+            reset_input();
             return true;
         }
         // PageDown键 - 翻到下一页
@@ -392,41 +2901,104 @@ bool fqwb_input_method::process_key_input(UINT key_code, LPARAM lParam, bool is_
         }
         // Enter键 - 确认输入
         else if (key_code == VK_RETURN) {
+            // 联想词不因回车或空格上屏，结束联想后按键交给应用程序
+            if (is_association_input()) {
+                end_associations();
+                *handled = false;
+                return true;
+            }
             if (!current_candidates.empty()) {
-                select_candidate(0);
+                commit_candidate(0);
             }
             return true;
         }
         // 空格键 - 显示更多候选词或确认输入
         else if (key_code == VK_SPACE) {
+            if (is_association_input()) {
+                end_associations();
+                *handled = false;
+                return true;
+            }
             if (!current_candidates.empty()) {
-                select_candidate(0);
+                commit_candidate(0);
             }
             return true;
         }
+        
+        // 其他键（Shift除外，用于选择第二页）结束联想
+        if (key_code != VK_SHIFT) {
+            end_associations();
+        }
     }
     
     *handled = false;
     return true;
 }
 
-const std::vector<std::wstring>& fqwb_input_method::get_candidates() {
+candidate_span fqwb_input_method::get_candidates() const {
     return current_candidates;
 }
 
 std::wstring fqwb_input_method::select_candidate(int index) {
-    if (index >= 0 && index < current_candidates.size()) {
-        std::wstring selected = current_candidates[index];
-        clear_input();
-        return selected;
+    trace.append_select(static_cast<uint32_t>(index));
+    if (commit_candidate(index)) {
+        return committed_text;
     }
     return L"";
 }
 
+bool fqwb_input_method::commit_candidate(int index) {
+    if (is_association_input()) {
+        if (index < 0 || static_cast<size_t>(index) >= current_candidates.size()) {
+            return false;
+        }
+        
+        // 联想词没有编码，不记录使用频率；上屏后按联想词继续联想
+        committed_text.assign(current_candidates[index].data(), current_candidates[index].size());
+        trace.append_commit(committed_text);
+        reset_input();
+        show_associations();
+        return true;
+    }
+    if (continuous_input) {
+        return commit_sentence(index);
+    }
+    if (index >= 0 && index < current_candidates.size()) {
+        // 只记录完全匹配的候选词，补全候选词和通配查询的候选词的编码与当前编码不同
+        if (!is_wildcard_input() && static_cast<size_t>(index) < cursor.get_exact_count()) {
+            dict_manager->record_usage(current_code, current_candidates[index]);
+        }
+        
+        // 上屏时才复制候选词，写入预留容量的缓冲区
+        committed_text.assign(current_candidates[index].data(), current_candidates[index].size());
+        trace.append_commit(committed_text);
+        reset_input();
+        show_associations();
+        return true;
+    }
+    return false;
+}
+
+const std::wstring& fqwb_input_method::get_committed_text() const {
+    return committed_text;
+}
+
 void fqwb_input_method::clear_input() {
+    trace.append_clear();
+    reset_input();
+    previous_commit.clear();
+}
+
+void fqwb_input_method::reset_input() {
     current_code.clear();
-    current_candidates.clear();
+    cursor.clear();
+    lattice.clear();
+    wildcard_candidates.clear();
+    sentence_candidates.clear();
+    association_candidates.clear();
+    current_candidates = candidate_span();
     current_page = 0; // 清除输入时重置到第一页
+    request_deferred_candidates();
 }
 
 const std::wstring& fqwb_input_method::get_current_code() const {
@@ -441,6 +3013,42 @@ bool fqwb_input_method::add_user_word(const std::wstring& code, const std::wstri
     return dict_manager->add_word(code, characters);
 }
 
+bool fqwb_input_method::add_user_word(const std::wstring& characters) {
+    if (!initialized || !dict_manager) {
+        return false;
+    }
+    
+    return dict_manager->add_phrase(characters);
+}
+
+bool fqwb_input_method::import_user_words(const std::vector<std::wstring>& phrases, size_t& imported) {
+    imported = 0;
+    if (!initialized || !dict_manager) {
+        return false;
+    }
+    
+    return dict_manager->import_phrases(phrases, imported);
+}
+
+size_t fqwb_input_method::find_codes(std::wstring_view phrase, std::vector<std::wstring>& codes) {
+    codes.clear();
+    if (!initialized || !dict_manager) {
+        return 0;
+    }
+    
+    return dict_manager->find_codes(phrase, codes);
+}
+
+#ifdef _WIN32
+// 输入法DLL的模块句柄，用于注册消息窗口类
+static HINSTANCE g_dll_instance = nullptr;
+
+// 消息窗口类名
+static const WCHAR NOTIFY_WINDOW_CLASS[] = L"fqwb_notify_window";
+
+// 后台查询完成的消息：查询线程发送到界面线程的消息窗口
+const UINT WM_FQWB_DEFERRED_READY = WM_APP + 1;
+
 // TSF文本服务类实现
 class fqwb_text_service : public ITfTextInputProcessor, public ITfThreadMgrEventSink, public ITfKeyEventSink {
 private:
@@ -450,10 +3058,48 @@ private:
     DWORD key_event_cookie;
     fqwb_input_method* input_method;
     bool is_active;
+    HWND notify_window;              // 界面线程中的消息窗口，接收后台查询完成的通知
+    candidate_span page_candidates;  // 候选窗口显示的当前页候选词
+
+    // 消息窗口过程：后台查询完成后在界面线程中合并结果并刷新候选窗口
+    static LRESULT CALLBACK notify_window_proc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+        if (message == WM_FQWB_DEFERRED_READY) {
+            fqwb_text_service* service = reinterpret_cast<fqwb_text_service*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA));
+            if (service && service->input_method && service->input_method->poll_deferred_candidates()) {
+                service->update_candidate_window();
+            }
+            return 0;
+        }
+        return DefWindowProcW(hwnd, message, wParam, lParam);
+    }
+    
+    // 在当前（界面）线程中创建只接收消息的窗口
+    bool create_notify_window() {
+        WNDCLASSEXW window_class = {};
+        window_class.cbSize = sizeof(window_class);
+        window_class.lpfnWndProc = notify_window_proc;
+        window_class.hInstance = g_dll_instance;
+        window_class.lpszClassName = NOTIFY_WINDOW_CLASS;
+        if (!RegisterClassExW(&window_class) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS) {
+            return false;
+        }
+        
+        notify_window = CreateWindowExW(0, NOTIFY_WINDOW_CLASS, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, g_dll_instance, nullptr);
+        if (!notify_window) {
+            return false;
+        }
+        SetWindowLongPtrW(notify_window, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+        return true;
+    }
+    
+    // 候选词变化后刷新候选窗口的内容（按键处理后和合并后台查询结果后）
+    void update_candidate_window() {
+        page_candidates = input_method->get_current_page_candidates();
+    }
 
 public:
     fqwb_text_service() : ref_count(1), thread_mgr(nullptr), thread_mgr_cookie(0), 
-                         key_event_cookie(0), input_method(nullptr), is_active(false) {
+                         key_event_cookie(0), input_method(nullptr), is_active(false), notify_window(nullptr) {
         input_method = new fqwb_input_method();
     }
     
@@ -521,6 +3167,22 @@ public:
             data_dir += L"\\Data";
             
             input_method->initialize(data_dir);
+            
+            // 设置了FQWB_TRACE_FILE环境变量时记录按键轨迹，用于复现输入延迟问题
+            WCHAR trace_path[MAX_PATH];
+            DWORD trace_length = GetEnvironmentVariableW(L"FQWB_TRACE_FILE", trace_path, ARRAYSIZE(trace_path));
+            if (trace_length > 0 && trace_length < ARRAYSIZE(trace_path)) {
+                input_method->start_trace(trace_path);
+            }
+            
+            // 补全和通配查询在后台线程中进行，按键不等待；查询完成的通知在查询线程中到达，转发到界面线程再合并结果
+            if (create_notify_window()) {
+                HWND window = notify_window;
+                input_method->set_deferred_notify([window]() {
+                    PostMessageW(window, WM_FQWB_DEFERRED_READY, 0, 0);
+                });
+                input_method->set_deferred_lookup(true);
+            }
         }
         
         // 注册线程管理器事件接收器
@@ -538,6 +3200,17 @@ public:
     }
     
     STDMETHODIMP Deactivate() {
+        // 先停止查询线程，之后不会再有通知发送到消息窗口
+        if (input_method) {
+            input_method->set_deferred_lookup(false);
+            input_method->set_deferred_notify(std::function<void()>());
+        }
+        if (notify_window) {
+            DestroyWindow(notify_window);
+            notify_window = nullptr;
+        }
+        page_candidates = candidate_span();
+        
         if (thread_mgr != nullptr) {
             // 取消注册事件接收器
             if (thread_mgr_cookie != 0) {
@@ -596,6 +3269,7 @@ public:
         } else {
             *pfEaten = FALSE;
         }
+        update_candidate_window();
         
         return S_OK;
     }
@@ -631,6 +3305,8 @@ public:
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
     switch (ul_reason_for_call) {
     case DLL_PROCESS_ATTACH:
+        g_dll_instance = hModule;
+        break;
     case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
     case DLL_PROCESS_DETACH:
@@ -675,4 +3351,5 @@ STDAPI DllRegisterServer(void) {
 STDAPI DllUnregisterServer(void) {
     // 简化实现，实际应用中需要注销输入法组件
     return S_OK;
-}
\ No newline at end of file
+}
+#endif // _WIN32
@@ -1,19 +1,62 @@
 // fqwb_tsf.h - 反切五笔输入法TSF接口头文件
-// 提供基于Windows TSF框架的输入法功能
+// 提供基于Windows TSF框架的输入法功能；其他平台上只提供不含TSF的输入法核心，用于无界面的回放和性能测试
 
 #ifndef FQWB_TSF_H
 #define FQWB_TSF_H
 
+#ifdef _WIN32
 #include <windows.h>
 #include <tchar.h>
 #include <msctf.h>
+#else
+#include <cstdint>
+
+// 输入法核心使用的Windows类型和虚拟键码
+typedef unsigned int UINT;
+typedef intptr_t LPARAM;
+
+#define VK_BACK   0x08
+#define VK_RETURN 0x0D
+#define VK_SHIFT  0x10
+#define VK_ESCAPE 0x1B
+#define VK_SPACE  0x20
+#define VK_PRIOR  0x21
+#define VK_NEXT   0x22
+#endif
+
 #include <vector>
+#include <algorithm>
 #include <string>
+#include <string_view>
 #include <map>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "fqwb_dict.h"
+#include "fqwb_usage.h"
+#include "fqwb_journal.h"
+#include "fqwb_assoc.h"
+#include "fqwb_fuzzy.h"
+#include "fqwb_reverse.h"
+#include "fqwb_store.h"
+#include "fqwb_userdict.h"
+#include "fqwb_epoch.h"
+#include "fqwb_watch.h"
+#include "fqwb_trace.h"
+#include "fqwb_stats.h"
+#include "fqwb_lattice.h"
 
+#ifdef _WIN32
 // 定义输入法GUID
 extern const GUID g_guidProfile;      // 输入法配置文件GUID
 extern const GUID g_guidInputMethod;  // 输入法GUID
+#endif
 
 // 词库数据结构
 struct dictionary_entry {
@@ -21,14 +64,379 @@ struct dictionary_entry {
     std::wstring characters; // 对应的汉字或词组
 };
 
+// 候选词视图：指向词库字符池中的词条，不拥有字符串
+// 在所属词库（或词库管理器的用户词条池）销毁前有效
+typedef std::wstring_view candidate_view;
+
+// 候选词范围：指向一段连续候选词视图，不复制候选词
+class candidate_span {
+private:
+    const candidate_view* items; // 第一个候选词
+    size_t count;                // 候选词数量
+
+public:
+    candidate_span() : items(nullptr), count(0) {}
+    candidate_span(const candidate_view* items, size_t count) : items(items), count(count) {}
+
+    const candidate_view* begin() const { return items; }
+    const candidate_view* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const candidate_view& operator[](size_t index) const { return items[index]; }
+
+    // 获取子范围[offset, offset + length)，超出部分自动截断
+    candidate_span subspan(size_t offset, size_t length) const {
+        if (offset >= count) {
+            return candidate_span();
+        }
+        return candidate_span(items + offset, std::min(length, count - offset));
+    }
+};
+
+// 候选词查询的工作缓冲区
+struct lookup_buffer {
+    completion_buffer completions;          // 补全查询
+    usage_rank_buffer ranking;              // 按使用频率排序
+    dedup_buffer dedup;                     // 模糊音和多词库层候选词去重
+    std::wstring fuzzy_key;                 // 当前前缀的规范模糊键
+    std::vector<code_range> layer_ranges;   // 前缀查询时各附加词库层的前缀范围
+    std::vector<completion_stream> streams; // 多词库层补全归并时各层的补全流
+};
+
+// 词库层：层叠查询中的一个只读词库
+struct dictionary_layer {
+    std::wstring name;                               // 词库名称
+    std::shared_ptr<const compiled_dictionary> data; // 词库数据
+};
+
+// 附加词库层列表（按优先级从高到低），只读，修改时整体替换
+typedef std::vector<dictionary_layer> dictionary_layer_list;
+
+// 查询所用的词库数据：在输入线程中取得，交给后台线程查询时保证词库数据和候选词视图在查询和显示期间有效
+struct lookup_source {
+    std::shared_ptr<const compiled_dictionary> dict;     // 当前词库
+    std::shared_ptr<const dictionary_layer_list> layers; // 附加词库层，为空表示只有当前词库
+    std::shared_ptr<const fuzzy_index> fuzzy;            // 模糊音索引，未启用模糊音时为空
+};
+
+// 后台查询的取消标志：发出查询后编码又有变化（最新代数与查询的代数不同）时取消
+struct lookup_cancel {
+    const std::atomic<unsigned long long>* latest; // 最新代数，为空表示不会取消
+    unsigned long long generation;                 // 查询的代数
+
+    bool cancelled() const {
+        return latest && latest->load(std::memory_order_acquire) != generation;
+    }
+};
+
+// 五笔万能键：匹配任意一个键（五笔编码不使用z）
+const wchar_t WILDCARD_KEY = L'z';
+
+// 通配查询模式末尾匹配任意长度后缀的通配符
+const wchar_t WILDCARD_ANY_SUFFIX = L'*';
+
+class dictionary_manager;
+
+// 逐键查询游标：缓存每一级已输入前缀在词库索引中的位置及其候选词
+// 追加一个字符只需在上一级范围内收窄一次，退格直接回到上一级缓存的结果
+class lookup_cursor {
+private:
+    friend class dictionary_manager;
+
+    // 一级前缀的查询状态
+    struct level {
+        size_t first;                         // 当前词库中以该前缀开头的编码范围起点
+        size_t last;                          // 当前词库中以该前缀开头的编码范围终点
+        std::vector<code_range> layer_ranges; // 各附加词库层中以该前缀开头的编码范围
+        bool user_match;                      // 用户词汇中是否存在以该前缀开头的编码
+        std::vector<candidate_view> candidates; // 该前缀的候选词（完全匹配在前，补全在后）
+        size_t exact_count;                   // 完全匹配的候选词数量
+    };
+
+    std::vector<level> levels;    // levels[0]为空前缀，levels[n]为前n个字符
+    std::wstring code;            // 当前前缀
+    size_t max_completions;       // 每级附带的补全候选词数量上限
+    unsigned long long version;   // 建立游标时的词库版本，词库变化后需要重建
+    std::shared_ptr<const compiled_dictionary> source; // 建立游标时的词库，保证候选词视图有效
+    std::shared_ptr<const dictionary_layer_list> source_layers; // 建立游标时的附加词库层
+    lookup_buffer buffer;         // 候选词查询的工作缓冲区
+
+    // 预留的前缀级数、每级候选词数量和附加词库层数，常规输入在预热后不再分配内存
+    static const size_t RESERVED_DEPTH = 8;
+    static const size_t RESERVED_EXACT = 32;
+    static const size_t RESERVED_LAYERS = 4;
+
+public:
+    lookup_cursor();
+
+    // 回到空前缀（保留已分配的缓存）
+    void clear();
+
+    // 退回上一级前缀，已在空前缀时返回false
+    bool pop();
+
+    // 设置补全候选词数量上限（下次查询时重建游标）
+    void set_completion_limit(size_t limit);
+
+    // 获取当前前缀
+    const std::wstring& get_code() const;
+
+    // 获取当前前缀的候选词
+    candidate_span get_candidates() const;
+
+    // 获取当前前缀完全匹配的候选词数量
+    size_t get_exact_count() const;
+
+    // 获取建立游标时的词库版本，游标重建后会变化
+    unsigned long long get_version() const;
+};
+
+// 后台候选词查询请求
+struct deferred_query {
+    unsigned long long generation;     // 发出查询时的代数
+    std::wstring code;                 // 编码，通配查询时为通配模式
+    bool wildcard;                     // 是否为通配查询
+    size_t limit;                      // 补全候选词或通配查询候选词的数量上限
+    std::vector<candidate_view> exact; // 输入线程已得到的候选词（完全匹配和模糊音），补全排在其后
+    lookup_source source;              // 发出查询时的词库数据
+};
+
+// 后台查询方式：把完整的候选词列表写入result（复用其容量）；cancel.cancelled()为true时可以提前返回，结果不会被使用
+typedef std::function<void(const deferred_query& query, const lookup_cancel& cancel, std::vector<candidate_view>& result)> deferred_lookup;
+
+// 后台候选词查询线程
+// 只保留最新的一个请求：编码变化时代数递增，尚未开始的旧请求直接丢弃，进行中的查询在下一个检查点取消，代数过期的结果不交给输入线程
+// 请求和结果都以交换方式传递，预热后输入线程不分配内存
+class deferred_lookup_worker {
+private:
+    std::thread thread;                     // 查询线程
+    std::mutex mutex;                       // 保护以下请求、结果和状态
+    std::condition_variable cv;             // 新请求或退出通知
+    deferred_lookup lookup;                 // 查询方式
+    std::function<void()> notify;           // 有新结果时在查询线程中调用
+    deferred_query pending;                 // 等待查询的请求
+    bool has_pending;                       // 是否有等待查询的请求
+    bool stopping;                          // 通知查询线程退出
+    std::atomic<unsigned long long> latest; // 最新代数
+    std::vector<candidate_view> ready;      // 已完成、尚未取走的结果
+    lookup_source ready_source;             // 结果所用的词库数据
+    unsigned long long ready_generation;    // 结果的代数
+    bool has_ready;                         // 是否有尚未取走的结果
+
+    // 查询线程主循环
+    void run();
+
+public:
+    deferred_lookup_worker();
+    ~deferred_lookup_worker();
+
+    deferred_lookup_worker(const deferred_lookup_worker&) = delete;
+    deferred_lookup_worker& operator=(const deferred_lookup_worker&) = delete;
+
+    // 启动查询线程，已在运行时先停止；on_ready可以为空
+    bool start(const deferred_lookup& lookup_fn, const std::function<void()>& on_ready);
+
+    // 停止查询线程，等待进行中的查询返回，丢弃未取走的请求和结果
+    void stop();
+
+    // 查询线程是否在运行
+    bool is_running() const;
+
+    // 编码已变化：记录最新代数，更早的请求和结果作废，进行中的查询取消
+    void cancel(unsigned long long generation);
+
+    // 提交请求（与内部的请求对象交换，query换回之前的缓冲区），代数更早的请求和查询同时作废
+    void submit(deferred_query& query);
+
+    // 取走代数为generation的结果（与result、source交换），没有时返回false
+    bool take(unsigned long long generation, std::vector<candidate_view>& result, lookup_source& source);
+};
+
+// 单个词库文件的加载耗时
+struct dictionary_load_timing {
+    std::wstring dict_name;  // 词库名称
+    std::wstring file_path;  // 词库文件路径
+    bool compiled;           // 是否为预编译词库
+    bool succeeded;          // 是否加载成功
+    double load_ms;          // 加载耗时（毫秒）
+};
+
+// 词库加载方式
+enum class dictionary_load_policy {
+    load_all,           // 初始化时并行加载全部词库
+    load_on_demand,     // 初始化时只加载当前词库，其余词库在首次切换时加载
+    load_in_background  // 初始化时只加载当前词库，其余词库在低优先级后台线程中加载
+};
+
+// 切换到尚未加载完成的词库时的处理方式
+enum class dictionary_switch_policy {
+    wait_for_load,      // 等待该词库加载完成后切换
+    keep_current        // 继续使用当前词库，加载完成后再切换
+};
+
+// 词库注册信息，初始化时只记录文件信息，词库数据按需加载
+struct dictionary_slot {
+    // 加载状态
+    enum load_state {
+        registered,      // 已注册，尚未加载
+        loading,         // 正在加载
+        loaded,          // 已加载
+        failed           // 加载失败
+    };
+
+    std::wstring file_path;                          // 词库文件路径
+    bool compiled;                                   // 是否为预编译词库
+    std::wstring fallback_path;                      // 同名文本词库路径，预编译词库读取失败时改为解析该文件，没有时为空
+    unsigned long long file_size;                    // 文件大小
+    unsigned long long write_time;                   // 文件最后修改时间
+    load_state state;                                // 加载状态
+    double load_ms;                                  // 加载耗时（毫秒）
+    std::shared_ptr<const compiled_dictionary> data; // 词库数据，加载完成前为空
+    std::shared_ptr<const fuzzy_index> fuzzy;        // 模糊音索引，未启用模糊音时为空
+    unsigned long long fuzzy_version;                // 构建模糊音索引时的规则版本
+    std::shared_ptr<const reverse_index> reverse;    // 反查索引，第一次反查时构建
+    std::shared_ptr<const association_index> association; // 联想索引，启用联想后第一次使用时构建
+};
+
 // 词库管理器类
+// 查询（search_code、search_prefix、search_wildcard和游标操作）可在多个线程中与写入用户词汇同时进行：
+// 用户词汇以只读快照发布，查询时不加锁，写入线程之间互斥；切换词库和设置只在输入线程中进行
+// 用户词汇、用户词库日志、使用频率和联想记录由使用同一Data目录的会话共用（见user_data）
 class dictionary_manager {
 private:
-    std::map<std::wstring, std::vector<std::wstring>> dict; // 当前词库：编码到汉字的映射
-    std::map<std::wstring, std::map<std::wstring, std::vector<std::wstring>>> dictionaries; // 所有词库
+    std::shared_ptr<const compiled_dictionary> dict;        // 当前词库（指向dictionaries中的同一份数据）
+    std::shared_ptr<const dictionary_layer_list> extra_layers; // 排在当前词库之后的附加词库层，为空表示只查询当前词库
+    std::map<std::wstring, dictionary_slot> dictionaries;   // 所有已注册的词库，每个词库只存一份且只读
+    std::vector<std::wstring> registration_order;           // 词库注册顺序
+    std::shared_ptr<user_data> user;                        // 用户数据，初始化前为本会话独有的空数据，初始化后与同一目录的会话共用
     bool initialized;                                       // 是否已初始化
     std::wstring data_dir;                                  // 词库数据目录
     std::wstring current_dict_name;                         // 当前词库名称
+    std::atomic<unsigned long long> version;                // 当前词库版本，切换或重新加载词库时递增；与用户词汇版本之和为游标使用的内容版本
+    size_t max_load_threads;                                // 并行加载词库的线程数上限，0表示按CPU核数
+    bool share_dictionaries;                                // 是否与进程内其他会话共用词库数据
+    dictionary_load_policy load_policy;                     // 词库加载方式
+    dictionary_switch_policy switch_policy;                 // 切换到未加载完成的词库时的处理方式
+    bool fuzzy_enabled;                                     // 是否启用模糊音
+    std::shared_ptr<const fuzzy_rules> fuzzy_rule_set;      // 模糊音规则，修改时整体替换
+    unsigned long long fuzzy_version;                       // 模糊音规则版本
+    std::shared_ptr<const fuzzy_index> fuzzy;               // 当前词库的模糊音索引
+    bool association_enabled;                               // 是否启用联想
+    size_t association_memory_limit;                        // 每个词库的联想索引内存上限（字节）
+    std::vector<wchar_t> learned_text;                      // 本次查询到的学习联想词的副本，每个占LEARNED_ASSOCIATION_LENGTH个字符
+
+    mutable std::mutex load_mutex;                          // 保护dictionaries、加载队列和待切换词库
+    std::condition_variable load_cv;                        // 词库加载完成通知
+    std::deque<std::wstring> load_queue;                    // 后台加载队列
+    std::thread loader_thread;                              // 后台加载线程
+    bool loader_running;                                    // 后台加载线程是否在运行
+    std::atomic<bool> stop_loading;                         // 通知后台加载线程退出
+    std::wstring pending_dict_name;                         // 等待加载完成后切换的词库
+    std::atomic<bool> pending_ready;                        // 待切换的词库已加载完成
+    std::atomic<bool> reload_ready;                         // 有词库在后台重新加载完成
+    directory_watcher watcher;                              // 词库目录监视器
+
+    // 读取词库文件并构建只读词库，不修改管理器状态，可在工作线程中调用
+    // 使用共享词库时，进程内其他会话已加载同一版本的文件则直接共用
+    std::shared_ptr<const compiled_dictionary> read_dictionary_file(const std::wstring& file_path, bool compiled) const;
+
+    // 注册词库文件（不加载），调用时需持有load_mutex
+    void register_dictionary(const std::wstring& dict_name, const std::wstring& file_path, bool compiled,
+                             unsigned long long file_size, unsigned long long write_time);
+
+    // 在调用线程中加载已注册的词库；其他线程正在加载时等待其完成
+    std::shared_ptr<const compiled_dictionary> load_slot(const std::wstring& dict_name);
+
+    // 获取词库在当前规则下的模糊音索引，尚未构建时在调用线程中构建
+    std::shared_ptr<const fuzzy_index> get_fuzzy_index(const std::wstring& dict_name, const std::shared_ptr<const compiled_dictionary>& data);
+
+    // 获取词库的反查索引，尚未构建时在调用线程中构建
+    std::shared_ptr<const reverse_index> get_reverse_index(const std::wstring& dict_name, const std::shared_ptr<const compiled_dictionary>& data);
+    
+    // 获取词库的联想索引，尚未构建时在调用线程中构建
+    std::shared_ptr<const association_index> get_association_index(const std::wstring& dict_name, const std::shared_ptr<const compiled_dictionary>& data);
+    
+    // 为当前词库和附加词库层构建尚未构建的联想索引
+    void prepare_associations();
+    
+    // 反查和造词使用的词库快照：写入线程可能不是输入线程，不能直接读取dict、extra_layers和current_dict_name
+    struct phrase_source {
+        std::wstring dict_name;                              // 当前词库名称
+        std::shared_ptr<const compiled_dictionary> dict;     // 当前词库
+        std::shared_ptr<const dictionary_layer_list> layers; // 附加词库层，为空表示只有当前词库
+    };
+    
+    // 在load_mutex内取得当前词库和附加词库层的快照；输入线程修改这三个成员时也持有load_mutex
+    phrase_source get_phrase_source() const;
+    
+    // 依次反查快照中的当前词库、附加词库层和用户词汇中词条的编码，对每个编码调用visit，调用时需持有user->write_mutex
+    void visit_phrase_codes(const phrase_source& source, std::wstring_view phrase, const std::function<void(std::wstring_view code)>& visit);
+    
+    // 获取单字的全码：反查到的最长编码，长度相同时取先查到的；查不到时返回空
+    // 返回的视图指向快照中词库的编码字符池或用户词条反查表，调用时需持有user->write_mutex
+    std::wstring_view find_char_code(const phrase_source& source, std::wstring_view character);
+    
+    // 快照中的当前词库或附加词库层中编码code下是否已有该词条
+    bool is_phrase_in_layers(const phrase_source& source, std::wstring_view code, std::wstring_view characters) const;
+    
+    // 词库文件变化后在监视线程中重新加载该词库，完成后由poll_pending_switch换入
+    void reload_dictionary_file(const std::wstring& file_name);
+
+    // 追加附加词库层中编码恰为prefix的词条，layer_ranges为各层的前缀范围
+    void append_layer_phrases(const std::wstring& prefix, const code_range* layer_ranges, std::vector<candidate_view>& result) const;
+    
+    // 按编码由短到长归并词库base和附加词库层layers的补全词条，相同编码时优先级高的词库在前，最多追加到limit个候选词
+    void merge_layer_completions(const compiled_dictionary* base, const dictionary_layer_list& layers, const std::wstring& prefix, size_t first, size_t last,
+                                 const code_range* layer_ranges, size_t limit, lookup_buffer& buffer, std::vector<candidate_view>& result) const;
+    
+    // 当前词库或前layer_count个附加词库层中是否有该编码
+    bool is_code_in_layers(std::wstring_view code, size_t layer_count) const;
+    
+    // 按当前层叠重新获取附加词库层的数据，没有变化时返回空，调用时需持有load_mutex
+    std::shared_ptr<const dictionary_layer_list> reload_extra_layers() const;
+    
+    // 按编码顺序追加用户词汇中长度恰为length、且与通配模式pattern匹配的编码的词条，最多追加到limit个
+    // 返回是否还有与pattern匹配且长于length的编码
+    bool append_user_wildcard_matches(const std::wstring& pattern, size_t length, size_t limit, std::vector<candidate_view>& result) const;
+    
+    // 追加模糊键与prefix相同、编码不同的词条
+    void append_fuzzy_matches(const std::wstring& prefix, lookup_buffer& buffer, std::vector<candidate_view>& result) const;
+
+    // 将词库放入后台加载队列并确保后台线程在运行，调用时需持有load_mutex
+    void queue_background_load(const std::wstring& dict_name, bool urgent);
+
+    // 后台加载线程主循环
+    void background_load_loop();
+
+    // 按编码由短到长追加用户词汇中以prefix开头的更长编码的词条
+    void append_user_completions(const std::wstring& prefix, size_t max_phrases, std::vector<candidate_view>& result) const;
+
+    // 收集前缀的候选词：完全匹配在前（按使用频率排序），补全在后；[first, last)为当前词库中的前缀范围，layer_ranges为各附加词库层的前缀范围
+    // 返回完全匹配的候选词数量；只能在读取区内调用
+    size_t collect_candidates(const std::wstring& prefix, size_t first, size_t last, const code_range* layer_ranges, size_t max_completions,
+                              lookup_buffer& buffer, std::vector<candidate_view>& result) const;
+
+    // 将词条放入用户词条池，返回池中词条的视图，调用时需持有user->write_mutex
+    candidate_view intern_user_phrase(std::wstring_view characters);
+
+    // 获取用户词汇的当前快照，只能在读取区（epoch_guard）内调用，离开读取区后不再使用
+    const user_word_snapshot& get_user_words() const;
+    
+    // 获取游标使用的内容版本：当前词库版本与用户词汇版本之和，其他会话添加新词时也会变化
+    unsigned long long get_content_version() const;
+    
+    // 将一批(编码, 词条)加入用户词汇并发布新快照，已有的词条跳过，added_count返回实际加入的词条数量
+    // write_journal为true时先把加入的词条写入日志，写入失败时不发布快照并返回false；调用时需持有user->write_mutex
+    bool insert_user_words(const std::vector<std::pair<std::wstring_view, std::wstring_view>>& words, bool write_journal, size_t& added_count);
+    
+    // 发布新的用户词汇快照，旧快照在没有线程读取后释放，调用时需持有user->write_mutex
+    void publish_user_words(std::shared_ptr<const user_word_snapshot> snapshot);
+    
+    // 将一批新词加入用户词汇并写入日志，调用时需持有user->write_mutex
+    bool write_user_words(const std::vector<std::pair<std::wstring_view, std::wstring_view>>& words, size_t& added_count);
+
+    // 日志中的过期记录过多时在后台压缩日志，调用时需持有user->write_mutex
+    void compact_user_journal();
 
 public:
     dictionary_manager();
@@ -37,11 +445,82 @@ public:
     // 初始化词库
     bool initialize(const std::wstring& dir_path);
 
-    // 搜索编码对应的汉字
-    std::vector<std::wstring> search_code(const std::wstring& code);
+    // 搜索编码对应的汉字，结果写入result（复用其容量），返回候选词数量
+    // 候选词为指向词库字符池的视图，在当前词库保持加载期间有效
+    size_t search_code(const std::wstring& code, std::vector<candidate_view>& result) const;
+
+    // 前缀搜索：先返回编码完全匹配的词条，再按编码由短到长返回最多max_completions个补全词条
+    // 结果写入result（复用其容量），返回其中完全匹配的词条数量
+    size_t search_prefix(const std::wstring& prefix, size_t max_completions, std::vector<candidate_view>& result) const;
+
+    // 通配查询：pattern中的万能键z或?匹配任意一个字符，末尾的*匹配任意长度的后缀
+    // 候选词按编码由短到长排列，长度相同时依次为当前词库、附加词库层和用户词汇（各自按编码顺序），相同的词条只保留第一个
+    // 结果写入result（复用其容量），最多max_results个，返回候选词数量
+    size_t search_wildcard(const std::wstring& pattern, size_t max_results, std::vector<candidate_view>& result) const;
+
+    // 查询编码完全匹配的候选词（按使用频率排序，不含模糊音和补全候选词），用于连续输入的分段
+    // buffer为调用方复用的工作缓冲区，预热后不再分配内存；结果写入result（复用其容量），返回候选词数量
+    size_t search_exact(const std::wstring& code, lookup_buffer& buffer, std::vector<candidate_view>& result) const;
+    
+    // 获取当前词库和附加词库层，用于在其他线程中查询（只在输入线程中调用）
+    lookup_source get_lookup_source() const;
+    
+    // 在source上查询补全：result中已有前缀的完全匹配候选词，在其后按编码由短到长追加最多max_completions个补全词条（与search_prefix的补全部分相同）
+    // 可在其他线程中调用；cancel被取消时提前返回。返回候选词总数
+    size_t search_completions(const lookup_source& source, const std::wstring& prefix, size_t max_completions, lookup_buffer& buffer,
+                              std::vector<candidate_view>& result, const lookup_cancel& cancel) const;
+    
+    // 在source上通配查询，与search_wildcard相同；可在其他线程中调用，cancel被取消时在下一级编码长度之前返回
+    size_t search_wildcard(const lookup_source& source, const std::wstring& pattern, size_t max_results, std::vector<candidate_view>& result,
+                           const lookup_cancel& cancel) const;
+
+    // 将游标重置到空前缀
+    void begin_lookup(lookup_cursor& cursor, size_t max_completions) const;
+
+    // 游标前进一个字符；没有任何编码以新前缀开头时返回false，游标保持不变
+    bool advance_lookup(lookup_cursor& cursor, wchar_t c) const;
+
+    // 词库发生变化后按游标当前前缀重建游标
+    void refresh_lookup(lookup_cursor& cursor) const;
 
     // 添加新词到词库
     bool add_word(const std::wstring& code, const std::wstring& characters);
+    
+    // 添加新词到词库，编码按五笔词组取码规则由各字的全码生成；词库中已有该词条时不再添加
+    bool add_phrase(const std::wstring& characters);
+    
+    // 批量导入词组，编码自动生成，所有新词一次写入日志；imported为新增的词条数量
+    // 词库中已有的词条和无法生成编码的词组（不足两个字或有字查不到编码）跳过；写入日志失败时返回false
+    bool import_phrases(const std::vector<std::wstring>& phrases, size_t& imported);
+    
+    // 反查词条的编码：查询当前词库、附加词库层和用户词汇，结果写入codes（按编码由短到长排列，相同编码只保留一个），返回编码数量
+    // 各词库的反查索引在第一次反查时构建
+    size_t find_codes(std::wstring_view phrase, std::vector<std::wstring>& codes);
+    
+    // 按五笔词组取码规则生成词组编码（各字取反查到的最长编码为全码），无法生成时返回false
+    bool make_phrase_code(std::wstring_view phrase, std::wstring& code);
+    
+    // 获取已构建的反查索引占用的内存（字节）
+    size_t get_reverse_index_memory() const;
+    
+    // 查询联想词：上文取context的最后三、二、一个字，依次追加学习到的联想和当前词库、附加词库层的联想，相同的只保留第一个
+    // 结果写入result（复用其容量），最多max_results个，返回联想词数量；视图在下一次查询联想或切换词库前有效
+    size_t search_associations(std::wstring_view context, size_t max_results, std::vector<candidate_view>& result);
+    
+    // 记录一次连续上屏，用于之后的联想
+    void learn_association(std::wstring_view previous, std::wstring_view next);
+    
+    // 获取联想占用的内存（字节）：已构建的联想索引和学习到的联想
+    size_t get_association_memory() const;
+    
+    // 设置每个词库的联想索引内存上限（字节），已构建的索引按新上限重建
+    void set_association_memory_limit(size_t bytes);
+    
+    // 保存学习到的联想到Data目录
+    bool save_associations();
+    
+    // 清除学习到的联想
+    void clear_associations();
 
     // 保存用户词库
     bool save_user_dictionary();
@@ -49,20 +528,83 @@ public:
     // 清除用户词库
     bool clear_user_dictionary();
 
+    // 记录一次上屏，完全匹配候选词的排序随之调整
+    void record_usage(const std::wstring& code, std::wstring_view characters);
+
+    // 保存使用频率到Data目录
+    bool save_usage();
+
+    // 清除使用频率记录
+    void clear_usage();
+
     // 获取所有编码
     std::vector<std::wstring> get_all_codes();
     
-    // 加载指定词库文件
+    // 加载指定文本词库文件（在内存中构建为与预编译词库相同的只读格式）
     bool load_dictionary(const std::wstring& dict_name, const std::wstring& file_path);
     
-    // 切换到指定词库
+    // 以内存映射方式加载预编译词库文件
+    bool load_compiled_dictionary(const std::wstring& dict_name, const std::wstring& file_path);
+    
+    // 切换到指定词库（只切换引用，不复制词库数据）
+    // 词库尚未加载时按切换策略等待加载，或保持当前词库并在加载完成后切换
     bool switch_dictionary(const std::wstring& dict_name);
     
-    // 获取所有可用词库名称
+    // 设置词库层叠（按优先级从高到低）：第一个词库成为当前词库，其余作为附加词库层一起查询，用户词汇排在最后
+    // 尚未加载的词库在调用线程中加载；任一词库不可用时返回false，层叠保持不变
+    bool set_dictionary_stack(const std::vector<std::wstring>& dict_names);
+    
+    // 获取词库层叠（当前词库在前）
+    std::vector<std::wstring> get_dictionary_stack() const;
+    
+    // 应用已加载完成的延迟切换或当前词库的重新加载，返回是否换用了新的词库数据
+    bool poll_pending_switch();
+    
+    // 开始监视Data目录，词库文件变化时在后台重新加载（只读取变化的词库）
+    bool start_watching(watch_backend backend = watch_backend::automatic, unsigned int interval_ms = DEFAULT_WATCH_INTERVAL_MS);
+    
+    // 停止监视Data目录
+    void stop_watching();
+    
+    // 获取所有已注册的词库名称（包括尚未加载和加载失败的词库，加载状态由get_dictionary_state获取）
     std::vector<std::wstring> get_available_dictionaries() const;
     
+    // 获取词库的加载状态，词库未注册时返回false
+    bool get_dictionary_state(const std::wstring& dict_name, dictionary_slot::load_state& state) const;
+    
     // 获取当前词库名称
     std::wstring get_current_dictionary() const;
+    
+    // 设置并行加载词库的线程数上限（0表示按CPU核数）
+    void set_max_load_threads(size_t count);
+    
+    // 获取已加载的各词库文件的加载耗时（按注册顺序）
+    std::vector<dictionary_load_timing> get_load_timings() const;
+    
+    // 设置词库加载方式（在initialize之前调用）
+    void set_load_policy(dictionary_load_policy policy);
+    
+    // 设置是否与进程内其他会话共用词库数据（默认共用，在initialize之前调用）
+    // 不共用时每次加载都重新读取文件
+    void set_dictionary_sharing(bool enable);
+    
+    // 设置切换到未加载完成的词库时的处理方式
+    void set_switch_policy(dictionary_switch_policy policy);
+    
+    // 启用或禁用模糊音，启用时为当前词库构建模糊音索引
+    void set_fuzzy_enabled(bool enable);
+    
+    // 获取模糊音功能状态
+    bool get_fuzzy_enabled() const;
+    
+    // 设置模糊音规则，已构建的索引在下次使用时按新规则重建
+    void set_fuzzy_rules(const fuzzy_rules& rules);
+    
+    // 启用或禁用联想，启用时为当前词库和附加词库层构建联想索引
+    void set_association_enabled(bool enable);
+    
+    // 获取联想功能状态
+    bool get_association_enabled() const;
 };
 
 // 输入法核心类
@@ -70,13 +612,81 @@ class fqwb_input_method {
 private:
     dictionary_manager* dict_manager; // 词库管理器
     std::wstring current_code;        // 当前输入的编码
-    std::vector<std::wstring> current_candidates; // 当前候选词列表
+    std::wstring committed_text;      // 最近一次上屏的字符串
+    candidate_span current_candidates; // 当前候选词列表（指向游标缓存的候选词视图）
+    lookup_cursor cursor;             // 逐键查询游标
+    std::vector<candidate_view> wildcard_candidates; // 含万能键的编码的候选词
+    std::wstring wildcard_pattern;    // 通配查询模式
+    sentence_lattice lattice;         // 连续输入的分段网格
+    segment_lookup segment_source;    // 分段网格查询各段候选词的方式
+    lookup_buffer segment_buffer;     // 分段查询的工作缓冲区
+    std::vector<std::wstring> sentence_texts;        // 整句候选词的文字
+    std::vector<candidate_view> sentence_candidates; // 整句候选词（指向sentence_texts）
+    std::vector<size_t> sentence_ranks;              // 各整句候选词在网格中的序号
+    std::vector<sentence_segment> sentence_segments; // 取整句时的各段
+    std::wstring segment_code;        // 上屏整句时各段的编码
+    std::vector<candidate_view> association_candidates; // 上屏后的联想词
+    deferred_lookup deferred_source;  // 替换的后台查询方式，为空时使用默认方式
+    std::function<void()> deferred_notify; // 后台查询完成时的通知
+    deferred_query deferred_request;  // 复用的后台查询请求
+    lookup_buffer deferred_buffer;    // 后台查询的工作缓冲区，只在查询线程中使用
+    std::vector<candidate_view> deferred_candidates; // 合并了后台查询结果的候选词
+    lookup_source deferred_data;      // 后台查询结果所用的词库数据
+    deferred_lookup_worker lookup_worker; // 后台候选词查询线程（查询时使用以上的查询方式和缓冲区）
+    unsigned long long lookup_generation; // 编码代数，编码或候选词变化时递增
+    std::wstring previous_commit;     // 上一次上屏的字符串，下一次上屏时学习联想
+    key_trace_writer trace;           // 按键轨迹记录
     bool initialized;                 // 是否已初始化
     bool auto_commit;                 // 是否启用四码上屏功能
     bool shift_select;                // 是否启用Shift选择重码功能
+    bool wildcard_enabled;            // 是否启用万能键
+    bool continuous_input;            // 是否启用连续输入（整句切分）
+    bool deferred_lookup_enabled;     // 是否在后台线程中查询补全和通配候选词
     int current_page;                 // 当前页码
     int page_size;                    // 每页显示的候选词数量
+    int completion_limit;             // 补全候选词（更长编码）的数量上限，0表示不补全
+    int sentence_count;               // 连续输入的整句候选词数量
     static const int MAX_CODE_LENGTH = 4; // 最大编码长度（四码上屏）
+    static const size_t COMMIT_BUFFER_SIZE = 32; // 上屏字符串预留长度
+    static const size_t MAX_WILDCARD_CANDIDATES = 90; // 通配查询的候选词数量上限
+    static const size_t MAX_CONTINUOUS_LENGTH = 64; // 连续输入的最大编码长度
+    static const size_t MAX_ASSOCIATION_CANDIDATES = 2 * ASSOCIATION_TOP_K; // 联想词数量上限
+
+    // 上屏候选词，结果保存在committed_text中（复用其容量）
+    bool commit_candidate(int index);
+
+    // 清除当前编码和候选词
+    void reset_input();
+
+    // 词库或查询设置变化后按当前编码重新获取候选词
+    void refresh_candidates();
+
+    // 当前编码是否含万能键（游标只缓存万能键之前的前缀）
+    bool is_wildcard_input() const;
+
+    // 按编码通配查询候选词，返回是否有候选词
+    bool search_wildcard_code(const std::wstring& code);
+
+    // 按分段网格更新整句候选词
+    void update_sentences();
+
+    // 上屏整句候选词，未能切分的剩余编码保留为新的输入
+    bool commit_sentence(int index);
+    
+    // 是否正在显示联想词（没有编码而有候选词）
+    bool is_association_input() const;
+    
+    // 上屏后学习与上一次上屏的联想；启用联想且没有剩余编码时按上屏的字符串显示联想词
+    void show_associations();
+    
+    // 结束联想：清除联想词，之后的上屏不再与上一次上屏一起学习
+    void end_associations();
+    
+    // 编码或候选词已变化：作废之前的后台查询，启用后台查询时按当前编码发出新的查询
+    void request_deferred_candidates();
+    
+    // 按当前的查询方式和通知启动后台查询线程
+    bool start_deferred_worker();
 
 public:
     fqwb_input_method();
@@ -88,12 +698,18 @@ public:
     // 处理按键输入
     bool process_key_input(UINT key_code, LPARAM lParam, bool is_down, bool* handled);
 
-    // 获取当前候选词列表
-    const std::vector<std::wstring>& get_candidates();
+    // 处理按键输入，Shift状态由调用方提供而不读取系统按键状态（用于回放按键轨迹）
+    bool process_key(UINT key_code, bool is_down, bool shift_pressed, bool* handled);
+
+    // 获取当前候选词列表（视图在下一次按键处理前有效）
+    candidate_span get_candidates() const;
 
-    // 选择候选词
+    // 选择候选词，返回上屏的字符串（唯一创建候选词字符串副本的地方）
     std::wstring select_candidate(int index);
 
+    // 获取最近一次上屏的字符串（按键处理中的上屏不创建副本）
+    const std::wstring& get_committed_text() const;
+
     // 清除当前输入
     void clear_input();
 
@@ -103,6 +719,15 @@ public:
     // 添加用户自定义词汇
     bool add_user_word(const std::wstring& code, const std::wstring& characters);
     
+    // 添加用户自定义词汇，编码按五笔词组取码规则自动生成
+    bool add_user_word(const std::wstring& characters);
+    
+    // 批量导入用户词汇（编码自动生成），imported为新增的词条数量
+    bool import_user_words(const std::vector<std::wstring>& phrases, size_t& imported);
+    
+    // 反查词条的编码，返回编码数量
+    size_t find_codes(std::wstring_view phrase, std::vector<std::wstring>& codes);
+    
     // 设置四码上屏功能
     void set_auto_commit(bool enable);
     
@@ -115,6 +740,47 @@ public:
     // 获取Shift选择重码功能状态
     bool get_shift_select() const;
     
+    // 设置是否启用万能键（z匹配任意一个键，词库中没有以当前编码开头的编码时生效）
+    void set_wildcard_enabled(bool enable);
+    
+    // 获取万能键功能状态
+    bool get_wildcard_enabled() const;
+    
+    // 设置是否启用连续输入：编码不限四码，按词库切分为整句，候选词为得分最高的几个整句（不含补全和万能键）
+    void set_continuous_input(bool enable);
+    
+    // 获取连续输入功能状态
+    bool get_continuous_input() const;
+    
+    // 设置连续输入的整句候选词数量
+    void set_sentence_count(int count);
+    
+    // 获取连续输入的整句候选词数量
+    int get_sentence_count() const;
+    
+    // 设置是否启用联想：上屏后没有编码时候选词为接下来可能输入的词，数字键上屏，字母键开始新的输入，其他键结束联想
+    void set_association_enabled(bool enable);
+    
+    // 获取联想功能状态
+    bool get_association_enabled() const;
+    
+    // 设置是否在后台线程中计算耗时的候选词：按键时只计算完全匹配（和模糊音）的候选词，补全、多词库归并和通配查询交给后台线程，
+    // 完成后由poll_deferred_candidates（或下一次按键）合并到当前候选词之后；编码变化时取消进行中的查询，过期的结果不会显示
+    // 通配查询的结果返回前没有候选词，也不再因没有候选词而拒绝按键；无法启动查询线程时返回false
+    bool set_deferred_lookup(bool enable);
+    
+    // 获取后台查询功能状态
+    bool get_deferred_lookup() const;
+    
+    // 设置后台查询完成时的通知，在查询线程中调用（一般用于通知界面线程调用poll_deferred_candidates）
+    void set_deferred_notify(const std::function<void()>& notify);
+    
+    // 替换后台查询方式（用于测试和性能基准），传入空函数时恢复默认
+    void set_deferred_lookup_source(const deferred_lookup& source);
+    
+    // 在输入线程中合并已完成的后台查询结果，返回当前候选词是否有变化
+    bool poll_deferred_candidates();
+    
     // 翻到下一页
     void next_page();
     
@@ -134,7 +800,34 @@ public:
     int get_page_size() const;
     
     // 获取当前页的候选词
-    std::vector<std::wstring> get_current_page_candidates() const;
+    candidate_span get_current_page_candidates() const;
+    
+    // 设置补全候选词的数量上限
+    void set_completion_limit(int limit);
+    
+    // 获取补全候选词的数量上限
+    int get_completion_limit() const;
+    
+    // 设置是否启用模糊音
+    void set_fuzzy_enabled(bool enable);
+    
+    // 获取模糊音功能状态
+    bool get_fuzzy_enabled() const;
+    
+    // 设置模糊音规则
+    void set_fuzzy_rules(const fuzzy_rules& rules);
+    
+    // 启用或禁用词库热更新（监视Data目录，变化的词库在后台重新加载）
+    bool set_hot_reload(bool enable);
+    
+    // 设置词库层叠（按优先级从高到低，第一个为当前词库）
+    bool set_dictionary_stack(const std::vector<std::wstring>& dict_names);
+    
+    // 开始将按键、界面操作和上屏结果记录到按键轨迹文件
+    bool start_trace(const std::wstring& file_path);
+    
+    // 停止记录按键轨迹
+    void stop_trace();
 };
 
 // TSF文本服务类的前向声明
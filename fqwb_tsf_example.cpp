@@ -62,11 +62,11 @@ int main() {
                 std::cout << "\r当前编码: " << wstring_to_string(input_method->get_current_code()) << "\t";
 
                 // 显示候选词
-                const std::vector<std::wstring>& candidates = input_method->get_candidates();
+                candidate_span candidates = input_method->get_candidates();
                 if (!candidates.empty()) {
                     std::cout << "候选词: ";
                     for (size_t i = 0; i < candidates.size(); ++i) {
-                        std::cout << (i + 1) << ")" << wstring_to_string(candidates[i]) << " ";
+                        std::cout << (i + 1) << ")" << wstring_to_string(std::wstring(candidates[i])) << " ";
                     }
                 }
                 std::cout << "\n";
@@ -0,0 +1,260 @@
+// fqwb_usage.cpp - 反切五笔输入法使用频率统计实现文件
+
+#include "fqwb_usage.h"
+#include "fqwb_dict.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char USAGE_FILE_MAGIC[4] = { 'F', 'Q', 'W', 'U' };
+
+// 散列表初始容量
+const size_t USAGE_INITIAL_CAPACITY = 1024;
+
+// 使用频率文件头，其后紧跟count个表项
+struct usage_file_header {
+    char magic[4];          // 文件标识 "FQWU"
+    uint32_t version;       // 格式版本
+    uint32_t decay_seconds; // 衰减时间常数
+    uint32_t reserved;      // 保留字段
+    uint64_t count;         // 表项数量
+};
+
+// 使用频率文件中的表项
+struct usage_file_entry {
+    uint64_t key;
+    float score;
+    uint32_t last_used;
+};
+
+} // namespace
+
+// usage_tracker 类实现
+usage_tracker::usage_tracker() : count(0), decay_seconds(DEFAULT_USAGE_DECAY_SECONDS), modified(false) {
+}
+
+uint64_t usage_tracker::make_key(std::wstring_view code, std::wstring_view phrase) {
+    // FNV-1a，编码与词条之间以0分隔；按字符值散列，与wchar_t宽度无关
+    uint64_t hash = 14695981039346656037ULL;
+    for (wchar_t c : code) {
+        hash ^= static_cast<uint32_t>(c);
+        hash *= 1099511628211ULL;
+    }
+    hash *= 1099511628211ULL;
+    for (wchar_t c : phrase) {
+        hash ^= static_cast<uint32_t>(c);
+        hash *= 1099511628211ULL;
+    }
+
+    // 0保留给空位
+    return hash != 0 ? hash : 1;
+}
+
+size_t usage_tracker::find_slot(uint64_t key) const {
+    size_t mask = table.size() - 1;
+    size_t slot = static_cast<size_t>(key ^ (key >> 32)) & mask;
+    while (table[slot].key != 0 && table[slot].key != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void usage_tracker::grow() {
+    std::vector<usage_entry> old_table;
+    old_table.swap(table);
+    table.assign(old_table.empty() ? USAGE_INITIAL_CAPACITY : old_table.size() * 2, usage_entry{ 0, 0.0f, 0 });
+
+    for (const usage_entry& entry : old_table) {
+        if (entry.key != 0) {
+            table[find_slot(entry.key)] = entry;
+        }
+    }
+}
+
+float usage_tracker::decayed_score(const usage_entry& entry, uint32_t time) const {
+    if (time <= entry.last_used || decay_seconds == 0) {
+        return entry.score;
+    }
+    return entry.score * static_cast<float>(std::exp(-static_cast<double>(time - entry.last_used) / decay_seconds));
+}
+
+uint32_t usage_tracker::now() {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+void usage_tracker::record(std::wstring_view code, std::wstring_view phrase, uint32_t time) {
+    record_key(make_key(code, phrase), time);
+}
+
+void usage_tracker::record(std::wstring_view code, std::wstring_view phrase) {
+    record(code, phrase, now());
+}
+
+void usage_tracker::record_key(uint64_t key, uint32_t time) {
+    // 装载因子保持在0.7以下
+    if ((count + 1) * 10 > table.size() * 7) {
+        grow();
+    }
+
+    usage_entry& entry = table[find_slot(key)];
+    if (entry.key == 0) {
+        entry.key = key;
+        entry.score = 0.0f;
+        entry.last_used = time;
+        count++;
+    }
+
+    entry.score = decayed_score(entry, time) + 1.0f;
+    entry.last_used = std::max(entry.last_used, time);
+    modified = true;
+}
+
+float usage_tracker::get_score(std::wstring_view code, std::wstring_view phrase, uint32_t time) const {
+    if (count == 0) {
+        return 0.0f;
+    }
+
+    const usage_entry& entry = table[find_slot(make_key(code, phrase))];
+    return entry.key != 0 ? decayed_score(entry, time) : 0.0f;
+}
+
+void usage_tracker::rank(std::wstring_view code, std::wstring_view* candidates, size_t candidate_count, usage_rank_buffer& buffer) const {
+    if (count == 0 || candidate_count < 2) {
+        return;
+    }
+
+    // 每个候选词一次散列查找
+    uint32_t time = now();
+    bool has_score = false;
+    buffer.entries.clear();
+    for (size_t i = 0; i < candidate_count; i++) {
+        float score = get_score(code, candidates[i], time);
+        has_score = has_score || score > 0.0f;
+        buffer.entries.push_back(usage_rank_buffer::ranked_entry{ score, static_cast<uint32_t>(i) });
+    }
+
+    // 都没有使用记录时保持原有顺序
+    if (!has_score) {
+        return;
+    }
+
+    std::sort(buffer.entries.begin(), buffer.entries.end(),
+        [](const usage_rank_buffer::ranked_entry& a, const usage_rank_buffer::ranked_entry& b) {
+            return a.score != b.score ? a.score > b.score : a.index < b.index;
+        });
+
+    buffer.views.assign(candidates, candidates + candidate_count);
+    for (size_t i = 0; i < candidate_count; i++) {
+        candidates[i] = buffer.views[buffer.entries[i].index];
+    }
+}
+
+void usage_tracker::set_decay_seconds(uint32_t seconds) {
+    decay_seconds = seconds;
+}
+
+size_t usage_tracker::size() const {
+    return count;
+}
+
+bool usage_tracker::is_modified() const {
+    return modified;
+}
+
+void usage_tracker::clear() {
+    table.clear();
+    count = 0;
+    modified = true;
+}
+
+bool usage_tracker::load(const std::wstring& file_path) {
+    try {
+        std::ifstream file(native_path(file_path), std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        usage_file_header header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            memcmp(header.magic, USAGE_FILE_MAGIC, sizeof(USAGE_FILE_MAGIC)) != 0 ||
+            header.version != USAGE_FILE_VERSION) {
+            return false;
+        }
+
+        std::vector<usage_file_entry> entries(static_cast<size_t>(header.count));
+        if (!entries.empty() &&
+            !file.read(reinterpret_cast<char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(usage_file_entry)))) {
+            return false;
+        }
+
+        // 按表项数量一次分配好散列表
+        size_t capacity = USAGE_INITIAL_CAPACITY;
+        while (entries.size() * 10 > capacity * 7) {
+            capacity *= 2;
+        }
+        table.assign(capacity, usage_entry{ 0, 0.0f, 0 });
+        count = 0;
+
+        for (const usage_file_entry& entry : entries) {
+            if (entry.key == 0) {
+                continue;
+            }
+            usage_entry& slot = table[find_slot(entry.key)];
+            if (slot.key == 0) {
+                count++;
+            }
+            slot = usage_entry{ entry.key, entry.score, entry.last_used };
+        }
+
+        decay_seconds = header.decay_seconds;
+        modified = false;
+        return true;
+    }
+    catch (...) {
+        clear();
+        modified = false;
+        return false;
+    }
+}
+
+void usage_tracker::serialize(std::vector<uint8_t>& data) const {
+    usage_file_header header;
+    memcpy(header.magic, USAGE_FILE_MAGIC, sizeof(header.magic));
+    header.version = USAGE_FILE_VERSION;
+    header.decay_seconds = decay_seconds;
+    header.reserved = 0;
+    header.count = count;
+
+    data.resize(sizeof(header) + count * sizeof(usage_file_entry));
+    memcpy(data.data(), &header, sizeof(header));
+    size_t offset = sizeof(header);
+    for (const usage_entry& entry : table) {
+        if (entry.key != 0) {
+            usage_file_entry record = { entry.key, entry.score, entry.last_used };
+            memcpy(data.data() + offset, &record, sizeof(record));
+            offset += sizeof(record);
+        }
+    }
+}
+
+bool usage_tracker::save(const std::wstring& file_path) {
+    try {
+        // 保存中途失败或断电时不能留下写了一半的记录：先写临时文件，写完后改名替换
+        std::vector<uint8_t> data;
+        serialize(data);
+        if (!write_file_replacing(data, file_path)) {
+            return false;
+        }
+
+        modified = false;
+        return true;
+    }
+    catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,103 @@
+// fqwb_usage.h - 反切五笔输入法使用频率统计
+// 按(编码, 词条)记录带时间衰减的使用频率，用于候选词排序
+
+#ifndef FQWB_USAGE_H
+#define FQWB_USAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 使用频率文件名
+#define FQWB_USAGE_FILE_NAME L"usage.bin"
+
+// 使用频率文件格式版本
+const uint32_t USAGE_FILE_VERSION = 1;
+
+// 默认衰减时间常数（秒）：与历史记录相同，7天未使用的词条权重降为原来的1/e
+const uint32_t DEFAULT_USAGE_DECAY_SECONDS = 7 * 24 * 3600;
+
+// 候选词排序的工作缓冲区，由调用方持有并在多次排序之间复用
+struct usage_rank_buffer {
+    struct ranked_entry {
+        float score;    // 当前时刻的衰减后得分
+        uint32_t index; // 原始位置，得分相同时保持原有顺序
+    };
+
+    std::vector<ranked_entry> entries;
+    std::vector<std::wstring_view> views;
+};
+
+// 使用频率统计
+// 每个(编码, 词条)只占一个16字节的表项：64位散列键、得分和最近使用时间
+// 表项存放在开放寻址散列表中，记录和查询都是O(1)
+class usage_tracker {
+private:
+    // 散列表表项，key为0表示空位
+    struct usage_entry {
+        uint64_t key;       // (编码, 词条)的64位散列
+        float score;        // 最近使用时刻的得分
+        uint32_t last_used; // 最近使用时间（Unix时间，秒）
+    };
+
+    std::vector<usage_entry> table; // 开放寻址散列表，容量为2的幂
+    size_t count;                   // 已使用的表项数量
+    uint32_t decay_seconds;         // 衰减时间常数
+    bool modified;                  // 自上次保存或加载后是否有变化
+
+    // 查找键所在位置，不存在时返回应插入的空位
+    size_t find_slot(uint64_t key) const;
+
+    // 扩容并重新散列
+    void grow();
+
+    // 计算表项在time时刻的衰减后得分
+    float decayed_score(const usage_entry& entry, uint32_t time) const;
+
+public:
+    usage_tracker();
+
+    // 获取当前时间（Unix时间，秒）
+    static uint32_t now();
+
+    // 计算(编码, 词条)的散列键
+    static uint64_t make_key(std::wstring_view code, std::wstring_view phrase);
+
+    // 记录一次使用：得分先按间隔时间衰减再加1
+    void record(std::wstring_view code, std::wstring_view phrase, uint32_t time);
+    void record(std::wstring_view code, std::wstring_view phrase);
+
+    // 按散列键记录一次使用，与record(编码, 词条, time)相同
+    void record_key(uint64_t key, uint32_t time);
+
+    // 获取(编码, 词条)在time时刻的得分，从未使用过时为0
+    float get_score(std::wstring_view code, std::wstring_view phrase, uint32_t time) const;
+
+    // 按得分从高到低重排同一编码下的候选词，得分相同的候选词保持原有顺序
+    void rank(std::wstring_view code, std::wstring_view* candidates, size_t candidate_count, usage_rank_buffer& buffer) const;
+
+    // 设置衰减时间常数（秒）
+    void set_decay_seconds(uint32_t seconds);
+
+    // 获取已记录的(编码, 词条)数量
+    size_t size() const;
+
+    // 是否有尚未保存的变化
+    bool is_modified() const;
+
+    // 清除所有记录
+    void clear();
+
+    // 从二进制文件加载，文件不存在或格式不符时返回false并保持为空
+    bool load(const std::wstring& file_path);
+
+    // 生成二进制文件的内容
+    void serialize(std::vector<uint8_t>& data) const;
+
+    // 保存到二进制文件
+    bool save(const std::wstring& file_path);
+};
+
+#endif // FQWB_USAGE_H
@@ -0,0 +1,181 @@
+// fqwb_userdict.cpp - 反切五笔输入法用户词汇快照实现文件
+
+#include "fqwb_userdict.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// 块内按编码比较
+bool code_less(const user_word_snapshot::value_type& entry, std::wstring_view code) {
+    return std::wstring_view(entry.first) < code;
+}
+
+bool code_greater(std::wstring_view code, const user_word_snapshot::value_type& entry) {
+    return code < std::wstring_view(entry.first);
+}
+
+// 块和组的末尾编码
+std::wstring_view get_last_code(const std::shared_ptr<const user_word_snapshot::block>& entries) {
+    return entries->back().first;
+}
+
+std::wstring_view get_last_code(const std::shared_ptr<const user_word_snapshot::block_group>& group) {
+    return group->back()->back().first;
+}
+
+// 在按编码排序的块（组）中查找第一个末尾编码不小于（strict为true时大于）code的，都小于时返回items.size()
+template <typename T>
+size_t find_item(const std::vector<std::shared_ptr<const T>>& items, std::wstring_view code, bool strict) {
+    size_t low = 0;
+    size_t high = items.size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        std::wstring_view last_code = get_last_code(items[mid]);
+        if (strict ? last_code <= code : last_code < code) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// 新快照中已复制、可以直接修改的组及其中已复制的块，未复制时为空
+struct writable_group {
+    user_word_snapshot::block_group* group;
+    std::vector<user_word_snapshot::block*> blocks;
+};
+
+} // namespace
+
+user_word_snapshot::user_word_snapshot() : code_count(0), word_count(0) {
+}
+
+user_word_snapshot::const_iterator user_word_snapshot::find_position(std::wstring_view code, bool strict) const {
+    size_t g = find_item(groups, code, strict);
+    if (g == groups.size()) {
+        return end();
+    }
+
+    // 该组（块）的末尾编码不小于code，结果一定在组（块）内
+    const block_group& group = *groups[g];
+    size_t b = find_item(group, code, strict);
+    const block& entries = *group[b];
+    auto it = strict ? std::upper_bound(entries.begin(), entries.end(), code, code_greater) : std::lower_bound(entries.begin(), entries.end(), code, code_less);
+    return const_iterator(this, g, b, static_cast<size_t>(it - entries.begin()));
+}
+
+user_word_snapshot::const_iterator user_word_snapshot::begin() const {
+    return const_iterator(this, 0, 0, 0);
+}
+
+user_word_snapshot::const_iterator user_word_snapshot::end() const {
+    return const_iterator(this, groups.size(), 0, 0);
+}
+
+user_word_snapshot::const_iterator user_word_snapshot::lower_bound(std::wstring_view code) const {
+    return find_position(code, false);
+}
+
+user_word_snapshot::const_iterator user_word_snapshot::upper_bound(std::wstring_view code) const {
+    return find_position(code, true);
+}
+
+user_word_snapshot::const_iterator user_word_snapshot::find(std::wstring_view code) const {
+    const_iterator it = lower_bound(code);
+    return it != end() && it->first == code ? it : end();
+}
+
+bool user_word_snapshot::empty() const {
+    return groups.empty();
+}
+
+size_t user_word_snapshot::size() const {
+    return code_count;
+}
+
+size_t user_word_snapshot::get_word_count() const {
+    return word_count;
+}
+
+std::shared_ptr<const user_word_snapshot> user_word_snapshot::insert(const std::vector<std::pair<std::wstring_view, std::wstring_view>>& words,
+                                                                     std::vector<size_t>& added) const {
+    // 新快照先共用全部组，第一次修改某组（块）时才复制该组（块）
+    std::shared_ptr<user_word_snapshot> result = std::make_shared<user_word_snapshot>(*this);
+    std::vector<writable_group> writable(result->groups.size(), writable_group{ nullptr, std::vector<block*>() });
+
+    for (size_t w = 0; w < words.size(); w++) {
+        std::wstring_view code = words[w].first;
+        std::wstring_view characters = words[w].second;
+
+        if (result->groups.empty()) {
+            std::shared_ptr<block> entries = std::make_shared<block>();
+            entries->emplace_back(std::wstring(code), std::vector<std::wstring_view>(1, characters));
+            std::shared_ptr<block_group> group = std::make_shared<block_group>(1, entries);
+            writable.push_back(writable_group{ group.get(), std::vector<block*>(1, entries.get()) });
+            result->groups.push_back(std::move(group));
+            result->code_count++;
+            result->word_count++;
+            added.push_back(w);
+            continue;
+        }
+
+        // 大于所有编码时加入最后一组的最后一块
+        size_t g = find_item(result->groups, code, false);
+        if (g == result->groups.size()) {
+            g--;
+        }
+        if (!writable[g].group) {
+            std::shared_ptr<block_group> copy = std::make_shared<block_group>(*result->groups[g]);
+            writable[g].group = copy.get();
+            writable[g].blocks.assign(copy->size(), nullptr);
+            result->groups[g] = std::move(copy);
+        }
+        block_group& group = *writable[g].group;
+        std::vector<block*>& writable_blocks = writable[g].blocks;
+
+        size_t b = find_item(group, code, false);
+        if (b == group.size()) {
+            b--;
+        }
+        if (!writable_blocks[b]) {
+            std::shared_ptr<block> copy = std::make_shared<block>(*group[b]);
+            writable_blocks[b] = copy.get();
+            group[b] = std::move(copy);
+        }
+
+        block& entries = *writable_blocks[b];
+        auto it = std::lower_bound(entries.begin(), entries.end(), code, code_less);
+        if (it != entries.end() && it->first == code) {
+            if (std::find(it->second.begin(), it->second.end(), characters) != it->second.end()) {
+                continue;
+            }
+            it->second.push_back(characters);
+        } else {
+            entries.insert(it, value_type(std::wstring(code), std::vector<std::wstring_view>(1, characters)));
+            result->code_count++;
+
+            // 块过大时把后一半移到新块，组过大时同样把后一半的块移到新组
+            if (entries.size() > USER_WORD_BLOCK_SIZE) {
+                size_t half = entries.size() / 2;
+                std::shared_ptr<block> upper = std::make_shared<block>(std::make_move_iterator(entries.begin() + half), std::make_move_iterator(entries.end()));
+                entries.erase(entries.begin() + half, entries.end());
+                writable_blocks.insert(writable_blocks.begin() + b + 1, upper.get());
+                group.insert(group.begin() + b + 1, std::move(upper));
+            }
+            if (group.size() > USER_WORD_GROUP_SIZE) {
+                size_t half = group.size() / 2;
+                std::shared_ptr<block_group> upper = std::make_shared<block_group>(group.begin() + half, group.end());
+                group.erase(group.begin() + half, group.end());
+                writable_group upper_writable = { upper.get(), std::vector<block*>(writable_blocks.begin() + half, writable_blocks.end()) };
+                writable_blocks.erase(writable_blocks.begin() + half, writable_blocks.end());
+                writable.insert(writable.begin() + g + 1, std::move(upper_writable));
+                result->groups.insert(result->groups.begin() + g + 1, std::move(upper));
+            }
+        }
+        result->word_count++;
+        added.push_back(w);
+    }
+    return result;
+}
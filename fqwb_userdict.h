@@ -0,0 +1,107 @@
+// fqwb_userdict.h - 反切五笔输入法用户词汇快照
+// 用户词汇按编码排序分块存放，块再分组，快照发布后不再修改；加入新词时生成新快照，只复制被修改的组和块，其余与旧快照共用
+
+#ifndef FQWB_USERDICT_H
+#define FQWB_USERDICT_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// 每块最多的编码数量和每组最多的块数，超过时分成两块（组）
+// 加入一个新词需要复制组指针表、一个组的块指针表和一个块，十万个编码时约复制三百个指针和一个块
+const size_t USER_WORD_BLOCK_SIZE = 16;
+const size_t USER_WORD_GROUP_SIZE = 64;
+
+// 用户词汇快照
+class user_word_snapshot {
+public:
+    // (编码, 词条)，词条为指向用户词条池的视图
+    typedef std::pair<std::wstring, std::vector<std::wstring_view>> value_type;
+    typedef std::vector<value_type> block;
+    typedef std::vector<std::shared_ptr<const block>> block_group;
+
+    // 按编码顺序遍历的只读迭代器
+    class const_iterator {
+    private:
+        const user_word_snapshot* owner;
+        size_t group_index;
+        size_t block_index;
+        size_t index;
+
+    public:
+        const_iterator() : owner(nullptr), group_index(0), block_index(0), index(0) {}
+        const_iterator(const user_word_snapshot* owner, size_t group_index, size_t block_index, size_t index)
+            : owner(owner), group_index(group_index), block_index(block_index), index(index) {}
+
+        const value_type& operator*() const {
+            return (*(*owner->groups[group_index])[block_index])[index];
+        }
+
+        const value_type* operator->() const {
+            return &**this;
+        }
+
+        const_iterator& operator++() {
+            const block_group& group = *owner->groups[group_index];
+            if (++index == group[block_index]->size()) {
+                index = 0;
+                if (++block_index == group.size()) {
+                    block_index = 0;
+                    group_index++;
+                }
+            }
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return group_index == other.group_index && block_index == other.block_index && index == other.index;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+private:
+    std::vector<std::shared_ptr<const block_group>> groups; // 按编码排序的组，不含空组和空块
+    size_t code_count;                                     // 编码数量
+    size_t word_count;                                     // 词条数量
+
+    // 查找code所在的位置：第一个不小于（strict为true时大于）code的编码
+    const_iterator find_position(std::wstring_view code, bool strict) const;
+
+public:
+    user_word_snapshot();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    // 第一个不小于code的编码
+    const_iterator lower_bound(std::wstring_view code) const;
+
+    // 第一个大于code的编码
+    const_iterator upper_bound(std::wstring_view code) const;
+
+    // 查找编码，不存在时返回end()
+    const_iterator find(std::wstring_view code) const;
+
+    // 是否没有任何编码
+    bool empty() const;
+
+    // 编码数量
+    size_t size() const;
+
+    // 词条数量
+    size_t get_word_count() const;
+
+    // 以当前快照为基础依次加入(编码, 词条)，返回新快照，当前快照不变
+    // 已有的词条（包括同一批中重复的）跳过，added中追加实际加入的项在words中的下标
+    std::shared_ptr<const user_word_snapshot> insert(const std::vector<std::pair<std::wstring_view, std::wstring_view>>& words,
+                                                     std::vector<size_t>& added) const;
+};
+
+#endif // FQWB_USERDICT_H
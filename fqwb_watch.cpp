@@ -0,0 +1,283 @@
+// fqwb_watch.cpp - 反切五笔输入法目录变化监视实现文件
+
+#include "fqwb_watch.h"
+#include "fqwb_dict.h"
+#include <chrono>
+#include <cwctype>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// 获取宽字符文件名
+std::wstring wide_file_name(const std::filesystem::path& path) {
+#ifdef _WIN32
+    return path.filename().wstring();
+#else
+    // 其他平台的文件名为UTF-8
+    std::string name = path.filename().string();
+    std::wstring result;
+    for (size_t i = 0; i < name.size();) {
+        unsigned char c = static_cast<unsigned char>(name[i]);
+        uint32_t code_point = c;
+        size_t length = 1;
+        if (c >= 0xF0 && i + 3 < name.size()) {
+            code_point = ((c & 0x07) << 18) | ((name[i + 1] & 0x3F) << 12) | ((name[i + 2] & 0x3F) << 6) | (name[i + 3] & 0x3F);
+            length = 4;
+        } else if (c >= 0xE0 && i + 2 < name.size()) {
+            code_point = ((c & 0x0F) << 12) | ((name[i + 1] & 0x3F) << 6) | (name[i + 2] & 0x3F);
+            length = 3;
+        } else if (c >= 0xC0 && i + 1 < name.size()) {
+            code_point = ((c & 0x1F) << 6) | (name[i + 1] & 0x3F);
+            length = 2;
+        }
+        result += static_cast<wchar_t>(code_point);
+        i += length;
+    }
+    return result;
+#endif
+}
+
+} // namespace
+
+// directory_watcher 类实现
+directory_watcher::directory_watcher() : interval_ms(DEFAULT_WATCH_INTERVAL_MS), backend(watch_backend::polling), stop_watching(false) {
+#ifdef __linux__
+    inotify_fd = -1;
+#endif
+}
+
+directory_watcher::~directory_watcher() {
+    stop();
+}
+
+bool directory_watcher::matches(const std::wstring& file_name) const {
+    if (extensions.empty()) {
+        return true;
+    }
+
+    for (const std::wstring& extension : extensions) {
+        if (file_name.size() <= extension.size()) {
+            continue;
+        }
+
+        // 扩展名不区分大小写
+        bool equal = true;
+        size_t offset = file_name.size() - extension.size();
+        for (size_t i = 0; i < extension.size() && equal; i++) {
+            equal = std::towlower(file_name[offset + i]) == std::towlower(extension[i]);
+        }
+        if (equal) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void directory_watcher::scan(std::map<std::wstring, file_state>& result) const {
+    result.clear();
+
+    std::error_code error;
+    std::filesystem::directory_iterator it(std::filesystem::path(native_path(directory)), error);
+    if (error) {
+        return;
+    }
+
+    for (; it != std::filesystem::directory_iterator(); it.increment(error)) {
+        if (error) {
+            break;
+        }
+
+        std::error_code entry_error;
+        if (!it->is_regular_file(entry_error)) {
+            continue;
+        }
+
+        std::wstring file_name = wide_file_name(it->path());
+        if (!matches(file_name)) {
+            continue;
+        }
+
+        file_state state;
+        state.size = it->file_size(entry_error);
+        state.write_time = static_cast<int64_t>(it->last_write_time(entry_error).time_since_epoch().count());
+        if (!entry_error) {
+            result[file_name] = state;
+        }
+    }
+}
+
+void directory_watcher::polling_loop() {
+    std::map<std::wstring, file_state> current;
+
+    while (!stop_watching) {
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex);
+            wait_cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]() { return stop_watching.load(); });
+        }
+        if (stop_watching) {
+            break;
+        }
+
+        scan(current);
+        for (const auto& pair : current) {
+            auto known_it = known.find(pair.first);
+            if (known_it != known.end() && known_it->second.size == pair.second.size && known_it->second.write_time == pair.second.write_time) {
+                changing.erase(pair.first);
+                continue;
+            }
+
+            // 与上次轮询相同才说明写入已完成，避免读到写了一半的文件
+            auto changing_it = changing.find(pair.first);
+            if (changing_it != changing.end() && changing_it->second.size == pair.second.size && changing_it->second.write_time == pair.second.write_time) {
+                changing.erase(changing_it);
+                known[pair.first] = pair.second;
+                callback(pair.first);
+            } else {
+                changing[pair.first] = pair.second;
+            }
+        }
+
+        // 已删除的文件不再跟踪，原有词库保持不变
+        for (auto it = known.begin(); it != known.end();) {
+            if (current.find(it->first) == current.end()) {
+                changing.erase(it->first);
+                it = known.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+#ifdef __linux__
+void directory_watcher::inotify_loop() {
+    alignas(struct inotify_event) char buffer[4096];
+
+    while (!stop_watching) {
+        // 定时醒来检查停止标志
+        struct pollfd descriptor = { inotify_fd, POLLIN, 0 };
+        int ready = ::poll(&descriptor, 1, static_cast<int>(interval_ms));
+        if (ready <= 0 || stop_watching) {
+            continue;
+        }
+
+        ssize_t length = ::read(inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            continue;
+        }
+
+        for (char* pos = buffer; pos < buffer + length;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(pos);
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                continue;
+            }
+
+            std::wstring file_name = wide_file_name(std::filesystem::path(event->name));
+            if (matches(file_name)) {
+                callback(file_name);
+            }
+        }
+    }
+}
+#endif
+
+void directory_watcher::watch_loop() {
+#ifdef _WIN32
+    // 监视线程不与输入线程争抢CPU
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#endif
+
+#ifdef __linux__
+    if (backend == watch_backend::inotify) {
+        inotify_loop();
+        return;
+    }
+#endif
+
+    polling_loop();
+}
+
+bool directory_watcher::start(const std::wstring& dir_path, const std::vector<std::wstring>& file_extensions, const change_callback& on_change,
+                              watch_backend requested, unsigned int interval) {
+    stop();
+
+    directory = dir_path;
+    extensions = file_extensions;
+    callback = on_change;
+    interval_ms = interval > 0 ? interval : DEFAULT_WATCH_INTERVAL_MS;
+    stop_watching = false;
+    backend = watch_backend::polling;
+
+#ifdef __linux__
+    // 写入关闭和移入（原子替换）都表示文件已写入完成
+    if (requested != watch_backend::polling) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, native_path(directory).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0) {
+            backend = watch_backend::inotify;
+        } else if (inotify_fd >= 0) {
+            ::close(inotify_fd);
+            inotify_fd = -1;
+        }
+    }
+#else
+    (void)requested;
+#endif
+
+    // 轮询方式以启动时的文件状态为基准
+    if (backend == watch_backend::polling) {
+        std::error_code error;
+        if (!std::filesystem::is_directory(std::filesystem::path(native_path(directory)), error)) {
+            return false;
+        }
+        scan(known);
+        changing.clear();
+    }
+
+    try {
+        watch_thread = std::thread(&directory_watcher::watch_loop, this);
+    }
+    catch (...) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void directory_watcher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        stop_watching = true;
+    }
+    wait_cv.notify_all();
+
+    if (watch_thread.joinable()) {
+        watch_thread.join();
+    }
+
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        ::close(inotify_fd);
+        inotify_fd = -1;
+    }
+#endif
+}
+
+bool directory_watcher::is_running() const {
+    return watch_thread.joinable() && !stop_watching;
+}
+
+watch_backend directory_watcher::get_backend() const {
+    return backend;
+}
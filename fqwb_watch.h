@@ -0,0 +1,95 @@
+// fqwb_watch.h - 反切五笔输入法目录变化监视
+// 在后台线程中监视词库目录，文件写入完成后回调通知；Linux下使用inotify，其他平台轮询
+
+#ifndef FQWB_WATCH_H
+#define FQWB_WATCH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 默认轮询间隔（毫秒）
+const unsigned int DEFAULT_WATCH_INTERVAL_MS = 1000;
+
+// 监视方式
+enum class watch_backend {
+    automatic, // Linux下使用inotify，其他平台轮询
+    polling,   // 定时比较文件大小和修改时间
+    inotify    // Linux inotify，不可用时退回轮询
+};
+
+// 目录变化监视器
+class directory_watcher {
+public:
+    // 变化回调：参数为变化的文件名（不含目录），在监视线程中调用
+    typedef std::function<void(const std::wstring& file_name)> change_callback;
+
+private:
+    // 轮询时记录的文件状态
+    struct file_state {
+        uint64_t size;       // 文件大小
+        int64_t write_time;  // 最后修改时间
+    };
+
+    std::wstring directory;                  // 监视的目录
+    std::vector<std::wstring> extensions;    // 关注的文件扩展名，为空时关注所有文件
+    change_callback callback;                // 变化回调
+    unsigned int interval_ms;                // 轮询间隔（inotify方式下为检查停止标志的间隔）
+    watch_backend backend;                   // 实际使用的监视方式
+    std::map<std::wstring, file_state> known; // 上次轮询时的文件状态
+    std::map<std::wstring, file_state> changing; // 发现变化但尚未稳定的文件
+
+#ifdef __linux__
+    int inotify_fd;                          // inotify描述符，使用轮询方式时为-1
+#endif
+
+    std::thread watch_thread;                // 监视线程
+    std::atomic<bool> stop_watching;         // 通知监视线程退出
+    std::mutex wait_mutex;                   // 轮询等待
+    std::condition_variable wait_cv;         // 用于提前结束轮询等待
+
+    // 文件名是否匹配关注的扩展名
+    bool matches(const std::wstring& file_name) const;
+
+    // 读取目录中关注的文件状态
+    void scan(std::map<std::wstring, file_state>& result) const;
+
+    // 轮询方式主循环：两次轮询之间状态不再变化的文件才视为写入完成
+    void polling_loop();
+
+#ifdef __linux__
+    // inotify方式主循环：收到写入关闭或移入事件时回调
+    void inotify_loop();
+#endif
+
+    // 监视线程入口
+    void watch_loop();
+
+public:
+    directory_watcher();
+    ~directory_watcher();
+
+    directory_watcher(const directory_watcher&) = delete;
+    directory_watcher& operator=(const directory_watcher&) = delete;
+
+    // 开始监视目录，extensions为关注的扩展名（如L".dic"）
+    bool start(const std::wstring& dir_path, const std::vector<std::wstring>& file_extensions, const change_callback& on_change,
+               watch_backend requested = watch_backend::automatic, unsigned int interval = DEFAULT_WATCH_INTERVAL_MS);
+
+    // 停止监视并等待监视线程退出
+    void stop();
+
+    // 是否正在监视
+    bool is_running() const;
+
+    // 获取实际使用的监视方式
+    watch_backend get_backend() const;
+};
+
+#endif // FQWB_WATCH_H
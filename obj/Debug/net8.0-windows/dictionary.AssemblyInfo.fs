@@ -0,0 +1,19 @@
+// <auto-generated>
+//     Generated by the FSharp WriteCodeFragment class.
+// </auto-generated>
+namespace FSharp
+
+open System
+open System.Reflection
+
+
+[<assembly: System.Reflection.AssemblyCompanyAttribute("dictionary")>]
+[<assembly: System.Reflection.AssemblyConfigurationAttribute("Debug")>]
+[<assembly: System.Reflection.AssemblyFileVersionAttribute("1.0.0.0")>]
+[<assembly: System.Reflection.AssemblyInformationalVersionAttribute("1.0.0+46585691b87428ae20e5a1aab851426a684ac768")>]
+[<assembly: System.Reflection.AssemblyProductAttribute("dictionary")>]
+[<assembly: System.Reflection.AssemblyTitleAttribute("dictionary")>]
+[<assembly: System.Reflection.AssemblyVersionAttribute("1.0.0.0")>]
+[<assembly: System.Runtime.Versioning.TargetPlatformAttribute("Windows7.0")>]
+[<assembly: System.Runtime.Versioning.SupportedOSPlatformAttribute("Windows7.0")>]
+do()